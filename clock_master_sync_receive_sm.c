@@ -23,6 +23,8 @@
 #include "gptpnet.h"
 #include "gptpclock.h"
 #include "clock_master_sync_receive_sm.h"
+#include "gptpservo.h"
+#include "gptpholdover.h"
 
 typedef enum {
 	INIT,
@@ -32,54 +34,45 @@ typedef enum {
 	REACTION,
 }clock_master_sync_receive_state_t;
 
-typedef enum {
-	OFFSET_NOT_ADJ=-1,
-	OFFSET_START_ADJ,
-	OFFSET_UNSTABLE_ADJ,
-	OFFSET_STABLE_ADJ,
-}offset_state_t;
-
 struct clock_master_sync_receive_data{
 	PerTimeAwareSystemGlobal *ptasg;
 	clock_master_sync_receive_state_t state;
 	clock_master_sync_receive_state_t last_state;
 	ClockMasterSyncReceiveSM *thisSM;
 	int domainIndex;
-	double mrate;
-	uint64_t last_lts;
-	uint64_t last_mts;
-	int gmadjppb;
-	double alpha;
-	int rate_stable;
-	int64_t offsetGM;
-	offset_state_t offsetGM_stable;
-	int gmchange_ind;
+	gptpservo_t *servo;
+	gptpservo_output_t sout; // the servo output of the current sync sample
+	int64_t q_abserr; // IIR mean of the absolute offset error to GM
+	int64_t q_rateerr; // IIR mean of the absolute rate error in ppb
+	int64_t q_interval; // IIR mean of the Sync interval
+	int64_t q_last_raw; // RAW time of the last Sync
+	gptp_clock_quality_para_t q_para; // the quality at the last Sync
+	gptpholdover_t *holdover; // NULL if the holdover is disabled
+	bool ho_tried; // the holdover has been tried after the last Sync
+	int64_t ho_last_update; // RAW time of the last frequency update in the holdover
+	gptpipc_servo_telemetry_t *tlm; // servo telemetry ring, NULL if disabled
+	uint32_t tlm_size; // number of the records in the ring, a power of 2
+	uint32_t tlm_index; // number of the records written
+	uint32_t adj_calls; // number of the frequency adjustments on thisClock
 };
 
 #define RCVD_CLOCK_SOURCE_REQ sm->thisSM->rcvdClockSourceReq
 #define RCVD_CLOCK_SOURCE_REQ_PTR sm->thisSM->rcvdClockSourceReqPtr
 #define	RCVD_LOCAL_CLOCK_TICK sm->thisSM->rcvdLocalClockTick
 
-//if passing time between GM and thisClock, no way to calculate the freq offset
-#define CMSR_TOO_BIG_PASSTIME_GAP (UB_SEC_NS/10)
-
-/* the following FREQ_* and PHASE_* constants may be configurable.
- * But because the current values have been well tuned,
- * and changing is not so easy, we use hardcoded numbers at this time.
- */
-
-// move to stable condition if the FREQ_OFFSET_STABLE_PPB passed this time consecutively
-#define FREQ_OFFSET_STABLE_TRNS 3
-// unstable if delta of adj rate is bigger than this
-#define FREQ_OFFSET_UNSTABLE_PPB 1000
+// IIR coefficient of the clock quality estimation is 1/QUALITY_IIR_ALPHA
+#define QUALITY_IIR_ALPHA 8
+// the frequency is updated by the model in this interval in the holdover
+#define HOLDOVER_UPDATE_INTERVAL UB_SEC_NS
 
-#define PHASE_NEWGM_CRITERION 1000000 // 1msec
-#define PHASE_STABLE_CRITERION 10000 // 10usec
-#define PHASE_UNSTABLE_CRITERION 30000 // 30usec
-// after stable, adjust phase when the detected gap between GM and thisClock exceeds this value
-#define PHASE_OFFSET_ADJUST_TARGET 10000 // nsec
-#define PHASE_OFFSET_ADJUST_BY_FREQ 100000 // 100usec
-#define SET_PHASE_OFFSETGM_NOOP_RETURN -99999999 // not in +/-(PHASE_OFFSET_ADJUST_BY_FREQ*10)
+// the servo state which is handed off to the next gptp2d,
+// the state data of the servo itself is in GPTPCLOCK_HANDOFF_SERVO_DATA
+typedef struct cmsr_handoff {
+	int servo_type;
+	int64_t q_abserr;
+	int64_t q_rateerr;
+	int64_t q_interval;
+} cmsr_handoff_t;
 
 static void debug_show_diff_to_GM(clock_master_sync_receive_data_t *sm,
 				  int64_t lts, int64_t mts) __attribute__((unused));
@@ -90,171 +83,139 @@ static void debug_show_diff_to_GM(clock_master_sync_receive_data_t *sm,
 			 0, sm->ptasg->domainNumber);
 	lts=mts-lts;
 	UB_LOG(UBL_INFO,"domainNumber=%d, %"PRIi64"nsec, offset=%"PRIi64"\n",
-	       sm->ptasg->domainNumber, lts, sm->offsetGM);
+	       sm->ptasg->domainNumber, lts, sm->sout.offset);
 }
 
-static int set_phase_offsetGM(clock_master_sync_receive_data_t *sm, int64_t dts, int64_t dlts)
+/* record the servo iteration in the telemetry ring, only a copy to the slot */
+static void record_telemetry(clock_master_sync_receive_data_t *sm,
+			     uint64_t lts, uint64_t mts)
 {
-	uint64_t dofg;
-	int alpha=1;
-	int64_t od;
-	int64_t offsetGM=0;
-	int padj_clockindex, poabf;
-
-	dofg=llabs(dts-sm->offsetGM);
-	if(dofg>=PHASE_NEWGM_CRITERION){
-		if(sm->gmchange_ind &&
-		   sm->gmchange_ind==gptpclock_get_gmchange_ind(sm->ptasg->domainNumber)){
-			if(sm->offsetGM_stable>=OFFSET_START_ADJ) {
-				UB_LOG(UBL_INFO, "%s:domainNumber=%d, big offset Jump=%u\n",
-				       __func__, sm->ptasg->domainNumber, (unsigned int)dofg);
-				sm->offsetGM_stable=OFFSET_NOT_ADJ;
-				// don't update 'sm->offsetGM' by the first 'big jump'
-				// if the value at the next time is in PHASE_NEWGM_CRITERION,
-				// this is treated as 'OFFSET_START_ADJ'
-				return 0;
-			}
-			UB_LOG(UBL_INFO, "%s:domainNumber=%d, big offset Jump=%u"
-			       "second time, update with the big jump\n",
-			       __func__, sm->ptasg->domainNumber, (unsigned int)dofg);
-			// second 'big jump', start over from 'OFFSET_START_ADJ'
-		}
-		sm->offsetGM_stable=OFFSET_START_ADJ;
-	}
+	gptpipc_servo_telemetry_t *td;
+	if(!sm->tlm) return;
+	td=&sm->tlm[sm->tlm_index & (sm->tlm_size-1)];
+	td->local_ts64=lts;
+	td->offset_in=(int64_t)(mts-lts);
+	td->offset64=sm->sout.offset;
+	td->step=sm->sout.step;
+	td->rate_ratio=sm->sout.rate;
+	td->fstate[0]=sm->sout.fstate[0];
+	td->fstate[1]=sm->sout.fstate[1];
+	td->adjppb=sm->sout.adjppb;
+	td->index=sm->tlm_index++;
+	td->seqid=sm->ptasg->lastSyncSeqID;
+	td->domainNumber=sm->ptasg->domainNumber;
+	td->flags=sm->sout.flags;
+	td->servo_type=gptpservo_type(sm->servo);
+}
 
-	if((dlts < gptpconf_get_intitem(CONF_CLOCK_COMPUTE_INTERVAL_MSEC)*UB_MSEC_NS)
-	   && (sm->offsetGM_stable > OFFSET_START_ADJ)) {
-		// once it reaches adjustment stage, use longer interval
-		return SET_PHASE_OFFSETGM_NOOP_RETURN;
-	}
-	switch(sm->offsetGM_stable){
-	case OFFSET_NOT_ADJ:
-	case OFFSET_START_ADJ:
-		offsetGM = dts;
-		sm->offsetGM_stable=OFFSET_UNSTABLE_ADJ;
-		UB_LOG(UBL_INFO, "%s:domainNumber=%d, New adjustment(New GM?)\n",
-		       __func__, sm->ptasg->domainNumber);
-		break;
-	case OFFSET_UNSTABLE_ADJ:
-		alpha=gptpconf_get_intitem(CONF_PHASE_OFFSET_IIR_ALPHA_START_VALUE);
-		offsetGM = dts/alpha + (alpha-1) * (sm->offsetGM / alpha);
-		if(dofg<PHASE_STABLE_CRITERION){
-			UB_LOG(UBL_INFO, "%s:domainNumber=%d, stable\n",
-			       __func__, sm->ptasg->domainNumber);
-			sm->offsetGM_stable=OFFSET_STABLE_ADJ;
-			sm->gmchange_ind=gptpclock_get_gmchange_ind(sm->ptasg->domainNumber);
-			UB_LOG(UBL_DEBUG, "%s:gmchange_ind=%d\n",
-			       __func__, sm->gmchange_ind);
-		}
-		break;
-	case OFFSET_STABLE_ADJ:
-		if(sm->gmchange_ind!=gptpclock_get_gmchange_ind(sm->ptasg->domainNumber)){
-			UB_LOG(UBL_INFO, "%s:domainNumber=%d, GM changed. start over.\n",
-			       __func__, sm->ptasg->domainNumber);
-			sm->offsetGM_stable=OFFSET_START_ADJ;
-			return 0;
-		}
-		alpha=gptpconf_get_intitem(CONF_PHASE_OFFSET_IIR_ALPHA_STABLE_VALUE);
-		offsetGM = dts/alpha + (alpha-1) * (sm->offsetGM / alpha);
-		if(dofg>PHASE_UNSTABLE_CRITERION){
-			UB_LOG(UBL_INFO, "%s:domainNumber=%d, unstable\n",
-			       __func__, sm->ptasg->domainNumber);
-			sm->offsetGM_stable=OFFSET_UNSTABLE_ADJ;
-		}
-		break;
-	}
+/* every frequency adjustment may be a clock_adjtime syscall, count them */
+static void set_clock_adj(clock_master_sync_receive_data_t *sm, int adjppb)
+{
+	gptpclock_setadj(adjppb, sm->ptasg->thisClockIndex, sm->ptasg->domainNumber);
+	sm->adj_calls++;
+}
 
-	od=offsetGM-sm->offsetGM;
-	if(gptpconf_get_intitem(CONF_USE_HW_PHASE_ADJUSTMENT) && sm->ptasg->domainNumber==0){
-		// the range to be adjusted by freq must be wider than normal,
-		// then gptpclock_setoffset64 is called less frequently
-		poabf=PHASE_OFFSET_ADJUST_BY_FREQ*10;
-		padj_clockindex=sm->ptasg->thisClockIndex;
-	}else{
-		poabf=PHASE_OFFSET_ADJUST_BY_FREQ;
-		padj_clockindex=0;
+/* run the servo, and apply the output on the clocks.
+   the output flags are checked even when the servo returns -1,
+   the phase may be stepped without the rate update */
+static void servo_sample(clock_master_sync_receive_data_t *sm, uint64_t lts, uint64_t mts,
+			 uint16_t mts_subns)
+{
+	gptpservo_output_t *so=&sm->sout;
+	int padj_clockindex;
+	gptpservo_sample(sm->servo, lts, mts, mts_subns,
+			 gptpclock_get_gmchange_ind(sm->ptasg->domainNumber));
+	//debug_show_diff_to_GM(sm, lts, mts);
+	gptpservo_output(sm->servo, so);
+	record_telemetry(sm, lts, mts);
+	if(gptpservo_fast_locked(sm->servo)){
+		// gm_stable_sm doesn't wait CONF_*_GM_STABLE_TIME by this
+		sm->ptasg->servo_fast_locked=true;
+		UB_TLOG(UBL_INFO, "clock_master_sync_receive:domainNumber=%d, "
+			"servo fast locked\n", sm->ptasg->domainNumber);
 	}
-	if(llabs(od)<poabf && gptpconf_get_intitem(CONF_PHASE_ADJUSTMENT_BY_FREQ)){
-		if(llabs(od)<PHASE_OFFSET_ADJUST_TARGET) return od;
-		UB_LOG(UBL_INFO, "%s:domainNumber=%d, offset adjustment by Freq., diff=%d\n",
-		       __func__, sm->ptasg->domainNumber, (int)(od));
-		return od;
+	if(so->flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP){
+		padj_clockindex=gptpconf_get_intitem(CONF_USE_HW_PHASE_ADJUSTMENT) &&
+			sm->ptasg->domainNumber==0?sm->ptasg->thisClockIndex:0;
+		gptpclock_setoffset64(so->step, padj_clockindex, sm->ptasg->domainNumber);
 	}
-	UB_LOG(UBL_INFO, "%s:domainNumber=%d, offset adjustment, diff=%d\n",
-	       __func__, sm->ptasg->domainNumber, (int)od);
-	gptpclock_setoffset64(offsetGM, padj_clockindex, sm->ptasg->domainNumber);
-	if(gptpconf_get_intitem(CONF_USE_HW_PHASE_ADJUSTMENT) && sm->ptasg->domainNumber==0){
-		sm->offsetGM=0;
-	}else{
-		sm->offsetGM=offsetGM;
+	if(so->flags & GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ){
+		set_clock_adj(sm, so->adjppb);
+		// the master must be synchronized and the rate becomes 1.0
+		sm->ptasg->gmRateRatio = RATE_RATIO_ONE;
 	}
-	return 0;
+	if(sm->holdover && (so->flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE) &&
+	   (so->flags & GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE))
+		gptpholdover_learn(sm->holdover, gptpclock_rawts64(), so->adjppb,
+				   gptpclock_get_gmchange_ind(sm->ptasg->domainNumber));
 }
 
-static int computeGmRateRatio(clock_master_sync_receive_data_t *sm,
-			      uint64_t lts, uint64_t mts)
+/* Sync comes back, the servo starts over from the frequency before the holdover */
+static void holdover_end(clock_master_sync_receive_data_t *sm)
 {
-	int64_t dlts, dmts;
-	int64_t	dts;
-	double nrate;
-	int ppb;
-	int offset_comp;
-	dlts = lts - sm->last_lts;
-	dts=mts-lts;
-	offset_comp=set_phase_offsetGM(sm, dts, dlts);
-	if(offset_comp==SET_PHASE_OFFSETGM_NOOP_RETURN) return -1;
-	//debug_show_diff_to_GM(sm, lts, mts);
+	sm->ho_tried=false;
+	if(!sm->holdover || !gptpholdover_active(sm->holdover)) return;
+	gptpholdover_stop(sm->holdover, gptpclock_rawts64());
+	set_clock_adj(sm, sm->sout.adjppb);
+	gptpservo_reset(sm->servo);
+}
 
-	dmts = mts - sm->last_mts;
-	sm->last_lts = lts;
-	sm->last_mts = mts;
-	if(llabs(dmts-dlts) > CMSR_TOO_BIG_PASSTIME_GAP) return -1;
-	// IIR filter, M(n) = a*R(n) + (1-a)*M(n-1), a=CMSR_IIR_COEFF
-	nrate = sm->alpha * ((double)dmts/(double)dlts) +
-		(1-sm->alpha)*sm->mrate;
-	ppb = (int)((nrate-1.0)*1.0E9);
-	if(sm->rate_stable < FREQ_OFFSET_STABLE_TRNS && abs(ppb) <
-	   gptpconf_get_intitem(CONF_FREQ_OFFSET_STABLE_PPB)){
-		sm->rate_stable++;
-		if(sm->rate_stable >= FREQ_OFFSET_STABLE_TRNS){
-			sm->alpha = 1.0/gptpconf_get_intitem(
-				CONF_FREQ_OFFSET_IIR_ALPHA_STABLE_VALUE);
-			UB_LOG(UBL_INFO, "domainNumber=%d, clock_master_sync_receive:stable rate\n",
-				sm->ptasg->domainNumber);
-		}
-	}
-	if(abs(ppb) > FREQ_OFFSET_UNSTABLE_PPB) {
-		sm->rate_stable=0;
-		sm->alpha = 1.0/gptpconf_get_intitem(
-			CONF_FREQ_OFFSET_IIR_ALPHA_START_VALUE);
-		UB_LOG(UBL_INFO,
-		       "domainNumber=%d, clock_master_sync_receive:unstable rate\n",
-		       sm->ptasg->domainNumber);
-	}
+/* publish the sample and the servo outputs for the clients */
+static void push_sync_sample(clock_master_sync_receive_data_t *sm,
+			     uint64_t lts, uint64_t mts)
+{
+	gptpipc_sync_sample_t smp;
+	smp.local_ts64 = lts;
+	smp.gm_ts64 = mts;
+	smp.offset64 = sm->sout.offset;
+	smp.rate_ratio = sm->sout.rate;
+	smp.adjppb = sm->sout.adjppb;
+	smp.seqid = sm->ptasg->lastSyncSeqID;
+	smp.domainNumber = sm->ptasg->domainNumber;
+	smp.flags = sm->sout.flags;
+	gptpclock_sync_sample_push(sm->domainIndex, &smp);
+}
 
-	UB_LOG(UBL_DEBUGV, "clock_master_sync_receive:%s:domainNumber=%d rate=%dppb\n",
-	       __func__, sm->ptasg->domainNumber, ppb);
-
-	ppb+=offset_comp;
-	if(abs(ppb) > gptpconf_get_intitem(CONF_FREQ_OFFSET_UPDATE_MRATE_PPB)){
-		int maxadj=gptpconf_get_intitem(CONF_MAX_ADJUST_RATE_ON_CLOCK);
-		sm->gmadjppb += ppb;
-		if(sm->gmadjppb > maxadj){
-			sm->gmadjppb = maxadj;
-		}else if(sm->gmadjppb < -maxadj){
-			sm->gmadjppb = -maxadj;
-		}
-		gptpclock_setadj(sm->gmadjppb,
-				 sm->ptasg->thisClockIndex, sm->ptasg->domainNumber);
-		UB_LOG(UBL_INFO, "domainNumber=%d, clock_master_sync_receive:"
-		       "the master clock rate to %dppb\n",
-		       sm->ptasg->domainNumber, sm->gmadjppb);
-		// the master must be synchronized and the rate becomes 1.0
-		sm->mrate = 1.0;
-		sm->ptasg->gmRateRatio = 1.0;
+/*
+ * publish the clock quality. the offset error of the master clock to GM is
+ * 'mts-lts-offset', and the uncertainty is the bigger of the last error and
+ * twice of its mean. Without Sync, it grows by the mean rate error plus
+ * CONF_CLOCK_QUALITY_DRIFT_PPB.
+ */
+static void set_clock_quality(clock_master_sync_receive_data_t *sm,
+			      uint64_t lts, uint64_t mts)
+{
+	gptp_clock_quality_para_t qp;
+	int64_t err, raw, interval;
+	raw=gptpclock_rawts64();
+	err=llabs((int64_t)(mts-lts)-sm->sout.offset);
+	if(!sm->q_last_raw || (sm->sout.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP)){
+		// the error before the phase step doesn't remain
+		sm->q_abserr=err;
+	}else{
+		sm->q_abserr+=(err-sm->q_abserr)/QUALITY_IIR_ALPHA;
 	}
-
-	return 0;
+	if(sm->sout.rate)
+		sm->q_rateerr+=(abs(gptp_rr_to_ppb(sm->sout.rate))-sm->q_rateerr)/
+			QUALITY_IIR_ALPHA;
+	interval=raw-sm->q_last_raw;
+	if(sm->q_last_raw && interval<UB_SEC_NS*10)
+		sm->q_interval+=(interval-sm->q_interval)/QUALITY_IIR_ALPHA;
+	sm->q_last_raw=raw;
+
+	memset(&qp, 0, sizeof(qp));
+	qp.sync_rawts64=raw;
+	qp.sync_timeout=sm->q_interval*gptpconf_get_intitem(CONF_SYNC_RECEIPT_TIMEOUT);
+	qp.uncertainty=(err>sm->q_abserr*2)?err:sm->q_abserr*2;
+	qp.drift_ppb=sm->q_rateerr+gptpconf_get_intitem(CONF_CLOCK_QUALITY_DRIFT_PPB);
+	qp.rate_ratio=sm->sout.rate;
+	if((sm->sout.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE) &&
+	   (sm->sout.flags & GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE))
+		qp.servo_state=GPTPIPC_SERVO_STATE_LOCKED;
+	else
+		qp.servo_state=GPTPIPC_SERVO_STATE_CONVERGING;
+	gptpclock_set_quality(sm->domainIndex, &qp);
+	sm->q_para=qp;
 }
 
 static clock_master_sync_receive_state_t allstate_condition(clock_master_sync_receive_data_t *sm)
@@ -267,16 +228,43 @@ static clock_master_sync_receive_state_t allstate_condition(clock_master_sync_re
 
 static void *initializing_proc(clock_master_sync_receive_data_t *sm)
 {
+	cmsr_handoff_t ho;
+	void *sdata;
+	int ssize;
 	UB_LOG(UBL_DEBUGV, "clock_master_sync_receive:%s:domainIndex=%d\n",
 	       __func__, sm->domainIndex);
 	sm->ptasg->clockSourceTimeBaseIndicatorOld = 0;
-	sm->mrate = 1.0;
-	sm->alpha = 1.0/gptpconf_get_intitem(CONF_FREQ_OFFSET_IIR_ALPHA_START_VALUE);
-	sm->last_lts = 0;
-	sm->last_mts = 0;
-	sm->offsetGM = 0;
+	gptpservo_reset(sm->servo);
+	memset(&sm->sout, 0, sizeof(sm->sout));
+	sm->q_abserr = 0;
+	sm->q_rateerr = 0;
+	sm->q_interval = LOG_TO_NSEC(gptpconf_get_intitem(CONF_LOG_SYNC_INTERVAL));
+	sm->q_last_raw = 0;
+	memset(&sm->q_para, 0, sizeof(sm->q_para));
+	if(sm->holdover){
+		gptpholdover_stop(sm->holdover, gptpclock_rawts64());
+		gptpholdover_reset(sm->holdover);
+	}
+	sm->ho_tried = false;
 	RCVD_CLOCK_SOURCE_REQ = false;
 	RCVD_LOCAL_CLOCK_TICK = false;
+	if(!gptpclock_handoff_get(GPTPCLOCK_HANDOFF_SERVO, sm->domainIndex, &ho, sizeof(ho))){
+		// continue from the servo state of the previous gptp2d
+		sdata=gptpservo_state(sm->servo, &ssize);
+		if(ho.servo_type==(int)gptpservo_type(sm->servo) &&
+		   !gptpclock_handoff_get(GPTPCLOCK_HANDOFF_SERVO_DATA, sm->domainIndex,
+					  sdata, ssize)){
+			gptpservo_skip_fast_lock(sm->servo);
+			gptpservo_output(sm->servo, &sm->sout);
+			sm->sout.flags &= ~(GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP |
+					    GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ);
+		}
+		sm->q_abserr = ho.q_abserr;
+		sm->q_rateerr = ho.q_rateerr;
+		sm->q_interval = ho.q_interval;
+		UB_LOG(UBL_INFO, "clock_master_sync_receive:%s:domainIndex=%d, "
+		       "inherited adjppb=%d\n", __func__, sm->domainIndex, sm->sout.adjppb);
+	}
 	return NULL;
 }
 
@@ -310,10 +298,17 @@ static void *receive_source_time_proc(clock_master_sync_receive_data_t *sm)
 	//sm->ptasg->localTime = currentTime;
 	if (RCVD_CLOCK_SOURCE_REQ) {
 		uint64_t lts, mts;
+		uint16_t mts_subns;
 		mts = sm->ptasg->syncReceiptTime.seconds.lsb * UB_SEC_NS +
 			sm->ptasg->syncReceiptTime.fractionalNanoseconds.msb;
+		mts_subns = sm->ptasg->syncReceiptTime.fractionalNanoseconds.lsb;
 		lts = sm->ptasg->syncReceiptLocalTime.nsec;
-		computeGmRateRatio(sm, lts, mts);
+		// move the sub-nsec part of lts into mts, the servo sees it in 'mts-lts'
+		mts = gptp_sns_add(mts, &mts_subns, -(int64_t)sm->ptasg->syncReceiptLocalTime.subns);
+		holdover_end(sm);
+		servo_sample(sm, lts, mts, mts_subns);
+		push_sync_sample(sm, lts, mts);
+		set_clock_quality(sm, lts, mts);
 		sm->ptasg->clockSourceTimeBaseIndicatorOld =
 			sm->ptasg->clockSourceTimeBaseIndicator;
 		// As rcvd values have already saved into sm->ptasg->*, copy from there
@@ -378,20 +373,63 @@ void clock_master_sync_receive_sm_init(clock_master_sync_receive_data_t **sm,
 	int domainIndex,
 	PerTimeAwareSystemGlobal *ptasg)
 {
+	gptpservo_para_t para;
 	UB_LOG(UBL_DEBUGV, "%s:domainIndex=%d\n", __func__, domainIndex);
 	INIT_SM_DATA(clock_master_sync_receive_data_t, ClockMasterSyncReceiveSM, sm);
 	(*sm)->ptasg = ptasg;
 	(*sm)->domainIndex = domainIndex;
+	para.domainNumber = ptasg->domainNumber;
+	para.hw_phase_adj = gptpconf_get_intitem(CONF_USE_HW_PHASE_ADJUSTMENT) &&
+		ptasg->domainNumber==0;
+	(*sm)->servo = gptpservo_create(gptpconf_get_intitem(CONF_SERVO_TYPE), &para);
+	if(!(*sm)->servo){
+		UB_LOG(UBL_WARN, "%s:domainIndex=%d, use the IIR servo\n", __func__, domainIndex);
+		(*sm)->servo = gptpservo_create(GPTPSERVO_IIR, &para);
+		ub_assert((*sm)->servo, __func__, "servo");
+	}
+	(*sm)->holdover = gptpholdover_create(ptasg->domainNumber);
+	(*sm)->tlm_size = gptpconf_get_intitem(CONF_SERVO_TELEMETRY_SIZE);
+	if((*sm)->tlm_size & ((*sm)->tlm_size-1)){
+		UB_LOG(UBL_WARN, "%s:CONF_SERVO_TELEMETRY_SIZE=%d must be a power of 2, "
+		       "no telemetry\n", __func__, (*sm)->tlm_size);
+		(*sm)->tlm_size = 0;
+	}
+	if((*sm)->tlm_size){
+		(*sm)->tlm = calloc((*sm)->tlm_size, sizeof(gptpipc_servo_telemetry_t));
+		ub_assert((*sm)->tlm, __func__, "calloc");
+	}
 	clock_master_sync_receive_sm(*sm, 0);
 }
 
 int clock_master_sync_receive_sm_close(clock_master_sync_receive_data_t **sm)
 {
 	UB_LOG(UBL_DEBUGV, "%s:domainIndex=%d\n", __func__, (*sm)->domainIndex);
+	if(*sm){
+		gptpservo_delete((*sm)->servo);
+		if((*sm)->holdover) gptpholdover_delete((*sm)->holdover);
+		if((*sm)->tlm) free((*sm)->tlm);
+	}
 	CLOSE_SM_DATA(sm);
 	return 0;
 }
 
+int clock_master_sync_receive_sm_handoff(clock_master_sync_receive_data_t *sm)
+{
+	cmsr_handoff_t ho;
+	void *sdata;
+	int ssize;
+	if(!sm) return -1;
+	memset(&ho, 0, sizeof(ho));
+	ho.servo_type = gptpservo_type(sm->servo);
+	ho.q_abserr = sm->q_abserr;
+	ho.q_rateerr = sm->q_rateerr;
+	ho.q_interval = sm->q_interval;
+	sdata = gptpservo_state(sm->servo, &ssize);
+	if(gptpclock_handoff_put(GPTPCLOCK_HANDOFF_SERVO_DATA, sm->domainIndex,
+				 sdata, ssize)) return -1;
+	return gptpclock_handoff_put(GPTPCLOCK_HANDOFF_SERVO, sm->domainIndex, &ho, sizeof(ho));
+}
+
 void *clock_master_sync_receive_sm_ClockSourceReq(clock_master_sync_receive_data_t *sm,
 						  uint64_t cts64)
 {
@@ -399,3 +437,62 @@ void *clock_master_sync_receive_sm_ClockSourceReq(clock_master_sync_receive_data
 	sm->last_state = REACTION;
 	return clock_master_sync_receive_sm(sm, cts64);
 }
+
+void clock_master_sync_receive_sm_holdover(clock_master_sync_receive_data_t *sm,
+					   uint64_t cts64)
+{
+	gptp_clock_quality_para_t qp;
+	int64_t raw;
+	bool reset_by_gm;
+	if(!sm || !sm->holdover || !sm->q_last_raw) return;
+	raw=gptpclock_rawts64();
+	// becoming GM resets the frequency adjustment by this config
+	reset_by_gm=gptpclock_we_are_gm(sm->domainIndex) &&
+		gptpconf_get_intitem(CONF_RESET_FREQADJ_BECOMEGM);
+	if(!gptpholdover_active(sm->holdover)){
+		if(sm->ho_tried || reset_by_gm) return;
+		if(raw-sm->q_last_raw <= sm->q_para.sync_timeout) return;
+		sm->ho_tried=true;
+		if(gptpholdover_start(sm->holdover, raw, sm->q_para.uncertainty+
+				      (raw-sm->q_last_raw)/UB_USEC_NS*sm->q_para.drift_ppb/
+				      UB_MSEC_NS)) return;
+		if(!gptpclock_we_are_gm(sm->domainIndex)){
+			qp=sm->q_para;
+			qp.servo_state=GPTPIPC_SERVO_STATE_HOLDOVER;
+			qp.uncertainty=gptpholdover_error(sm->holdover, raw);
+			qp.holdover_rawts64=raw;
+			gptpholdover_model_error(sm->holdover, &qp.holdover_ferr_ppt,
+						 &qp.holdover_derr_ppt);
+			gptpclock_set_quality(sm->domainIndex, &qp);
+		}
+		sm->ho_last_update=0;
+	}
+	if(reset_by_gm){
+		gptpholdover_stop(sm->holdover, raw);
+		return;
+	}
+	if(raw-sm->ho_last_update < HOLDOVER_UPDATE_INTERVAL) return;
+	sm->ho_last_update=raw;
+	set_clock_adj(sm, gptpholdover_adjppb(sm->holdover, raw));
+	UB_LOG(UBL_DEBUG, "clock_master_sync_receive:%s:domainNumber=%d, %"PRIi64"nsec, "
+	       "estimated error=%"PRIi64"nsec\n", __func__, sm->ptasg->domainNumber,
+	       gptpholdover_duration(sm->holdover, raw),
+	       gptpholdover_error(sm->holdover, raw));
+}
+
+int clock_master_sync_receive_sm_telemetry(clock_master_sync_receive_data_t *sm, uint32_t n,
+					   gptpipc_servo_telemetry_t *td)
+{
+	uint32_t num;
+	if(!sm || !sm->tlm) return -1;
+	num=sm->tlm_index<sm->tlm_size?sm->tlm_index:sm->tlm_size;
+	if(n>=num) return -1;
+	*td=sm->tlm[(sm->tlm_index-num+n) & (sm->tlm_size-1)];
+	return 0;
+}
+
+uint32_t clock_master_sync_receive_sm_adj_calls(clock_master_sync_receive_data_t *sm)
+{
+	if(!sm) return 0;
+	return sm->adj_calls;
+}
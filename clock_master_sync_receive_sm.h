@@ -31,6 +31,21 @@ void clock_master_sync_receive_sm_init(clock_master_sync_receive_data_t **sm,
 
 int clock_master_sync_receive_sm_close(clock_master_sync_receive_data_t **sm);
 
+/* put the servo state for the next gptp2d, after gptpclock_handoff_begin */
+int clock_master_sync_receive_sm_handoff(clock_master_sync_receive_data_t *sm);
+
 void *clock_master_sync_receive_sm_ClockSourceReq(clock_master_sync_receive_data_t *sm,
 						  uint64_t cts64);
+
+/* start the holdover when Sync is lost, and update the frequency by the model */
+void clock_master_sync_receive_sm_holdover(clock_master_sync_receive_data_t *sm,
+					   uint64_t cts64);
+
+/* get the 'n'th record of the servo telemetry ring, n=0 is the oldest.
+   return -1 if there is no such record */
+int clock_master_sync_receive_sm_telemetry(clock_master_sync_receive_data_t *sm, uint32_t n,
+					   gptpipc_servo_telemetry_t *td);
+
+/* the number of the frequency adjustments on thisClock since the init */
+uint32_t clock_master_sync_receive_sm_adj_calls(clock_master_sync_receive_data_t *sm);
 #endif
@@ -79,31 +79,49 @@ static clock_slave_sync_state_t initializing_condition(clock_slave_sync_data_t *
 static void *send_sync_indication_proc(clock_slave_sync_data_t *sm)
 {
 	uint64_t nsec;
+	int64_t sns;
+	uint16_t subns;
+	PerPortGlobal *lppg;
 	void *smret=NULL;
 	UB_LOG(UBL_DEBUGV, "clock_slave_sync:%s:domainIndex=%d\n", __func__, sm->domainIndex);
 	// localPortNumber==0 means, sync by ClockMasterSyncSend,
 	// and don't need to issue syncReciptTime event
 	if (RCVD_PSSYNC && RCVD_PSSYNC_PTR->localPortNumber ) {
-		nsec=((RCVD_PSSYNC_PTR->preciseOriginTimestamp.seconds.lsb * UB_SEC_NS) +
-		      RCVD_PSSYNC_PTR->preciseOriginTimestamp.nanoseconds) +
-			RCVD_PSSYNC_PTR->followUpCorrectionField.nsec;
-		if(RCVD_PSSYNC_PTR->local_ppg)
-			nsec += RCVD_PSSYNC_PTR->local_ppg->forAllDomain->neighborPropDelay.nsec *
-				(RCVD_PSSYNC_PTR->rateRatio /
-				 RCVD_PSSYNC_PTR->local_ppg->forAllDomain->neighborRateRatio) +
-				RCVD_PSSYNC_PTR->local_ppg->forAllDomain->delayAsymmetry.nsec;
+		lppg=RCVD_PSSYNC_PTR->local_ppg;
+		// the corrections are summed in scaled nsec, the sub-nsec part is kept
+		sns=gptp_sns_from_ns(RCVD_PSSYNC_PTR->followUpCorrectionField.nsec,
+				     RCVD_PSSYNC_PTR->followUpCorrectionField.subns);
+		if(lppg)
+			sns += gptp_rr_mul_ns(
+				gptp_sns_from_ns(lppg->forAllDomain->neighborPropDelay.nsec,
+						 lppg->forAllDomain->neighborPropDelay.subns),
+				gptp_rr_div(RCVD_PSSYNC_PTR->rateRatio,
+					    lppg->forAllDomain->neighborRateRatio)) +
+				gptp_sns_from_ns(lppg->forAllDomain->delayAsymmetry.nsec,
+						 lppg->forAllDomain->delayAsymmetry.subns);
+		subns=0;
+		nsec=gptp_sns_add((RCVD_PSSYNC_PTR->preciseOriginTimestamp.seconds.lsb * UB_SEC_NS) +
+				  RCVD_PSSYNC_PTR->preciseOriginTimestamp.nanoseconds, &subns, sns);
 
 		sm->ptasg->lastSyncSeqID = RCVD_PSSYNC_PTR->lastSyncSeqID;
 		sm->ptasg->syncReceiptTime.seconds.lsb = nsec / UB_SEC_NS;
 		sm->ptasg->syncReceiptTime.fractionalNanoseconds.msb = nsec % UB_SEC_NS;
-
-		sm->ptasg->syncReceiptLocalTime.nsec = RCVD_PSSYNC_PTR->upstreamTxTime.nsec;
-		if(RCVD_PSSYNC_PTR->local_ppg)
-			sm->ptasg->syncReceiptLocalTime.nsec +=
-				RCVD_PSSYNC_PTR->local_ppg->forAllDomain->neighborPropDelay.nsec /
-				RCVD_PSSYNC_PTR->local_ppg->forAllDomain->neighborRateRatio +
-				RCVD_PSSYNC_PTR->local_ppg->forAllDomain->delayAsymmetry.nsec /
-				RCVD_PSSYNC_PTR->rateRatio;
+		sm->ptasg->syncReceiptTime.fractionalNanoseconds.lsb = subns;
+
+		sm->ptasg->syncReceiptLocalTime.subns = RCVD_PSSYNC_PTR->upstreamTxTime.subns;
+		sns=0;
+		if(lppg)
+			sns = gptp_rr_div_ns(
+				gptp_sns_from_ns(lppg->forAllDomain->neighborPropDelay.nsec,
+						 lppg->forAllDomain->neighborPropDelay.subns),
+				lppg->forAllDomain->neighborRateRatio) +
+				gptp_rr_div_ns(
+					gptp_sns_from_ns(lppg->forAllDomain->delayAsymmetry.nsec,
+							 lppg->forAllDomain->delayAsymmetry.subns),
+					RCVD_PSSYNC_PTR->rateRatio);
+		sm->ptasg->syncReceiptLocalTime.nsec =
+			gptp_sns_add(RCVD_PSSYNC_PTR->upstreamTxTime.nsec,
+				     &sm->ptasg->syncReceiptLocalTime.subns, sns);
 
 		sm->ptasg->gmTimeBaseIndicator = RCVD_PSSYNC_PTR->gmTimeBaseIndicator;
 		sm->ptasg->lastGmPhaseChange = RCVD_PSSYNC_PTR->lastGmPhaseChange;
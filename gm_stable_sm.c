@@ -91,6 +91,7 @@ static void *gm_unstable_proc(gm_stable_data_t *sm, uint64_t cts64)
 {
 	UB_TLOG(UBL_INFO, "gm_stable:%s:domainIndex=%d\n", __func__, sm->domainIndex);
 	sm->gm_stable_time=cts64+sm->gm_stable_timer_time;
+	sm->ptasg->servo_fast_locked=false;
 	gptpclock_set_gmstable(sm->domainIndex, false);
 	return NULL;
 }
@@ -98,6 +99,8 @@ static void *gm_unstable_proc(gm_stable_data_t *sm, uint64_t cts64)
 static gm_stable_state_t gm_unstable_condition(gm_stable_data_t *sm, uint64_t cts64)
 {
 	if(cts64>sm->gm_stable_time) return GM_STABLE;
+	// the fast lock doesn't need to wait the stable time
+	if(sm->ptasg->servo_fast_locked) return GM_STABLE;
 	if(sm->gm_change) return GM_LOST;
 	return GM_UNSTABLE;
 }
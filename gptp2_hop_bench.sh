@@ -0,0 +1,116 @@
+#!/bin/bash
+#
+# Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+# Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+#
+# This file is part of Excelfore-gptp.
+#
+# Excelfore-gptp is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# Excelfore-gptp is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Excelfore-gptp.  If not, see
+# <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+#
+# multi-hop time error benchmark over OVIP
+# GM - bridge1 - ... - bridgeN - end station, every instance has a different clock rate.
+# measures the time difference between the master clocks of GM and the end station,
+# with and without CONF_SYNC_SUBNS_PRECISION.
+# OVIP timestamps are taken by software, the difference of the 2 runs is
+# meaningful only when the number of samples is large enough.
+# gptpfixedpoint_unittest shows the same without any timestamp noise.
+# usage: gptp2_hop_bench.sh [number_of_bridges] [number_of_samples]
+#
+NUM_BRIDGES=${1:-4}
+NUM_SAMPLES=${2:-300}
+let END_NODE=${NUM_BRIDGES}+1
+
+# $1:node number, $2:OVIP start port, $3:priority, $4:clock rate, $5:subns precision
+create_config_file()
+{
+    let ipc_port=$2+500
+    cat <<EOF  > gptp2_hop$1.conf
+CONF_IPC_UDP_PORT ${ipc_port}
+CONF_OVIP_MODE_STRT_PORTNO $2
+CONF_PRIMARY_PRIORITY1 $3
+CONF_PTPVFD_CLOCK_RATE $4
+CONF_SYNC_SUBNS_PRECISION $5
+CONF_MASTER_CLOCK_SHARED_MEM "/gptp_mc_shm_hop$1"
+CONF_DEBUGLOG_MEMORY_FILE "gptp2d_debugmem_hop$1.log"
+CONF_DEBUGLOG_MEMORY_SIZE 1024
+EOF
+}
+
+# the OVIP peer port is port^1, and the ports of an instance are 'start port + 2*n'
+# $1:subns precision
+start_chain()
+{
+    let sport=5018
+    let devno=0
+    for ((node=0;node<=${END_NODE};node++)); do
+	if [ ${node} -eq 0 ]; then
+	    priority=246
+	else
+	    priority=248
+	fi
+	create_config_file ${node} ${sport} ${priority} $(((node%2)?(node*700):(-node*900))) $1
+	devs=cbeth${devno}
+	let devno++
+	let lport=${sport}
+	if [ ${node} -ne 0 -a ${node} -ne ${END_NODE} ]; then
+	    devs=${devs},cbeth${devno}
+	    let devno++
+	    let lport=${sport}+2
+	fi
+	UBL_GPTP="3,ubase:35,cbase:35,gptp:36" \
+		./gptp2d -d ${devs} -c gptp2_hop${node}.conf > /dev/null &
+	g_pid[${node}]=$!
+	let sport=${lport}^1
+    done
+}
+
+stop_chain()
+{
+    for ((node=0;node<=${END_NODE};node++)); do
+	kill ${g_pid[${node}]}
+    done
+    wait
+}
+
+# 'dts' of domain 0, time difference of the master clock to CLOCK_REALTIME
+clock_dts()
+{
+    ./gptpclock_monitor -o -s /gptp_mc_shm_hop$1 | sed -rn "s/^domain=0 [0-9]* ([-0-9]*)/\1/p"
+}
+
+# $1:subns precision
+one_run()
+{
+    start_chain $1
+    # wait the sync through all the hops
+    sleep $((10+${NUM_BRIDGES}*5))
+    for ((i=0;i<${NUM_SAMPLES};i++)); do
+	gm=`clock_dts 0`
+	end=`clock_dts ${END_NODE}`
+	if [ -n "${gm}" -a -n "${end}" ]; then
+	    echo $((${end}-${gm}))
+	fi
+	sleep 0.1
+    done > gptp2_hop_diff$1.log
+    stop_chain
+    awk -v p=$1 -v h=${END_NODE} '{s+=$1; ss+=$1*$1; n++}
+	END{if(n==0){print "no samples"; exit 1}
+	    m=s/n; printf("%d hops, subns precision=%d: %d samples, mean=%.1fnsec, stddev=%.1fnsec\n",
+	    h, p, n, m, sqrt(ss/n-m*m))}' gptp2_hop_diff$1.log
+}
+
+one_run 0 || exit -1
+one_run 1 || exit -1
+exit 0
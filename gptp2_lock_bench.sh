@@ -0,0 +1,113 @@
+#!/bin/bash
+#
+# Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+# Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+#
+# This file is part of Excelfore-gptp.
+#
+# Excelfore-gptp is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# Excelfore-gptp is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Excelfore-gptp.  If not, see
+# <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+#
+# time-to-lock benchmark over OVIP
+# the measured instance has 2 ports, GM1 is on the first port.
+# After the lock, GM2 which has a better priority and a different phase and
+# frequency starts on the second port, and the GM changes.
+# measures the time from the start of GM2 to the GM stable of the measured instance,
+# without and with the fast lock.
+# usage: gptp2_lock_bench.sh [fast_lock_samples] [number_of_runs]
+#
+FAST_LOCK_SAMPLES=${1:-16}
+NUM_RUNS=${2:-5}
+
+create_config_file()
+{
+    let suffix_no=$1
+    let priority=$2
+    if [ ${suffix_no} -eq 0 ]; then
+	let ovip_port=5018
+    else
+	let ovip_port=5017+${suffix_no}*2
+    fi
+    let ipc_port=${ovip_port}+500
+    cat <<EOF  > gptp2_lock${suffix_no}.conf
+CONF_IPC_UDP_PORT ${ipc_port}
+CONF_OVIP_MODE_STRT_PORTNO ${ovip_port}
+CONF_PRIMARY_PRIORITY1 ${priority}
+CONF_MASTER_CLOCK_SHARED_MEM "/gptp_mc_shm_lock${suffix_no}"
+CONF_DEBUGLOG_MEMORY_FILE "gptp2d_debugmem_lock${suffix_no}.log"
+CONF_DEBUGLOG_MEMORY_SIZE 1024
+EOF
+}
+
+# returns the rt value in the last log line which matches $1
+log_rt()
+{
+    sed -rn "s/.*$1.* rt=([0-9]*).*/\1/p" gptp2_lock0.log | tail -n 1
+}
+
+# $1:run number, $2:fast lock samples
+one_run()
+{
+    create_config_file 0 248
+    echo "CONF_SERVO_FAST_LOCK_SAMPLES $2" >> gptp2_lock0.conf
+    create_config_file 1 246
+    echo "CONF_PTPVFD_CLOCK_RATE -3000" >> gptp2_lock1.conf
+    create_config_file 2 240
+    echo "CONF_PTPVFD_CLOCK_RATE 5000" >> gptp2_lock2.conf
+    echo "CONF_PTPVFD_INIT_OFFSET 300000" >> gptp2_lock2.conf
+
+    UBL_GPTP="3,ubase:35,cbase:35,gptp:36" \
+	    ./gptp2d -d cbeth2 -c gptp2_lock1.conf > /dev/null &
+    gm1_pid=$!
+    UBL_GPTP="4,ubase:45,cbase:45,gptp:46" \
+	    ./gptp2d -d cbeth0,cbeth1 -c gptp2_lock0.conf > gptp2_lock0.log &
+    g0_pid=$!
+    for ((i=0;i<300;i++)); do
+	sleep 0.1
+	if grep -q "gm_stable_proc" gptp2_lock0.log; then break; fi
+    done
+    # wait the servo to settle with GM1
+    sleep 10
+    t0=`date +%s%N`
+    UBL_GPTP="3,ubase:35,cbase:35,gptp:36" \
+	    ./gptp2d -d cbeth3 -c gptp2_lock2.conf > /dev/null &
+    gm2_pid=$!
+    for ((i=0;i<300;i++)); do
+	sleep 0.1
+	rt_stable=`log_rt gm_stable_proc`
+	if [ -n "${rt_stable}" ] && [ ${rt_stable} -gt ${t0} ]; then break; fi
+    done
+    kill ${g0_pid} ${gm1_pid} ${gm2_pid}
+    wait ${g0_pid} ${gm1_pid} ${gm2_pid}
+    if [ -z "${rt_stable}" ] || [ ${rt_stable} -le ${t0} ]; then
+	echo "can't get the lock time"
+	exit -1
+    fi
+    stable_ms=$(((${rt_stable}-${t0})/1000000))
+    echo "run $1, fast lock samples=$2: GM stable ${stable_ms} msec after the GM change"
+    lock_ms=$((${lock_ms}+${stable_ms}))
+}
+
+lock_ms=0
+for ((run=1;run<=${NUM_RUNS};run++)); do
+    one_run ${run} 0
+done
+nofl_ms=${lock_ms}
+lock_ms=0
+for ((run=1;run<=${NUM_RUNS};run++)); do
+    one_run ${run} ${FAST_LOCK_SAMPLES}
+done
+echo "average of ${NUM_RUNS} runs: GM stable $((${nofl_ms}/${NUM_RUNS})) msec without the fast lock," \
+     "$((${lock_ms}/${NUM_RUNS})) msec with ${FAST_LOCK_SAMPLES} samples of the fast lock"
+exit 0
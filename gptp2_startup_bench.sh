@@ -0,0 +1,117 @@
+#!/bin/bash
+#
+# Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+# Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+#
+# This file is part of Excelfore-gptp.
+#
+# Excelfore-gptp is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 2 of the License, or
+# (at your option) any later version.
+#
+# Excelfore-gptp is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Excelfore-gptp.  If not, see
+# <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+#
+# startup time benchmark over OVIP
+# measures the time from the process start of gptp2d to GPTP_READY,
+# and to the first transmitted Sync.
+# usage: gptp2_startup_bench.sh [number_of_ports] [number_of_runs]
+#
+NUM_PORTS=${1:-8}
+NUM_RUNS=${2:-5}
+
+create_config_file()
+{
+    let suffix_no=$1
+    let priority=$2
+    # port N of the measured instance uses 5018+N*2, and its peer uses 5018+N*2+1
+    if [ ${suffix_no} -eq 0 ]; then
+	let ovip_port=5018
+    else
+	let ovip_port=5017+${suffix_no}*2
+    fi
+    let ipc_port=${ovip_port}+500
+    cat <<EOF  > gptp2_bench${suffix_no}.conf
+CONF_IPC_UDP_PORT ${ipc_port}
+CONF_OVIP_MODE_STRT_PORTNO ${ovip_port}
+CONF_PRIMARY_PRIORITY1 ${priority}
+CONF_MASTER_CLOCK_SHARED_MEM "/gptp_mc_shm_bench${suffix_no}"
+CONF_DEBUGLOG_MEMORY_FILE "gptp2d_debugmem_bench${suffix_no}.log"
+CONF_DEBUGLOG_MEMORY_SIZE 1024
+EOF
+}
+
+start_peers()
+{
+    # the peers are started first, the measured instance must become GM
+    for ((i=1;i<=${NUM_PORTS};i++)); do
+	create_config_file $i 248
+	UBL_GPTP="3,ubase:35,cbase:35,gptp:36" \
+		./gptp2d -d cbeth$((${NUM_PORTS}+${i}-1)) -c gptp2_bench${i}.conf > /dev/null &
+	peer_pid[${i}]=$!
+    done
+    sleep 1
+}
+
+stop_peers()
+{
+    for ((i=1;i<=${NUM_PORTS};i++)); do
+	kill ${peer_pid[${i}]}
+    done
+}
+
+# returns the rt value in the log line which matches $1
+log_rt()
+{
+    sed -rn "s/.*$1.* rt=([0-9]*).*/\1/p" gptp2_bench0.log | head -n 1
+}
+
+one_run()
+{
+    devs=cbeth0
+    for ((i=1;i<${NUM_PORTS};i++)); do
+	devs=${devs},cbeth${i}
+    done
+    create_config_file 0 246
+    t0=`date +%s%N`
+    UBL_GPTP="4,ubase:45,cbase:45,gptp:46" \
+	    ./gptp2d -d ${devs} -c gptp2_bench0.conf > gptp2_bench0.log &
+    g0_pid=$!
+    for ((i=0;i<100;i++)); do
+	sleep 0.1
+	if grep -q "the first Sync is sent" gptp2_bench0.log; then break; fi
+    done
+    kill ${g0_pid}
+    wait ${g0_pid}
+    rt_ready=`log_rt GPTP_READY`
+    rt_sync=`log_rt "the first Sync is sent"`
+    if [ -z "${rt_ready}" -o -z "${rt_sync}" ]; then
+	echo "can't get the startup time"
+	stop_peers
+	exit -1
+    fi
+    ready_us=$(((${rt_ready}-${t0})/1000))
+    sync_us=$(((${rt_sync}-${t0})/1000))
+    echo "run $1: GPTP_READY ${ready_us} usec, first Sync ${sync_us} usec"
+    let sum_ready+=${ready_us}
+    let sum_sync+=${sync_us}
+}
+
+sum_ready=0
+sum_sync=0
+start_peers
+for ((run=1;run<=${NUM_RUNS};run++)); do
+    one_run ${run}
+done
+stop_peers
+echo "${NUM_PORTS} ports, average of ${NUM_RUNS} runs:" \
+     "GPTP_READY $((${sum_ready}/${NUM_RUNS})) usec," \
+     "first Sync $((${sum_sync}/${NUM_RUNS})) usec"
+exit 0
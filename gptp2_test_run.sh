@@ -282,10 +282,87 @@ static_config_test()
     fi
 }
 
+sync_loss_test()
+{
+    start_gptp2d 0
+    sleep 3
+    v1=`./gptpclock_monitor -s /gptp_mc_shm1 -o -q 0`
+    echo "${v1}"
+    if ! echo "${v1}" | grep -E "servo=(LOCKED|CONVERGING) holdover=0" > /dev/null; then
+	echo "the clock quality before Sync loss looks bad"
+	stop_gptp2d
+	exit -1
+    fi
+    # Sync is lost by stopping GM, holdover before the announce timeout
+    kill $g1_pid
+    sleep 1
+    v1=`./gptpclock_monitor -s /gptp_mc_shm1 -o -q 0`
+    echo "${v1}"
+    kill $g2_pid
+    if ! echo "${v1}" | grep "holdover=1" > /dev/null; then
+	echo "the clock quality after Sync loss looks bad"
+	exit -1
+    fi
+    echo "##### PASS #####: holdover on Sync loss"
+}
+
+# gPTP time - CLOCK_REALTIME of domain=0 on the slave, in nsec
+slave_time_diff()
+{
+    ./gptpclock_monitor -s /gptp_mc_shm1 -o | sed -rn "s/^domain=0 [^ ]* ([^ ]*)$/\1/p"
+}
+
+restart_handoff_test()
+{
+    ppb=100000
+    start_gptp2d $ppb
+    sleep 5
+    d1=`slave_time_diff`
+    t1=`date +%s%N`
+    if [ -z "${d1}" ]; then
+	echo "can't read the slave clock"
+	stop_gptp2d
+	exit -1
+    fi
+    # SIGUSR1 hands off the state to the next gptp2d
+    kill -USR1 $g2_pid
+    wait $g2_pid
+    ./gptp2d -d cbeth1 -c gptp2_test1.conf &
+    g2_pid=$!
+    # the slave clock must keep following GM, which runs at +ppb to CLOCK_REALTIME
+    maxe=0
+    for i in `seq 30`; do
+	d=`slave_time_diff`
+	t=`date +%s%N`
+	if [ -z "${d}" ]; then
+	    echo "the slave clock is not readable during the restart"
+	    stop_gptp2d
+	    exit -1
+	fi
+	e=$((${d}-${d1}-(${t}-${t1})*${ppb}/1000000000))
+	if [ ${e} -lt 0 ]; then e=$((-${e})); fi
+	if [ ${e} -gt ${maxe} ]; then maxe=${e}; fi
+	sleep 0.1
+    done
+    v1=`./gptpipcmon -d 0 -u 5519 -a 127.0.0.1 -o | sed -rn "s/GPTPD_CLOCKD domainNumber=0 portIndex=0 (.*)/\1/p"`
+    stop_gptp2d
+    if [ "${v1}" != "GM_SYNC" ]; then
+	echo "can't get SYNC status after the restart"
+	exit -1
+    fi
+    if [ ${maxe} -gt 100000 ]; then
+	echo "the time error across the restart is ${maxe} nsec, looks bad"
+	exit -1
+    fi
+    echo "##### PASS #####: time error across the restart is ${maxe} nsec"
+}
+
 rate_move_test -300000
 rate_move_test 300000
 multi_port_test
 multi_domain_test
 static_config_test
+sync_loss_test
+restart_handoff_test
 sleep 1
 exit 0
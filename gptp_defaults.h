@@ -41,6 +41,13 @@
 
 #define DEFAULT_MASTER_PTPDEV "" // max_length=32 use "" for the first detected ptpdev
 
+/* Comma separated list of network devices which run with the software clock.
+   The software clock is CLOCK_MONOTONIC_RAW, and it is used for devices without PHC.
+   Software timestamps are used on these devices, and the frequency and phase
+   are adjusted by software in gptpclock.
+   A device without PHC which is not in this list uses the first ptpdev. */
+#define DEFAULT_SWCLOCK_NETDEVS "" // max_length=64
+
 #define DEFAULT_TXTS_LOST_TIME 20000000 //20msec, give up if no TxTS in this time
 
 /* Protocol-defined priority for all outgoing packets.
@@ -57,7 +64,10 @@
 #define DEFAULT_SECOND_DOMAIN_THIS_CLOCK -1
 #define DEFAULT_SECOND_DOMAIN_NUMBER 1
 
-/* set 1 for single clock with multiple ports.  Switches are likely in that mode */
+/* set 1 for single clock with multiple ports.  Switches are likely in that mode
+   The ports which report the same PHC index are detected at the start, and
+   the timestamp conversion between them is done without reading the clocks
+   even if this is 0. */
 #define DEFAULT_SINGLE_CLOCK_MODE 0
 
 /* AFTERSEND_GUARDTIME, is a guard time not to send the next packet in this time.
@@ -81,6 +91,11 @@
    the value should be estimated Pdelay in nsec. */
 #define DEFAULT_NEIGHBOR_PROP_DELAY 0
 
+/* 1: the sub-nanosecond parts of correctionField, upstreamTxTime and neighborPropDelay
+   are carried through Sync/FollowUp processing and forwarding, and into the servo.
+   0: they are truncated to nsec at every hop(the previous behavior) */
+#define DEFAULT_SYNC_SUBNS_PRECISION 1
+
 /* -1 for nomal operation
    stting this value, BMCS is skipped and the port states are statically configured.
    value 0: port0 is SLAVE and the others are MASTER, which means this Device is GM.
@@ -187,6 +202,13 @@
 // will mark the port as non asCapable
 #define DEFAULT_NEIGHBOR_PROPDELAY_MINLIMIT 0
 
+// neighborRateRatio is fitted by least squares over the last this number of
+// Pdelay exchanges, max 32. less than 3: computed from the last 2 exchanges
+#define DEFAULT_NEIGHBOR_RATE_RATIO_WINDOW 8
+// nsec, a Pdelay exchange whose residual from the fit is over 4 times of the rms
+// and over this value is rejected as an outlier
+#define DEFAULT_NEIGHBOR_RATE_RATIO_OUTLIER 100
+
 // if this is a positive number, use a UDP connection for the IPC instaead of Unix Domain Socket
 // the defined number becomes the UDP server port number
 #define DEFAULT_IPC_UDP_PORT 0
@@ -208,9 +230,49 @@
 
 #define DEFAULT_FREQ_OFFSET_STABLE_PPB 100 // freq. is stable if delta of adj rate is less then this
 
-#define DEFAULT_CLOCK_COMPUTE_INTERVAL_MSEC 1000 // compute phase and freq every this time
+// the IIR servo skips the samples in this time after the phase adjustment starts.
+// 0: every Sync sample updates it, SERVO_UPDATE_INTERVAL_MSEC decimates them instead
+#define DEFAULT_CLOCK_COMPUTE_INTERVAL_MSEC 0
 #define DEFAULT_FREQ_OFFSET_UPDATE_MRATE_PPB 10 // update freq offset only when the abs of diff to the new rate is bigger than this
 
+// servo algorithm to synchronize thisClock to GM
+// 0: IIR filters on the rate and the phase, FREQ_OFFSET_* and PHASE_OFFSET_* are used
+// 1: PI controller on the phase offset, SERVO_PI_* are used
+// 2: Kalman filter on the phase and the frequency, SERVO_KF_* are used
+#define DEFAULT_SERVO_TYPE 0
+// fit the frequency and the phase over this number of the first samples by least squares,
+// and apply them in one step, after the start and a GM change. 0:disabled, max 64
+#define DEFAULT_SERVO_FAST_LOCK_SAMPLES 0
+// 0: no decimation, every Sync sample updates the servo and may adjust the clock.
+// N: the samples in N msec are decimated into one by least squares, then the servo
+// is updated and the clock is adjusted at most once in N msec. max 10000,
+// and 1024 samples give the decimated one before N msec.
+#define DEFAULT_SERVO_UPDATE_INTERVAL_MSEC 0
+
+// PI servo, adjppb = KP*offset + I, I += KI*offset*interval
+#define DEFAULT_SERVO_PI_KP 700 // 1/1000 per sec
+#define DEFAULT_SERVO_PI_KI 300 // 1/1000 per sec^2
+#define DEFAULT_SERVO_PI_STEP_THRESHOLD 1000000 // nsec, step the phase over this offset
+#define DEFAULT_SERVO_PI_LOCKED_THRESHOLD 1000 // nsec, locked when the offset is less than this
+
+// Kalman filter servo, the phase and the frequency are estimated jointly
+#define DEFAULT_SERVO_KF_MEAS_NOISE 100 // nsec, standard deviation of the timestamp noise
+#define DEFAULT_SERVO_KF_FREQ_NOISE 10 // ppb per sqrt(sec), random walk of the frequency
+// reject a sample as an outlier, if the innovation is bigger than this times of its sigma
+#define DEFAULT_SERVO_KF_GATE 4
+#define DEFAULT_SERVO_KF_MAX_REJECTS 8 // start over after this number of consecutive outliers
+#define DEFAULT_SERVO_KF_PHASE_TIME 2000 // msec, the phase is corrected in this time constant
+#define DEFAULT_SERVO_KF_STEP_THRESHOLD 1000000 // nsec, step the phase over this offset
+#define DEFAULT_SERVO_KF_LOCKED_THRESHOLD 1000 // nsec, locked when the offset is less than this
+
+// holdover, while the servo is locked, the frequency model is learned over this time(sec unit).
+// when Sync is lost, the frequency of thisClock follows the model. 0 disables the holdover
+#define DEFAULT_HOLDOVER_LEARN_TIME 600
+// 1: the model has the aging term, the frequency is fitted by a quadratic of the time
+#define DEFAULT_HOLDOVER_AGING 0
+// the model is applied up to this time(sec unit) in the holdover, then the frequency is kept
+#define DEFAULT_HOLDOVER_MAX_TIME 3600
+
 // switch active domain automatically to stable domain
 // 2: even the current active domain is stable, if any lower number of domain is stable
 //    switch the active domain to the lowest number of stable domain
@@ -242,9 +304,60 @@
 // Only in such case, the shared mem name must be changed.
 #define DEFAULT_MASTER_CLOCK_SHARED_MEM "" // max_length=32
 
+// gptp2d publishes a linear mapping from CLOCK_MONOTONIC_RAW to gPTP time
+// in the shared memory, and libx4gptp2 gets gPTP time without reading the ptp device.
+// the mapping is updated in every CONF_RAWMAP_UPDATE_INTERVAL(msec unit),
+// and it is valid for CONF_RAWMAP_VALID_TIME(msec unit) after the update.
+// setting CONF_RAWMAP_VALID_TIME=0 disables the mapping.
+#define DEFAULT_RAWMAP_UPDATE_INTERVAL 100
+#define DEFAULT_RAWMAP_VALID_TIME 500
+// the rate of the ptp device to CLOCK_MONOTONIC_RAW is measured in this period(msec unit)
+#define DEFAULT_RAWMAP_RATE_PERIOD 1000
+
+// gptp2d publishes the recent sync samples and the servo outputs in a ring
+// in the shared memory, the name has "_smp" after the master clock shared mem name.
+// the number of the samples per domain, it must be a power of 2. '0' disables the ring.
+#define DEFAULT_SYNC_SAMPLE_RING_SIZE 256
+
+// gptp2d records the input, the filter state and the output of every servo iteration
+// in a ring, which is read by GPTPIPC_CMD_REQ_SERVO_TELEMETRY(gptpipcmon 'V' command).
+// the number of the records per domain, it must be a power of 2. '0' disables the ring.
+#define DEFAULT_SERVO_TELEMETRY_SIZE 256
+
+// the offset uncertainty which gptp2d publishes grows by this rate(ppb unit)
+// after the last Sync, in addition to the measured rate error
+#define DEFAULT_CLOCK_QUALITY_DRIFT_PPB 100
+
+// gptp2d which is terminated by SIGUSR1 hands off the clock parameters, the servo state
+// and the neighbor delays to the next gptp2d, in a shared memory which has "_ho" after
+// the master clock shared mem name. The next gptp2d inherits them when it starts
+// in this time(msec unit) after the termination. '0' disables the inheritance.
+#define DEFAULT_RESTART_HANDOFF_VALID_TIME 10000
+// after the inheritance, becoming GM doesn't reset the clock parameters in this time
+// (msec unit), the GM of the previous gptp2d is expected to appear in the time.
+#define DEFAULT_RESTART_HANDOFF_HOLD_TIME 5000
+
 // for the over ip mode testing, this clock rate(ppb unit) change is applied.
 #define DEFAULT_PTPVFD_CLOCK_RATE 0
 
+// oscillator model of the virtual ptp clocks for the over ip mode testing.
+// initial phase offset from the system clock(nsec unit)
+#define DEFAULT_PTPVFD_INIT_OFFSET 0
+// frequency random walk(ppb per sqrt(sec) unit)
+#define DEFAULT_PTPVFD_RANDOM_WALK 0
+// frequency step(ppb unit) like a temperature change, up or down at random
+// in every CONF_PTPVFD_FREQ_STEP_INTERVAL(msec unit)
+#define DEFAULT_PTPVFD_FREQ_STEP 0
+#define DEFAULT_PTPVFD_FREQ_STEP_INTERVAL 0
+// linear frequency drift like aging(ppb per hour unit)
+#define DEFAULT_PTPVFD_AGING 0
+// resolution of the clock value(nsec unit), 0 or 1 means no quantization
+#define DEFAULT_PTPVFD_QUANTIZATION 0
+// standard deviation of the timestamp noise(nsec unit)
+#define DEFAULT_PTPVFD_TS_NOISE 0
+// seed of the pseudo random generator, each clock uses a different seed made from this
+#define DEFAULT_PTPVFD_SEED 1
+
 // low-pass-filter threshold value for calculating the average ts2diff
 // (time spend to setup the clock value)
 #define DEFAULT_MAX_CONSEC_TS_DIFF 500000 //500usec
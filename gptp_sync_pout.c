@@ -31,7 +31,7 @@
 #include "gptpmasterclock.h"
 
 #define DEFAULT_SETUPTIME 1000 /* 1uSec */
-#define DEFAULT_WAKEUPTIME 200000 /* 200uSec */
+#define DEFAULT_WAKEUPTIME -1 /* calibrated in the library */
 #define DEFAULT_INTERVAL 100000000 /* 100msec */
 #define GOOD_TIMING_RANGE 100 /* nsec */
 #define BAD_TIMING_THRESH 10000 /* 10 usec */
@@ -143,7 +143,6 @@ static void getout(int sig)
 
 static int lpout(int setup, int wakeup, int interval, int portn)
 {
-	struct timespec ts1, ts2;
 	int64_t cts64, ts64; // current time
 	int64_t tgts64; // target time
 	int64_t tsiv64=interval;
@@ -159,35 +158,10 @@ static int lpout(int setup, int wakeup, int interval, int portn)
 		cts64=gptpmasterclock_getts64();
 		tgts64=cts64+tsiv64;
 		tgts64=(tgts64/interval)*interval; // align to the interval time
-		ts64=tgts64-cts64;
 
-		while(ts64>wakeup){
-			ts64-=wakeup;
-			memset(&ts2,0,sizeof(ts2));
-			UB_LOG(UBL_DEBUGV, "sleep for %"PRIi64"nsec\n",ts64);
-			UB_NSEC2TS(ts64, ts1);
-			if(clock_nanosleep(CLOCK_REALTIME,0,&ts1,&ts2)){
-				UB_LOG(UBL_INFO, "sleep failed %s\n", strerror(errno));
-				cts64=gptpmasterclock_getts64();
-				ts64=tgts64-cts64;
-				if(ts64<=0) break;
-			}else{
-				break;
-			}
-		}
-
-		cts64=gptpmasterclock_getts64();
-		ts64=tgts64-cts64;
-		if(ts64<0){
-			over_run=true;
-			UB_LOG(UBL_DEBUGV, "over run by sleep, %"PRIi64" nsec\n", ts64);
-		}else{
-			UB_LOG(UBL_DEBUGV, "spin for %"PRIi64"nsec\n",ts64);
-			while(ts64>setup){
-				cts64=gptpmasterclock_getts64();
-				ts64=tgts64-cts64;
-			}
-		}
+		// hit the port 'setup' before the target time
+		over_run=gptpmasterclock_precise_wait_until_ts64(tgts64-setup, wakeup, &ts64)!=0;
+		if(over_run) UB_LOG(UBL_DEBUGV, "over run by sleep, %"PRIi64" nsec\n", ts64);
 		cts64=gptpmasterclock_getts64();
 		// rising edge
 		if(portn>=0){
@@ -253,6 +227,7 @@ static int lpout(int setup, int wakeup, int interval, int portn)
 static int print_usage(const char *argv0)
 {
 	UB_LOG(UBL_INFO, "%s [-s setup_time][-w wakeup_time][-i interval_time(in msec)]\n", argv0);
+	UB_LOG(UBL_INFO, "      [-w -1: wakeup_time is calibrated by the wake up latency]\n");
 	UB_LOG(UBL_INFO, "      [-n sysfs gpio port number, if not defined use Parallel port]\n");
 	UB_LOG(UBL_INFO, "BBB: -n 60 -w 600000\n");
 	return -1;
@@ -23,6 +23,9 @@
 #include <limits.h>
 #include "gptpclock.h"
 #include "gptpcommon.h"
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+#include "gptpclock_virtual.h"
+#endif
 
 /*
 
@@ -191,9 +194,10 @@ typedef struct oneclock_data {
 	ptpclock_state_t state;
 	int64_t offset64; // this is not the same as pp->offset64
 	int64_t last_setts64; // this is not the same as pp->last_setts64
-	double adjrate; // this is not the same as pp->adjrate
+	ScaledRateRatio adjrate; // this is not the same as pp->adjrate
 	int adjvppb;
 	int ts2diff;
+	bool ts2diff_valid; // ts2diff is calibrated
 	uint32_t flags;
 } oneclock_data_t;
 
@@ -206,8 +210,53 @@ typedef struct per_domain_data {
 	ClockIdentity gmClockId;
 	int thisClockIndex;
 	int thisClock_adjppb;
+	// for the mapping of CLOCK_MONOTONIC_RAW to gPTP time
+	int64_t rm_next; // RAW time of the next update
+	int64_t rm_raw0; // RAW time at the start of the rate measurement, 0:not started
+	int64_t rm_phc0; // ptp device time at the start of the rate measurement
+	int64_t rm_phc_adj; // ptp device time at the last HW adjustment
+	int64_t rm_hwadj_ns; // nsec added by the HW adjustment from rm_phc0 to rm_phc_adj
+	int rm_hwadj; // the current HW adjustment rate of the ptp device, ppb
+	ScaledRateRatio rm_freerate; // rate of the ptp device to RAW without HW adjustment
+	bool rm_freerate_valid;
+	int64_t handoff_hold_until; // the inherited parameters are held until this, 0:no hold
 } per_domain_data_t;
 
+/* the shared memory to hand off the state to the next gptp2d.
+   'magic' is written at last, after all the records are put */
+#define HANDOFF_MAGIC 0x67707432
+#define HANDOFF_CLOCK_INDEX(clockIndex, domainNumber) ((clockIndex)<<8 | (domainNumber))
+
+typedef struct handoff_record {
+	uint16_t type; // gptpclock_handoff_type_t, 0:empty or taken
+	uint16_t size;
+	int index;
+	uint8_t data[GPTPCLOCK_HANDOFF_DATA_SIZE];
+} handoff_record_t;
+
+typedef struct handoff_shm {
+	uint32_t magic;
+	int max_domains;
+	int shmsize; // size of the master clock shared memory
+	int max_records;
+	int num_records;
+	int64_t put_ts64; // CLOCK_MONOTONIC time when the records were completed
+	handoff_record_t records[];
+} handoff_shm_t;
+
+typedef struct handoff_clock {
+	ClockIdentity clockId;
+	ptpclock_mode_t mode;
+	int64_t offset64;
+	int64_t last_setts64;
+	ScaledRateRatio adjrate;
+	int adjvppb;
+	// the shared memory has them for clockIndex=0
+	int64_t pp_offset64;
+	int64_t pp_last_setts64;
+	ScaledRateRatio pp_adjrate;
+} handoff_clock_t;
+
 struct gptpclock_data {
 	ub_esarray_cstd_t *clds;
 	int shmfd;
@@ -215,6 +264,16 @@ struct gptpclock_data {
 	gptp_master_clock_shm_t *shm;
 	per_domain_data_t *pdd;
 	int active_domain_switch;
+	int smpfd;
+	int smpsize;
+	gptp_sync_sample_shm_t *smpshm;
+	char smpname[GPTP_MAX_SIZE_SHARED_MEMNAME+sizeof(GPTP_SYNC_SAMPLE_SHM_SUFFIX)];
+	int max_records;
+	handoff_shm_t *ho; // the shared memory to put, or a copy of the taken records
+	bool ho_put; // gptpclock_handoff_begin was called
+	int hofd;
+	int hosize;
+	char honame[GPTP_MAX_SIZE_SHARED_MEMNAME+sizeof(GPTP_HANDOFF_SHM_SUFFIX)];
 };
 
 static gptpclock_data_t gcd;
@@ -225,6 +284,30 @@ static gptpclock_data_t gcd;
 		if(!PTPFD_VALID(od->ptpfd)) return -1;				\
 	}
 
+/* any update of the parameters invalidates the RAW mapping,
+   and gptpclock_rawmap_update makes a new one */
+static void ppara_update_begin(gptp_clock_ppara_t *pp)
+{
+	gptpclock_seq_write_begin(pp);
+	pp->map_valid_until=0;
+}
+
+/* wake up the clients which wait for the events on the shared memory */
+static void shm_event_notify(uint32_t flags)
+{
+	gcd.shm->head.event_flags=flags;
+	__atomic_add_fetch(&gcd.shm->head.event_seq, 1, __ATOMIC_RELEASE);
+	gptpclock_futex_wake(&gcd.shm->head.event_seq);
+}
+
+static char *master_clock_shm_name(void)
+{
+	char *shmem_name;
+	shmem_name=gptpconf_get_item(CONF_MASTER_CLOCK_SHARED_MEM);
+	if(!shmem_name[0]) shmem_name=GPTP_MASTER_CLOCK_SHARED_MEM;
+	return shmem_name;
+}
+
 static oneclock_data_t *get_clockod(int clockIndex, uint8_t domainNumber)
 {
 	int i;
@@ -240,15 +323,13 @@ static oneclock_data_t *get_clockod(int clockIndex, uint8_t domainNumber)
 static int gptpclock_getts_od(int64_t *ts64, oneclock_data_t *od)
 {
 	int64_t dts64=0;
-	double adjrate;
 
 	GPTP_CLOCK_GETTIME(od->ptpfd, *ts64);
 	if(!od->offset64) return 0;
-	adjrate=od->adjrate;
-	if(adjrate != 0.0){
+	if(od->adjrate != RATE_RATIO_ONE){
 		// get dts, which is diff between now and last setts time
 		dts64=*ts64-od->last_setts64;
-		dts64=adjrate * (double)dts64;
+		dts64=gptp_rr_delta_ns(dts64, od->adjrate);
 		UB_LOG(UBL_DEBUGV, "%s:applied SW adjrate, dts=%"PRIi64"nsec\n",
 		       __func__, dts64);
 	}
@@ -259,6 +340,33 @@ static int gptpclock_getts_od(int64_t *ts64, oneclock_data_t *od)
 	return 0;
 }
 
+/* the ptp device of 'od' was stepped, or its HW adjustment rate was changed.
+   The RAW mapping of every domain on the same ptp device is invalidated */
+static void rawmap_hw_changed(oneclock_data_t *od, bool step, int adjppb)
+{
+	int i;
+	int64_t phc;
+	oneclock_data_t *od0;
+	per_domain_data_t *pdd;
+	GPTP_CLOCK_GETTIME(od->ptpfd, phc);
+	for(i=0;i<ub_esarray_ele_nums(gcd.clds);i++){
+		od0 = (oneclock_data_t *)ub_esarray_get_ele(gcd.clds, i);
+		if(od0->clockIndex!=0 || strcmp(od0->pp->ptpdev, od->pp->ptpdev)) continue;
+		pdd=&gcd.pdd[od0->domainIndex];
+		if(step){
+			// restart the rate measurement
+			pdd->rm_raw0=0;
+		}else{
+			pdd->rm_hwadj_ns+=gptp_rr_delta_ns(phc-pdd->rm_phc_adj,
+							   gptp_rr_from_ppb(pdd->rm_hwadj));
+			pdd->rm_phc_adj=phc;
+		}
+		pdd->rm_hwadj=adjppb;
+		ppara_update_begin(od0->pp);
+		gptpclock_seq_write_end(od0->pp);
+	}
+}
+
 static int gptpclock_setoffset_od(oneclock_data_t *od)
 {
 	oneclock_data_t *od0, *odt;
@@ -268,14 +376,18 @@ static int gptpclock_setoffset_od(oneclock_data_t *od)
 		odt=get_clockod(gcd.pdd[od->domainIndex].thisClockIndex, od->pp->domainNumber);
 		if(odt && od==od0) {
 			// offset64 in the shm must be updated with the one of 'thisClock'
+			ppara_update_begin(od->pp);
 			od->pp->offset64=od->offset64+odt->offset64;
+			gptpclock_seq_write_end(od->pp);
 		}
 	}else if(od->mode==PTPCLOCK_SLAVE_SUB){
 		od0=get_clockod(0, od->pp->domainNumber);
 		odt=get_clockod(gcd.pdd[od->domainIndex].thisClockIndex, od->pp->domainNumber);
 		if(od0 && odt==od){
+			ppara_update_begin(od0->pp);
 			od0->pp->last_setts64=od->last_setts64;
 			od0->pp->offset64=od0->offset64+od->offset64;
+			gptpclock_seq_write_end(od0->pp);
 		}
 	}else{
 		return -1;
@@ -294,6 +406,7 @@ static int gptpclock_setts_od(int64_t ts64, oneclock_data_t *od)
 	if(od->mode==PTPCLOCK_SLAVE_MAIN){
 		od->offset64=0;
 		GPTP_CLOCK_SETTIME(od->ptpfd, ts64);
+		rawmap_hw_changed(od, true, od->adjvppb);
 	}else{
 		gptpclock_setoffset_od(od);
 	}
@@ -321,15 +434,30 @@ static int64_t time_setoffset64(int64_t ts64, int clockIndex, uint8_t domainNumb
 	return mt2-mt1;
 }
 
-static int avarage_time_setoffset(int clockIndex, uint8_t domainNumber)
+/* the same clock reads as time_setoffset64 in PTPCLOCK_MASTER mode,
+   but nothing is set. It is safe to call at any time in any mode */
+static int64_t time_setoffset64_dry(oneclock_data_t *od)
+{
+	int64_t ats64, lts64;
+	int64_t mt1,mt2;
+	mt1=ub_mt_gettime64();
+	gptpclock_getts_od(&ats64, od);
+	GPTP_CLOCK_GETTIME(od->ptpfd, lts64);
+	mt2=ub_mt_gettime64();
+	return mt2-mt1;
+}
+
+static int avarage_time_setoffset(oneclock_data_t *od)
 {
 	int64_t v;
 	int64_t vmax=0;
 	int av=0, avc;
 	int count=0;
 	int i;
+	int clockIndex=od->clockIndex;
+	uint8_t domainNumber=od->pp->domainNumber;
 	for(i=0;i<10;i++){
-		v = time_setoffset64(0, clockIndex, domainNumber);
+		v = time_setoffset64_dry(od);
 		if(v > gptpconf_get_intitem(CONF_MAX_CONSEC_TS_DIFF)) continue;
 		if(llabs(vmax)<llabs(v)) vmax=v;
 		av += v;
@@ -353,6 +481,397 @@ static int avarage_time_setoffset(int clockIndex, uint8_t domainNumber)
 	return avc;
 }
 
+/* ts2diff is calibrated at the first use, or by gptpclock_calibrate_next.
+   Clocks on the same ptpdev have the same cost, and the result is shared */
+static int calibrate_od(oneclock_data_t *od)
+{
+	int i;
+	oneclock_data_t *odr;
+	if(od->ts2diff_valid) return od->ts2diff;
+	for(i=0;i<ub_esarray_ele_nums(gcd.clds);i++){
+		odr = (oneclock_data_t *)ub_esarray_get_ele(gcd.clds, i);
+		if(odr==od || !odr->ts2diff_valid) continue;
+		if(strcmp(odr->pp->ptpdev, od->pp->ptpdev)) continue;
+		od->ts2diff=odr->ts2diff;
+		od->ts2diff_valid=true;
+		return od->ts2diff;
+	}
+	od->ts2diff=avarage_time_setoffset(od);
+	od->ts2diff_valid=true;
+	return od->ts2diff;
+}
+
+/* the limit of 2 consecutive clock reads.
+   Before the calibration, use the threshold of the calibration itself */
+static int64_t ts2diff_limit(oneclock_data_t *od)
+{
+	if(!od->ts2diff_valid) return gptpconf_get_intitem(CONF_MAX_CONSEC_TS_DIFF);
+	return (int64_t)od->ts2diff*10;
+}
+
+/* a pair of RAW time and the ptp device time, the narrowest of 3 tries */
+#define RAWMAP_SAMPLE_TRIES 3
+static int rawmap_sample(oneclock_data_t *od, int64_t *raw, int64_t *phc)
+{
+	int64_t r1, r2, p=0, w, wmin=-1;
+	int i;
+	for(i=0;i<RAWMAP_SAMPLE_TRIES;i++){
+		r1=gptpclock_rawts64();
+		GPTP_CLOCK_GETTIME(od->ptpfd, p);
+		r2=gptpclock_rawts64();
+		w=r2-r1;
+		if(wmin>=0 && w>=wmin) continue;
+		wmin=w;
+		*raw=r1+w/2;
+		*phc=p;
+	}
+	if(wmin > ts2diff_limit(od)) return -1;
+	return 0;
+}
+
+/*
+ * gPTP time = ptp device time + offset + (ptp device time - last_setts)*adjrate,
+ * and ptp device time = RAW time * (1 + the free running rate) * (1 + HW adjustment).
+ * The free running rate is measured in every CONF_RAWMAP_RATE_PERIOD,
+ * removing the time which is added by the HW adjustment in the period.
+ */
+static int rawmap_update_od(oneclock_data_t *od0, int64_t rawnow)
+{
+	per_domain_data_t *pdd=&gcd.pdd[od0->domainIndex];
+	gptp_clock_ppara_t *pp=od0->pp;
+	int64_t raw=0, phc=0, dphc;
+	ScaledRateRatio rate;
+
+	if(rawnow<pdd->rm_next && (pp->map_valid_until || !pdd->rm_freerate_valid))
+		return 0;
+	if(rawmap_sample(od0, &raw, &phc)) return 0;
+	pdd->rm_next=raw+gptpconf_get_intitem(CONF_RAWMAP_UPDATE_INTERVAL)*UB_MSEC_NS;
+	if(!pdd->rm_raw0 ||
+	   raw-pdd->rm_raw0 >= gptpconf_get_intitem(CONF_RAWMAP_RATE_PERIOD)*UB_MSEC_NS){
+		if(pdd->rm_raw0){
+			dphc=phc-pdd->rm_phc0-pdd->rm_hwadj_ns-
+				gptp_rr_delta_ns(phc-pdd->rm_phc_adj,
+						 gptp_rr_from_ppb(pdd->rm_hwadj));
+			pdd->rm_freerate=gptp_rr_from_delta(dphc, raw-pdd->rm_raw0);
+			pdd->rm_freerate_valid=true;
+		}
+		pdd->rm_raw0=raw;
+		pdd->rm_phc0=phc;
+		pdd->rm_phc_adj=phc;
+		pdd->rm_hwadj_ns=0;
+	}
+	if(!pdd->rm_freerate_valid) return 0;
+	rate=gptp_rr_mul(pdd->rm_freerate, gptp_rr_from_ppb(pdd->rm_hwadj));
+	rate=gptp_rr_mul(rate, pp->adjrate);
+	gptpclock_seq_write_begin(pp);
+	// the same computation as gptpmasterclock_get_domain_ts64 does
+	pp->map_gptpts64=phc+pp->offset64+gptp_rr_delta_ns(phc-pp->last_setts64, pp->adjrate);
+	pp->map_rawts64=raw;
+	pp->map_rate=rate;
+	pp->map_valid_until=raw+gptpconf_get_intitem(CONF_RAWMAP_VALID_TIME)*UB_MSEC_NS;
+	gptpclock_seq_write_end(pp);
+	return 1;
+}
+
+int gptpclock_rawmap_update(void)
+{
+	int i, res=0;
+	int64_t rawnow;
+	oneclock_data_t *od;
+	if(!gcd.clds) return 0;
+	if(!gptpconf_get_intitem(CONF_RAWMAP_VALID_TIME)) return 0;
+	rawnow=gptpclock_rawts64();
+	for(i=0;i<ub_esarray_ele_nums(gcd.clds);i++){
+		od = (oneclock_data_t *)ub_esarray_get_ele(gcd.clds, i);
+		if(od->clockIndex!=0 || !PTPFD_VALID(od->ptpfd)) continue;
+		res+=rawmap_update_od(od, rawnow);
+	}
+	return res;
+}
+
+int gptpclock_sync_sample_push(int domainIndex, gptpipc_sync_sample_t *smp)
+{
+	gptp_sync_sample_ring_t *ring;
+	gptp_sync_sample_slot_t *slot;
+	uint64_t head;
+	if(!gcd.smpshm) return -1;
+	if(domainIndex<0 || domainIndex>=gcd.smpshm->max_domains) return -1;
+	ring=gptp_sync_sample_ring(gcd.smpshm, domainIndex);
+	head=ring->head;
+	slot=&ring->slots[head & (gcd.smpshm->num_slots-1)];
+	smp->raw_ts64=gptpclock_rawts64();
+	__atomic_store_n(&slot->wseq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&slot->smp, smp, sizeof(gptpipc_sync_sample_t));
+	__atomic_store_n(&slot->wseq, head+1, __ATOMIC_RELEASE);
+	__atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+	// the system call happens only when some readers are waiting
+	__atomic_add_fetch(&ring->wake, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST))
+		gptpclock_futex_wake(&ring->wake);
+	return 0;
+}
+
+int gptpclock_set_quality(int domainIndex, gptp_clock_quality_para_t *qp)
+{
+	gptp_clock_ppara_t *pp;
+	if(!gcd.clds) return -1;
+	if(domainIndex<0 || domainIndex>=gcd.shm->head.max_domains) return -1;
+	pp=&gcd.shm->gcpp[domainIndex];
+	// the RAW mapping is not affected, update only under 'seq'
+	gptpclock_seq_write_begin(pp);
+	memcpy(&pp->quality, qp, sizeof(gptp_clock_quality_para_t));
+	gptpclock_seq_write_end(pp);
+	return 0;
+}
+
+static int sync_sample_shm_open(int max_domains, char *shmem_name)
+{
+	int num_slots=gptpconf_get_intitem(CONF_SYNC_SAMPLE_RING_SIZE);
+	if(num_slots<=0) return 0;
+	if(num_slots & (num_slots-1)){
+		UB_LOG(UBL_ERROR, "%s:CONF_SYNC_SAMPLE_RING_SIZE=%d must be a power of 2\n",
+		       __func__, num_slots);
+		return -1;
+	}
+	snprintf(gcd.smpname, sizeof(gcd.smpname), "%s"GPTP_SYNC_SAMPLE_SHM_SUFFIX,
+		 shmem_name);
+	gcd.smpsize=gptp_sync_sample_shm_size(max_domains, num_slots);
+	gcd.smpshm=(gptp_sync_sample_shm_t *)cb_get_shared_mem(
+		&gcd.smpfd, gcd.smpname, gcd.smpsize, O_CREAT | O_RDWR);
+	if(!gcd.smpshm) return -1;
+	if(gcd.ho && gcd.smpshm->max_domains==max_domains &&
+	   gcd.smpshm->num_slots==num_slots){
+		// the clients keep reading the ring which the previous gptp2d left
+		UB_LOG(UBL_DEBUG, "%s:%s is inherited\n", __func__, gcd.smpname);
+		return 0;
+	}
+	memset(gcd.smpshm, 0, gcd.smpsize);
+	gcd.smpshm->num_slots=num_slots;
+	__atomic_store_n(&gcd.smpshm->max_domains, max_domains, __ATOMIC_RELEASE);
+	UB_LOG(UBL_DEBUG, "%s:%s, num_slots=%d, size=%d\n",
+	       __func__, gcd.smpname, num_slots, gcd.smpsize);
+	return 0;
+}
+
+/* at the handoff, the ring is left for the next gptp2d */
+static void sync_sample_shm_close(bool handoff)
+{
+	int i;
+	if(!gcd.smpshm) return;
+	if(!handoff){
+		__atomic_store_n(&gcd.smpshm->max_domains, 0, __ATOMIC_RELEASE);
+		// wake up the waiting readers, they find max_domains=0
+		for(i=0;i<gcd.shm->head.max_domains;i++){
+			gptp_sync_sample_ring_t *ring=gptp_sync_sample_ring(gcd.smpshm, i);
+			__atomic_add_fetch(&ring->wake, 1, __ATOMIC_RELEASE);
+			gptpclock_futex_wake(&ring->wake);
+		}
+	}
+	cb_close_shared_mem(gcd.smpshm, &gcd.smpfd, gcd.smpname, gcd.smpsize, !handoff);
+	gcd.smpshm=NULL;
+}
+
+static int handoff_shm_size(int max_records)
+{
+	return sizeof(handoff_shm_t)+max_records*sizeof(handoff_record_t);
+}
+
+/* copy the records which the previous gptp2d put, and remove the shared memory.
+   gcd.ho is set only when the records can be inherited */
+static void handoff_take(char *shmem_name, int max_domains)
+{
+	handoff_shm_t *ho, hoh;
+	int hofd, size;
+	int64_t age;
+	if(!gptpconf_get_intitem(CONF_RESTART_HANDOFF_VALID_TIME)) return;
+	snprintf(gcd.honame, sizeof(gcd.honame), "%s"GPTP_HANDOFF_SHM_SUFFIX, shmem_name);
+	// it doesn't exist at a normal start, suppress the error message
+	ub_log_change(CB_COMBASE_LOGCAT, UBL_NONE, UBL_NONE);
+	ho=(handoff_shm_t *)cb_get_shared_mem(&hofd, gcd.honame, sizeof(handoff_shm_t),
+					      O_RDWR);
+	ub_log_return(CB_COMBASE_LOGCAT);
+	if(!ho) return;
+	memcpy(&hoh, ho, sizeof(handoff_shm_t));
+	age=ub_mt_gettime64()-hoh.put_ts64;
+	if(hoh.magic!=HANDOFF_MAGIC || hoh.max_domains!=max_domains ||
+	   hoh.shmsize!=gcd.shmsize || hoh.num_records>hoh.max_records ||
+	   age>gptpconf_get_intitem(CONF_RESTART_HANDOFF_VALID_TIME)*UB_MSEC_NS){
+		UB_LOG(UBL_INFO, "%s:%s can't be inherited\n", __func__, gcd.honame);
+		cb_close_shared_mem(ho, &hofd, gcd.honame, sizeof(handoff_shm_t), true);
+		return;
+	}
+	cb_close_shared_mem(ho, &hofd, gcd.honame, sizeof(handoff_shm_t), false);
+	size=handoff_shm_size(hoh.max_records);
+	ho=(handoff_shm_t *)cb_get_shared_mem(&hofd, gcd.honame, size, O_RDWR);
+	if(!ho) return;
+	gcd.ho=malloc(size);
+	ub_assert(gcd.ho, __func__, "malloc error");
+	memcpy(gcd.ho, ho, size);
+	// the records are used only once
+	cb_close_shared_mem(ho, &hofd, gcd.honame, size, true);
+	UB_LOG(UBL_INFO, "%s:inherit %d records, put %"PRIi64"msec ago\n",
+	       __func__, gcd.ho->num_records, (int64_t)(age/UB_MSEC_NS));
+}
+
+/* put the parameters of all the clocks, and complete the records */
+static void handoff_put_clocks(void)
+{
+	int i;
+	oneclock_data_t *od;
+	handoff_clock_t hc;
+	for(i=0;i<ub_esarray_ele_nums(gcd.clds);i++){
+		od = (oneclock_data_t *)ub_esarray_get_ele(gcd.clds, i);
+		memset(&hc, 0, sizeof(hc));
+		memcpy(hc.clockId, od->clockId, sizeof(ClockIdentity));
+		hc.mode=od->mode;
+		hc.offset64=od->offset64;
+		hc.last_setts64=od->last_setts64;
+		hc.adjrate=od->adjrate;
+		hc.adjvppb=od->adjvppb;
+		hc.pp_offset64=od->pp->offset64;
+		hc.pp_last_setts64=od->pp->last_setts64;
+		hc.pp_adjrate=od->pp->adjrate;
+		gptpclock_handoff_put(GPTPCLOCK_HANDOFF_CLOCK,
+				      HANDOFF_CLOCK_INDEX(od->clockIndex, od->pp->domainNumber),
+				      &hc, sizeof(hc));
+	}
+	gcd.ho->put_ts64=ub_mt_gettime64();
+	__atomic_store_n(&gcd.ho->magic, HANDOFF_MAGIC, __ATOMIC_RELEASE);
+	UB_LOG(UBL_INFO, "%s:%d records in %s\n", __func__, gcd.ho->num_records, gcd.honame);
+	cb_close_shared_mem(gcd.ho, &gcd.hofd, gcd.honame, gcd.hosize, false);
+	gcd.ho=NULL;
+	gcd.ho_put=false;
+}
+
+/* restore the parameters which the previous gptp2d put, return 0 when restored */
+static int handoff_restore_od(oneclock_data_t *od, uint8_t domainNumber)
+{
+	handoff_clock_t hc;
+	if(gptpclock_handoff_get(GPTPCLOCK_HANDOFF_CLOCK,
+				 HANDOFF_CLOCK_INDEX(od->clockIndex, domainNumber),
+				 &hc, sizeof(hc))) return -1;
+	if(memcmp(hc.clockId, od->clockId, sizeof(ClockIdentity))){
+		UB_LOG(UBL_WARN, "%s:clockIndex=%d, domainNumber=%d, a different clock\n",
+		       __func__, od->clockIndex, domainNumber);
+		return -1;
+	}
+	od->mode=hc.mode;
+	od->offset64=hc.offset64;
+	od->last_setts64=hc.last_setts64;
+	od->adjrate=hc.adjrate;
+	od->adjvppb=hc.adjvppb;
+	if(od->clockIndex!=0){
+		od->pp->offset64=hc.pp_offset64;
+		od->pp->last_setts64=hc.pp_last_setts64;
+		od->pp->adjrate=hc.pp_adjrate;
+	}else{
+		gcd.pdd[od->domainIndex].handoff_hold_until=ub_mt_gettime64()+
+			gptpconf_get_intitem(CONF_RESTART_HANDOFF_HOLD_TIME)*UB_MSEC_NS;
+	}
+	UB_LOG(UBL_INFO, "%s:clockIndex=%d, domainNumber=%d, adjvppb=%d\n",
+	       __func__, od->clockIndex, domainNumber, od->adjvppb);
+	return 0;
+}
+
+int gptpclock_handoff_begin(void)
+{
+	if(!gcd.clds) return -1;
+	if(gcd.ho_put) return 0;
+	// the records from the previous gptp2d, which were not taken
+	if(gcd.ho) free(gcd.ho);
+	snprintf(gcd.honame, sizeof(gcd.honame), "%s"GPTP_HANDOFF_SHM_SUFFIX,
+		 master_clock_shm_name());
+	gcd.hosize=handoff_shm_size(gcd.max_records);
+	gcd.ho=(handoff_shm_t *)cb_get_shared_mem(&gcd.hofd, gcd.honame, gcd.hosize,
+						  O_CREAT | O_RDWR);
+	if(!gcd.ho){
+		UB_LOG(UBL_ERROR, "%s:can't create %s\n", __func__, gcd.honame);
+		return -1;
+	}
+	memset(gcd.ho, 0, gcd.hosize);
+	gcd.ho->max_domains=gcd.shm->head.max_domains;
+	gcd.ho->shmsize=gcd.shmsize;
+	gcd.ho->max_records=gcd.max_records;
+	gcd.ho_put=true;
+	return 0;
+}
+
+int gptpclock_handoff_put(gptpclock_handoff_type_t type, int index, void *data, int size)
+{
+	handoff_record_t *rec;
+	if(!gcd.ho_put) return -1;
+	if(size>GPTPCLOCK_HANDOFF_DATA_SIZE || gcd.ho->num_records>=gcd.ho->max_records){
+		UB_LOG(UBL_ERROR, "%s:can't put, type=%d, index=%d, size=%d\n",
+		       __func__, type, index, size);
+		return -1;
+	}
+	rec=&gcd.ho->records[gcd.ho->num_records++];
+	rec->type=type;
+	rec->index=index;
+	rec->size=size;
+	memcpy(rec->data, data, size);
+	return 0;
+}
+
+int gptpclock_handoff_get(gptpclock_handoff_type_t type, int index, void *data, int size)
+{
+	handoff_record_t *rec;
+	int i;
+	if(!gcd.ho || gcd.ho_put) return -1;
+	for(i=0;i<gcd.ho->num_records;i++){
+		rec=&gcd.ho->records[i];
+		if(rec->type!=type || rec->index!=index) continue;
+		// a different size comes from a different version of gptp2d
+		if(rec->size!=size) return -1;
+		memcpy(data, rec->data, size);
+		rec->type=0;
+		return 0;
+	}
+	return -1;
+}
+
+bool gptpclock_handoff_holding(int domainIndex)
+{
+	if(!gcd.clds) return false;
+	if(domainIndex<0 || domainIndex>=gcd.shm->head.max_domains) return false;
+	if(!gcd.pdd[domainIndex].handoff_hold_until) return false;
+	return ub_mt_gettime64()<gcd.pdd[domainIndex].handoff_hold_until;
+}
+
+int gptpclock_calibrate_next(void)
+{
+	int i;
+	oneclock_data_t *od;
+	if(!gcd.clds) return 0;
+	for(i=0;i<ub_esarray_ele_nums(gcd.clds);i++){
+		od = (oneclock_data_t *)ub_esarray_get_ele(gcd.clds, i);
+		if(od->ts2diff_valid || !PTPFD_VALID(od->ptpfd)) continue;
+		calibrate_od(od);
+		return 1;
+	}
+	return 0;
+}
+
+
+/* the applications read the virtual clock of the master clock from
+   the oscillator state in the shared memory */
+static int vclock_share(oneclock_data_t *od, bool inherit)
+{
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+	if(od->clockIndex==0 && VIRTUAL_CLOCKFD(od->ptpfd))
+		return gptp_vclock_share(od->ptpfd, master_clock_shm_name(), inherit);
+#endif
+	return 0;
+}
+
+static void vclock_unshare(oneclock_data_t *od, bool unlink)
+{
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+	if(od->clockIndex==0 && VIRTUAL_CLOCKFD(od->ptpfd))
+		gptp_vclock_unshare(od->ptpfd, unlink);
+#endif
+}
 
 #define PTPCLOCK_OPEN_TOUT 100 // msec
 /* It is okay to use ptpdev which doesn't belong to portIndex.
@@ -362,6 +881,7 @@ int gptpclock_add_clock(int clockIndex, char *ptpdev, int domainIndex,
 {
 	int i;
 	oneclock_data_t *od;
+	bool inherited;
 	if(!gcd.clds) return -1;
 	for(i=0;i<ub_esarray_ele_nums(gcd.clds);i++){
 		od = (oneclock_data_t *)ub_esarray_get_ele(gcd.clds, i);
@@ -373,32 +893,47 @@ int gptpclock_add_clock(int clockIndex, char *ptpdev, int domainIndex,
 	}
 	od = (oneclock_data_t *)ub_esarray_get_newele(gcd.clds);
 	memset(od, 0, sizeof(oneclock_data_t));
+	od->clockIndex=clockIndex;
+	od->domainIndex=domainIndex;
+	memcpy(od->clockId, id, sizeof(ClockIdentity));
 	if(clockIndex!=0){
 		od->pp=&od->ppe;
 	}else{
 		//pp for id=0 must be shared with other processes
 		od->pp=&gcd.shm->gcpp[domainIndex];
+		// the RAW mapping starts from the rate measurement
+		gcd.pdd[domainIndex].rm_raw0=0;
+		gcd.pdd[domainIndex].rm_freerate_valid=false;
+	}
+	inherited=!handoff_restore_od(od, domainNumber);
+	if(clockIndex==0 && !inherited){
 		memset(od->pp, 0, sizeof(gptp_clock_ppara_t));
 		od->pp->gmchange_ind=1; //start with 1
+		od->pp->quality.uncertainty=-1;
 	}
-	od->clockIndex=clockIndex;
 	od->pp->domainNumber=domainNumber;
-	od->domainIndex=domainIndex;
 	gcd.pdd[domainIndex].domainNumber=domainNumber;
-	memcpy(od->clockId, id, sizeof(ClockIdentity));
 	od->state = gptp_get_ptpfd(ptpdev, &od->ptpfd);
-	if(od->state == PTPCLOCK_RDWR || od->state == PTPCLOCK_RDONLY){
-		snprintf(od->pp->ptpdev, MAX_PTPDEV_NAME, "%s", ptpdev);
-	}else{
+	if((od->state == PTPCLOCK_RDWR || od->state == PTPCLOCK_RDONLY) &&
+	   vclock_share(od, inherited)){
+		gptp_close_ptpfd(od->ptpfd);
+		od->state=PTPCLOCK_NOACCESS;
+	}
+	if(od->state != PTPCLOCK_RDWR && od->state != PTPCLOCK_RDONLY){
 		UB_LOG(UBL_ERROR, "%s:clockIndex=%d, ptpdev=%s is not accessible\n",
 		       __func__, clockIndex, ptpdev);
 		od->ptpfd=PTPFD_INVALID;
 		gptpclock_del_clock(clockIndex, domainNumber);
 		return -1;
 	}
-	od->ts2diff = avarage_time_setoffset(clockIndex, domainNumber);
-	od->pp->offset64=0;
-	od->offset64=0;
+	// the applications open ptpdev when they find the name, set it after the sharing
+	snprintf(od->pp->ptpdev, MAX_PTPDEV_NAME, "%s", ptpdev);
+	// ts2diff is calibrated later, not to delay the startup
+	od->ts2diff_valid=false;
+	if(!inherited){
+		od->pp->offset64=0;
+		od->offset64=0;
+	}
 	UB_LOG(UBL_DEBUG, "%s:clockIndex=%d, ptpdev=%s, domainNumber=%d\n",
 	       __func__, clockIndex, ptpdev, domainNumber);
 	GH_SET_GPTP_SHM;
@@ -410,7 +945,12 @@ int gptpclock_del_clock(int clockIndex, uint8_t domainNumber)
 	oneclock_data_t *od;
 	if(!gcd.clds) return 0;
 	if((od=get_clockod(clockIndex, domainNumber))){
-		if(PTPFD_VALID(od->ptpfd)) gptp_close_ptpfd(od->ptpfd);
+		if(PTPFD_VALID(od->ptpfd)){
+			vclock_unshare(od, true);
+			gptp_close_ptpfd(od->ptpfd);
+		}
+		// the applications don't open the deleted ptpdev
+		if(clockIndex==0) od->pp->ptpdev[0]=0;
 		ub_esarray_del_pointer(gcd.clds, (ub_esarray_element_t *)od);
 		UB_LOG(UBL_DEBUG, "%s:clockIndex=%d, domainNumber=%d\n",
 		       __func__, clockIndex, domainNumber);
@@ -426,6 +966,7 @@ int gptpclock_init(int max_domains, int max_ports)
 	int max_clocks = max_domains * max_ports;
 	CB_THREAD_MUTEXATTR_T mattr;
 	char *shmem_name;
+	uint32_t generation;
 	memset(&gcd, 0, sizeof(gptpclock_data_t));
 	gcd.pdd=malloc(max_domains*sizeof(per_domain_data_t));
 	ub_assert(gcd.pdd, __func__, "malloc error");
@@ -437,18 +978,42 @@ int gptpclock_init(int max_domains, int max_ports)
 	gcd.clds = ub_esarray_init(max_clocks, sizeof(oneclock_data_t), max_clocks);
 	gcd.shmsize = sizeof(gptp_clock_ppara_t)*max_domains +
 		sizeof(gptp_master_clock_shm_head_t);
-	shmem_name=gptpconf_get_item(CONF_MASTER_CLOCK_SHARED_MEM);
-	if(!shmem_name[0]) shmem_name=GPTP_MASTER_CLOCK_SHARED_MEM;
+	// records of the clocks, the servos with their state data, and the ports
+	gcd.max_records = max_clocks + max_domains*2 + max_ports + 1;
+	shmem_name=master_clock_shm_name();
+	handoff_take(shmem_name, max_domains);
 	gcd.shm=(gptp_master_clock_shm_t *)cb_get_shared_mem(
 		&gcd.shmfd, shmem_name, gcd.shmsize, O_CREAT | O_RDWR);
 	if(!gcd.shm) return -1;
-	memset(gcd.shm, 0, gcd.shmsize);
-	gcd.shm->head.max_domains = max_domains;
+	if(gcd.ho && (gcd.shm->head.version!=GPTP_MASTER_CLOCK_SHM_VERSION ||
+		      gcd.shm->head.head_size!=sizeof(gptp_master_clock_shm_head_t) ||
+		      gcd.shm->head.ppara_size!=sizeof(gptp_clock_ppara_t))){
+		UB_LOG(UBL_WARN, "%s:%s has a different layout, not inherited\n",
+		       __func__, shmem_name);
+		free(gcd.ho);
+		gcd.ho=NULL;
+	}
+	generation=gcd.shm->head.generation;
+	if(gcd.ho){
+		// the clients keep using it, the mutex was initialized by the previous gptp2d
+		UB_LOG(UBL_INFO, "%s:inherit %s, generation=%u\n",
+		       __func__, shmem_name, generation+1);
+	}else{
+		memset(gcd.shm, 0, gcd.shmsize);
+		gcd.shm->head.version = GPTP_MASTER_CLOCK_SHM_VERSION;
+		gcd.shm->head.head_size = sizeof(gptp_master_clock_shm_head_t);
+		gcd.shm->head.ppara_size = sizeof(gptp_clock_ppara_t);
+		gcd.shm->head.max_domains = max_domains;
+		CB_THREAD_MUTEXATTR_INIT(&mattr);
+		CB_THREAD_MUTEXATTR_SETPSHARED(&mattr, CB_THREAD_PROCESS_SHARED);
+		CB_THREAD_MUTEX_INIT(&gcd.shm->head.mcmutex, &mattr);
+	}
+	__atomic_store_n(&gcd.shm->head.generation, generation+1, __ATOMIC_RELEASE);
 	UB_LOG(UBL_DEBUG, "%s:done, max_domains=%d, shmsize=%d\n",
 	       __func__, max_domains, gcd.shmsize);
-	CB_THREAD_MUTEXATTR_INIT(&mattr);
-	CB_THREAD_MUTEXATTR_SETPSHARED(&mattr, CB_THREAD_PROCESS_SHARED);
-	CB_THREAD_MUTEX_INIT(&gcd.shm->head.mcmutex, &mattr);
+	if(sync_sample_shm_open(max_domains, shmem_name)){
+		UB_LOG(UBL_WARN, "%s:the sync sample ring is not available\n", __func__);
+	}
 	GH_SET_GPTP_SHM;
 	return 0;
 }
@@ -456,21 +1021,35 @@ int gptpclock_init(int max_domains, int max_ports)
 void gptpclock_close(void)
 {
 	oneclock_data_t od;
-	char *shmem_name;
+	bool handoff;
 	if(!gcd.clds) return;
-	gcd.shm->head.max_domains=0;
+	// at the handoff, the clients keep using the shared memory with the next gptp2d
+	handoff=gcd.ho_put;
+	if(handoff) handoff_put_clocks();
+	sync_sample_shm_close(handoff);
+	if(!handoff){
+		__atomic_store_n(&gcd.shm->head.max_domains, 0, __ATOMIC_RELEASE);
+		// the clients find max_domains=0, and know gptp2d is closed.
+		// the waiters on event_seq are woken up, and move to the next gptp2d
+		shm_event_notify(0);
+	}
 	while(!ub_esarray_pop_ele(gcd.clds, (ub_esarray_element_t *)&od)){
-		if(od.mode==PTPCLOCK_SLAVE_MAIN){
+		if(od.mode==PTPCLOCK_SLAVE_MAIN && !handoff){
 			// return HW adjustment rate to 0
 			gptp_clock_adjtime(od.ptpfd, 0);
 		}
-		if(PTPFD_VALID(od.ptpfd)) gptp_close_ptpfd(od.ptpfd);
+		if(PTPFD_VALID(od.ptpfd)){
+			// at the handoff, the next gptp2d continues the virtual clock
+			vclock_unshare(&od, !handoff);
+			gptp_close_ptpfd(od.ptpfd);
+		}
 	}
 	ub_esarray_close(gcd.clds);
-	CB_THREAD_MUTEX_DESTROY(&gcd.shm->head.mcmutex);
-	shmem_name=gptpconf_get_item(CONF_MASTER_CLOCK_SHARED_MEM);
-	if(!shmem_name[0]) shmem_name=GPTP_MASTER_CLOCK_SHARED_MEM;
-	cb_close_shared_mem(gcd.shm, &gcd.shmfd, shmem_name, gcd.shmsize, true);
+	if(!handoff) CB_THREAD_MUTEX_DESTROY(&gcd.shm->head.mcmutex);
+	cb_close_shared_mem(gcd.shm, &gcd.shmfd, master_clock_shm_name(), gcd.shmsize,
+			    !handoff);
+	// the inherited records which were not taken
+	if(gcd.ho) free(gcd.ho);
 	free(gcd.pdd);
 	GH_SET_GPTP_SHM;
 	UB_LOG(UBL_DEBUGV, "%s:closed\n", __func__);
@@ -528,8 +1107,8 @@ int gptpclock_setoffset64(int64_t ts64, int clockIndex, uint8_t domainNumber)
 		return 0;
 	}
 
-	ts64 = od->ts2diff/2 + ts64;
-	if(time_setoffset64(ts64, clockIndex, domainNumber) > od->ts2diff*10){
+	ts64 = calibrate_od(od)/2 + ts64;
+	if(time_setoffset64(ts64, clockIndex, domainNumber) > ts2diff_limit(od)){
 		UB_LOG(UBL_WARN, "%s:clockIndex=%d, domainNumber=%d, "
 		       "can't set in the time. the result must be inaccurate\n",
 		       __func__, clockIndex, domainNumber);
@@ -554,6 +1133,7 @@ int gptpclock_setadj(int adjvppb, int clockIndex, uint8_t domainNumber)
 			       __func__, clockIndex, domainNumber);
 			return -1;
 		}
+		rawmap_hw_changed(od, false, adjvppb);
 		break;
 	case PTPCLOCK_MASTER:
 		UB_LOG(UBL_ERROR,"%s:MASTER can't adjust freq.\n",__func__);
@@ -561,18 +1141,20 @@ int gptpclock_setadj(int adjvppb, int clockIndex, uint8_t domainNumber)
 	case PTPCLOCK_SLAVE_SUB:
 		// to apply new adjrate, update offset value. it updates 'last_setts64'.
 		save_flags=od->flags;
-		ts=time_setoffset64(od->ts2diff/2, clockIndex, domainNumber);
-		if(ts > od->ts2diff*10){
+		ts=time_setoffset64(calibrate_od(od)/2, clockIndex, domainNumber);
+		if(ts > ts2diff_limit(od)){
 			UB_LOG(UBL_WARN, "%s:clockIndex=%d, domainNumber=%d, time_setoffset64 "
 			       "took too long, %"PRIi64"/%d\n",
 			       __func__, clockIndex, domainNumber, ts, od->ts2diff);
 		}
 		od->flags=save_flags; // don't update the flag by the above procedure
-		od->adjrate = (double)adjvppb/1.0E9;
+		od->adjrate = gptp_rr_from_ppb(adjvppb);
 		od0=get_clockod(0, domainNumber);
 		// od0->pp->adjrate is in the shared memory
 		// it is different from od0->adjrate,
+		ppara_update_begin(od0->pp);
 		od0->pp->adjrate = od->adjrate;
+		gptpclock_seq_write_end(od0->pp);
 		GH_SET_GPTP_SHM;
 		break;
 	}
@@ -605,7 +1187,7 @@ void gptpclock_print_clkpara(ub_dbgmsg_level_t level)
 			ub_console_print("adjrate=0(master)\n");
 			break;
 		case PTPCLOCK_SLAVE_SUB:
-			ub_console_print("sw-adjrate=%e\n", pp->adjrate);
+			ub_console_print("sw-adjrate=%dppb\n", gptp_rr_to_ppb(pp->adjrate));
 			break;
 		}
 		ub_console_print("        gmsync=%s, last_setts64=%"PRIi64"nsec\n",
@@ -639,13 +1221,15 @@ int gptpclock_mode_slave_main(int clockIndex, uint8_t domainNumber)
 		}
 	}
 	od->mode=PTPCLOCK_SLAVE_MAIN;
-	od->adjrate=0.0;
+	od->adjrate=RATE_RATIO_ONE;
 	// if SLAVE_MAIN is used, SLAVE_SUB is not used in the same domain.
-	// When SLAVE_SUB is not used, adjrate in the shared mem. must be 0.0,
+	// When SLAVE_SUB is not used, adjrate in the shared mem. must be RATE_RATIO_ONE,
 	// and offset64 is not needed to combine with the one of 'thisClock'
 	GPTPCLOCK_FN_ENTRY(od, 0, domainNumber);
-	od->pp->adjrate=0.0;
+	ppara_update_begin(od->pp);
+	od->pp->adjrate=RATE_RATIO_ONE;
 	od->pp->offset64=od->offset64;
+	gptpclock_seq_write_end(od->pp);
 	GH_SET_GPTP_SHM;
 	return 0;
 }
@@ -686,20 +1270,47 @@ static int diff_in_two_clocks(int64_t *tss64,
 	}
 
 	ts3=(ts3-ts1)/2;
-	if(ts3 > od->ts2diff*10) return -1;
+	if(ts3 > ts2diff_limit(od)) return -1;
 	*tss64=ts2-ts1-ts3;
 	return 0;
 }
 
+/* the software part of gptpclock_getts_od at the hw clock value of 'hwts64' */
+static int64_t sw_offset_od(oneclock_data_t *od, int64_t hwts64)
+{
+	if(!od->offset64) return 0;
+	if(od->adjrate == RATE_RATIO_ONE) return od->offset64;
+	return od->offset64+gptp_rr_delta_ns(hwts64-od->last_setts64, od->adjrate);
+}
+
+/* the both clocks are based on the same physical clock, only the software offset
+   and rate are different. At most one clock read is needed. */
+static int diff_in_same_phc(int64_t *tss64, oneclock_data_t *od, oneclock_data_t *od1)
+{
+	int64_t hwts64=0;
+	if(!PTPFD_VALID(od->ptpfd)) return -1;
+	if((od->offset64 && od->adjrate != RATE_RATIO_ONE) ||
+	   (od1->offset64 && od1->adjrate != RATE_RATIO_ONE))
+		GPTP_CLOCK_GETTIME(od->ptpfd, hwts64);
+	*tss64=sw_offset_od(od1, hwts64)-sw_offset_od(od, hwts64);
+	return 0;
+}
+
 int gptpclock_tsconv(int64_t *ts64, int clockIndex, uint8_t domainNumber,
 		     int clockIndex1, uint8_t domainNumber1)
 {
 	int64_t dtss;
-	oneclock_data_t *od;
+	oneclock_data_t *od, *od1;
 
-	if(clockIndex==clockIndex1 && domainNumber==domainNumber1) return 0;
-	if((od=get_clockod(clockIndex1, domainNumber1))==NULL) return -1;
-	if(clockIndex==clockIndex1 && od->mode!=PTPCLOCK_SLAVE_SUB) return 0;
+	if(clockIndex==clockIndex1 && domainNumber==domainNumber1) return 1;
+	if((od1=get_clockod(clockIndex1, domainNumber1))==NULL) return -1;
+	if(clockIndex==clockIndex1 && od1->mode!=PTPCLOCK_SLAVE_SUB) return 1;
+	if((od=get_clockod(clockIndex, domainNumber))==NULL) return -1;
+	if(!strcmp(od->pp->ptpdev, od1->pp->ptpdev)){
+		if(diff_in_same_phc(&dtss, od, od1)) return -1;
+		*ts64+=dtss;
+		return 1;
+	}
 	if(diff_in_two_clocks(&dtss, clockIndex, domainNumber,
 			      clockIndex1, domainNumber1)){
 		// in case of a fail by context switching, we'll try twice
@@ -734,11 +1345,11 @@ int gptpclock_rate_same(int clockIndex, uint8_t domainNumber,
 	if(!strcmp(od->pp->ptpdev, od1->pp->ptpdev)){
 		if(od->mode != PTPCLOCK_SLAVE_SUB && od1->mode != PTPCLOCK_SLAVE_SUB)
 			return 0;
-		if(od->adjrate == 0.0 && od1->adjrate == 0.0)
+		if(od->adjrate == RATE_RATIO_ONE && od1->adjrate == RATE_RATIO_ONE)
 			return 0;
-		if(od->adjrate == 0.0 && od1->mode != PTPCLOCK_SLAVE_SUB)
+		if(od->adjrate == RATE_RATIO_ONE && od1->mode != PTPCLOCK_SLAVE_SUB)
 			return 0;
-		if(od1->adjrate == 0.0 && od->mode != PTPCLOCK_SLAVE_SUB)
+		if(od1->adjrate == RATE_RATIO_ONE && od->mode != PTPCLOCK_SLAVE_SUB)
 			return 0;
 	}
 	return 1;
@@ -751,6 +1362,7 @@ static int switch_active_domain(int di)
 	UB_TLOG(UBL_INFO, "active domain switched from %d to %d\n",
 		 gcd.shm->head.active_domain, di);
 	gcd.shm->head.active_domain=di;
+	shm_event_notify(GPTPIPC_EVENT_CLOCK_FLAG_ACTIVE_DOMAIN);
 	GPTPCLOCK_FN_ENTRY(od, 0, gcd.pdd[di].domainNumber);
 	od->flags |= GPTPIPC_EVENT_CLOCK_FLAG_ACTIVE_DOMAIN;
 	GH_SET_GPTP_SHM;
@@ -805,10 +1417,12 @@ static int adjust_GM_btw_domains(int domainNumber)
 		return 0;
 	}
 	// 'thisClock of D0' and 'thisClock of Di' is based on the same clock.
-	od1->adjrate=0.0; // GM Freq. sync to Domain0
-	od1->pp->adjrate=0.0;
+	od1->adjrate=RATE_RATIO_ONE; // GM Freq. sync to Domain0
 	od1->offset64=od->offset64;
+	ppara_update_begin(od1->pp);
+	od1->pp->adjrate=RATE_RATIO_ONE;
 	od1->pp->offset64=od->pp->offset64;
+	gptpclock_seq_write_end(od1->pp);
 	GH_SET_GPTP_SHM;
 	return 0;
 }
@@ -829,19 +1443,34 @@ int gptpclock_active_domain_status(void)
 int gptpclock_set_gmsync(int clockIndex, uint8_t domainNumber, ClockIdentity gmIdentity, bool becomeGM)
 {
 	oneclock_data_t *od;
+	bool hold;
 	UB_LOG(UBL_DEBUGV, "%s:clockIndex=%d, domainNumber=%d, becomeGM=%d\n",
 	       __func__, clockIndex, domainNumber, becomeGM);
 	GPTPCLOCK_FN_ENTRY(od, clockIndex, domainNumber);
-	if(od->pp->gmsync) return 0;
+	/* in the hold after the handoff, becoming GM keeps the inherited parameters,
+	   and syncing to GM ends the hold. pp->gmsync may remain from the previous
+	   gptp2d, and only the status in this process is updated */
+	hold=(clockIndex==0 && gptpclock_handoff_holding(od->domainIndex));
+	if(hold && !becomeGM) gcd.pdd[od->domainIndex].handoff_hold_until=0;
+	if(od->pp->gmsync && !hold) return 0;
 	if(becomeGM){
 		gcd.pdd[od->domainIndex].we_are_gm=true;
 		memcpy(gcd.pdd[od->domainIndex].gmClockId, gmIdentity, sizeof(ClockIdentity));
+		if(clockIndex==0 && !hold){
+			gptp_clock_quality_para_t qp;
+			memset(&qp, 0, sizeof(qp));
+			qp.servo_state=GPTPIPC_SERVO_STATE_GM;
+			gptpclock_set_quality(od->domainIndex, &qp);
+		}
 	}
 	else
 		gcd.pdd[od->domainIndex].we_are_gm=false;
+	if(od->pp->gmsync) return 0;
 
 	od->flags |= GPTPIPC_EVENT_CLOCK_FLAG_GM_SYNCED;
 	od->pp->gmsync=true;
+	if(clockIndex==0) shm_event_notify(GPTPIPC_EVENT_CLOCK_FLAG_GM_SYNCED);
+	if(hold) return 0;
 	if(clockIndex==0 && domainNumber!=0 && becomeGM)
 		adjust_GM_btw_domains(domainNumber);
 	if(clockIndex==0 && becomeGM && gptpconf_get_intitem(CONF_RESET_FREQADJ_BECOMEGM))
@@ -864,6 +1493,7 @@ int gptpclock_reset_gmsync(int clockIndex, uint8_t domainNumber)
 	if(!od->pp->gmsync) return 0;
 	od->flags |= GPTPIPC_EVENT_CLOCK_FLAG_GM_UNSYNCED;
 	od->pp->gmsync=false;
+	if(clockIndex==0) shm_event_notify(GPTPIPC_EVENT_CLOCK_FLAG_GM_UNSYNCED);
 	return 0;
 }
 
@@ -880,6 +1510,9 @@ void gptpclock_set_gmstable(int domainIndex, bool stable)
 	if(domainIndex<0 || domainIndex>=gcd.shm->head.max_domains) return;
 	if(gcd.pdd[domainIndex].gm_stable==stable) return;
 	gcd.pdd[domainIndex].gm_stable=stable;
+	gcd.shm->gcpp[domainIndex].gmstable=stable;
+	shm_event_notify(stable?GPTPIPC_EVENT_CLOCK_FLAG_GM_STABLE:
+			 GPTPIPC_EVENT_CLOCK_FLAG_GM_UNSTABLE);
 	gptpclock_update_active_domain();
 }
 
@@ -896,6 +1529,7 @@ int gptpclock_set_gmchange(int domainNumber, ClockIdentity clockIdentity)
 	od->flags |= GPTPIPC_EVENT_CLOCK_FLAG_GM_CHANGE;
 	od->pp->gmchange_ind++;
 	memcpy(gcd.pdd[od->domainIndex].gmClockId, clockIdentity, sizeof(ClockIdentity));
+	shm_event_notify(GPTPIPC_EVENT_CLOCK_FLAG_GM_CHANGE);
 	GH_SET_GPTP_SHM;
 	return 0;
 }
@@ -933,7 +1567,7 @@ int gptpclock_get_ipc_clock_data(int clockIndex, uint8_t domainNumber, gptpipc_c
 int gptpclock_set_thisClock(int clockIndex, uint8_t domainNumber, bool set_clock_para)
 {
 	oneclock_data_t *od, *mod;
-	double adjrate;
+	ScaledRateRatio adjrate;
 	int64_t ts64;
 	if(clockIndex==0){
 		UB_LOG(UBL_ERROR,"%s:clockIndex=0 can't be thisClock\n", __func__);
@@ -969,8 +1603,8 @@ int gptpclock_set_thisClock(int clockIndex, uint8_t domainNumber, bool set_clock
 		if(od->offset64){
 			gptpclock_setoffset64(od->offset64, clockIndex, domainNumber);
 		}
-		if(adjrate){
-			gptpclock_setadj(adjrate*UB_SEC_NS, clockIndex, domainNumber);
+		if(adjrate != RATE_RATIO_ONE){
+			gptpclock_setadj(gptp_rr_to_ppb(adjrate), clockIndex, domainNumber);
 		}
 
 		/* move the offset in the master clock to thisClock */
@@ -990,7 +1624,9 @@ int gptpclock_set_thisClock(int clockIndex, uint8_t domainNumber, bool set_clock
 	/* when set_clock_para==true, offset in the master clock has been moved to thisClock,
 	   and it needs to be cleared */
 	mod->offset64=0;
+	ppara_update_begin(mod->pp);
 	mod->pp->offset64=mod->offset64+od->offset64;
+	gptpclock_seq_write_end(mod->pp);
 mutexout:
 	CB_THREAD_MUTEX_UNLOCK(&gcd.shm->head.mcmutex);
 	GH_SET_GPTP_SHM;
@@ -1014,7 +1650,7 @@ int64_t gptpclock_d0ClockfromRT(int clockIndex)
 		return 0;
 	}
 	ts3=(ts3-ts1)/2;
-	if(ts3 > od->ts2diff*10) {
+	if(ts3 > ts2diff_limit(od)) {
 		UB_LOG(UBL_WARN,"%s:gap of 2 ts is too big:clockIndex=%d, domainNumber=%d, %"
 		       PRIi64"\n",__func__, od->clockIndex, od->pp->domainNumber, ts3);
 	}
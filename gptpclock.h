@@ -21,7 +21,13 @@
 #ifndef __GPTPCLOCK_H_
 #define __GPTPCLOCK_H_
 #include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "gptpbasetypes.h"
+#include "gptpfixedpoint.h"
 #include "ll_gptpsupport.h"
 #include "gptpipc.h"
 
@@ -37,20 +43,64 @@ typedef enum {
 	PTPCLOCK_RDWR,
 } ptpclock_state_t;
 
+/* the quality of the clock which the servo sets at each Sync */
+typedef struct gptp_clock_quality_para {
+	int64_t sync_rawts64; // RAW time of the last Sync, 0:no Sync
+	int64_t sync_timeout; // nsec, Sync is taken as lost after this from the last one
+	int64_t uncertainty; // estimated offset uncertainty at the last Sync, -1:unknown
+	int64_t drift_ppb; // the uncertainty grows by this rate without Sync
+	ScaledRateRatio rate_ratio; // measured rate ratio of GM to thisClock
+	uint8_t servo_state; // GPTPIPC_SERVO_STATE_*
+	// in the holdover, 'uncertainty' is at the start, and it grows by the model errors
+	int64_t holdover_rawts64; // RAW time of the holdover start, 0:not in the holdover
+	int64_t holdover_ferr_ppt; // frequency error of the model, 1/1000 ppb
+	int64_t holdover_derr_ppt; // drift error of the model, 1/1000 ppb per sec
+} gptp_clock_quality_para_t;
+
+/* the phase error of the holdover, 'duration' nsec after the start,
+   by the frequency error and the drift error of the model */
+static inline int64_t gptpclock_holdover_error(int64_t ferr_ppt, int64_t derr_ppt,
+					       int64_t duration)
+{
+	int64_t sec=duration/UB_SEC_NS;
+	return (duration/UB_MSEC_NS)*ferr_ppt/UB_MSEC_NS + derr_ppt*sec*sec/2000;
+}
+
 typedef struct gptp_clock_ppara {
 	char ptpdev[MAX_PTPDEV_NAME];
 	uint8_t domainNumber; //when accessed by domainIndex, need this domainNumber
 	int64_t offset64;
 	bool gmsync;
+	bool gmstable;
 	uint32_t gmchange_ind;
 	int64_t last_setts64;
-	double adjrate;
+	ScaledRateRatio adjrate;
+	uint32_t seq; // sequence counter of the parameters, odd while updating
+	// mapping of CLOCK_MONOTONIC_RAW to gPTP time, protected by 'seq' as well
+	// gPTP time = map_gptpts64 + (raw - map_rawts64) * map_rate
+	int64_t map_rawts64;
+	int64_t map_gptpts64;
+	ScaledRateRatio map_rate;
+	int64_t map_valid_until; // RAW time, the mapping is not used after this. 0:invalid
+	gptp_clock_quality_para_t quality; // protected by 'seq'
 } gptp_clock_ppara_t;
 
+/* the layout of the master clock shared memory, increment it at any change of
+   gptp_master_clock_shm_head_t or gptp_clock_ppara_t.
+   the upper bits are not taken for 'active_domain' of the layout without the version */
+#define GPTP_MASTER_CLOCK_SHM_VERSION 0x47500001
+
 typedef struct gptp_master_clock_shm_head {
 	int max_domains;
+	// the clients check these before mapping the whole, they must stay here
+	uint32_t version; // GPTP_MASTER_CLOCK_SHM_VERSION
+	uint16_t head_size; // sizeof(gptp_master_clock_shm_head_t)
+	uint16_t ppara_size; // sizeof(gptp_clock_ppara_t)
 	int active_domain;
 	CB_THREAD_MUTEX_T mcmutex;
+	uint32_t event_seq; // incremented at each event, clients wait on this as a futex
+	uint32_t event_flags; // GPTPIPC_EVENT_CLOCK_FLAG_* of the last event
+	uint32_t generation; // incremented at each start of gptp2d
 }gptp_master_clock_shm_head_t;
 
 typedef struct gptp_master_clock_shm {
@@ -58,6 +108,67 @@ typedef struct gptp_master_clock_shm {
 	gptp_clock_ppara_t gcpp[];
 } gptp_master_clock_shm_t;
 
+/*
+ * Ring of the sync samples in a separate shared memory, which is named
+ * by adding GPTP_SYNC_SAMPLE_SHM_SUFFIX to the master clock shared memory name.
+ * Each domain has one ring of 'num_slots' slots, gptp2d is the only writer.
+ * The writer clears 'wseq' of the slot, writes the sample, sets 'wseq' to
+ * the sample number + 1, and then increments 'head'.
+ * Readers check 'wseq' before and after copying a slot, and a changed 'wseq'
+ * means the slot was overwritten during the copy.
+ */
+#define GPTP_SYNC_SAMPLE_SHM_SUFFIX "_smp"
+
+typedef struct gptp_sync_sample_slot {
+	uint64_t wseq; // the sample number + 1, 0 while writing
+	gptpipc_sync_sample_t smp;
+} __attribute__((aligned(64))) gptp_sync_sample_slot_t;
+
+typedef struct gptp_sync_sample_ring {
+	uint64_t head; // the number of the pushed samples
+	uint32_t wake; // incremented at each push, readers wait on this as a futex
+	uint32_t waiters; // the number of the waiting readers
+	gptp_sync_sample_slot_t slots[];
+} __attribute__((aligned(64))) gptp_sync_sample_ring_t;
+
+typedef struct gptp_sync_sample_shm {
+	int max_domains; // 0 when gptp2d is closed
+	uint32_t num_slots; // power of 2
+} __attribute__((aligned(64))) gptp_sync_sample_shm_t;
+
+static inline int gptp_sync_sample_shm_size(int max_domains, uint32_t num_slots)
+{
+	return sizeof(gptp_sync_sample_shm_t) + max_domains *
+		(sizeof(gptp_sync_sample_ring_t) + num_slots*sizeof(gptp_sync_sample_slot_t));
+}
+
+static inline gptp_sync_sample_ring_t *gptp_sync_sample_ring(gptp_sync_sample_shm_t *sshm,
+							     int domainIndex)
+{
+	return (gptp_sync_sample_ring_t *)((uint8_t *)sshm + sizeof(gptp_sync_sample_shm_t) +
+		domainIndex * (sizeof(gptp_sync_sample_ring_t) +
+			       sshm->num_slots*sizeof(gptp_sync_sample_slot_t)));
+}
+
+/*
+ * Handoff to the next gptp2d at a restart.
+ * gptp2d which is terminated by SIGUSR1 leaves the master clock shared memory,
+ * the sync sample ring and the HW adjustment rate of the clocks as they are,
+ * and puts its state as records in another shared memory, which is named
+ * by adding GPTP_HANDOFF_SHM_SUFFIX to the master clock shared memory name.
+ * The next gptp2d inherits the shared memory and takes the records, then
+ * the clients keep reading valid parameters during the restart.
+ */
+#define GPTP_HANDOFF_SHM_SUFFIX "_ho"
+#define GPTPCLOCK_HANDOFF_DATA_SIZE 256
+
+typedef enum {
+	GPTPCLOCK_HANDOFF_CLOCK = 1, // clock parameters, index=clockIndex<<8|domainNumber
+	GPTPCLOCK_HANDOFF_SERVO, // servo state, index=domainIndex
+	GPTPCLOCK_HANDOFF_PDELAY, // neighbor delay and rate ratio, index=portIndex
+	GPTPCLOCK_HANDOFF_SERVO_DATA, // state data of the servo algorithm, index=domainIndex
+} gptpclock_handoff_type_t;
+
 #define GPTP_MAX_SIZE_SHARED_MEMNAME 32
 #define GPTP_MASTER_CLOCK_SHARED_MEM "/gptp_mc_shm"
 #define GPTP_MASTER_CLOCK_MUTEX_TIMEOUT (10*UB_MSEC_NS)
@@ -78,11 +189,139 @@ static inline int gptpclock_mutex_trylock(CB_THREAD_MUTEX_T *mutex)
 	return 0;
 }
 
+/*
+ * The clock parameters in the shared memory are protected by a sequence counter.
+ * gptp2d is the only writer, and increments 'seq' before and after updating
+ * the parameters. Readers don't lock anything; they read 'seq', the parameters
+ * and 'seq' again, and retry when 'seq' is odd or changed.
+ * 'mcmutex' is still used to serialize the updates in gptp2d.
+ * An update takes a few usec, the first retries spin and the next ones sleep
+ * with a growing backoff. When all the retries fail, gptp2d must have stopped
+ * in the middle of an update, and the parameters must not be used.
+ */
+#define GPTP_MASTER_CLOCK_SEQ_RETRY 8
+#define GPTP_MASTER_CLOCK_SEQ_SPIN 2
+#define GPTP_MASTER_CLOCK_SEQ_BACKOFF (10*UB_USEC_NS)
+
+static inline void gptpclock_seq_write_begin(gptp_clock_ppara_t *pp)
+{
+	__atomic_store_n(&pp->seq, pp->seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void gptpclock_seq_write_end(gptp_clock_ppara_t *pp)
+{
+	__atomic_store_n(&pp->seq, pp->seq+1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t gptpclock_seq_read_begin(gptp_clock_ppara_t *pp)
+{
+	return __atomic_load_n(&pp->seq, __ATOMIC_ACQUIRE);
+}
+
+// return true when the read must be retried
+static inline bool gptpclock_seq_read_retry(gptp_clock_ppara_t *pp, uint32_t seq)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return (seq & 1) || __atomic_load_n(&pp->seq, __ATOMIC_RELAXED)!=seq;
+}
+
+// call before the i-th retry, 10,20,40...usec of sleep after the spins
+static inline void gptpclock_seq_read_backoff(int i)
+{
+	struct timespec ts;
+	if(i<GPTP_MASTER_CLOCK_SEQ_SPIN) return;
+	UB_NSEC2TS(GPTP_MASTER_CLOCK_SEQ_BACKOFF<<(i-GPTP_MASTER_CLOCK_SEQ_SPIN), ts);
+	nanosleep(&ts, NULL);
+}
+
+/* wake up all the processes waiting on 'addr' */
+static inline int gptpclock_futex_wake(uint32_t *addr)
+{
+	return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* wait while *addr==val, 'toutns' is relative time, toutns<0 waits forever */
+static inline int gptpclock_futex_wait(uint32_t *addr, uint32_t val, int64_t toutns)
+{
+	struct timespec ts;
+	UB_NSEC2TS(toutns, ts);
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, (toutns<0)?NULL:&ts, NULL, 0);
+}
+
+/* CLOCK_MONOTONIC_RAW, the base of the mapping to gPTP time.
+   It is read by vDSO on most of the platforms, no system call happens */
+static inline int64_t gptpclock_rawts64(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (int64_t)ts.tv_sec*UB_SEC_NS+ts.tv_nsec;
+}
+
 int gptpclock_init(int max_domains, int max_ports);
 void gptpclock_close(void);
 int gptpclock_add_clock(int clockIndex, char *ptpdev, int domainIndex,
 			uint8_t domainNumber, ClockIdentity id);
 int gptpclock_del_clock(int clockIndex, uint8_t domainNumber);
+
+/**
+ * @brief calibrate the clock access time of one clock which is not yet calibrated.
+ * gptpclock_add_clock doesn't calibrate it, not to delay the startup.
+ * @result 1:one clock is calibrated, 0:no more clock to calibrate
+ */
+int gptpclock_calibrate_next(void);
+
+/**
+ * @brief update the mapping of CLOCK_MONOTONIC_RAW to gPTP time in the shared memory.
+ * The mapping is updated when the clock parameters were changed, or when
+ * CONF_RAWMAP_UPDATE_INTERVAL has passed. Call this after each event in gptp2d.
+ * @result the number of updated domains
+ */
+int gptpclock_rawmap_update(void);
+
+/**
+ * @brief push a sync sample to the ring of the domain in the shared memory.
+ * 'raw_ts64' of the sample is set in this function.
+ * @result 0:pushed, -1:the ring is not used or error
+ */
+int gptpclock_sync_sample_push(int domainIndex, gptpipc_sync_sample_t *smp);
+
+/**
+ * @brief publish the quality of the clock of the domain for the clients.
+ * the servo calls this at each Sync. when this device becomes GM, the quality
+ * is set to GPTPIPC_SERVO_STATE_GM in gptpclock_set_gmsync.
+ * @result 0:success, -1:error
+ */
+int gptpclock_set_quality(int domainIndex, gptp_clock_quality_para_t *qp);
+
+/**
+ * @brief start the handoff to the next gptp2d.
+ * After this call, gptpclock_handoff_put stores records, and gptpclock_close
+ * puts the clock parameters and leaves the shared memory for the next gptp2d.
+ * @result 0:success, -1:error
+ */
+int gptpclock_handoff_begin(void);
+
+/**
+ * @brief put a record for the next gptp2d, only after gptpclock_handoff_begin.
+ * 'size' must not exceed GPTPCLOCK_HANDOFF_DATA_SIZE.
+ * @result 0:success, -1:error
+ */
+int gptpclock_handoff_put(gptpclock_handoff_type_t type, int index, void *data, int size);
+
+/**
+ * @brief get a record which the previous gptp2d put. Each record is given only once.
+ * @result 0:success, -1:no record
+ */
+int gptpclock_handoff_get(gptpclock_handoff_type_t type, int index, void *data, int size);
+
+/**
+ * @brief true while the domain holds the inherited clock parameters.
+ * Becoming GM doesn't reset the parameters in CONF_RESTART_HANDOFF_HOLD_TIME
+ * after the start, and syncing to GM ends the hold.
+ */
+bool gptpclock_handoff_holding(int domainIndex);
+
 int gptpclock_apply_offset(int64_t *ts64, int clockIndex, uint8_t domainNumber);
 int gptpclock_setts64(int64_t ts64, int clockIndex, uint8_t domainNumber);
 int gptpclock_setadj(int adjvppb, int clockIndex, uint8_t domainNumber);
@@ -93,6 +332,14 @@ int gptpclock_mode_slave_sub(int clockIndex, uint8_t domainNumber);
 
 int64_t gptpclock_getts64(int clockIndex, uint8_t domainNumber);
 int64_t gptpclock_gethwts64(int clockIndex, uint8_t domainNumber);
+
+/**
+ * @brief convert ts64 of (clockIndex, domainNumber) to (clockIndex1, domainNumber1)
+ * When the both clocks are based on the same physical clock(the same ptpdev),
+ * only the software offset and rate are applied without reading the two clocks.
+ * @result 0:converted by reading the two clocks, 1:converted without reading them,
+ *	-1:error
+ */
 int gptpclock_tsconv(int64_t *ts64, int clockIndex, uint8_t domainNumber,
 		     int clockIndex1, uint8_t domainNumber1);
 uint8_t *gptpclock_clockid(int clockIndex, uint8_t domainNumber);
@@ -24,11 +24,14 @@
 #include <xl4unibase/unibase_binding.h>
 #include "gptpcommon.h"
 #include "gptpmasterclock.h"
+#include "gptpfixedpoint.h"
 
 static int verbose;
 static int oneshot;
 static int dcdiff;
 static char *shmem_name;
+static int sample_domain=-1;
+static int quality_domain=-1;
 
 static int64_t get_two_ts_diff(int64_t *ts64, int64_t *rts64, int di)
 {
@@ -196,6 +199,62 @@ int main_loop(void)
 	return 0;
 }
 
+/* print the sync samples which gptp2d pushes in the shared memory ring */
+#define SAMPLE_READ_NUM 16
+static int sample_loop(int di)
+{
+	gptpipc_sync_sample_t smps[SAMPLE_READ_NUM];
+	uint64_t pos;
+	uint32_t lost;
+	int i, n;
+	if(gptpmasterclock_sync_sample_head(di, &pos)){
+		printf("no sync sample ring for domainIndex=%d\n", di);
+		return 2;
+	}
+	printf("seqid local_ts64 gm_ts64 offset64 rate(ppb) adjppb flags\n");
+	while(true){
+		n=gptpmasterclock_sync_sample_read(di, &pos, smps, SAMPLE_READ_NUM, &lost);
+		if(n<0) return 2;
+		if(lost) printf("%u samples lost\n", lost);
+		for(i=0;i<n;i++){
+			printf("%5u %"PRIi64" %"PRIi64" %"PRIi64" %d %d 0x%x\n",
+			       smps[i].seqid, smps[i].local_ts64, smps[i].gm_ts64,
+			       smps[i].offset64,
+			       smps[i].rate_ratio?gptp_rr_to_ppb(smps[i].rate_ratio):0,
+			       smps[i].adjppb, smps[i].flags);
+		}
+		if(n==SAMPLE_READ_NUM) continue;
+		if(oneshot && n) return 0;
+		if(gptpmasterclock_sync_sample_wait(di, pos, UB_SEC_NS)<0) return 2;
+	}
+	return 0;
+}
+
+/* print the time and the quality of the clock in every second */
+static int quality_loop(int di)
+{
+	const char *stname[]={"FREERUN","CONVERGING","LOCKED","GM","HOLDOVER"};
+	gptpipc_clock_quality_t qy;
+	int64_t ts64;
+	while(true){
+		if(gptpmasterclock_get_domain_ts64_quality(&ts64, &qy, di)){
+			printf("can't get the quality of domainIndex=%d\n", di);
+			return 2;
+		}
+		printf("%"PRIi64" servo=%s holdover=%d gmstable=%d uncertainty=%"PRIi64
+		       " sync_age=%"PRIi64" rate=%dppb holdover_time=%"PRIi64"\n", ts64,
+		       (qy.servo_state<=GPTPIPC_SERVO_STATE_HOLDOVER)?
+		       stname[qy.servo_state]:"UNKNOWN",
+		       (qy.flags & GPTPIPC_CLOCK_QUALITY_FLAG_HOLDOVER)?1:0,
+		       (qy.flags & GPTPIPC_CLOCK_QUALITY_FLAG_GM_STABLE)?1:0,
+		       qy.uncertainty, qy.sync_age,
+		       qy.rate_ratio?gptp_rr_to_ppb(qy.rate_ratio):0, qy.holdover_time);
+		if(oneshot) return 0;
+		sleep(1);
+	}
+	return 0;
+}
+
 static int print_usage(char *pname)
 {
 	char *s;
@@ -206,6 +265,8 @@ static int print_usage(char *pname)
 	ub_console_print("-o|--oneshot: print one shot of messages and terminate program\n");
 	ub_console_print("-d|--diff domain_N: show time diff between domain_N and domain_0\n");
 	ub_console_print("-s|--shmem shmem_name: shared memory node name\n");
+	ub_console_print("-r|--samples domain_N: print sync samples of domain_N as they come\n");
+	ub_console_print("-q|--quality domain_N: print the clock quality of domain_N\n");
 	return -1;
 }
 
@@ -218,8 +279,10 @@ static int set_options(int argc, char *argv[])
 		{"oneshot", no_argument, 0, 'o'},
 		{"diff", required_argument, 0, 'd'},
 		{"shmem", required_argument, 0, 's'},
+		{"samples", required_argument, 0, 'r'},
+		{"quality", required_argument, 0, 'q'},
 	};
-	while((oc=getopt_long(argc, argv, "hvod:s:", long_options, NULL))!=-1){
+	while((oc=getopt_long(argc, argv, "hvod:s:r:q:", long_options, NULL))!=-1){
 		switch(oc){
 		case 'v':
 			verbose=1;
@@ -233,6 +296,12 @@ static int set_options(int argc, char *argv[])
 		case 's':
 			shmem_name=optarg;
 			break;
+		case 'r':
+			sample_domain=strtol(optarg, NULL, 0);
+			break;
+		case 'q':
+			quality_domain=strtol(optarg, NULL, 0);
+			break;
 		case 'h':
 		default:
 			return print_usage(argv[0]);
@@ -252,7 +321,12 @@ int main(int argc, char *argv[])
 	if(set_options(argc, argv)) return 1;
 	if(gptpmasterclock_init(shmem_name)) return 1;
 	while(true){
-		res=main_loop();
+		if(sample_domain>=0)
+			res=sample_loop(sample_domain);
+		else if(quality_domain>=0)
+			res=quality_loop(quality_domain);
+		else
+			res=main_loop();
 		if(res==2){
 			sleep(1); // sleep one sec before re-initialization
 			gptpmasterclock_close();
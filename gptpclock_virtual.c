@@ -18,70 +18,99 @@
  * along with Excelfore-gptp.  If not, see
  * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
  */
+#include <fcntl.h>
 #include "gptpclock_virtual.h"
 #include "gptpclock.h"
 #include "gptp_config.h"
 
 #define PTPVDEV_MAX_NAME 16
 #define MAX_VPTPD (GPTP_VIRTUAL_PTPDEV_FDMAX-GPTP_VIRTUAL_PTPDEV_FDBASE+1)
+#define VCLOCK_MCSHM_MAX_NAME 33
 
 typedef struct ptpfd_virtual {
 	char ptpdev[PTPVDEV_MAX_NAME];
 	PTPFD_TYPE fd;
-	int freq_adj;
-	uint64_t lastts;
-	uint64_t lastpts;
-	bool rdwr_mode;
+	uint64_t lastts; // the latest read
 	int users;
+	gptp_vclock_state_t st;
+	gptp_vclock_shm_t *vshm; // the applications read 'st' from here
+	int vshmfd;
+	int shares;
+	char mcshm[VCLOCK_MCSHM_MAX_NAME];
 } ptpfd_virtual_t;
 
-static ub_esarray_cstd_t *esvptpd = NULL;
+/* fd is 'GPTP_VIRTUAL_PTPDEV_FDBASE + index', and it is directly looked up */
+static ptpfd_virtual_t vptpd[MAX_VPTPD];
+
+// the real time given by gptp_vclock_set_simtime, 0:use ub_rt_gettime64()
+static uint64_t simtime;
+
+static uint64_t vclock_now(void)
+{
+	return simtime?simtime:ub_rt_gettime64();
+}
 
 static ptpfd_virtual_t *find_ptpfd_virtual(PTPFD_TYPE ptpfd)
 {
-	int i;
 	ptpfd_virtual_t *pv;
-	int en;
-	if (!esvptpd) {
-		UB_LOG(UBL_ERROR,"%s:esvptpd is NULL\n", __func__);
-		return NULL;
-	}
-	en=ub_esarray_ele_nums(esvptpd);
-	for(i=0;i<en;i++){
-		pv=(ptpfd_virtual_t *)ub_esarray_get_ele(esvptpd, i);
-		if(ptpfd==pv->fd) return pv;
-	}
+	if(!VIRTUAL_CLOCKFD(ptpfd)) return NULL;
+	pv=&vptpd[ptpfd-(PTPFD_TYPE)GPTP_VIRTUAL_PTPDEV_FDBASE];
+	if(pv->users) return pv;
 	UB_LOG(UBL_ERROR,"%s:ptpfd="PRiFD" is not opened\n", __func__, ptpfd);
 	return NULL;
 }
 
+static void vclock_publish(ptpfd_virtual_t *pv)
+{
+	if(pv->vshm) gptp_vclock_shm_store(pv->vshm, &pv->st);
+}
+
+static void vclock_start(ptpfd_virtual_t *pv, uint64_t rts64)
+{
+	gptp_vclock_state_start(&pv->st, rts64);
+	pv->lastts=rts64;
+}
+
+static void vclock_default_model(ptpfd_virtual_t *pv)
+{
+	gptp_vclock_model_t model;
+	memset(&model, 0, sizeof(model));
+	model.init_offset=gptpconf_get_intitem(CONF_PTPVFD_INIT_OFFSET);
+	model.freq_ppb=gptpconf_get_intitem(CONF_PTPVFD_CLOCK_RATE);
+	model.random_walk_ppb=gptpconf_get_intitem(CONF_PTPVFD_RANDOM_WALK);
+	model.step_ppb=gptpconf_get_intitem(CONF_PTPVFD_FREQ_STEP);
+	model.step_interval=(uint64_t)gptpconf_get_intitem(CONF_PTPVFD_FREQ_STEP_INTERVAL)*
+		UB_MSEC_NS;
+	model.aging_pph=gptpconf_get_intitem(CONF_PTPVFD_AGING);
+	model.quantization=gptpconf_get_intitem(CONF_PTPVFD_QUANTIZATION);
+	model.ts_noise=gptpconf_get_intitem(CONF_PTPVFD_TS_NOISE);
+	// each clock gets a different sequence, but it is the same in every run
+	model.seed=(uint64_t)gptpconf_get_intitem(CONF_PTPVFD_SEED)*1000+
+		(pv->fd-(PTPFD_TYPE)GPTP_VIRTUAL_PTPDEV_FDBASE);
+	gptp_vclock_state_init(&pv->st, &model);
+}
+
 PTPFD_TYPE gptp_vclock_alloc_fd(char *ptpdev)
 {
-	int i,en;
-	ptpfd_virtual_t *pv, *rpv;
-	PTPFD_TYPE fdmax=(PTPFD_TYPE)(GPTP_VIRTUAL_PTPDEV_FDBASE-1);
-	if(!esvptpd){
-		esvptpd=ub_esarray_init(4, sizeof(ptpfd_virtual_t), MAX_VPTPD);
-	}
-	en=ub_esarray_ele_nums(esvptpd);
-	for(i=0;i<en;i++){
-		pv=(ptpfd_virtual_t *)ub_esarray_get_ele(esvptpd, i);
-		if(!strcmp(pv->ptpdev, ptpdev)) {
-			(pv->users)++;
-			return pv->fd;
+	int i;
+	ptpfd_virtual_t *rpv=NULL;
+	for(i=0;i<MAX_VPTPD;i++){
+		if(!vptpd[i].users){
+			if(!rpv) rpv=&vptpd[i];
+			continue;
+		}
+		if(!strcmp(vptpd[i].ptpdev, ptpdev)) {
+			(vptpd[i].users)++;
+			return vptpd[i].fd;
 		}
-		fdmax=UB_MAX(pv->fd, fdmax);
 	}
-	rpv=(ptpfd_virtual_t *)ub_esarray_get_newele(esvptpd);
+	if(!rpv) return PTPFD_INVALID;
 	memset(rpv, 0, sizeof(ptpfd_virtual_t));
 	strncpy(rpv->ptpdev, ptpdev, PTPVDEV_MAX_NAME-1);
-	rpv->fd=fdmax+1;
+	rpv->fd=(PTPFD_TYPE)GPTP_VIRTUAL_PTPDEV_FDBASE+(rpv-vptpd);
 	rpv->users=1;
-	if(ptpdev[strlen(CB_VIRTUAL_PTPDEV_PREFIX)]=='w') rpv->rdwr_mode=true;
-	if(rpv->fd>(PTPFD_TYPE)GPTP_VIRTUAL_PTPDEV_FDMAX){
-		ub_esarray_del_pointer(esvptpd, (ub_esarray_element_t *)rpv);
-		return PTPFD_INVALID;
-	}
+	if(ptpdev[strlen(CB_VIRTUAL_PTPDEV_PREFIX)]=='w') rpv->st.rdwr_mode=true;
+	vclock_default_model(rpv);
 	return rpv->fd;
 }
 
@@ -92,54 +121,125 @@ int gptp_vclock_free_fd(PTPFD_TYPE ptpfd)
 		UB_LOG(UBL_ERROR,"%s:ptpfd="PRiFD" is not opened\n", __func__, ptpfd);
 		return -1;
 	}
-	if(--(pv->users)==0){
-		ub_esarray_del_pointer(esvptpd, (ub_esarray_element_t *)pv);
-		if(ub_esarray_ele_nums(esvptpd)==0){
-			ub_esarray_close(esvptpd);
-			esvptpd=NULL;
+	(pv->users)--;
+	if(!pv->users && pv->vshm){
+		// the last user didn't unshare
+		gptp_vclock_shm_close(pv->vshm, &pv->vshmfd, pv->mcshm, pv->ptpdev, true);
+		pv->vshm=NULL;
+		pv->shares=0;
+	}
+	return 0;
+}
+
+int gptp_vclock_share(PTPFD_TYPE ptpfd, const char *mcshm, bool inherit)
+{
+	ptpfd_virtual_t *pv=find_ptpfd_virtual(ptpfd);
+	gptp_vclock_state_t vs;
+	if(!pv) return -1;
+	if(pv->vshm){
+		if(strcmp(pv->mcshm, mcshm)){
+			UB_LOG(UBL_ERROR,"%s:%s is already shared in %s\n",
+			       __func__, pv->ptpdev, pv->mcshm);
+			return -1;
 		}
+		pv->shares++;
+		return 0;
+	}
+	pv->vshm=gptp_vclock_shm_open(mcshm, pv->ptpdev, O_CREAT | O_RDWR, &pv->vshmfd);
+	if(!pv->vshm){
+		UB_LOG(UBL_ERROR,"%s:%s, can't open the shared memory\n", __func__, pv->ptpdev);
+		return -1;
+	}
+	snprintf(pv->mcshm, VCLOCK_MCSHM_MAX_NAME, "%s", mcshm);
+	pv->shares=1;
+	if(inherit && !gptp_vclock_shm_load(pv->vshm, &vs)){
+		// the clock continues from the previous gptp2d
+		vs.rdwr_mode=pv->st.rdwr_mode;
+		pv->st=vs;
+		pv->lastts=vs.ats;
+		UB_LOG(UBL_DEBUG, "%s:%s is inherited\n", __func__, pv->ptpdev);
+		return 0;
+	}
+	// the applications can't read it before the start
+	if(!pv->st.startts) vclock_start(pv, vclock_now());
+	vclock_publish(pv);
+	return 0;
+}
+
+int gptp_vclock_unshare(PTPFD_TYPE ptpfd, bool unlink)
+{
+	ptpfd_virtual_t *pv=find_ptpfd_virtual(ptpfd);
+	if(!pv || !pv->vshm) return -1;
+	if(--pv->shares) return 0;
+	gptp_vclock_shm_close(pv->vshm, &pv->vshmfd, pv->mcshm, pv->ptpdev, unlink);
+	pv->vshm=NULL;
+	return 0;
+}
+
+int gptp_vclock_set_model(PTPFD_TYPE ptpfd, const gptp_vclock_model_t *model)
+{
+	ptpfd_virtual_t *pv=find_ptpfd_virtual(ptpfd);
+	if(!pv) return -1;
+	gptp_vclock_state_init(&pv->st, model);
+	pv->lastts=0;
+	if(pv->vshm){
+		vclock_start(pv, vclock_now());
+		vclock_publish(pv);
 	}
 	return 0;
 }
 
 int gptp_vclock_settime(PTPFD_TYPE ptpfd, uint64_t ts64)
 {
+	uint64_t rts64;
 	ptpfd_virtual_t *pv=find_ptpfd_virtual(ptpfd);
 	if(!pv) return -1;
-	if(!pv->rdwr_mode) return -1;
-	pv->lastpts=ts64;
-	pv->lastts=ub_rt_gettime64();
+	if(!pv->st.rdwr_mode) return -1;
+	rts64=vclock_now();
+	if(!pv->st.startts) vclock_start(pv, rts64);
+	gptp_vclock_state_advance(&pv->st, rts64);
+	pv->st.ats=rts64;
+	pv->st.apts=ts64;
+	pv->st.afrac=0.0;
+	if(rts64>pv->lastts) pv->lastts=rts64;
+	vclock_publish(pv);
 	return 0;
 }
 
-uint64_t gptp_vclock_gettime(PTPFD_TYPE ptpfd)
+uint64_t gptp_vclock_gettime_at(PTPFD_TYPE ptpfd, uint64_t rts64)
 {
-	uint64_t ts64;
-	int64_t dts64, dpts64;
 	ptpfd_virtual_t *pv=find_ptpfd_virtual(ptpfd);
 	if(!pv) return 0;
-	ts64=ub_rt_gettime64();
-	if(!pv->lastts){
-		pv->lastpts=ts64;
-		pv->lastts=ts64;
-		return ts64;
+	if(!pv->st.startts){
+		vclock_start(pv, rts64);
+		vclock_publish(pv);
+	}else if(gptp_vclock_state_advance(&pv->st, rts64)){
+		vclock_publish(pv);
 	}
-	dts64=ts64-pv->lastts;
-	if(pv->rdwr_mode)
-		dpts64=dts64*(pv->freq_adj+gptpconf_get_intitem(CONF_PTPVFD_CLOCK_RATE))/UB_SEC_NS;
-	else
-		dpts64=dts64*(gptpconf_get_intitem(CONF_PTPVFD_CLOCK_RATE))/UB_SEC_NS;
-	pv->lastts=ts64;
-	ts64=pv->lastpts+dts64+dpts64;
-	pv->lastpts=ts64;
-	return ts64;
+	if(rts64>pv->lastts) pv->lastts=rts64;
+	return gptp_vclock_state_read(&pv->st, rts64);
+}
+
+uint64_t gptp_vclock_gettime(PTPFD_TYPE ptpfd)
+{
+	return gptp_vclock_gettime_at(ptpfd, vclock_now());
+}
+
+void gptp_vclock_set_simtime(uint64_t rts64)
+{
+	simtime=rts64;
 }
 
 int gptp_vclock_adjtime(PTPFD_TYPE ptpfd, int adjppb)
 {
+	uint64_t rts64;
 	ptpfd_virtual_t *pv=find_ptpfd_virtual(ptpfd);
 	if(!pv) return -1;
-	if(!pv->rdwr_mode) return -1;
-	pv->freq_adj=adjppb;
+	if(!pv->st.rdwr_mode) return -1;
+	// apply the old rate up to now, or up to the latest read
+	rts64=vclock_now();
+	if(rts64<pv->lastts) rts64=pv->lastts;
+	gptp_vclock_state_adjust(&pv->st, rts64, adjppb);
+	vclock_publish(pv);
 	return 0;
 }
@@ -23,8 +23,140 @@
 
 #include "ll_gptpsupport.h"
 
+/**
+ * @brief oscillator model of a virtual clock.
+ * The initial values come from CONF_PTPVFD_* config items.
+ */
+typedef struct gptp_vclock_model {
+	int64_t init_offset; //!< nsec, the phase at the first read
+	int freq_ppb; //!< constant frequency error
+	int random_walk_ppb; //!< frequency random walk, ppb per sqrt(sec)
+	int step_ppb; //!< frequency step like a temperature change, up or down at random
+	uint64_t step_interval; //!< nsec, the interval of the frequency steps
+	int aging_pph; //!< linear frequency drift like aging, ppb per hour
+	int quantization; //!< nsec, resolution of the read value
+	int ts_noise; //!< nsec, standard deviation of noise on the read value
+	uint64_t seed; //!< seed of the pseudo random generator, the same seed gives the same result
+} gptp_vclock_model_t;
+
+/**
+ * @brief state of the oscillator of a virtual clock.
+ * The random walk, the steps and the aging are updated at every
+ * #GPTP_VCLOCK_TICK from the start, and the clock runs linearly from the anchor
+ * in between. The noise on a read value comes from the seed and the real time
+ * of the read. So the clock value is a function of the
+ * real time and this state, and any process which has the same state reads
+ * the same value regardless of how often it reads.
+ */
+typedef struct gptp_vclock_state {
+	gptp_vclock_model_t model;
+	uint64_t rnd; //!< state of the pseudo random generator
+	uint64_t startts; //!< real time of the start, the base of the aging, 0:not started
+	uint64_t ats; //!< real time of the anchor
+	uint64_t apts; //!< clock value at the anchor
+	double afrac; //!< fraction of nsec at the anchor
+	double ppb; //!< frequency error from the anchor
+	double rw_ppb; //!< accumulated random walk
+	double step_ppb; //!< accumulated frequency steps
+	uint64_t next_tick;
+	uint64_t next_step;
+	int freq_adj; //!< adjustment by adjtime
+	bool rdwr_mode; //!< freq_adj is applied only in the read-write mode
+} gptp_vclock_state_t;
+
+#define GPTP_VCLOCK_TICK (100*UB_MSEC_NS)
+
+/**
+ * @brief gptp2d puts the state in the shared memory '<master clock shm>_<ptpdev>',
+ * and the applications read the virtual clock from it.
+ */
+typedef struct gptp_vclock_shm {
+	uint32_t version; //!< #GPTP_VCLOCK_SHM_VERSION when 'st' is valid
+	uint32_t seq; //!< sequence counter of 'st', odd while updating
+	gptp_vclock_state_t st;
+} gptp_vclock_shm_t;
+
+#define GPTP_VCLOCK_SHM_VERSION 0x47560001
+
+void gptp_vclock_state_init(gptp_vclock_state_t *vs, const gptp_vclock_model_t *model);
+
+/**
+ * @brief start the clock from 'init_offset' at 'rts64'.
+ */
+void gptp_vclock_state_start(gptp_vclock_state_t *vs, uint64_t rts64);
+
+/**
+ * @brief run the ticks up to 'rts64'.
+ * @return true when the state is changed
+ */
+bool gptp_vclock_state_advance(gptp_vclock_state_t *vs, uint64_t rts64);
+
+/**
+ * @brief change the frequency adjustment at 'rts64'.
+ */
+void gptp_vclock_state_adjust(gptp_vclock_state_t *vs, uint64_t rts64, int adjppb);
+
+/**
+ * @brief the clock value at 'rts64' with the quantization and the noise.
+ * the state must be advanced to 'rts64'.
+ */
+uint64_t gptp_vclock_state_read(const gptp_vclock_state_t *vs, uint64_t rts64);
+
+/**
+ * @brief open the shared memory of the virtual clock 'ptpdev' which belongs to
+ * the master clock shared memory 'mcshm'.
+ * @param flag	O_CREAT|O_RDWR in gptp2d, O_RDWR in the applications
+ */
+gptp_vclock_shm_t *gptp_vclock_shm_open(const char *mcshm, const char *ptpdev,
+					int flag, int *shmfd);
+
+void gptp_vclock_shm_close(gptp_vclock_shm_t *vshm, int *shmfd, const char *mcshm,
+			   const char *ptpdev, bool unlink);
+
+void gptp_vclock_shm_store(gptp_vclock_shm_t *vshm, const gptp_vclock_state_t *vs);
+
+/**
+ * @brief copy the state out of the shared memory.
+ * @return 0 on success, -1 when the state is not valid or it is being updated
+ * for too long.
+ */
+int gptp_vclock_shm_load(gptp_vclock_shm_t *vshm, gptp_vclock_state_t *vs);
+
+/**
+ * @brief the clock value at 'rts64', the same value as gptp2d reads.
+ * @return 0 on success, -1 on error
+ */
+int gptp_vclock_shm_gettime(gptp_vclock_shm_t *vshm, uint64_t rts64, uint64_t *ts64);
+
 PTPFD_TYPE gptp_vclock_alloc_fd(char *ptpdev);
 
+/**
+ * @brief let the applications read this virtual clock through
+ * the shared memory '<mcshm>_<ptpdev>'. It can be called for multiple domains,
+ * and each call needs gptp_vclock_unshare.
+ * @param inherit	take over the state which the previous gptp2d left
+ */
+int gptp_vclock_share(PTPFD_TYPE ptpfd, const char *mcshm, bool inherit);
+
+/**
+ * @brief stop sharing, the shared memory is left for the next gptp2d when
+ * 'unlink' is false.
+ */
+int gptp_vclock_unshare(PTPFD_TYPE ptpfd, bool unlink);
+
+/**
+ * @brief replace the oscillator model, the clock restarts from 'init_offset'
+ * at the next read, or right now when it is shared.
+ */
+int gptp_vclock_set_model(PTPFD_TYPE ptpfd, const gptp_vclock_model_t *model);
+
+/**
+ * @brief the clock value at the real time 'rts64'.
+ * gptp_vclock_gettime uses the current ub_rt_gettime64().
+ * 'rts64' must not go backward.
+ */
+uint64_t gptp_vclock_gettime_at(PTPFD_TYPE ptpfd, uint64_t rts64);
+
 int gptp_vclock_free_fd(PTPFD_TYPE ptpfd);
 
 uint64_t gptp_vclock_gettime(PTPFD_TYPE ptpfd);
@@ -33,4 +165,13 @@ int gptp_vclock_settime(PTPFD_TYPE ptpfd, uint64_t ts64);
 
 int gptp_vclock_adjtime(PTPFD_TYPE ptpfd, int adjppb);
 
+/**
+ * @brief run the virtual clocks in a simulated time, for a replay faster than the real time.
+ * gptp_vclock_gettime, gptp_vclock_settime and gptp_vclock_adjtime use 'rts64'
+ * as the current real time. 'rts64' must not go backward, 0 goes back to the real time.
+ * The applications read the shared clocks in the real time, don't share them
+ * in a simulated time.
+ */
+void gptp_vclock_set_simtime(uint64_t rts64);
+
 #endif //__GPTPCLOCK_VIRTUAL_H_
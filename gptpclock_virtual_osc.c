@@ -0,0 +1,218 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * the oscillator of the virtual clocks, it is used by gptp2d and by
+ * the applications through libx4gptp2. It doesn't depend on the config.
+ */
+#include <math.h>
+#include <fcntl.h>
+#include "gptpclock_virtual.h"
+#include "gptpclock.h"
+
+#define VCLOCK_SHM_NAME_MAX 64
+
+// xorshift64*, deterministic for the seed
+static uint64_t vclock_rand(uint64_t *rnd)
+{
+	*rnd ^= *rnd >> 12;
+	*rnd ^= *rnd << 25;
+	*rnd ^= *rnd >> 27;
+	return *rnd * 2685821657736338717ULL;
+}
+
+// normal distribution with sigma=1.0, by Box-Muller
+static double vclock_gauss(uint64_t *rnd)
+{
+	double u1, u2;
+	u1=((vclock_rand(rnd)>>11)+1.0)/9007199254740993.0;
+	u2=(vclock_rand(rnd)>>11)/9007199254740992.0;
+	return sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+}
+
+// splitmix64, to make a seed from the time of a read
+static uint64_t vclock_mix(uint64_t x)
+{
+	x+=0x9e3779b97f4a7c15ULL;
+	x=(x^(x>>30))*0xbf58476d1ce4e5b9ULL;
+	x=(x^(x>>27))*0x94d049bb133111ebULL;
+	return x^(x>>31);
+}
+
+// the frequency error in the current tick, with the aging at the middle of the tick
+static double vclock_rate(const gptp_vclock_state_t *vs)
+{
+	double ppb, mid;
+	ppb=vs->model.freq_ppb+vs->rw_ppb+vs->step_ppb;
+	if(vs->model.aging_pph){
+		mid=(double)(vs->next_tick-vs->startts)-GPTP_VCLOCK_TICK/2.0;
+		ppb+=vs->model.aging_pph*mid/(3600.0*UB_SEC_NS);
+	}
+	if(vs->rdwr_mode) ppb+=vs->freq_adj;
+	return ppb;
+}
+
+// the clock value at 'rts64' from the anchor, 'frac' gets the fraction of nsec
+static uint64_t vclock_phase(const gptp_vclock_state_t *vs, uint64_t rts64, double *frac)
+{
+	int64_t dts64;
+	double dpts;
+	dts64=rts64-vs->ats;
+	dpts=(double)dts64*vs->ppb/UB_SEC_NS+vs->afrac;
+	*frac=dpts-floor(dpts);
+	return vs->apts+dts64+(int64_t)floor(dpts);
+}
+
+void gptp_vclock_state_init(gptp_vclock_state_t *vs, const gptp_vclock_model_t *model)
+{
+	bool rdwr_mode=vs->rdwr_mode;
+	int freq_adj=vs->freq_adj;
+	// freq_adj and rdwr_mode belong to the device, not to the model
+	memset(vs, 0, sizeof(gptp_vclock_state_t));
+	vs->model=*model;
+	// 0 is not allowed as the seed of xorshift
+	vs->rnd=model->seed?model->seed:0x9e3779b97f4a7c15ULL;
+	vs->rdwr_mode=rdwr_mode;
+	vs->freq_adj=freq_adj;
+}
+
+void gptp_vclock_state_start(gptp_vclock_state_t *vs, uint64_t rts64)
+{
+	vs->startts=rts64;
+	vs->ats=rts64;
+	vs->apts=rts64+vs->model.init_offset;
+	vs->afrac=0.0;
+	vs->next_tick=rts64+GPTP_VCLOCK_TICK;
+	vs->next_step=rts64+vs->model.step_interval;
+	vs->ppb=vclock_rate(vs);
+}
+
+// move the anchor to 'rts64', before changing the frequency
+static void vclock_anchor(gptp_vclock_state_t *vs, uint64_t rts64)
+{
+	double frac;
+	vs->apts=vclock_phase(vs, rts64, &frac);
+	vs->afrac=frac;
+	vs->ats=rts64;
+}
+
+bool gptp_vclock_state_advance(gptp_vclock_state_t *vs, uint64_t rts64)
+{
+	bool changed=false;
+	while(rts64>=vs->next_tick){
+		vclock_anchor(vs, vs->next_tick);
+		if(vs->model.random_walk_ppb)
+			vs->rw_ppb+=vs->model.random_walk_ppb*vclock_gauss(&vs->rnd)*
+				sqrt((double)GPTP_VCLOCK_TICK/UB_SEC_NS);
+		if(vs->model.step_ppb && vs->model.step_interval){
+			// a step like a temperature change, up or down at random
+			while(vs->next_tick>=vs->next_step){
+				vs->step_ppb+=(vclock_rand(&vs->rnd)&1)?
+					vs->model.step_ppb:-vs->model.step_ppb;
+				vs->next_step+=vs->model.step_interval;
+			}
+		}
+		vs->next_tick+=GPTP_VCLOCK_TICK;
+		vs->ppb=vclock_rate(vs);
+		changed=true;
+	}
+	return changed;
+}
+
+void gptp_vclock_state_adjust(gptp_vclock_state_t *vs, uint64_t rts64, int adjppb)
+{
+	vs->freq_adj=adjppb;
+	if(!vs->startts) return;
+	gptp_vclock_state_advance(vs, rts64);
+	vclock_anchor(vs, rts64);
+	vs->ppb=vclock_rate(vs);
+}
+
+uint64_t gptp_vclock_state_read(const gptp_vclock_state_t *vs, uint64_t rts64)
+{
+	uint64_t ts64, rnd;
+	double frac;
+	ts64=vclock_phase(vs, rts64, &frac);
+	// quantization and noise are on the read value, the oscillator is not affected
+	if(vs->model.quantization>1) ts64-=ts64%vs->model.quantization;
+	if(vs->model.ts_noise){
+		// a read at the same time gets the same noise in any process
+		rnd=vclock_mix(vs->model.seed^vclock_mix(rts64-vs->startts))|1;
+		ts64+=(int64_t)(vs->model.ts_noise*vclock_gauss(&rnd));
+	}
+	return ts64;
+}
+
+gptp_vclock_shm_t *gptp_vclock_shm_open(const char *mcshm, const char *ptpdev,
+					int flag, int *shmfd)
+{
+	char name[VCLOCK_SHM_NAME_MAX];
+	snprintf(name, sizeof(name), "%s_%s", mcshm, ptpdev);
+	return (gptp_vclock_shm_t *)cb_get_shared_mem(shmfd, name, sizeof(gptp_vclock_shm_t),
+						      flag);
+}
+
+void gptp_vclock_shm_close(gptp_vclock_shm_t *vshm, int *shmfd, const char *mcshm,
+			   const char *ptpdev, bool unlink)
+{
+	char name[VCLOCK_SHM_NAME_MAX];
+	snprintf(name, sizeof(name), "%s_%s", mcshm, ptpdev);
+	if(unlink) __atomic_store_n(&vshm->version, 0, __ATOMIC_RELEASE);
+	cb_close_shared_mem(vshm, shmfd, name, sizeof(gptp_vclock_shm_t), unlink);
+}
+
+/* only gptp2d writes, the same seqlock as the master clock parameters */
+void gptp_vclock_shm_store(gptp_vclock_shm_t *vshm, const gptp_vclock_state_t *vs)
+{
+	__atomic_store_n(&vshm->seq, vshm->seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	vshm->st=*vs;
+	__atomic_store_n(&vshm->seq, vshm->seq+1, __ATOMIC_RELEASE);
+	if(vshm->version!=GPTP_VCLOCK_SHM_VERSION)
+		__atomic_store_n(&vshm->version, GPTP_VCLOCK_SHM_VERSION, __ATOMIC_RELEASE);
+}
+
+int gptp_vclock_shm_load(gptp_vclock_shm_t *vshm, gptp_vclock_state_t *vs)
+{
+	uint32_t seq;
+	int i;
+	if(__atomic_load_n(&vshm->version, __ATOMIC_ACQUIRE)!=GPTP_VCLOCK_SHM_VERSION)
+		return -1;
+	for(i=0;i<GPTP_MASTER_CLOCK_SEQ_RETRY;i++){
+		gptpclock_seq_read_backoff(i);
+		seq=__atomic_load_n(&vshm->seq, __ATOMIC_ACQUIRE);
+		*vs=vshm->st;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(!(seq & 1) && __atomic_load_n(&vshm->seq, __ATOMIC_RELAXED)==seq)
+			return vs->startts?0:-1;
+	}
+	UB_LOG(UBL_WARN, "%s:the process is very slow, or gptp2d may crash\n", __func__);
+	return -1;
+}
+
+int gptp_vclock_shm_gettime(gptp_vclock_shm_t *vshm, uint64_t rts64, uint64_t *ts64)
+{
+	gptp_vclock_state_t vs;
+	if(gptp_vclock_shm_load(vshm, &vs)) return -1;
+	// run the ticks which gptp2d has not yet run, in the same way as gptp2d does
+	gptp_vclock_state_advance(&vs, rts64);
+	*ts64=gptp_vclock_state_read(&vs, rts64);
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <xl4unibase/unibase_binding.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "gptpclock.h"
+#include "gptpclock_virtual.h"
+
+#define TEST_RTS_BASE (1600000000LL*UB_SEC_NS)
+#define TEST_SHARED_MEM "/gptp_vc_test"
+#define TEST_SHARED_READS 40
+#define TEST_SHARED_STEP (333*UB_MSEC_NS)
+
+static void test_direct_lookup(void **state)
+{
+	int i;
+	char ptpdev[16];
+	PTPFD_TYPE fd;
+	for(i=0;i<GPTP_VIRTUAL_PTPDEV_FDMAX-GPTP_VIRTUAL_PTPDEV_FDBASE+1;i++){
+		snprintf(ptpdev, sizeof(ptpdev), CB_VIRTUAL_PTPDEV_PREFIX"w%d", i);
+		fd=gptp_vclock_alloc_fd(ptpdev);
+		assert_int_equal(fd, GPTP_VIRTUAL_PTPDEV_FDBASE+i);
+	}
+	// no more room
+	assert_int_equal(gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"wx"), PTPFD_INVALID);
+	// the same name gets the same fd
+	assert_int_equal(gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w5"),
+			 GPTP_VIRTUAL_PTPDEV_FDBASE+5);
+	assert_int_equal(gptp_vclock_free_fd(GPTP_VIRTUAL_PTPDEV_FDBASE+5), 0);
+	assert_int_equal(gptp_vclock_adjtime(GPTP_VIRTUAL_PTPDEV_FDBASE+5, 100), 0);
+	assert_int_equal(gptp_vclock_free_fd(GPTP_VIRTUAL_PTPDEV_FDBASE+5), 0);
+	assert_int_equal(gptp_vclock_adjtime(GPTP_VIRTUAL_PTPDEV_FDBASE+5, 100), -1);
+	// the freed fd is reused
+	assert_int_equal(gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"wx"),
+			 GPTP_VIRTUAL_PTPDEV_FDBASE+5);
+	for(i=0;i<GPTP_VIRTUAL_PTPDEV_FDMAX-GPTP_VIRTUAL_PTPDEV_FDBASE+1;i++)
+		assert_int_equal(gptp_vclock_free_fd(GPTP_VIRTUAL_PTPDEV_FDBASE+i), 0);
+	assert_int_equal(gptp_vclock_free_fd(GPTP_VIRTUAL_PTPDEV_FDBASE), -1);
+}
+
+static void test_offset_and_freq(void **state)
+{
+	PTPFD_TYPE fd;
+	gptp_vclock_model_t model;
+	uint64_t ts, base;
+	memset(&model, 0, sizeof(model));
+	model.init_offset=5000;
+	model.freq_ppb=1000;
+	// adjtime applies the old rate up to the current time, base must be later than that
+	base=ub_rt_gettime64()+UB_SEC_NS;
+	fd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w0");
+	assert_int_equal(gptp_vclock_set_model(fd, &model), 0);
+	assert_true(gptp_vclock_gettime_at(fd, base)==base+5000);
+	ts=gptp_vclock_gettime_at(fd, base+10*UB_SEC_NS);
+	assert_true(ts==base+10*UB_SEC_NS+5000+10000);
+	// adjustment is added on the frequency error, read in small steps
+	gptp_vclock_adjtime(fd, -3000);
+	ts=gptp_vclock_gettime_at(fd, base+10*UB_SEC_NS);
+	for(ts=0;ts<1000;ts++)
+		gptp_vclock_gettime_at(fd, base+10*UB_SEC_NS+ts*UB_MSEC_NS);
+	ts=gptp_vclock_gettime_at(fd, base+11*UB_SEC_NS);
+	assert_true(ts==base+11*UB_SEC_NS+5000+10000-2000);
+	gptp_vclock_free_fd(fd);
+}
+
+static void read_sequence(PTPFD_TYPE fd, gptp_vclock_model_t *model, uint64_t *res, int num)
+{
+	int i;
+	gptp_vclock_set_model(fd, model);
+	for(i=0;i<num;i++)
+		res[i]=gptp_vclock_gettime_at(fd, TEST_RTS_BASE+i*125*UB_MSEC_NS);
+}
+
+static void test_deterministic(void **state)
+{
+	PTPFD_TYPE fd1, fd2;
+	gptp_vclock_model_t model;
+	uint64_t res1[100], res2[100];
+	int i;
+	memset(&model, 0, sizeof(model));
+	model.random_walk_ppb=50;
+	model.step_ppb=200;
+	model.step_interval=UB_SEC_NS;
+	model.ts_noise=20;
+	model.seed=12345;
+	fd1=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w0");
+	fd2=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w1");
+	read_sequence(fd1, &model, res1, 100);
+	read_sequence(fd2, &model, res2, 100);
+	assert_memory_equal(res1, res2, sizeof(res1));
+	// the same clock with the same seed, the same result again
+	read_sequence(fd1, &model, res2, 100);
+	assert_memory_equal(res1, res2, sizeof(res1));
+	model.seed=12346;
+	read_sequence(fd2, &model, res2, 100);
+	assert_memory_not_equal(res1, res2, sizeof(res1));
+	// it is wandering, but it doesn't go too far in 12.5 sec
+	for(i=1;i<100;i++)
+		assert_true(llabs((int64_t)(res1[i]-TEST_RTS_BASE-i*125*UB_MSEC_NS)) <
+			    100*UB_USEC_NS);
+	gptp_vclock_free_fd(fd1);
+	gptp_vclock_free_fd(fd2);
+}
+
+static void test_quantization(void **state)
+{
+	PTPFD_TYPE fd;
+	gptp_vclock_model_t model;
+	uint64_t ts;
+	int i;
+	memset(&model, 0, sizeof(model));
+	model.freq_ppb=12345;
+	model.quantization=8;
+	fd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w0");
+	gptp_vclock_set_model(fd, &model);
+	for(i=0;i<1000;i++){
+		ts=gptp_vclock_gettime_at(fd, TEST_RTS_BASE+i*1234567);
+		assert_true(ts%8==0);
+	}
+	gptp_vclock_free_fd(fd);
+}
+
+/* an application process reads the clock from the shared memory */
+static void shared_reads(uint64_t base, uint64_t *res)
+{
+	gptp_vclock_shm_t *vshm;
+	int i, shmfd, pfd[2];
+	pid_t pid;
+	assert_int_equal(pipe(pfd), 0);
+	pid=fork();
+	assert_true(pid>=0);
+	if(!pid){
+		vshm=gptp_vclock_shm_open(TEST_SHARED_MEM, CB_VIRTUAL_PTPDEV_PREFIX"w0",
+					  O_RDWR, &shmfd);
+		for(i=0;i<TEST_SHARED_READS;i++){
+			if(!vshm || gptp_vclock_shm_gettime(vshm, base+i*TEST_SHARED_STEP,
+							    &res[i])) res[i]=0;
+		}
+		_exit(write(pfd[1], res, TEST_SHARED_READS*sizeof(uint64_t))<0);
+	}
+	assert_int_equal(read(pfd[0], res, TEST_SHARED_READS*sizeof(uint64_t)),
+			 TEST_SHARED_READS*sizeof(uint64_t));
+	waitpid(pid, NULL, 0);
+	close(pfd[0]);
+	close(pfd[1]);
+}
+
+/* gptp2d reads in its own steps, and the values are the same as the application's */
+static void owner_reads(PTPFD_TYPE fd, uint64_t base, uint64_t *res)
+{
+	int i;
+	for(i=0;i<TEST_SHARED_READS;i++){
+		res[i]=gptp_vclock_gettime_at(fd, base+i*TEST_SHARED_STEP);
+		gptp_vclock_gettime_at(fd, base+i*TEST_SHARED_STEP+TEST_SHARED_STEP/3);
+	}
+}
+
+static void test_shared(void **state)
+{
+	PTPFD_TYPE fd;
+	gptp_vclock_model_t model;
+	uint64_t base, res1[TEST_SHARED_READS], res2[TEST_SHARED_READS];
+	memset(&model, 0, sizeof(model));
+	model.init_offset=1000000;
+	model.freq_ppb=-5000;
+	model.random_walk_ppb=50;
+	model.step_ppb=200;
+	model.step_interval=UB_SEC_NS;
+	model.aging_pph=3600;
+	model.ts_noise=20;
+	model.seed=777;
+	fd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w0");
+	assert_int_equal(gptp_vclock_share(fd, TEST_SHARED_MEM, false), 0);
+	assert_int_equal(gptp_vclock_set_model(fd, &model), 0);
+	assert_int_equal(gptp_vclock_adjtime(fd, 3000), 0);
+	// the application reads ahead of gptp2d
+	base=ub_rt_gettime64();
+	shared_reads(base, res2);
+	owner_reads(fd, base, res1);
+	assert_memory_equal(res1, res2, sizeof(res1));
+	// an adjustment after the reads
+	assert_int_equal(gptp_vclock_adjtime(fd, -2000), 0);
+	base+=TEST_SHARED_READS*TEST_SHARED_STEP;
+	shared_reads(base, res2);
+	owner_reads(fd, base, res1);
+	assert_memory_equal(res1, res2, sizeof(res1));
+	assert_int_equal(gptp_vclock_unshare(fd, true), 0);
+	gptp_vclock_free_fd(fd);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:46", "UBL_GPTP");
+	unibase_init(&init_para);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unibase_close();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_direct_lookup),
+		cmocka_unit_test(test_offset_and_freq),
+		cmocka_unit_test(test_deterministic),
+		cmocka_unit_test(test_quantization),
+		cmocka_unit_test(test_shared),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
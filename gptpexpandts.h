@@ -0,0 +1,87 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef __GPTPEXPANDTS_H_
+#define __GPTPEXPANDTS_H_
+
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/*
+ * Expansion of 32-bit nsec timestamps, like AVTP presentation time,
+ * to 64-bit time aligned to 'ts64'.
+ * The result is in the range of ts64-2^31 to ts64+2^31-1, about +-2.147 seconds,
+ * and it wraps around with the lower 32 bits of 'ts64'.
+ */
+
+/* the reference, one timestamp */
+static inline uint64_t gptp_expand_ts32(uint32_t ts32, int64_t ts64)
+{
+	// the difference becomes a range of -2.147 to 2.147 seconds
+	return ts64+(int32_t)(ts32-(uint32_t)ts64);
+}
+
+/* the reference, one by one */
+static inline void gptp_expand_ts32_scalar(const uint32_t *ts32, uint64_t *res,
+					   int num, int64_t ts64)
+{
+	int i;
+	for(i=0;i<num;i++) res[i]=gptp_expand_ts32(ts32[i], ts64);
+}
+
+/* 4 timestamps in each step by SSE2 or NEON, and the rest by the reference.
+   the result must be the same as gptp_expand_ts32_scalar */
+static inline void gptp_expand_ts32_batch(const uint32_t *ts32, uint64_t *res,
+					  int num, int64_t ts64)
+{
+	int i=0;
+#if defined(__SSE2__)
+	__m128i c32=_mm_set1_epi32((uint32_t)ts64);
+	__m128i c64=_mm_set1_epi64x(ts64);
+	__m128i d, s;
+	for(;i+4<=num;i+=4){
+		d=_mm_sub_epi32(_mm_loadu_si128((const __m128i *)&ts32[i]), c32);
+		// sign extension to 64 bits, SSE2 doesn't have _mm_cvtepi32_epi64
+		s=_mm_srai_epi32(d, 31);
+		_mm_storeu_si128((__m128i *)&res[i],
+				 _mm_add_epi64(c64, _mm_unpacklo_epi32(d, s)));
+		_mm_storeu_si128((__m128i *)&res[i+2],
+				 _mm_add_epi64(c64, _mm_unpackhi_epi32(d, s)));
+	}
+#elif defined(__ARM_NEON)
+	uint32x4_t c32=vdupq_n_u32((uint32_t)ts64);
+	int64x2_t c64=vdupq_n_s64(ts64);
+	int32x4_t d;
+	for(;i+4<=num;i+=4){
+		d=vreinterpretq_s32_u32(vsubq_u32(vld1q_u32(&ts32[i]), c32));
+		vst1q_u64(&res[i], vreinterpretq_u64_s64(
+				  vaddq_s64(c64, vmovl_s32(vget_low_s32(d)))));
+		vst1q_u64(&res[i+2], vreinterpretq_u64_s64(
+				  vaddq_s64(c64, vmovl_s32(vget_high_s32(d)))));
+	}
+#endif
+	gptp_expand_ts32_scalar(&ts32[i], &res[i], num-i, ts64);
+}
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <xl4unibase/unibase_binding.h>
+#include "gptpexpandts.h"
+
+#define NUM_RANDOM_TESTS 10000
+#define MAX_BATCH 67 // not a multiple of 4, to have the rest
+#define NUM_BENCH_TIMESTAMPS 1024
+#define NUM_BENCH_LOOPS 10000
+
+static uint32_t rand_seed=1;
+static uint32_t test_rand(void)
+{
+	// simple LCG, to have the same sequence on every platform
+	rand_seed=rand_seed*1103515245u+12345u;
+	return rand_seed;
+}
+
+/* expand 'num' timestamps by both, and compare them */
+static void check_batch(const uint32_t *ts32, int num, int64_t ts64)
+{
+	uint64_t sres[MAX_BATCH], bres[MAX_BATCH];
+	int64_t d;
+	int i;
+	memset(bres, 0, sizeof(bres));
+	gptp_expand_ts32_scalar(ts32, sres, num, ts64);
+	gptp_expand_ts32_batch(ts32, bres, num, ts64);
+	for(i=0;i<num;i++){
+		if(sres[i]!=bres[i]){
+			printf("ts32=0x%08x, ts64=%"PRIi64": %"PRIu64" != %"PRIu64"\n",
+			       ts32[i], ts64, sres[i], bres[i]);
+		}
+		assert_true(sres[i]==bres[i]);
+		// the lower 32 bits are kept, and the result is within +-2^31
+		assert_true((uint32_t)sres[i]==ts32[i]);
+		d=(int64_t)sres[i]-ts64;
+		assert_true(d>=-((int64_t)1<<31) && d<((int64_t)1<<31));
+	}
+	// nothing is written beyond 'num'
+	for(;i<MAX_BATCH;i++) assert_true(bres[i]==0);
+}
+
+static void test_wrap_edges(void **state)
+{
+	// snapshot times around the 32-bit wrap, and a large value
+	int64_t snaps[]={0, 1, 0x7fffffffLL, 0x80000000LL, 0xffffffffLL, 0x100000000LL,
+			 0x17fffffffLL, 0x180000000LL, 0x1ffffffffLL,
+			 1700000000LL*UB_SEC_NS, 1700000000LL*UB_SEC_NS+0x7fffffffLL};
+	// timestamps relative to the lower 32 bits of the snapshot
+	uint32_t rels[]={0, 1, 0xffffffffu, 0x7ffffffeu, 0x7fffffffu, 0x80000000u,
+			 0x80000001u, 1000, (uint32_t)-1000};
+	uint32_t ts32[MAX_BATCH];
+	int i, j, n;
+
+	for(i=0;i<(int)(sizeof(snaps)/sizeof(snaps[0]));i++){
+		n=0;
+		for(j=0;j<(int)(sizeof(rels)/sizeof(rels[0]));j++)
+			ts32[n++]=(uint32_t)snaps[i]+rels[j];
+		// absolute edges
+		ts32[n++]=0;
+		ts32[n++]=0xffffffffu;
+		ts32[n++]=0x80000000u;
+		ts32[n++]=0x7fffffffu;
+		check_batch(ts32, n, snaps[i]);
+	}
+
+	// the half way is expanded backward
+	assert_true(gptp_expand_ts32(0x80000000u, 0)==(uint64_t)-((int64_t)1<<31));
+	assert_true(gptp_expand_ts32(0x7fffffffu, 0)==0x7fffffffu);
+	assert_true(gptp_expand_ts32(0, 0xffffffffLL)==0x100000000LL);
+	assert_true(gptp_expand_ts32(0xffffffffu, 0x100000000LL)==0xffffffffLL);
+}
+
+static void test_random(void **state)
+{
+	uint32_t ts32[MAX_BATCH];
+	int64_t ts64;
+	int i, j, n;
+	for(i=0;i<NUM_RANDOM_TESTS;i++){
+		ts64=(((int64_t)test_rand()<<30)^test_rand()) & INT64_MAX>>2;
+		n=test_rand()%(MAX_BATCH+1);
+		for(j=0;j<n;j++){
+			// near the snapshot in the most cases
+			if(test_rand()&1)
+				ts32[j]=(uint32_t)ts64+(int32_t)(test_rand()>>8)-(1<<23);
+			else
+				ts32[j]=test_rand();
+		}
+		check_batch(ts32, n, ts64);
+	}
+}
+
+/* nsec per timestamp, only for the information */
+static void test_benchmark(void **state)
+{
+	static uint32_t ts32[NUM_BENCH_TIMESTAMPS];
+	static uint64_t res[NUM_BENCH_TIMESTAMPS];
+	uint64_t sum=0;
+	int64_t ts1, dns[2];
+	int i, n;
+	for(i=0;i<NUM_BENCH_TIMESTAMPS;i++) ts32[i]=test_rand();
+	for(n=0;n<2;n++){
+		ts1=ub_mt_gettime64();
+		for(i=0;i<NUM_BENCH_LOOPS;i++){
+			if(n==0)
+				gptp_expand_ts32_scalar(ts32, res, NUM_BENCH_TIMESTAMPS, ts1+i);
+			else
+				gptp_expand_ts32_batch(ts32, res, NUM_BENCH_TIMESTAMPS, ts1+i);
+			sum+=res[i&(NUM_BENCH_TIMESTAMPS-1)]; // not to be optimized out
+		}
+		dns[n]=ub_mt_gettime64()-ts1;
+	}
+	printf("scalar: %.2f nsec/timestamp, batch: %.2f nsec/timestamp\n",
+	       (double)dns[0]/NUM_BENCH_LOOPS/NUM_BENCH_TIMESTAMPS,
+	       (double)dns[1]/NUM_BENCH_LOOPS/NUM_BENCH_TIMESTAMPS);
+	UB_LOG(UBL_DEBUG, "%s:sum=%"PRIu64"\n", __func__, sum);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:46", "UBL_GPTP");
+	unibase_init(&init_para);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unibase_close();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_wrap_edges),
+		cmocka_unit_test(test_random),
+		cmocka_unit_test(test_benchmark),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,192 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#ifndef __GPTPFIXEDPOINT_H_
+#define __GPTPFIXEDPOINT_H_
+
+#include <stdint.h>
+
+/*
+ * Fixed-point rate ratio.
+ * A rate ratio 'r' is kept as (r-1.0) in units of 2^-41, which is the scale of
+ * cumulativeScaledRateOffset in the Follow_Up information TLV(11.4.4.3).
+ * 1ppb is about 2199 in this unit, and the range is far wider than the TLV field.
+ * Every per-message computation on the Sync/Pdelay path uses this type,
+ * so that no floating-point arithmetic is needed there.
+ * Only additions, shifts and 32x32 bit multiplications are used to apply a rate,
+ * 64-bit divisions happen only when a new ratio is computed from two time deltas.
+ */
+typedef int64_t ScaledRateRatio;
+
+#define RATE_RATIO_SHIFT 41
+#define RATE_RATIO_ONE 0 // rate ratio 1.0
+// 10^9 = 2^9 * 1953125, used to convert between ppb and 2^-41 unit without overflow
+#define RATE_RATIO_PPB_DIV 1953125
+
+/* (a*b)>>shift with 128-bit intermediate result, rounded to the nearest.
+   'shift' must be 1 to 63. 32-bit CPUs don't have a native 128-bit type,
+   so it is composed of 4 of 32x32 multiplications there */
+static inline int64_t gptp_fp_mulshr(int64_t a, int64_t b, int shift)
+{
+#ifdef __SIZEOF_INT128__
+	__int128 v=(__int128)a*b;
+	// round the magnitude, the same as below
+	if(v<0) return -(int64_t)((-v+((__int128)1<<(shift-1)))>>shift);
+	return (int64_t)((v+((__int128)1<<(shift-1)))>>shift);
+#else
+	uint64_t ua, ub, ll, lh, hl, hh, mid, lo, hi, res;
+	int neg=(a<0)^(b<0);
+	ua=(a<0)?-(uint64_t)a:(uint64_t)a;
+	ub=(b<0)?-(uint64_t)b:(uint64_t)b;
+	if(!(ua>>32) && !(ub>>32)){
+		// most of the cases come here
+		lo=ua*ub;
+		hi=0;
+	}else{
+		ll=(ua&0xffffffffu)*(ub&0xffffffffu);
+		lh=(ua&0xffffffffu)*(ub>>32);
+		hl=(ua>>32)*(ub&0xffffffffu);
+		hh=(ua>>32)*(ub>>32);
+		mid=(ll>>32)+(lh&0xffffffffu)+(hl&0xffffffffu);
+		lo=(ll&0xffffffffu)|(mid<<32);
+		hi=hh+(lh>>32)+(hl>>32)+(mid>>32);
+	}
+	res=(lo>>shift)|(hi<<(64-shift));
+	if(lo & (1ULL<<(shift-1))) res++;
+	return neg?-(int64_t)res:(int64_t)res;
+#endif
+}
+
+/* ns*(r-1.0), the deviation caused by the rate */
+static inline int64_t gptp_rr_delta_ns(int64_t ns, ScaledRateRatio rr)
+{
+	return gptp_fp_mulshr(ns, rr, RATE_RATIO_SHIFT);
+}
+
+/* ns*r */
+static inline int64_t gptp_rr_mul_ns(int64_t ns, ScaledRateRatio rr)
+{
+	return ns+gptp_fp_mulshr(ns, rr, RATE_RATIO_SHIFT);
+}
+
+/* ns/r, computed as ns*(1 - e + e^2 - e^3), e=r-1.0
+   when |e|<2^-10, which covers the range of cumulativeScaledRateOffset,
+   the error is only by rounding of the 3 terms and within 2nsec */
+static inline int64_t gptp_rr_div_ns(int64_t ns, ScaledRateRatio rr)
+{
+	int64_t d1, d2;
+	d1=gptp_fp_mulshr(ns, rr, RATE_RATIO_SHIFT);
+	d2=gptp_fp_mulshr(d1, rr, RATE_RATIO_SHIFT);
+	return ns-d1+d2-gptp_fp_mulshr(d2, rr, RATE_RATIO_SHIFT);
+}
+
+/* ra*rb */
+static inline ScaledRateRatio gptp_rr_mul(ScaledRateRatio ra, ScaledRateRatio rb)
+{
+	// (1+a)*(1+b)-1 = a+b+a*b
+	return ra+rb+gptp_fp_mulshr(ra, rb, RATE_RATIO_SHIFT);
+}
+
+/* ra/rb */
+static inline ScaledRateRatio gptp_rr_div(ScaledRateRatio ra, ScaledRateRatio rb)
+{
+	// (1+a)/(1+b)-1 = (a-b)/(1+b)
+	return gptp_rr_div_ns(ra-rb, rb);
+}
+
+/* ratio of two time intervals, num/den */
+static inline ScaledRateRatio gptp_rr_from_delta(int64_t num, int64_t den)
+{
+	int64_t d, q, r;
+	int sh=RATE_RATIO_SHIFT;
+	if(den==0) return RATE_RATIO_ONE;
+	d=num-den;
+	// reduce the pre-shift for a big difference
+	while(sh>0 && (d>=((int64_t)1<<(62-sh)) || d<=-((int64_t)1<<(62-sh)))) sh--;
+	q=(d*((int64_t)1<<sh))/den;
+	if(sh==RATE_RATIO_SHIFT) return q;
+	// get the lower bits from the remainder
+	r=(d*((int64_t)1<<sh))%den;
+	sh=RATE_RATIO_SHIFT-sh;
+	q*=(int64_t)1<<sh;
+	if(r<((int64_t)1<<(62-sh)) && r>-((int64_t)1<<(62-sh)))
+		q+=(r*((int64_t)1<<sh))/den;
+	return q;
+}
+
+static inline ScaledRateRatio gptp_rr_from_ppb(int32_t ppb)
+{
+	int64_t v=(int64_t)ppb*((int64_t)1<<32);
+	// round to the nearest
+	v+=(v<0)?-(RATE_RATIO_PPB_DIV/2):(RATE_RATIO_PPB_DIV/2);
+	return v/RATE_RATIO_PPB_DIV;
+}
+
+static inline int32_t gptp_rr_to_ppb(ScaledRateRatio rr)
+{
+	return (int32_t)gptp_fp_mulshr(rr, RATE_RATIO_PPB_DIV, 32);
+}
+
+/*
+ * Scaled nsec, nsec in units of 2^-16 as correctionField(11.4.2.4) and ScaledNs.
+ * int64_t covers +/-2^47 nsec(39 hours), enough for corrections and delays.
+ * An absolute time doesn't fit, it is kept as nsec and a 16-bit sub-nsec part,
+ * which is the unsigned fraction below the nsec, the same as ScaledNs.
+ */
+#define SCALED_NS_SHIFT 16
+#define SCALED_NS_MASK 0xffff
+
+static inline int64_t gptp_sns_from_ns(int64_t ns, uint16_t subns)
+{
+	return ns*((int64_t)1<<SCALED_NS_SHIFT)+subns;
+}
+
+/* floor in nsec, the sub-nsec part is 'sns&SCALED_NS_MASK' */
+static inline int64_t gptp_sns_to_ns(int64_t sns)
+{
+	return (sns-(sns&SCALED_NS_MASK))/((int64_t)1<<SCALED_NS_SHIFT);
+}
+
+/* rounded to the nearest nsec */
+static inline int64_t gptp_sns_round_ns(int64_t sns)
+{
+	return gptp_sns_to_ns(sns+((int64_t)1<<(SCALED_NS_SHIFT-1)));
+}
+
+/* (ns + *subns/2^16) + sns, returns nsec and updates *subns */
+static inline int64_t gptp_sns_add(int64_t ns, uint16_t *subns, int64_t sns)
+{
+	sns+=*subns;
+	*subns=sns&SCALED_NS_MASK;
+	return ns+gptp_sns_to_ns(sns);
+}
+
+/* conversions with double, use them only outside of the per-message path */
+static inline double gptp_rr_to_double(ScaledRateRatio rr)
+{
+	return 1.0+(double)rr/(double)((int64_t)1<<RATE_RATIO_SHIFT);
+}
+
+static inline ScaledRateRatio gptp_rr_from_double(double r)
+{
+	return (ScaledRateRatio)((r-1.0)*(double)((int64_t)1<<RATE_RATIO_SHIFT));
+}
+
+#endif
@@ -0,0 +1,418 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <xl4unibase/unibase_binding.h>
+#include "gptpfixedpoint.h"
+
+#define NUM_RANDOM_TESTS 100000
+#define NUM_BENCH_MESSAGES 1000000
+
+static uint32_t rand_seed=1;
+static uint32_t test_rand(void)
+{
+	// simple LCG, to have the same sequence on every platform
+	rand_seed=rand_seed*1103515245u+12345u;
+	return rand_seed;
+}
+
+static int64_t rand_ns(int64_t range)
+{
+	int64_t v=(((int64_t)test_rand()<<31)^test_rand())%range;
+	return (test_rand()&1)?-v:v;
+}
+
+/* the double implementation which was used before ScaledRateRatio */
+static double d_rate_from_tlv(int32_t cumulativeScaledRateOffset)
+{
+	return 1.0+ldexp(cumulativeScaledRateOffset, -41);
+}
+
+static void test_mulshr(void **state)
+{
+	int i;
+	int64_t a, b, r;
+	double dr;
+	assert_int_equal(gptp_fp_mulshr(3, 1, 1), 2); // 1.5 is rounded to 2
+	assert_int_equal(gptp_fp_mulshr(-3, 1, 1), -2);
+	assert_int_equal(gptp_fp_mulshr((int64_t)1<<62, 4, 63), (int64_t)1<<1);
+	assert_int_equal(gptp_fp_mulshr(-((int64_t)1<<40), (int64_t)1<<40, 41),
+			 -((int64_t)1<<39));
+	for(i=0;i<NUM_RANDOM_TESTS;i++){
+		a=rand_ns((int64_t)1<<50);
+		b=rand_ns((int64_t)1<<40);
+		r=gptp_fp_mulshr(a, b, RATE_RATIO_SHIFT);
+		dr=ldexp((double)a*(double)b, -RATE_RATIO_SHIFT);
+		// double has 53 bits mantissa, the result is up to 2^49
+		assert_true(fabs((double)r-dr) <= 1.0+fabs(dr)*1.0E-15);
+	}
+}
+
+static void test_ppb_conversion(void **state)
+{
+	int32_t ppb;
+	for(ppb=-10000000;ppb<=10000000;ppb+=997){
+		assert_int_equal(gptp_rr_to_ppb(gptp_rr_from_ppb(ppb)), ppb);
+	}
+	assert_int_equal(gptp_rr_from_ppb(0), RATE_RATIO_ONE);
+	assert_int_equal(gptp_rr_to_ppb(gptp_rr_from_double(1.000001)), 1000);
+	assert_true(fabs(gptp_rr_to_double(gptp_rr_from_ppb(-250000))-0.99975) < 1.0E-12);
+}
+
+/* gptpclock_getts_od and gptpmasterclock_get_domain_ts64 apply adjrate on
+   the time passed from last_setts64 */
+static void test_apply_adjrate(void **state)
+{
+	int i;
+	int32_t ppb;
+	int64_t dts, fr, dr;
+	for(i=0;i<NUM_RANDOM_TESTS;i++){
+		ppb=(int32_t)(test_rand()%2000001)-1000000;
+		dts=rand_ns(4000LL*UB_SEC_NS);
+		fr=gptp_rr_delta_ns(dts, gptp_rr_from_ppb(ppb));
+		dr=((double)ppb/1.0E9)*(double)dts;
+		/* the double version truncates, the fixed point version rounds.
+		   and the resolution of ScaledRateRatio is 2^-41 */
+		assert_true(llabs(fr-dr) <= 1+(llabs(dts)>>RATE_RATIO_SHIFT));
+	}
+}
+
+/* computePdelayRateRatio and computeGmRateRatio get a ratio from 2 intervals */
+static void test_ratio_from_delta(void **state)
+{
+	int i;
+	int64_t num, den;
+	double dr, fr;
+	for(i=0;i<NUM_RANDOM_TESTS;i++){
+		den=UB_SEC_NS/8+(test_rand()%(8*UB_SEC_NS));
+		num=den+rand_ns(den/1000); // up to 1000ppm
+		dr=(double)num/(double)den;
+		fr=gptp_rr_to_double(gptp_rr_from_delta(num, den));
+		assert_true(fabs(fr-dr) <= ldexp(1.0, -RATE_RATIO_SHIFT));
+	}
+	// a big difference still gives the right value, with less resolution
+	fr=gptp_rr_to_double(gptp_rr_from_delta(3*UB_SEC_NS, UB_SEC_NS));
+	assert_true(fabs(fr-3.0) < 1.0E-9);
+	assert_int_equal(gptp_rr_from_delta(UB_SEC_NS, 0), RATE_RATIO_ONE);
+}
+
+static void test_div(void **state)
+{
+	int i;
+	int32_t tlvr, tlvn;
+	int64_t ns;
+	double r, rn;
+	for(i=0;i<NUM_RANDOM_TESTS;i++){
+		tlvr=(int32_t)test_rand();
+		tlvn=(int32_t)test_rand();
+		r=d_rate_from_tlv(tlvr);
+		rn=d_rate_from_tlv(tlvn);
+		ns=rand_ns(UB_SEC_NS);
+		assert_true(fabs((double)gptp_rr_div_ns(ns, tlvr)-(double)ns/r) <= 2.0);
+		assert_true(fabs(gptp_rr_to_double(gptp_rr_div(tlvr, tlvn))-r/rn) <= 1.0E-12);
+		assert_true(fabs(gptp_rr_to_double(gptp_rr_mul(tlvr, tlvn))-r*rn) <= 1.0E-12);
+	}
+}
+
+typedef struct test_sync_msg {
+	int32_t cumulativeScaledRateOffset;
+	uint64_t rts;
+	uint64_t sync_ts;
+	int64_t propDelay;
+	int64_t delayAsymmetry;
+	int64_t t41; // t4-t1 of pdelay
+} test_sync_msg_t;
+
+typedef struct test_sync_result {
+	int64_t upstreamTxTime;
+	int64_t correctionField;
+	int64_t syncReceiptLocalTime;
+	int64_t propTime;
+} test_sync_result_t;
+
+/* the per-message computations in md_sync_receive_sm, port_sync_sync_receive_sm,
+   md_sync_send_sm, clock_slave_sync_sm and md_pdelay_req_sm, double version.
+   The double version converted the absolute time 'rts' into double, which
+   has only 53 bits of mantissa. Here only the relative values are computed in double,
+   to make this usable as the reference */
+static void per_message_double(test_sync_msg_t *msg, double nrr, test_sync_result_t *res)
+{
+	double rr;
+	rr=d_rate_from_tlv(msg->cumulativeScaledRateOffset);
+	res->upstreamTxTime=msg->rts - (int64_t)(((double)msg->propDelay / nrr) +
+						 ((double)msg->delayAsymmetry / rr));
+	rr+=nrr-1.0;
+	res->correctionField=rr * ((int64_t)(msg->sync_ts-res->upstreamTxTime)<<16);
+	res->syncReceiptLocalTime=res->upstreamTxTime + (int64_t)(msg->propDelay / nrr +
+								  msg->delayAsymmetry / rr);
+	res->propTime=nrr*msg->t41;
+}
+
+/* the same with ScaledRateRatio */
+static void per_message_fixed(test_sync_msg_t *msg, ScaledRateRatio nrr,
+			      test_sync_result_t *res)
+{
+	ScaledRateRatio rr;
+	rr=msg->cumulativeScaledRateOffset;
+	res->upstreamTxTime=msg->rts - gptp_rr_div_ns(msg->propDelay, nrr) -
+		gptp_rr_div_ns(msg->delayAsymmetry, rr);
+	rr+=nrr;
+	res->correctionField=gptp_rr_mul_ns(
+		(int64_t)(msg->sync_ts-res->upstreamTxTime)<<16, rr);
+	res->syncReceiptLocalTime=res->upstreamTxTime + gptp_rr_div_ns(msg->propDelay, nrr) +
+		gptp_rr_div_ns(msg->delayAsymmetry, rr);
+	res->propTime=gptp_rr_mul_ns(msg->t41, nrr);
+}
+
+static void make_sync_msg(test_sync_msg_t *msg)
+{
+	msg->cumulativeScaledRateOffset=(int32_t)test_rand()/16; // up to +/-61ppm
+	msg->rts=1600000000LL*UB_SEC_NS+(test_rand()%UB_SEC_NS);
+	msg->sync_ts=msg->rts+(test_rand()%(10*UB_MSEC_NS)); // residence time <10msec
+	msg->propDelay=test_rand()%10000;
+	msg->delayAsymmetry=test_rand()%100;
+	msg->t41=msg->propDelay*2+(test_rand()%100000);
+}
+
+static void test_per_message_precision(void **state)
+{
+	int i;
+	test_sync_msg_t msg;
+	test_sync_result_t dres, fres;
+	double nrr;
+	for(i=0;i<NUM_RANDOM_TESTS;i++){
+		make_sync_msg(&msg);
+		nrr=1.0+(double)((int32_t)test_rand()/16)/1.0E15;
+		per_message_double(&msg, nrr, &dres);
+		per_message_fixed(&msg, gptp_rr_from_double(nrr), &fres);
+		assert_true(llabs(dres.upstreamTxTime-fres.upstreamTxTime) <= 2);
+		assert_true(llabs(dres.syncReceiptLocalTime-fres.syncReceiptLocalTime) <= 4);
+		assert_true(llabs(dres.propTime-fres.propTime) <= 1);
+		// correctionField is in 2^-16 nsec, follows the upstreamTxTime difference
+		assert_true(llabs(dres.correctionField-fres.correctionField) <= (3<<16));
+	}
+}
+
+static void test_scaled_ns(void **state)
+{
+	uint16_t subns;
+	int64_t ns;
+	assert_int_equal(gptp_sns_to_ns(gptp_sns_from_ns(-3, 0x8000)), -3);
+	assert_int_equal(gptp_sns_from_ns(-3, 0x8000)&SCALED_NS_MASK, 0x8000);
+	assert_int_equal(gptp_sns_round_ns(gptp_sns_from_ns(-3, 0x8000)), -2);
+	assert_int_equal(gptp_sns_round_ns(gptp_sns_from_ns(-3, 0x7fff)), -3);
+	assert_int_equal(gptp_sns_round_ns(gptp_sns_from_ns(5, 0x8000)), 6);
+	subns=0xc000;
+	ns=gptp_sns_add(1600000000LL*UB_SEC_NS, &subns, gptp_sns_from_ns(0, 0x8000));
+	assert_int_equal(ns, 1600000000LL*UB_SEC_NS+1);
+	assert_int_equal(subns, 0x4000);
+	ns=gptp_sns_add(ns, &subns, -gptp_sns_from_ns(2, 0x8000));
+	assert_int_equal(ns, 1600000000LL*UB_SEC_NS-2);
+	assert_int_equal(subns, 0xc000);
+}
+
+#define NUM_HOPS 8
+#define NUM_CHAIN_TESTS 10000
+
+typedef struct test_hop {
+	ScaledRateRatio nrr; // neighborRateRatio
+	int64_t t41; // t4-t1 of pdelay
+	int64_t t32; // t3-t2 of pdelay
+	int64_t residence; // sync_ts-rts
+} test_hop_t;
+
+/* Sync through a chain of time-aware relays, the same computations as
+   md_pdelay_req_sm, md_sync_receive_sm, md_sync_send_sm and clock_slave_sync_sm.
+   returns syncReceiptTime-preciseOriginTimestamp at the end station, in scaled nsec.
+   'precise=false' truncates to nsec as CONF_SYNC_SUBNS_PRECISION=0 */
+static int64_t chain_fixed(test_hop_t *hops, int nhops, bool precise)
+{
+	int64_t cf=0, pd, dts, sns, mask;
+	uint64_t rts, up;
+	uint16_t up_subns;
+	ScaledRateRatio rr=RATE_RATIO_ONE, srr;
+	int i;
+	mask=precise?-1:~(int64_t)SCALED_NS_MASK;
+	for(i=0;i<nhops;i++){
+		rts=1600000000LL*UB_SEC_NS+(test_rand()%UB_SEC_NS);
+		pd=(gptp_rr_mul_ns(gptp_sns_from_ns(hops[i].t41, 0), hops[i].nrr) -
+		    gptp_sns_from_ns(hops[i].t32, 0))/2;
+		pd&=mask;
+		cf&=mask;
+		dts=gptp_rr_div_ns(pd, hops[i].nrr);
+		if(!precise) dts=gptp_sns_round_ns(dts)*((int64_t)1<<SCALED_NS_SHIFT);
+		up_subns=0;
+		up=gptp_sns_add(rts, &up_subns, -dts);
+		srr=gptp_rr_mul(rr, hops[i].nrr);
+		if(i==nhops-1){
+			sns=cf+gptp_rr_mul_ns(pd, gptp_rr_div(srr, hops[i].nrr));
+			return sns;
+		}
+		cf+=gptp_rr_mul_ns(gptp_sns_from_ns(rts+hops[i].residence-up, 0)-up_subns, srr);
+		rr=srr;
+	}
+	return 0;
+}
+
+/* the same in double without any truncation, in nsec */
+static double chain_double(test_hop_t *hops, int nhops)
+{
+	double cf=0.0, pd, nrr, rr=1.0;
+	int i;
+	for(i=0;i<nhops;i++){
+		nrr=gptp_rr_to_double(hops[i].nrr);
+		pd=(nrr*hops[i].t41-hops[i].t32)/2.0;
+		if(i==nhops-1) return cf+pd*rr;
+		cf+=rr*nrr*(hops[i].residence+pd/nrr);
+		rr*=nrr;
+	}
+	return 0.0;
+}
+
+/* the accumulated error over NUM_HOPS hops, with and without the sub-nsec precision */
+static void test_multi_hop_subns(void **state)
+{
+	test_hop_t hops[NUM_HOPS];
+	double ref, err, sum[2]={0.0, 0.0}, maxerr[2]={0.0, 0.0};
+	int i, n, p;
+	for(n=0;n<NUM_CHAIN_TESTS;n++){
+		for(i=0;i<NUM_HOPS;i++){
+			hops[i].nrr=gptp_rr_from_ppb((int32_t)(test_rand()%100001)-50000);
+			hops[i].t32=test_rand()%UB_MSEC_NS;
+			hops[i].t41=hops[i].t32+2*(test_rand()%1000);
+			hops[i].residence=test_rand()%(10*UB_MSEC_NS);
+		}
+		ref=chain_double(hops, NUM_HOPS);
+		for(p=0;p<2;p++){
+			err=(double)chain_fixed(hops, NUM_HOPS, p)/(1<<SCALED_NS_SHIFT)-ref;
+			sum[p]+=err;
+			if(fabs(err)>maxerr[p]) maxerr[p]=fabs(err);
+		}
+	}
+	for(p=0;p<2;p++){
+		printf("%d hops %s sub-nsec: mean error=%.3fnsec, max error=%.3fnsec\n",
+		       NUM_HOPS, p?"with   ":"without", sum[p]/NUM_CHAIN_TESTS, maxerr[p]);
+	}
+	assert_true(maxerr[1] < 0.1);
+	assert_true(fabs(sum[0]/NUM_CHAIN_TESTS) > 1.0);
+}
+
+static int cycle_counter_open(void)
+{
+	struct perf_event_attr pea;
+	memset(&pea, 0, sizeof(pea));
+	pea.type=PERF_TYPE_HARDWARE;
+	pea.size=sizeof(pea);
+	pea.config=PERF_COUNT_HW_CPU_CYCLES;
+	pea.disabled=1;
+	pea.exclude_kernel=1;
+	pea.exclude_hv=1;
+	return syscall(__NR_perf_event_open, &pea, 0, -1, -1, 0);
+}
+
+static uint64_t cycle_counter_read(int fd)
+{
+	uint64_t v=0;
+	if(fd<0) return 0;
+	if(read(fd, &v, sizeof(v))!=sizeof(v)) return 0;
+	return v;
+}
+
+/* cycles(or nsec if cycle counter is not available) per message,
+   this is only for the information and doesn't fail */
+static void test_per_message_benchmark(void **state)
+{
+	static test_sync_msg_t msgs[1024];
+	test_sync_result_t res;
+	int64_t sum=0;
+	uint64_t ts1, ts2, c1, c2, dns[2], dcycles[2];
+	int i, n, cfd;
+	ScaledRateRatio fnrr=gptp_rr_from_ppb(12);
+	double dnrr=gptp_rr_to_double(fnrr);
+
+	for(i=0;i<1024;i++) make_sync_msg(&msgs[i]);
+	cfd=cycle_counter_open();
+	if(cfd>=0){
+		ioctl(cfd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(cfd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	for(n=0;n<2;n++){
+		ts1=ub_mt_gettime64();
+		c1=cycle_counter_read(cfd);
+		for(i=0;i<NUM_BENCH_MESSAGES;i++){
+			if(n==0)
+				per_message_double(&msgs[i&1023], dnrr, &res);
+			else
+				per_message_fixed(&msgs[i&1023], fnrr, &res);
+			sum+=res.correctionField; // not to be optimized out
+		}
+		c2=cycle_counter_read(cfd);
+		ts2=ub_mt_gettime64();
+		dns[n]=ts2-ts1;
+		dcycles[n]=c2-c1;
+	}
+	if(cfd>=0) close(cfd);
+	for(n=0;n<2;n++){
+		printf("%s: %.1f nsec/message", n?"fixed point":"double     ",
+		       (double)dns[n]/NUM_BENCH_MESSAGES);
+		if(cfd>=0)
+			printf(", %.1f cycles/message", (double)dcycles[n]/NUM_BENCH_MESSAGES);
+		printf("\n");
+	}
+	UB_LOG(UBL_DEBUG, "%s:sum=%"PRIi64"\n", __func__, sum);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:46", "UBL_GPTP");
+	unibase_init(&init_para);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unibase_close();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_mulshr),
+		cmocka_unit_test(test_ppb_conversion),
+		cmocka_unit_test(test_apply_adjrate),
+		cmocka_unit_test(test_ratio_from_delta),
+		cmocka_unit_test(test_div),
+		cmocka_unit_test(test_per_message_precision),
+		cmocka_unit_test(test_scaled_ns),
+		cmocka_unit_test(test_multi_hop_subns),
+		cmocka_unit_test(test_per_message_benchmark),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,246 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * The frequency adjustment is averaged in HOLDOVER_BINS bins over
+ * CONF_HOLDOVER_LEARN_TIME, only integer sums are done on the Sync path.
+ * The least squares fit on the bins is done once at the start of the holdover,
+ * it is not on the Sync path and uses floating point.
+ */
+#include <math.h>
+#include "gptpclock.h"
+#include "gptpholdover.h"
+#include "gptp_config.h"
+
+#define HOLDOVER_BINS 32
+// the minimum number of the bins to fit the model
+#define HOLDOVER_MIN_BINS 4
+// the aging term needs more bins
+#define HOLDOVER_MIN_BINS_AGING 8
+
+typedef struct holdover_bin {
+	int64_t tsum; // sum of 'ts-base' in msec
+	int64_t ysum; // sum of adjppb
+	int count;
+} holdover_bin_t;
+
+struct gptpholdover {
+	uint8_t domainNumber;
+	int64_t learn_time;
+	int64_t max_time;
+	int64_t bin_time;
+	bool aging;
+	int gmchange_ind;
+	int64_t base; // ts of the first sample
+	int64_t bin_start; // ts of the first sample in the current bin
+	int head; // the current bin
+	int nbins; // the number of the used bins
+	holdover_bin_t bins[HOLDOVER_BINS];
+	bool active;
+	int64_t start;
+	int64_t uncertainty; // at the start
+	double c[3]; // adjppb=c0+c1*t+c2*t^2, t in sec from the start
+	int64_t ferr_ppt;
+	int64_t derr_ppt;
+	int maxadj;
+};
+
+gptpholdover_t *gptpholdover_create(uint8_t domainNumber)
+{
+	gptpholdover_t *ho;
+	int64_t learn_time;
+	learn_time=gptpconf_get_intitem(CONF_HOLDOVER_LEARN_TIME)*UB_SEC_NS;
+	if(learn_time<=0) return NULL;
+	ho=malloc(sizeof(gptpholdover_t));
+	ub_assert(ho, __func__, "malloc");
+	memset(ho, 0, sizeof(gptpholdover_t));
+	ho->domainNumber=domainNumber;
+	ho->learn_time=learn_time;
+	ho->bin_time=learn_time/HOLDOVER_BINS;
+	ho->max_time=gptpconf_get_intitem(CONF_HOLDOVER_MAX_TIME)*UB_SEC_NS;
+	ho->aging=gptpconf_get_intitem(CONF_HOLDOVER_AGING)!=0;
+	ho->maxadj=gptpconf_get_intitem(CONF_MAX_ADJUST_RATE_ON_CLOCK);
+	return ho;
+}
+
+void gptpholdover_delete(gptpholdover_t *ho)
+{
+	free(ho);
+}
+
+void gptpholdover_reset(gptpholdover_t *ho)
+{
+	ho->nbins=0;
+	ho->head=0;
+}
+
+void gptpholdover_learn(gptpholdover_t *ho, int64_t ts, int adjppb, int gmchange_ind)
+{
+	holdover_bin_t *bin;
+	if(ho->nbins && ho->gmchange_ind!=gmchange_ind){
+		UB_LOG(UBL_INFO, "%s:domainNumber=%d, GM changed. learn the model again\n",
+		       __func__, ho->domainNumber);
+		gptpholdover_reset(ho);
+	}
+	ho->gmchange_ind=gmchange_ind;
+	if(!ho->nbins){
+		ho->base=ts;
+		ho->bin_start=ts;
+		ho->head=0;
+		ho->nbins=1;
+		memset(&ho->bins[0], 0, sizeof(holdover_bin_t));
+	}else if(ts-ho->bin_start >= ho->bin_time){
+		ho->head=(ho->head+1)%HOLDOVER_BINS;
+		if(ho->nbins<HOLDOVER_BINS) ho->nbins++;
+		ho->bin_start=ts;
+		memset(&ho->bins[ho->head], 0, sizeof(holdover_bin_t));
+	}
+	bin=&ho->bins[ho->head];
+	bin->tsum+=(ts-ho->base)/UB_MSEC_NS;
+	bin->ysum+=adjppb;
+	bin->count++;
+}
+
+/* solve a*x=b by the gaussian elimination, n<=3 */
+static int solve(double a[3][3], double b[3], int n)
+{
+	int i, j, k;
+	double f;
+	for(i=0;i<n;i++){
+		if(fabs(a[i][i])<1e-12) return -1;
+		for(j=i+1;j<n;j++){
+			f=a[j][i]/a[i][i];
+			for(k=i;k<n;k++) a[j][k]-=f*a[i][k];
+			b[j]-=f*b[i];
+		}
+	}
+	for(i=n-1;i>=0;i--){
+		for(j=i+1;j<n;j++) b[i]-=a[i][j]*b[j];
+		b[i]/=a[i][i];
+	}
+	return 0;
+}
+
+int gptpholdover_start(gptpholdover_t *ho, int64_t ts, int64_t uncertainty)
+{
+	double t[HOLDOVER_BINS], y[HOLDOVER_BINS];
+	double a[3][3], b[3], inv[3][3], e[3], r, s2=0.0;
+	holdover_bin_t *bin;
+	int i, j, k, n=0, np;
+	if(ho->active) return 0;
+	for(i=0;i<ho->nbins;i++){
+		bin=&ho->bins[i];
+		if(!bin->count) continue;
+		// t in sec from the start, the bins older than the learn time are not used
+		t[n]=((double)bin->tsum/bin->count-(double)((ts-ho->base)/UB_MSEC_NS))/1000.0;
+		if(t[n]*UB_SEC_NS < -(double)(ho->learn_time+ho->bin_time)) continue;
+		y[n]=(double)bin->ysum/bin->count;
+		n++;
+	}
+	if(n<HOLDOVER_MIN_BINS){
+		UB_LOG(UBL_INFO, "%s:domainNumber=%d, the model is not learned, %d bins\n",
+		       __func__, ho->domainNumber, n);
+		return -1;
+	}
+	np=(ho->aging && n>=HOLDOVER_MIN_BINS_AGING)?3:2;
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	for(i=0;i<n;i++){
+		for(j=0;j<np;j++){
+			for(k=0;k<np;k++) a[j][k]+=pow(t[i], j+k);
+			b[j]+=y[i]*pow(t[i], j);
+		}
+	}
+	// the diagonal of the inverse gives the variances of the coefficients
+	for(i=0;i<np;i++){
+		double aa[3][3];
+		memcpy(aa, a, sizeof(aa));
+		memset(e, 0, sizeof(e));
+		e[i]=1.0;
+		if(solve(aa, e, np)) return -1;
+		for(j=0;j<np;j++) inv[j][i]=e[j];
+	}
+	if(solve(a, b, np)) return -1;
+	memset(ho->c, 0, sizeof(ho->c));
+	for(i=0;i<np;i++) ho->c[i]=b[i];
+	for(i=0;i<n;i++){
+		r=y[i]-(ho->c[0]+ho->c[1]*t[i]+ho->c[2]*t[i]*t[i]);
+		s2+=r*r;
+	}
+	if(n>np) s2/=(n-np);
+	// the frequency error includes the scatter of the bins
+	ho->ferr_ppt=(int64_t)(2000.0*sqrt(s2*(1.0+inv[0][0])));
+	ho->derr_ppt=(int64_t)(2000.0*sqrt(s2*inv[1][1]));
+	ho->uncertainty=uncertainty;
+	ho->start=ts;
+	ho->active=true;
+	UB_TLOG(UBL_INFO, "%s:domainNumber=%d, holdover start, adjppb=%.1f, drift=%.4fppb/s, "
+		"aging=%.6fppb/s^2, ferr=%"PRIi64"ppt, derr=%"PRIi64"ppt/s\n",
+		__func__, ho->domainNumber, ho->c[0], ho->c[1], ho->c[2],
+		ho->ferr_ppt, ho->derr_ppt);
+	return 0;
+}
+
+void gptpholdover_stop(gptpholdover_t *ho, int64_t ts)
+{
+	int64_t duration;
+	if(!ho->active) return;
+	duration=gptpholdover_duration(ho, ts);
+	UB_TLOG(UBL_INFO, "%s:domainNumber=%d, holdover end, duration=%"PRIi64"nsec, "
+		"estimated error=%"PRIi64"nsec\n", __func__, ho->domainNumber,
+		duration, gptpholdover_error(ho, ts));
+	ho->active=false;
+}
+
+bool gptpholdover_active(gptpholdover_t *ho)
+{
+	return ho->active;
+}
+
+int gptpholdover_adjppb(gptpholdover_t *ho, int64_t ts)
+{
+	double t, v;
+	int64_t duration;
+	duration=gptpholdover_duration(ho, ts);
+	if(duration > ho->max_time) duration=ho->max_time;
+	t=(double)duration/UB_SEC_NS;
+	v=ho->c[0]+ho->c[1]*t+ho->c[2]*t*t;
+	if(v > ho->maxadj) return ho->maxadj;
+	if(v < -ho->maxadj) return -ho->maxadj;
+	return (int)lround(v);
+}
+
+int64_t gptpholdover_duration(gptpholdover_t *ho, int64_t ts)
+{
+	if(!ho->active || ts<ho->start) return 0;
+	return ts-ho->start;
+}
+
+int64_t gptpholdover_error(gptpholdover_t *ho, int64_t ts)
+{
+	return ho->uncertainty+gptpclock_holdover_error(ho->ferr_ppt, ho->derr_ppt,
+							gptpholdover_duration(ho, ts));
+}
+
+void gptpholdover_model_error(gptpholdover_t *ho, int64_t *ferr_ppt, int64_t *derr_ppt)
+{
+	*ferr_ppt=ho->ferr_ppt;
+	*derr_ppt=ho->derr_ppt;
+}
@@ -0,0 +1,96 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/**
+ * @addtogroup gptp
+ * @{
+ * @file gptpholdover.h
+ * @copyright Copyright (C) 2019 Excelfore Corporation
+ * @brief the holdover by a learned frequency model.
+ *
+ * While the servo is locked, the frequency adjustment of thisClock is learned
+ * over CONF_HOLDOVER_LEARN_TIME. When Sync is lost, the frequency is extrapolated
+ * by the model; the offset and the drift, and the aging term with CONF_HOLDOVER_AGING.
+ * The model errors give the estimated phase error in the holdover.
+ */
+
+#ifndef __GPTPHOLDOVER_H_
+#define __GPTPHOLDOVER_H_
+
+typedef struct gptpholdover gptpholdover_t;
+
+/**
+ * @brief create a holdover
+ * @return the holdover, NULL if CONF_HOLDOVER_LEARN_TIME is 0
+ */
+gptpholdover_t *gptpholdover_create(uint8_t domainNumber);
+
+void gptpholdover_delete(gptpholdover_t *ho);
+
+/**
+ * @brief learn the frequency adjustment while the servo is locked
+ * @param ts	time of the sample in nsec, the same clock must be used for all the calls
+ * @param adjppb	the frequency adjustment of thisClock
+ * @param gmchange_ind	the learned model is dropped at a GM change
+ */
+void gptpholdover_learn(gptpholdover_t *ho, int64_t ts, int adjppb, int gmchange_ind);
+
+/**
+ * @brief drop the learned model
+ */
+void gptpholdover_reset(gptpholdover_t *ho);
+
+/**
+ * @brief fit the model and start the holdover
+ * @param uncertainty	the phase uncertainty at the start
+ * @return 0 on success, -1 if the model hasn't been learned enough
+ */
+int gptpholdover_start(gptpholdover_t *ho, int64_t ts, int64_t uncertainty);
+
+void gptpholdover_stop(gptpholdover_t *ho, int64_t ts);
+
+bool gptpholdover_active(gptpholdover_t *ho);
+
+/**
+ * @brief the frequency adjustment of thisClock by the model at 'ts',
+ * the model is applied up to CONF_HOLDOVER_MAX_TIME
+ */
+int gptpholdover_adjppb(gptpholdover_t *ho, int64_t ts);
+
+/**
+ * @brief nsec since the start of the holdover, 0 if not in the holdover
+ */
+int64_t gptpholdover_duration(gptpholdover_t *ho, int64_t ts);
+
+/**
+ * @brief the estimated phase error at 'ts', including the uncertainty at the start.
+ * the estimation is about 2 sigma of the model errors.
+ */
+int64_t gptpholdover_error(gptpholdover_t *ho, int64_t ts);
+
+/**
+ * @brief the errors of the model, for gptpclock_holdover_error
+ * @param ferr_ppt	return the frequency error, 1/1000 ppb
+ * @param derr_ppt	return the drift error, 1/1000 ppb per sec
+ */
+void gptpholdover_model_error(gptpholdover_t *ho, int64_t *ferr_ppt, int64_t *derr_ppt);
+
+#endif
+/** @}*/
@@ -0,0 +1,199 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * the holdover on virtual clocks. A slave clock which has a frequency drift
+ * is synchronized to a virtual GM by the PI servo, and the frequency model is learned.
+ * Then Sync stops, and the phase error after the holdover is compared with
+ * keeping the last frequency adjustment.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <xl4unibase/unibase_binding.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "gptpclock.h"
+#include "gptpclock_virtual.h"
+#include "gptpipc.h"
+#include "gptpservo.h"
+#include "gptpholdover.h"
+#include "gptp_config.h"
+
+#define HO_SYNC_INTERVAL (125*UB_MSEC_NS)
+#define HO_LOCKED_SEC 700 // synchronized in this time
+#define HO_HOLDOVER_SEC 300 // then Sync is lost in this time
+#define HO_AGING_PPH 3600 // 1ppb per sec
+#define HO_TS_NOISE 20 // nsec
+
+typedef struct holdover_result {
+	int64_t err; // the phase error at the end of the holdover
+	int64_t est; // the estimated error
+	int64_t duration;
+} holdover_result_t;
+
+static void run_holdover(bool use_model, holdover_result_t *res)
+{
+	PTPFD_TYPE gmfd, lcfd;
+	gptp_vclock_model_t model;
+	gptpservo_t *sv;
+	gptpholdover_t *ho;
+	gptpservo_para_t para={.domainNumber=0, .hw_phase_adj=false};
+	gptpservo_output_t out;
+	uint64_t base, rts, lts, mts;
+	int64_t applied=0;
+	int i, n;
+
+	memset(&model, 0, sizeof(model));
+	gmfd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"0");
+	model.seed=1;
+	assert_int_equal(gptp_vclock_set_model(gmfd, &model), 0);
+	lcfd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w1");
+	model.freq_ppb=10000;
+	model.aging_pph=HO_AGING_PPH;
+	model.random_walk_ppb=1;
+	model.ts_noise=HO_TS_NOISE;
+	model.seed=2;
+	assert_int_equal(gptp_vclock_set_model(lcfd, &model), 0);
+	sv=gptpservo_create(GPTPSERVO_PI, &para);
+	assert_non_null(sv);
+	ho=gptpholdover_create(0);
+	assert_non_null(ho);
+
+	// adjtime applies the old rate up to the real time, the simulation must be ahead
+	base=ub_rt_gettime64()+UB_SEC_NS;
+	n=HO_LOCKED_SEC*UB_SEC_NS/HO_SYNC_INTERVAL;
+	for(i=0;i<n;i++){
+		rts=base+(uint64_t)i*HO_SYNC_INTERVAL;
+		mts=gptp_vclock_gettime_at(gmfd, rts);
+		lts=gptp_vclock_gettime_at(lcfd, rts);
+		gptpservo_sample(sv, lts, mts, 0, 1);
+		gptpservo_output(sv, &out);
+		if(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP) applied=out.step;
+		if(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ)
+			assert_int_equal(gptp_vclock_adjtime(lcfd, out.adjppb), 0);
+		if((out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE) &&
+		   (out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE))
+			gptpholdover_learn(ho, rts, out.adjppb, 1);
+	}
+	assert_int_equal(gptpholdover_start(ho, rts, HO_TS_NOISE*2), 0);
+	// the frequency is updated in every second
+	for(i=1;i<=HO_HOLDOVER_SEC;i++){
+		rts+=UB_SEC_NS;
+		gptp_vclock_gettime_at(lcfd, rts);
+		if(use_model)
+			assert_int_equal(gptp_vclock_adjtime(lcfd, gptpholdover_adjppb(ho, rts)), 0);
+	}
+	mts=gptp_vclock_gettime_at(gmfd, rts);
+	lts=gptp_vclock_gettime_at(lcfd, rts);
+	res->err=llabs((int64_t)(mts-lts)-applied);
+	res->est=gptpholdover_error(ho, rts);
+	res->duration=gptpholdover_duration(ho, rts);
+	gptpholdover_stop(ho, rts);
+	assert_false(gptpholdover_active(ho));
+	printf("holdover%s: error=%"PRIi64"nsec, estimated=%"PRIi64"nsec after %"PRIi64"sec\n",
+	       use_model?"(model)":"(last adj)", res->err, res->est,
+	       (int64_t)(res->duration/UB_SEC_NS));
+	gptpholdover_delete(ho);
+	gptpservo_delete(sv);
+	gptp_vclock_free_fd(gmfd);
+	gptp_vclock_free_fd(lcfd);
+}
+
+/* the model follows the drift, the last adjustment doesn't */
+static void test_holdover_drift(void **state)
+{
+	holdover_result_t mres, lres;
+	run_holdover(true, &mres);
+	run_holdover(false, &lres);
+	assert_int_equal(mres.duration, (int64_t)HO_HOLDOVER_SEC*UB_SEC_NS);
+	assert_true(mres.err*5 < lres.err);
+	assert_true(mres.err < mres.est);
+	assert_true(mres.est < lres.err);
+}
+
+/* the fit on synthetic samples, with and without the aging term */
+static void test_holdover_model(void **state)
+{
+	gptpholdover_t *ho;
+	int32_t v;
+	int64_t ts;
+	double t;
+	int i;
+	ho=gptpholdover_create(0);
+	assert_non_null(ho);
+	// not enough learned
+	gptpholdover_learn(ho, UB_SEC_NS, 100, 1);
+	assert_int_equal(gptpholdover_start(ho, 2*UB_SEC_NS, 0), -1);
+	assert_false(gptpholdover_active(ho));
+	assert_int_equal(gptpholdover_duration(ho, 2*UB_SEC_NS), 0);
+	// the offset and the drift, adjppb=100+0.2*t
+	for(i=0;i<600;i++){
+		ts=(int64_t)i*UB_SEC_NS;
+		gptpholdover_learn(ho, ts, 100+i/5, 1);
+	}
+	assert_int_equal(gptpholdover_start(ho, ts, 0), 0);
+	assert_true(abs(gptpholdover_adjppb(ho, ts+100*UB_SEC_NS)-(100+699/5)) <= 2);
+	gptpholdover_stop(ho, ts);
+	// a GM change drops the learned model
+	gptpholdover_learn(ho, ts+UB_SEC_NS, 0, 2);
+	assert_int_equal(gptpholdover_start(ho, ts+UB_SEC_NS, 0), -1);
+	gptpholdover_delete(ho);
+
+	// the aging term, adjppb=100+0.2*t+0.001*t^2
+	v=1;
+	gptpconf_set_item(CONF_HOLDOVER_AGING, &v);
+	ho=gptpholdover_create(0);
+	for(i=0;i<600;i++){
+		ts=(int64_t)i*UB_SEC_NS;
+		gptpholdover_learn(ho, ts, (int)(100+0.2*i+0.001*i*i), 1);
+	}
+	assert_int_equal(gptpholdover_start(ho, ts, 0), 0);
+	t=699;
+	assert_true(abs(gptpholdover_adjppb(ho, ts+100*UB_SEC_NS)-(int)(100+0.2*t+0.001*t*t))
+		    <= 2);
+	gptpholdover_delete(ho);
+	v=0;
+	gptpconf_set_item(CONF_HOLDOVER_AGING, &v);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:45", "UBL_GPTP");
+	unibase_init(&init_para);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unibase_close();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_holdover_model),
+		cmocka_unit_test(test_holdover_drift),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -37,6 +37,16 @@ static char *selectedStateStr(uint8_t selectedState)
 	}
 }
 
+void gptpipc_print_servotd(gptpipc_servo_telemetry_t *td)
+{
+	printf("%"PRIu32",%d,%d,%"PRIi64",%d,%"PRIi64",%"PRIi64",%"PRIi64",%"PRIi64
+	       ",%"PRIi64",%"PRIi64",%"PRIi32",0x%02x\n",
+	       td->index, td->domainNumber, td->servo_type, td->local_ts64, td->seqid,
+	       td->offset_in, td->offset64, td->step, td->rate_ratio,
+	       td->fstate[0], td->fstate[1], td->adjppb, td->flags);
+	fflush(stdout);
+}
+
 static void print_ipc_data(gptpipc_gptpd_data_t *rd)
 {
 	char *duplex="unknown";
@@ -152,7 +162,23 @@ static void print_ipc_data(gptpipc_gptpd_data_t *rd)
 		printf("signal_rec=%"PRIu32"\n", rd->u.stattd.signal_rec);
 		printf("signal_msg_interval_rec=%"PRIu32"\n", rd->u.stattd.signal_msg_interval_rec);
 		printf("signal_gptp_capable_rec=%"PRIu32"\n", rd->u.stattd.signal_gptp_capable_rec);
+		printf("sync_rec_tsconv=%"PRIu32"\n", rd->u.stattd.sync_rec_tsconv);
+		printf("sync_rec_tsconv_skip=%"PRIu32"\n", rd->u.stattd.sync_rec_tsconv_skip);
+		printf("sync_send_tsconv=%"PRIu32"\n", rd->u.stattd.sync_send_tsconv);
+		printf("sync_send_tsconv_skip=%"PRIu32"\n", rd->u.stattd.sync_send_tsconv_skip);
+		break;
+	case GPTPIPC_GPTPD_SWCLKD:
+		printf("GPTPD_SWCLKD --- portIndex=%"PRIi32"\n", rd->u.swclkd.portIndex);
+		printf("ts_count=%"PRIu32"\n", rd->u.swclkd.ts_count);
+		printf("rt_offset=%"PRIi64"\n", rd->u.swclkd.rt_offset);
+		printf("width_avg=%"PRIu32"\n", rd->u.swclkd.width_avg);
+		printf("width_max=%"PRIu32"\n", rd->u.swclkd.width_max);
+		printf("drift_max=%"PRIu32"\n", rd->u.swclkd.drift_max);
+		printf("step_count=%"PRIu32"\n", rd->u.swclkd.step_count);
 		break;
+	case GPTPIPC_GPTPD_SERVOTD:
+		gptpipc_print_servotd(&rd->u.servotd);
+		return;
 	default:
 		printf("unknonw data\n");
 		break;
@@ -266,6 +292,14 @@ static void *gptpipc_thread_proc(void *ptr)
 			UB_LOG(UBL_DEBUG,"%s:gptp IPC STATTD response\n", __func__);
 			if(ipcpd->cb) ipcpd->cb(&rd, ipcpd->cbdata);
 			break;
+		case GPTPIPC_GPTPD_SWCLKD:
+			UB_LOG(UBL_DEBUG,"%s:gptp IPC SWCLKD response\n", __func__);
+			if(ipcpd->cb) ipcpd->cb(&rd, ipcpd->cbdata);
+			break;
+		case GPTPIPC_GPTPD_SERVOTD:
+			UB_LOG(UBL_DEBUGV,"%s:gptp IPC SERVOTD response\n", __func__);
+			if(ipcpd->cb) ipcpd->cb(&rd, ipcpd->cbdata);
+			break;
 		}
 		continue;
 	reinit:
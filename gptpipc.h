@@ -57,6 +57,7 @@ typedef enum {
 	GPTPIPC_CMD_REQ_STAT_INFO_RESET,
 	GPTPIPC_CMD_REG_ABNORMAL_EVENT,
 	GPTPIPC_CMD_DISCONNECT,
+	GPTPIPC_CMD_REQ_SERVO_TELEMETRY,
 } gptp_ipc_command_t;
 
 #define GPTPIPC_EXT_SCRIPT "gptpipc_extscript"
@@ -75,6 +76,8 @@ typedef enum {
 	GPTPIPC_EVENT_PORT_AS_CAPABLE_DOWN,
 	GPTPIPC_EVENT_PORT_AS_CAPABLE_UP,
 	GPTPIPC_EVENT_CLOCK_ACTIVE_DOMAIN,
+	GPTPIPC_EVENT_CLOCK_GM_STABLE,
+	GPTPIPC_EVENT_CLOCK_GM_UNSTABLE,
 } gptpipc_event_t;
 
 /**
@@ -90,6 +93,8 @@ typedef enum {
 #define GPTPIPC_EVENT_PORT_FLAG_AS_CAPABLE_DOWN (1<<GPTPIPC_EVENT_PORT_AS_CAPABLE_DOWN)
 #define GPTPIPC_EVENT_PORT_FLAG_AS_CAPABLE_UP (1<<GPTPIPC_EVENT_PORT_AS_CAPABLE_UP)
 #define GPTPIPC_EVENT_CLOCK_FLAG_ACTIVE_DOMAIN (1<<GPTPIPC_EVENT_CLOCK_ACTIVE_DOMAIN)
+#define GPTPIPC_EVENT_CLOCK_FLAG_GM_STABLE (1<<GPTPIPC_EVENT_CLOCK_GM_STABLE)
+#define GPTPIPC_EVENT_CLOCK_FLAG_GM_UNSTABLE (1<<GPTPIPC_EVENT_CLOCK_GM_UNSTABLE)
 
 /**
  * @brief gptp notice data type
@@ -237,6 +242,74 @@ typedef struct gptpipc_clock_data{
 	uint8_t lastGmFreqChangePk[sizeof(double)];
 } __attribute__((packed)) gptpipc_clock_data_t;
 
+#define GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE (1<<0) //!< the phase offset is stable
+#define GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE (1<<1) //!< the rate is stable
+#define GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP (1<<2) //!< the offset was stepped by this sample
+#define GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ (1<<3) //!< adjppb was updated by this sample
+
+/**
+ * @brief a sync sample of a domain, which gptp2d publishes in the shared memory ring.
+ * gptp2d pushes one sample for each received Sync, after the servo processed it.
+ * 'local_ts64' and 'gm_ts64' are the same instant in thisClock time and GM time.
+ */
+typedef struct gptpipc_sync_sample{
+	int64_t local_ts64; //!< syncReceiptLocalTime, thisClock time in nsec
+	int64_t gm_ts64; //!< syncReceiptTime, GM time in nsec
+	int64_t raw_ts64; //!< CLOCK_MONOTONIC_RAW when the sample was pushed
+	int64_t offset64; //!< servo output, filtered offset of GM to thisClock in nsec
+	int64_t rate_ratio; //!< ScaledRateRatio of GM to thisClock since the last sample, 0:unknown
+	int32_t adjppb; //!< servo output, frequency adjustment of thisClock in ppb
+	uint16_t seqid; //!< sequenceId of the Sync
+	uint8_t domainNumber;
+	uint8_t flags; //!< GPTPIPC_SYNC_SAMPLE_FLAG_*
+} gptpipc_sync_sample_t;
+
+#define GPTPIPC_SERVO_STATE_FREERUN 0 //!< no Sync has been received from GM
+#define GPTPIPC_SERVO_STATE_CONVERGING 1 //!< the phase or the rate is not stable yet
+#define GPTPIPC_SERVO_STATE_LOCKED 2 //!< both the phase and the rate are stable
+#define GPTPIPC_SERVO_STATE_GM 3 //!< this device is GM
+#define GPTPIPC_SERVO_STATE_HOLDOVER 4 //!< Sync is lost, the clock runs by the learned frequency model
+
+#define GPTPIPC_CLOCK_QUALITY_FLAG_HOLDOVER (1<<0) //!< Sync is lost, the clock runs by the last rate
+#define GPTPIPC_CLOCK_QUALITY_FLAG_GM_STABLE (1<<1) //!< the same as gptpmasterclock_gmstable
+
+/**
+ * @brief quality of gPTP time of a domain, which libx4gptp2 returns with the time.
+ * 'uncertainty' is the estimated offset error at the last Sync, and it grows
+ * in proportion to 'sync_age' until the next Sync comes.
+ */
+typedef struct gptpipc_clock_quality{
+	int64_t uncertainty; //!< estimated offset uncertainty in nsec, -1:unknown
+	int64_t sync_age; //!< nsec since the last Sync, -1:no Sync
+	int64_t rate_ratio; //!< ScaledRateRatio of GM to thisClock at the last Sync, 0:unknown
+	int64_t holdover_time; //!< nsec in the holdover by the frequency model, 0:not in it
+	uint8_t servo_state; //!< GPTPIPC_SERVO_STATE_*
+	uint8_t flags; //!< GPTPIPC_CLOCK_QUALITY_FLAG_*
+} gptpipc_clock_quality_t;
+
+/**
+ * @brief a record of the servo telemetry ring, one record for each servo iteration.
+ * gptp2d keeps the last CONF_SERVO_TELEMETRY_SIZE records for each domain,
+ * and sends them from the oldest by GPTPIPC_CMD_REQ_SERVO_TELEMETRY.
+ */
+typedef struct gptpipc_servo_telemetry{
+	int64_t local_ts64; //!< syncReceiptLocalTime, thisClock time in nsec
+	int64_t offset_in; //!< servo input, 'mts-lts' in nsec
+	int64_t offset64; //!< servo output, filtered offset of GM to thisClock in nsec
+	int64_t step; //!< servo output, the stepped offset with GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP
+	int64_t rate_ratio; //!< ScaledRateRatio of GM to thisClock since the last sample, 0:unknown
+	int64_t fstate[2]; //!< the internal filter state, the meaning depends on 'servo_type'
+	int32_t adjppb; //!< servo output, frequency adjustment of thisClock in ppb
+	uint32_t index; //!< sequential number of the record, a gap means lost records
+	uint16_t seqid; //!< sequenceId of the Sync
+	uint8_t domainNumber;
+	uint8_t flags; //!< GPTPIPC_SYNC_SAMPLE_FLAG_*
+	uint8_t servo_type; //!< CONF_SERVO_TYPE, 0:IIR, 1:PI, 2:KALMAN
+} __attribute__((packed)) gptpipc_servo_telemetry_t;
+
+#define GPTPIPC_SERVOTD_CSV_HEADER "index,domainNumber,servo_type,local_ts64,seqid," \
+	"offset_in,offset64,step,rate_ratio,fstate0,fstate1,adjppb,flags"
+
 typedef struct gptpipc_statistics_system{
 	int32_t portIndex;
 	uint32_t pdelay_req_send;
@@ -267,8 +340,26 @@ typedef struct gptpipc_statistics_tas{
 	uint32_t signal_rec;
 	uint32_t signal_msg_interval_rec;
 	uint32_t signal_gptp_capable_rec;
+	uint32_t sync_rec_tsconv;
+	uint32_t sync_rec_tsconv_skip;
+	uint32_t sync_send_tsconv;
+	uint32_t sync_send_tsconv_skip;
 } __attribute__((packed)) gptpipc_statistics_tas_t;
 
+/* statistics of a port which runs with the software clock(CLOCK_MONOTONIC_RAW).
+   software timestamps are taken by CLOCK_REALTIME, and converted with 'rt_offset'.
+   'rt_offset' is measured by reading REALTIME before and after MONOTONIC_RAW,
+   the width of the two REALTIME reading is the uncertainty of the conversion. */
+typedef struct gptpipc_statistics_swclock{
+	int32_t portIndex;
+	uint32_t ts_count; // number of converted timestamps
+	int64_t rt_offset; // the last offset, REALTIME - MONOTONIC_RAW in nsec
+	uint32_t width_avg; // average width of the measurement in nsec
+	uint32_t width_max; // maximum width of the measurement in nsec
+	uint32_t drift_max; // maximum change of rt_offset between timestamps in nsec
+	uint32_t step_count; // number of REALTIME steps
+} __attribute__((packed)) gptpipc_statistics_swclock_t;
+
 /**
  * @brief data from gptp2d to connected clients
  */
@@ -279,6 +370,8 @@ typedef enum {
 	GPTPIPC_GPTPD_CLOCKD,
 	GPTPIPC_GPTPD_STATSD,
 	GPTPIPC_GPTPD_STATTD,
+	GPTPIPC_GPTPD_SWCLKD,
+	GPTPIPC_GPTPD_SERVOTD,
 } gptpd_data_type_t;
 
 /**
@@ -293,6 +386,8 @@ typedef struct gptpipc_gptpd_data{
 		gptpipc_clock_data_t clockd;
 		gptpipc_statistics_system_t statsd;
 		gptpipc_statistics_tas_t stattd;
+		gptpipc_statistics_swclock_t swclkd;
+		gptpipc_servo_telemetry_t servotd;
 	}u;
 } __attribute__((packed)) gptpipc_gptpd_data_t;
 
@@ -336,6 +431,13 @@ typedef struct gptpipc_thread_data{
  */
 int send_ipc_request(int ipcfd, int domainNumber, int portIndex, gptp_ipc_command_t cmd);
 
+/**
+ * @brief print a servo telemetry record as a CSV line on stdout
+ * @param td	a record of GPTPIPC_GPTPD_SERVOTD
+ * @see GPTPIPC_SERVOTD_CSV_HEADER
+ */
+void gptpipc_print_servotd(gptpipc_servo_telemetry_t *td);
+
 /**
  * @brief run gptp2d ipc thread
  * @result 0:success, -1:error
@@ -45,6 +45,8 @@ static int print_usage(char *pname)
 	ub_console_print("-a|--udpaddr IP address: use UDP mode connection with target IP\n");
 	ub_console_print("-i|--interval query interval time(msec unit):\n");
 	ub_console_print("-o|--oneshot: print one shot of messages and terminate program\n");
+	ub_console_print("-V|--servotd domainNumber: dump the servo telemetry in CSV and exit, "
+			 "-1:all domains\n");
 	return -1;
 }
 
@@ -54,6 +56,8 @@ typedef struct gptpipcmon {
 	uint16_t udpport;
 	char *udpaddr;
 	int query_interval; //in msec
+	bool servotd; // dump the servo telemetry of 'servotd_domain'
+	int servotd_domain;
 }gptpipcmon_t;
 
 static int set_options(gptpipcmon_t *gipcmd, int argc, char *argv[])
@@ -68,8 +72,9 @@ static int set_options(gptpipcmon_t *gipcmd, int argc, char *argv[])
 		{"udpaddr", required_argument, 0, 'a'},
 		{"interval", required_argument, 0, 'i'},
 		{"oneshot", no_argument, 0, 'o'},
+		{"servotd", required_argument, 0, 'V'},
 	};
-	while((oc=getopt_long(argc, argv, "hd:p:nu:a:i:o", long_options, NULL))!=-1){
+	while((oc=getopt_long(argc, argv, "hd:p:nu:a:i:oV:", long_options, NULL))!=-1){
 		switch(oc){
 		case 'd':
 			gipcmd->domainIndex=strtol(optarg, NULL, 0);
@@ -92,6 +97,10 @@ static int set_options(gptpipcmon_t *gipcmd, int argc, char *argv[])
 		case 'o':
 			main_terminate=1;
 			break;
+		case 'V':
+			gipcmd->servotd=true;
+			gipcmd->servotd_domain=strtol(optarg, NULL, 0);
+			break;
 		case 'h':
 		default:
 			return print_usage(argv[0]);
@@ -116,6 +125,8 @@ static void print_key_commands(char *rbuf)
 			 "domain=-1:all domains, port=0:all ports\n");
 	ub_console_print("    R [domain,port] : Reset Statistics info, "
 			 "domain=-1:all domains, port=0:all ports\n");
+	ub_console_print("    V [domain] : Servo telemetry in CSV, "
+			 "domain=-1:all domains\n");
 	ub_console_print("    S: start TSN Scheduling\n");
 	ub_console_print("    s: stop TSN Scheduling\n");
 	ub_console_print("    A: domain,port,msgtype,eventtype,eventrate,"
@@ -238,6 +249,11 @@ static int read_stdin(gptpipc_thread_data_t *ipctd)
 	case 'R':
 		return send_ipc_request(ipctd->ipcfd, domain, port,
 					GPTPIPC_CMD_REQ_STAT_INFO_RESET);
+	case 'V':
+		if(!strchr(rbuf,',')) domain=port;
+		ub_console_print("%s\n", GPTPIPC_SERVOTD_CSV_HEADER);
+		return send_ipc_request(ipctd->ipcfd, domain, 0,
+					GPTPIPC_CMD_REQ_SERVO_TELEMETRY);
 	case 'S':
 		return send_ipc_request(ipctd->ipcfd, 1, 0,
 					GPTPIPC_CMD_TSN_SCHEDULE_CONTROL);
@@ -252,7 +268,12 @@ static int read_stdin(gptpipc_thread_data_t *ipctd)
 
 static int ipcmon_notice_cb(gptpipc_gptpd_data_t *ipcrd, void *ptr)
 {
+	gptpipc_thread_data_t *ipctd=(gptpipc_thread_data_t *)ptr;
 	switch(ipcrd->dtype){
+	case GPTPIPC_GPTPD_SERVOTD:
+		// printed by gptpipc in the interactive mode
+		if(!ipctd->printdata) gptpipc_print_servotd(&ipcrd->u.servotd);
+		break;
 	case GPTPIPC_GPTPD_GPORTD:
 		/* do nothing */
 		break;
@@ -334,7 +355,19 @@ int main(int argc, char *argv[])
 	ipctd.cbdata=&ipctd;
 	ipctd.udpport=gipcmd.udpport;
 	ipctd.udpaddr=gipcmd.udpaddr;
+	if(gipcmd.servotd){
+		// only the CSV lines come on stdout
+		ipctd.printdata=false;
+		ipctd.query_interval=0;
+		main_terminate=1;
+	}
 	if(ipc_reconnect(&ipctd, &ipcrun)) return -1;
+	if(gipcmd.servotd){
+		ub_console_print("%s\n", GPTPIPC_SERVOTD_CSV_HEADER);
+		send_ipc_request(ipctd.ipcfd, gipcmd.servotd_domain, 0,
+				 GPTPIPC_CMD_REQ_SERVO_TELEMETRY);
+		usleep(500000);
+	}
 	if(gipcmd.domainIndex>0){
 		send_ipc_request(ipctd.ipcfd, gipcmd.domainIndex, 1, GPTPIPC_CMD_REQ_GPORT_INFO);
 		send_ipc_request(ipctd.ipcfd, gipcmd.domainIndex, 0, GPTPIPC_CMD_REQ_CLOCK_INFO);
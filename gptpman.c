@@ -126,6 +126,8 @@ struct gptpman_data {
 	int max_ports;
 	int max_domains;
 	FILE *extcmdstdin;
+	uint64_t start_ts64; // monotonic time at the start of gptpman_run
+	bool sync_sent; // the first Sync has been sent
 };
 
 static void set_asCapable(PerTimeAwareSystemGlobal *tasg, gptpsm_ptd_t *ptd)
@@ -370,7 +372,10 @@ static int gptpnet_cb_timeout(gptpman_data_t *gpmand, uint64_t cts64)
 			sm_bmcs_domain_port_update(gpmand, di, pi, cts64);
 		}
 		gm_stable_sm(gpmand->tasds[di].gmsd, cts64);
+		clock_master_sync_receive_sm_holdover(gpmand->tasds[di].cmsrecd, cts64);
 	}
+	// the clock calibration is deferred from the startup, do one clock at a time
+	gptpclock_calibrate_next();
 	return 0;
 }
 
@@ -379,7 +384,6 @@ static int gptpnet_cb_recv(gptpman_data_t *gpmand, int portIndex,
 			   event_data_recv_t *ed, uint64_t cts64)
 {
 	int di=0;
-	int pi;
 	char *msg;
 	void *smret;
 	uint32_t stype;
@@ -401,16 +405,7 @@ static int gptpnet_cb_recv(gptpman_data_t *gpmand, int portIndex,
 
 	switch(ed->msgtype){
 	case SYNC:
-		/* in a TAS, all the TSs work based on 'thisClock', so when a TS is not
-		 * based on 'thisClock', it must be converted.
-		 * When this TAS is synced to GM, 'thisClock' has the same freq. rate as GM,
-		 * but the phase is different. The phase sync happens in the TAS master clock,
-		 * which is gptpclock entity of (ClockIndex=0, tasglb->domainNumber)
-		 */
-		pi=gptpconf_get_intitem(CONF_SINGLE_CLOCK_MODE)?1:portIndex;
-		gptpclock_tsconv(&ed->ts64, pi, 0,
-				 gpmand->tasds[di].tasglb->thisClockIndex,
-				 gpmand->tasds[di].tasglb->domainNumber);
+		// the timestamp is converted to 'thisClock' in md_sync_receive_sm
 		md_sync_receive_sm_recv_sync(gpmand->tasds[di].ptds[portIndex].mdsrecd,
 					     ed, cts64);
 		return 0;
@@ -507,6 +502,13 @@ static int gptpnet_cb_txts(gptpman_data_t *gpmand, int portIndex,
 
 	switch(ed->msgtype){
 	case SYNC:
+		if(!gpmand->sync_sent){
+			gpmand->sync_sent=true;
+			UB_LOG(UBL_INFO, "%s:the first Sync is sent, %"PRIu64"usec after the start,"
+			       " rt=%"PRIu64"\n", __func__,
+			       (uint64_t)((ub_mt_gettime64()-gpmand->start_ts64)/UB_USEC_NS),
+			       ub_rt_gettime64());
+		}
 		md_sync_send_sm_txts(gpmand->tasds[di].ptds[portIndex].mdssendd,
 				     ed, cts64);
 		return 0;
@@ -588,7 +590,8 @@ static int ipc_respond_one_gport(gptpnet_data_t *gpnetd,
 	pd.u.gportd.selectedState=tasglb->selectedState[portIndex];
 	pd.u.gportd.gmStable=gptpclock_get_gmstable(domainIndex);
 	pd.u.gportd.pDelay=ppglb->forAllDomain->neighborPropDelay.nsec;
-	pd.u.gportd.pDelayRateRatio=ppglb->forAllDomain->neighborRateRatio;
+	pd.u.gportd.pDelayRateRatio=
+		gptp_rr_to_double(ppglb->forAllDomain->neighborRateRatio);
 	memcpy(&pd.u.gportd.gmClockId, tasglb->gmIdentity, sizeof(ClockIdentity));
 	pd.u.gportd.annPathSequenceCount=bppglb->annPathSequenceCount;
 	if(bppglb->annPathSequenceCount>=MAX_PATH_TRACE_N) return -1;
@@ -652,12 +655,16 @@ static int ipc_respond_stattd_info(gptpman_data_t *gpmand, int di, int pi, int r
 	pd.u.stattd.domainNumber=gpmand->tasds[di].tasglb->domainNumber;
 	pd.u.stattd.sync_send=sssd->sync_send;
 	pd.u.stattd.sync_fup_send=sssd->sync_fup_send;
+	pd.u.stattd.sync_send_tsconv=sssd->sync_send_tsconv;
+	pd.u.stattd.sync_send_tsconv_skip=sssd->sync_send_tsconv_skip;
 
 	srsd=md_sync_receive_get_stat(gpmand->tasds[di].ptds[pi].mdsrecd);
 	pd.u.stattd.sync_rec=srsd->sync_rec;
 	pd.u.stattd.sync_fup_rec=srsd->sync_fup_rec;
 	pd.u.stattd.sync_rec_valid=srsd->sync_rec_valid;
 	pd.u.stattd.sync_fup_rec_valid=srsd->sync_fup_rec_valid;
+	pd.u.stattd.sync_rec_tsconv=srsd->sync_rec_tsconv;
+	pd.u.stattd.sync_rec_tsconv_skip=srsd->sync_rec_tsconv_skip;
 
 	gssd=md_signaling_send_get_stat(gpmand->tasds[di].ptds[pi].mdsigsendd);
 	pd.u.stattd.signal_msg_interval_send=gssd->signal_msg_interval_send;
@@ -672,6 +679,37 @@ static int ipc_respond_stattd_info(gptpman_data_t *gpmand, int di, int pi, int r
 	return 0;
 }
 
+static int ipc_respond_swclkd_info(gptpman_data_t *gpmand, int pi, int resetcmd,
+				   struct sockaddr *addr)
+{
+	gptpipc_gptpd_data_t pd;
+
+	if(pi<=0 || pi>=gpmand->max_ports) return -1;
+	memset(&pd, 0, sizeof(pd));
+	// only the ports with the software clock respond
+	if(gptpnet_swclock_stat(gpmand->gpnetd, pi-1, &pd.u.swclkd, resetcmd)) return 0;
+	if(resetcmd) return 0;
+	pd.dtype=GPTPIPC_GPTPD_SWCLKD;
+	pd.u.swclkd.portIndex=pi;
+	gptpnet_ipc_respond(gpmand->gpnetd, addr, &pd, sizeof(pd));
+	return 0;
+}
+
+static int ipc_respond_servotd_info(gptpman_data_t *gpmand, int di, struct sockaddr *addr)
+{
+	gptpipc_gptpd_data_t pd;
+	uint32_t n;
+
+	if(di<0 || di>=gpmand->max_domains) return -1;
+	memset(&pd, 0, sizeof(pd));
+	pd.dtype=GPTPIPC_GPTPD_SERVOTD;
+	// from the oldest record, the ring is not changed while this runs
+	for(n=0;!clock_master_sync_receive_sm_telemetry(gpmand->tasds[di].cmsrecd, n,
+							 &pd.u.servotd);n++)
+		gptpnet_ipc_respond(gpmand->gpnetd, addr, &pd, sizeof(pd));
+	return 0;
+}
+
 static int get_domain_index_ipc(gptpman_data_t *gpmand, gptpipc_client_req_data_t *reqdata)
 {
 	if(reqdata->domainNumber==-1){
@@ -853,6 +891,8 @@ static int gptpnet_cb(void *cb_data, int portIndex, gptpnet_event_t event,
 				       (event_data_txts_t *)event_data, cts64);
 		break;
 	}
+	// the clock parameters may be updated by the event
+	gptpclock_rawmap_update();
 	ub_log_flush();
 	if(res) return res;
 	ipc_clock_notice(gpmand);
@@ -964,11 +1004,21 @@ static int gptpnet_ipc_cb(void *cbdata, uint8_t *rdata, int size, struct sockadd
 				if(ppi>0 && ppi!=pi) continue;
 				if(di==0) ipc_respond_statsd_info(gpmand, pi, resetcmd,
 								  addr);
+				if(di==0) ipc_respond_swclkd_info(gpmand, pi, resetcmd,
+								  addr);
 				ipc_respond_stattd_info(gpmand, di, pi, resetcmd,
 							addr);
 			}
 		}
 		return 0;
+	case GPTPIPC_CMD_REQ_SERVO_TELEMETRY:
+		ddi=get_domain_index_ipc(gpmand, reqdata);
+		if(reqdata->domainNumber>=0 && ddi<0) return -1;
+		for(di=0;di<gpmand->max_domains;di++){
+			if(ddi>=0 && ddi!=di) continue;
+			ipc_respond_servotd_info(gpmand, di, addr);
+		}
+		return 0;
 	case GPTPIPC_CMD_REG_ABNORMAL_EVENT:
 		return ipc_register_abnormal_event(reqdata);
 	default:
@@ -977,8 +1027,11 @@ static int gptpnet_ipc_cb(void *cbdata, uint8_t *rdata, int size, struct sockadd
 }
 
 static int stopgptp;
+static int handoffgptp;
 static void signal_handler(int sig)
 {
+	// SIGUSR1 terminates with the handoff to the next gptp2d
+	if(sig==SIGUSR1) handoffgptp=1;
 	stopgptp=1;
 }
 
@@ -1148,6 +1201,19 @@ static int all_sm_close(gptpman_data_t *gpmand)
 	return 0;
 }
 
+/* put the servo state and the neighbor delays for the next gptp2d,
+   the clock parameters are put in gptpclock_close */
+static void handoff_save(gptpman_data_t *gpmand)
+{
+	int di, pi;
+	if(gptpclock_handoff_begin()) return;
+	for(di=0;di<gpmand->max_domains;di++)
+		clock_master_sync_receive_sm_handoff(gpmand->tasds[di].cmsrecd);
+	for(pi=1;pi<gpmand->max_ports;pi++)
+		md_pdelay_req_sm_handoff(gpmand->tasds[0].ptds[pi].mdpdreqd);
+	UB_LOG(UBL_INFO, "%s:hand off to the next gptp2d\n", __func__);
+}
+
 static int gptpman_close(gptpman_data_t *gpmand)
 {
 	free(gpmand->tasds);
@@ -1201,8 +1267,10 @@ static int set_domain_thisClock(PerTimeAwareSystemGlobal *tasglb, int domainNumb
 	tasglb->thisClockIndex=thisClockIndex;
 	gptpclock_set_thisClock(tasglb->thisClockIndex, domainNumber, false);
 
-	/* initialize adjustment rate of the master clock to 0 */
-	gptpclock_setadj(0, thisClockIndex, domainNumber);
+	/* initialize adjustment rate of the master clock to 0,
+	   or to the one inherited from the previous gptp2d */
+	gptpclock_setadj(gptpclock_get_adjppb(thisClockIndex, domainNumber),
+			 thisClockIndex, domainNumber);
 
 	clockid=gptpclock_clockid(tasglb->thisClockIndex, domainNumber);
 	if(!clockid) return -1;
@@ -1267,6 +1335,7 @@ int gptpman_run(char *netdevs[], int max_ports, int max_domains, char *inittm)
 	gpmand=malloc(sizeof(gptpman_data_t));
 	ub_assert(gpmand!=NULL, __func__, "malloc error");
 	memset(gpmand, 0, sizeof(gptpman_data_t));
+	gpmand->start_ts64=ub_mt_gettime64();
 
 	// provide seed to pseudo random generator rand()
 	srand(time(NULL));
@@ -1314,11 +1383,16 @@ int gptpman_run(char *netdevs[], int max_ports, int max_domains, char *inittm)
 	sigact.sa_handler=signal_handler;
 	sigaction(SIGINT, &sigact, NULL);
 	sigaction(SIGTERM, &sigact, NULL);
+	sigaction(SIGUSR1, &sigact, NULL);
 
 	if(gptpnet_activate(gpmand->gpnetd)) goto erexit;
 	if(gptpconf_get_intitem(CONF_ACTIVATE_ABNORMAL_HOOKS)) md_abnormal_init();
 	GPTP_READY_NOTICE;
+	UB_LOG(UBL_INFO, "%s:GPTP_READY, %"PRIu64"usec after the start, rt=%"PRIu64"\n",
+	       __func__, (uint64_t)((ub_mt_gettime64()-gpmand->start_ts64)/UB_USEC_NS),
+	       ub_rt_gettime64());
 	gptpnet_eventloop(gpmand->gpnetd, &stopgptp);
+	if(handoffgptp) handoff_save(gpmand);
 	all_sm_close(gpmand);
 	md_abnormal_close();
 	res=0;
@@ -21,226 +21,849 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <sys/eventfd.h>
 #include "gptpclock.h"
 #include "gptpmasterclock.h"
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+#include "gptpclock_virtual.h"
+#endif
+#include "gptpexpandts.h"
 
-typedef struct gptp_master_clock_data{
+/* the mapping of the shared memory of one run of gptp2d.
+   when gptp2d restarts, a new one is made. The old one is kept until the last
+   gptpmasterclock_close, because the other threads may be still reading it */
+typedef struct gmc_map {
 	int max_domains;
 	int shmfd;
 	int shmsize;
 	gptp_master_clock_shm_t *shm;
-	PTPFD_TYPE *ptpfds;
+	PTPFD_TYPE *ptpfds; // opened at the first access, accessed atomically
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+	// the oscillator state of a virtual clock, mapped before ptpfds is set
+	gptp_vclock_shm_t **vshms;
+	int *vshmfds;
+#endif
+	int smpfd;
+	int smpsize;
+	gptp_sync_sample_shm_t *smpshm; // mapped at the first access, accessed atomically
+	struct gmc_map *retired; // the older mappings
+} gmc_map_t;
+
+/*
+ * The read path only loads 'map' atomically, and doesn't lock anything.
+ * 'mutex' protects the rest, which is used only in the slow path.
+ */
+typedef struct gptp_master_clock_data{
+	CB_THREAD_MUTEX_T mutex;
+	gmc_map_t *map;
 	int suppress_msg;
 	int ref_counter;
 	char shmem_name[GPTP_MAX_SIZE_SHARED_MEMNAME];
+	char smpname[GPTP_MAX_SIZE_SHARED_MEMNAME+sizeof(GPTP_SYNC_SAMPLE_SHM_SUFFIX)];
+	int evfd;
+	CB_THREAD_T evthread;
+	bool evthread_stop;
 } gptp_master_clock_data_t;
 
-static gptp_master_clock_data_t gmcd;
+static gptp_master_clock_data_t gmcd={
+	.mutex=PTHREAD_MUTEX_INITIALIZER,
+	.evfd=-1,
+};
 
-#define GMCD_INIT_CHECK gmcd.max_domains?0:gptpmasterclock_init(NULL)
+/* data of each thread, which is used without locking */
+typedef struct gmc_thread_data{
+	int64_t wake_late; // decaying peak of the wake up latency from the sleep
+	char conv_ptpdev[MAX_PTPDEV_NAME]; // the source ptp device of the conversion
+	PTPFD_TYPE conv_ptpfd;
+} gmc_thread_data_t;
 
-static int ptpdev_open(void)
+static CB_THREAD_KEY_T gmctd_key;
+static CB_THREAD_ONCE_T gmctd_once=CB_THREAD_ONCE_INIT;
+
+// the event thread wakes up in this interval to check the stop request
+#define EVENT_THREAD_CHECK_INTERVAL (100*UB_MSEC_NS)
+// a long sleep is divided by this, to catch up a jump of gPTP time
+#define PRECISE_WAIT_MAX_SLEEP (100*UB_MSEC_NS)
+// the offset between 2 clocks is taken from the narrowest one of the reads
+#define CONV_SAMPLE_TRIES 3
+// the initial spin length, until the wake up latency is measured
+#define PRECISE_WAIT_INIT_SPIN (100*UB_USEC_NS)
+#define PRECISE_WAIT_MIN_SPIN (10*UB_USEC_NS)
+#define PRECISE_WAIT_SPIN_MARGIN (5*UB_USEC_NS)
+
+static void thread_data_free(void *ptr)
+{
+	gmc_thread_data_t *td=(gmc_thread_data_t *)ptr;
+	if(td->conv_ptpdev[0]) PTPDEV_CLOCK_CLOSE(td->conv_ptpfd);
+	free(td);
+}
+
+static void thread_data_key_create(void)
+{
+	CB_THREAD_KEY_CREATE(&gmctd_key, thread_data_free);
+}
+
+/* the data of the calling thread, NULL if it is not yet made and 'create' is false.
+   the data is freed at the exit of the thread */
+static gmc_thread_data_t *thread_data_get(bool create)
+{
+	gmc_thread_data_t *td;
+	CB_THREAD_ONCE(&gmctd_once, thread_data_key_create);
+	td=(gmc_thread_data_t *)CB_THREAD_GETSPECIFIC(gmctd_key);
+	if(td || !create) return td;
+	td=malloc(sizeof(gmc_thread_data_t));
+	ub_assert(td, __func__, "malloc error");
+	memset(td, 0, sizeof(gmc_thread_data_t));
+	CB_THREAD_SETSPECIFIC(gmctd_key, td);
+	return td;
+}
+
+static gmc_thread_data_t *thread_data(void)
+{
+	return thread_data_get(true);
+}
+
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+/* gptp2d shares the oscillator state of a virtual clock,
+   and this process reads the same clock value as gptp2d */
+static int vclock_open(gmc_map_t *m, int domainIndex)
+{
+	char *ptpdev=m->shm->gcpp[domainIndex].ptpdev;
+	if(!VIRTUAL_CLOCKNAME(ptpdev) || m->vshms[domainIndex]) return 0;
+	m->vshms[domainIndex]=gptp_vclock_shm_open(gmcd.shmem_name, ptpdev, O_RDWR,
+						   &m->vshmfds[domainIndex]);
+	if(m->vshms[domainIndex]) return 0;
+	UB_LOG(UBL_ERROR, "ptpdev=%s, can't open the virtual clock\n", ptpdev);
+	return -1;
+}
+
+static void vclock_close(gmc_map_t *m)
+{
+	int i;
+	for(i=0;i<m->max_domains;i++){
+		if(!m->vshms[i]) continue;
+		gptp_vclock_shm_close(m->vshms[i], &m->vshmfds[i], gmcd.shmem_name,
+				      m->shm->gcpp[i].ptpdev, false);
+	}
+	free(m->vshms);
+	free(m->vshmfds);
+}
+#endif
+
+/* the time of the ptp device of the domain */
+static int domain_clock_gettime(gmc_map_t *m, int domainIndex, int64_t *ts64)
+{
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+	if(m->vshms[domainIndex])
+		return gptp_vclock_shm_gettime(m->vshms[domainIndex], ub_rt_gettime64(),
+					       (uint64_t *)ts64);
+#endif
+	PTPDEV_CLOCK_GETTIME(m->ptpfds[domainIndex], *ts64);
+	return 0;
+}
+
+/* call with the mutex locked */
+static int ptpdev_open(gmc_map_t *m)
 {
 	int i;
 	int res=-1;
-	for(i=0;i<gmcd.max_domains;i++){
-		if(gmcd.ptpfds[i]) continue; // already opened
-		if(!gmcd.shm->gcpp[i].ptpdev[0]) continue; // no ptpdev, it may come later
-		gmcd.ptpfds[i]=PTPDEV_CLOCK_OPEN(gmcd.shm->gcpp[i].ptpdev, O_RDONLY);
-		if(!PTPFD_VALID(gmcd.ptpfds[i])){
+	PTPFD_TYPE fd;
+	for(i=0;i<m->max_domains;i++){
+		if(PTPFD_VALID(m->ptpfds[i])) continue; // already opened
+		if(!m->shm->gcpp[i].ptpdev[0]) continue; // no ptpdev, it may come later
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+		if(vclock_open(m, i)) return -1;
+#endif
+		fd=PTPDEV_CLOCK_OPEN(m->shm->gcpp[i].ptpdev, O_RDONLY);
+		if(!PTPFD_VALID(fd)){
 			UB_LOG(UBL_ERROR, "ptpdev=%s, can't open, %s\n",
-			       gmcd.shm->gcpp[i].ptpdev, strerror(errno));
+			       m->shm->gcpp[i].ptpdev, strerror(errno));
 			return -1;
 		}
-		UB_LOG(UBL_DEBUG,"domainIndex=%d, ptpdev=%s\n",i,gmcd.shm->gcpp[i].ptpdev);
+		__atomic_store_n(&m->ptpfds[i], fd, __ATOMIC_RELEASE);
+		UB_LOG(UBL_DEBUG,"domainIndex=%d, ptpdev=%s\n",i,m->shm->gcpp[i].ptpdev);
 		res=0;
 	}
 	return res;
 }
 
-static int gptpmasterclock_health_check(int domainIndex)
+static void gmc_map_close(gmc_map_t *m)
 {
-	if(GMCD_INIT_CHECK) return -1;
-	if(!gmcd.shm->head.max_domains){
-		UB_LOG(UBL_ERROR, "%s:gptp2d might be closed, re-initialize now\n",__func__);
-		gptpmasterclock_close();
-		if(gptpmasterclock_init(gmcd.shmem_name)) return -1;
-	}
-	if(!PTPFD_VALID(gmcd.ptpfds[domainIndex])){
-		// this must be rare case. when there are multiple ptp devices,
-		// there might be latency to add ptp devices.
-		if(!gmcd.suppress_msg){
-			UB_LOG(UBL_INFO, "%s:domainIndex=%d, ptpdev is not yet opened\n",
-			       __func__, domainIndex);
-		}
-		// when ptpdev is not yet opened, it may be opened this time
-		if(ptpdev_open() || !PTPFD_VALID(gmcd.ptpfds[domainIndex])){
-			gmcd.suppress_msg=1;
-			return -1;
-		}
-		UB_LOG(UBL_INFO, "%s:domainIndex=%d, ptpdev=%s is opened\n",
-		       __func__, domainIndex, gmcd.shm->gcpp[domainIndex].ptpdev);
-		gmcd.suppress_msg=0;
+	int i;
+	if(m->smpshm)
+		cb_close_shared_mem(m->smpshm, &m->smpfd, gmcd.smpname, m->smpsize, false);
+	for(i=0;i<m->max_domains;i++){
+		if(PTPFD_VALID(m->ptpfds[i])) PTPDEV_CLOCK_CLOSE(m->ptpfds[i]);
 	}
-	return 0;
+	free(m->ptpfds);
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+	vclock_close(m);
+#endif
+	cb_close_shared_mem(m->shm, &m->shmfd, gmcd.shmem_name, m->shmsize, false);
+	free(m);
 }
 
-int gptpmasterclock_init(const char *shmem_name)
+/* call with the mutex locked */
+static gmc_map_t *gmc_map_open(void)
 {
-	int *dnum;
+	gmc_map_t *m;
+	gptp_master_clock_shm_head_t *head, hd;
+	int shmfd, max_domains, i;
+	int hsize=offsetof(gptp_master_clock_shm_head_t, active_domain);
 
-	gmcd.ref_counter++;
-	UB_LOG(UBL_INFO, "%s: gptp2-"XL4PKGVERSION", ref_counter=%d\n",
-	       __func__, gmcd.ref_counter);
-	if(gmcd.max_domains){
-		UB_LOG(UBL_DEBUG, "%s: already initialized\n", __func__);
-		return 0;
-	}
 	if(gmcd.suppress_msg) ub_log_change(CB_COMBASE_LOGCAT, UBL_NONE, UBL_NONE);
-	if(shmem_name && shmem_name[0]) {
-		snprintf(gmcd.shmem_name, GPTP_MAX_SIZE_SHARED_MEMNAME, "%s", shmem_name);
-	}else{
-		strcpy(gmcd.shmem_name, GPTP_MASTER_CLOCK_SHARED_MEM);
-	}
-	dnum=(int*)cb_get_shared_mem(&gmcd.shmfd, gmcd.shmem_name, sizeof(int), O_RDONLY);
+	head=(gptp_master_clock_shm_head_t *)cb_get_shared_mem(
+		&shmfd, gmcd.shmem_name, hsize, O_RDONLY);
 	if(gmcd.suppress_msg) ub_log_return(CB_COMBASE_LOGCAT);
-	if(!dnum){
+	if(!head){
 		if(!gmcd.suppress_msg){
 			UB_LOG(UBL_ERROR, "%s:master clock is not yet register by gptp\n",
 			       __func__);
 		}
 		goto erexit;
 	}
-	if(*dnum==0){
+	memcpy(&hd, head, hsize);
+	cb_close_shared_mem(head, &shmfd, gmcd.shmem_name, hsize, false);
+	max_domains=hd.max_domains;
+	if(max_domains && (hd.version!=GPTP_MASTER_CLOCK_SHM_VERSION ||
+			   hd.head_size!=sizeof(gptp_master_clock_shm_head_t) ||
+			   hd.ppara_size!=sizeof(gptp_clock_ppara_t))){
+		// gptp2d and this library are built from different versions
+		UB_LOG(UBL_ERROR, "%s:%s has a different layout, version=0x%x, "
+		       "head_size=%d, ppara_size=%d, expected 0x%x, %d, %d\n",
+		       __func__, gmcd.shmem_name, hd.version, hd.head_size, hd.ppara_size,
+		       GPTP_MASTER_CLOCK_SHM_VERSION,
+		       (int)sizeof(gptp_master_clock_shm_head_t),
+		       (int)sizeof(gptp_clock_ppara_t));
+		goto erexit;
+	}
+	if(max_domains==0){
 		if(!gmcd.suppress_msg){
 			UB_LOG(UBL_ERROR, "%s:master clock is not yet added\n", __func__);
 		}
 		goto erexit;
 	}
-	UB_LOG(UBL_DEBUG, "%s:*dnum=%d\n", __func__, *dnum);
-	gmcd.max_domains=*dnum;
-	cb_close_shared_mem(dnum, &gmcd.shmfd, gmcd.shmem_name, sizeof(int), false);
-	gmcd.shmsize=sizeof(gptp_clock_ppara_t)*gmcd.max_domains +
+	UB_LOG(UBL_DEBUG, "%s:max_domains=%d\n", __func__, max_domains);
+	m=malloc(sizeof(gmc_map_t));
+	ub_assert(m, __func__, "malloc error");
+	memset(m, 0, sizeof(gmc_map_t));
+	m->max_domains=max_domains;
+	m->shmsize=sizeof(gptp_clock_ppara_t)*max_domains +
 		sizeof(gptp_master_clock_shm_head_t);
-	gmcd.shm=(gptp_master_clock_shm_t *)cb_get_shared_mem(
-		&gmcd.shmfd, gmcd.shmem_name, gmcd.shmsize, O_RDWR);
-	if(!gmcd.shm){
+	m->shm=(gptp_master_clock_shm_t *)cb_get_shared_mem(
+		&m->shmfd, gmcd.shmem_name, m->shmsize, O_RDWR);
+	if(!m->shm){
 		UB_LOG(UBL_ERROR, "%s:can't get the shared memory\n", __func__);
+		free(m);
+		goto erexit;
+	}
+	m->ptpfds=malloc(max_domains*sizeof(PTPFD_TYPE));
+	ub_assert(m->ptpfds, __func__, "malloc error");
+	for(i=0;i<max_domains;i++) m->ptpfds[i]=-1;
+#ifdef PTP_VIRTUAL_CLOCK_SUPPORT
+	m->vshms=calloc(max_domains, sizeof(gptp_vclock_shm_t *));
+	m->vshmfds=calloc(max_domains, sizeof(int));
+	ub_assert(m->vshms && m->vshmfds, __func__, "malloc error");
+#endif
+	if(ptpdev_open(m)){
+		gmc_map_close(m);
 		goto erexit;
 	}
-	gmcd.ptpfds=malloc(gmcd.max_domains*sizeof(PTPFD_TYPE));
-	ub_assert(gmcd.ptpfds, __func__, "malloc error");
-	memset(gmcd.ptpfds,0,gmcd.max_domains*sizeof(PTPFD_TYPE));
-	if(ptpdev_open()) goto erexit;
 	if(gmcd.suppress_msg){
 		UB_LOG(UBL_INFO, "%s:recovered\n",__func__);
 		gmcd.suppress_msg=0;
 	}
-	UB_LOG(UBL_DEBUG, "%s:done\n",__func__);
-	return 0;
+	return m;
 erexit:
 	if(!gmcd.suppress_msg){
 		UB_LOG(UBL_INFO, "%s:failed\n",__func__);
-		gptpmasterclock_close();
 		gmcd.suppress_msg=1;
+	}
+	return NULL;
+}
+
+/* the current mapping, gptpmasterclock_init is called when it is not yet initialized */
+static gmc_map_t *gmc_get(void)
+{
+	gmc_map_t *m;
+	m=__atomic_load_n(&gmcd.map, __ATOMIC_ACQUIRE);
+	if(m) return m;
+	if(gptpmasterclock_init(NULL)) return NULL;
+	return __atomic_load_n(&gmcd.map, __ATOMIC_ACQUIRE);
+}
+
+/* the current mapping, re-initialized when gptp2d was closed */
+static gmc_map_t *gmc_check(void)
+{
+	gmc_map_t *m, *nm;
+	if(!(m=gmc_get())) return NULL;
+	if(__atomic_load_n(&m->shm->head.max_domains, __ATOMIC_ACQUIRE)) return m;
+	CB_THREAD_MUTEX_LOCK(&gmcd.mutex);
+	nm=gmcd.map;
+	if(nm==m){
+		// no other thread has done it yet
+		if(!gmcd.suppress_msg){
+			UB_LOG(UBL_ERROR, "%s:gptp2d might be closed, re-initialize now\n",
+			       __func__);
+		}
+		nm=gmc_map_open();
+		if(nm){
+			nm->retired=m;
+			__atomic_store_n(&gmcd.map, nm, __ATOMIC_RELEASE);
+		}
+	}
+	CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+	return nm;
+}
+
+static gmc_map_t *gptpmasterclock_health_check(int domainIndex)
+{
+	gmc_map_t *m;
+	if(!(m=gmc_check())) return NULL;
+	if(domainIndex<0 || domainIndex>=m->max_domains) return NULL;
+	if(PTPFD_VALID(__atomic_load_n(&m->ptpfds[domainIndex], __ATOMIC_ACQUIRE))) return m;
+	CB_THREAD_MUTEX_LOCK(&gmcd.mutex);
+	if(PTPFD_VALID(m->ptpfds[domainIndex])) goto erexit; // opened by another thread
+	// this must be rare case. when there are multiple ptp devices,
+	// there might be latency to add ptp devices.
+	if(!gmcd.suppress_msg){
+		UB_LOG(UBL_INFO, "%s:domainIndex=%d, ptpdev is not yet opened\n",
+		       __func__, domainIndex);
+	}
+	// when ptpdev is not yet opened, it may be opened this time
+	if(ptpdev_open(m) || !PTPFD_VALID(m->ptpfds[domainIndex])){
+		gmcd.suppress_msg=1;
+		m=NULL;
+		goto erexit;
+	}
+	UB_LOG(UBL_INFO, "%s:domainIndex=%d, ptpdev=%s is opened\n",
+	       __func__, domainIndex, m->shm->gcpp[domainIndex].ptpdev);
+	gmcd.suppress_msg=0;
+erexit:
+	CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+	return m;
+}
+
+/* the sync sample ring is mapped at the first access */
+static gptp_sync_sample_ring_t *sync_sample_ring(int domainIndex,
+						 gptp_sync_sample_shm_t **rsshm)
+{
+	gmc_map_t *m;
+	gptp_sync_sample_shm_t *sshm;
+	int max_domains, smpfd;
+	uint32_t num_slots;
+	if(!(m=gmc_check())) return NULL;
+	if(domainIndex<0 || domainIndex>=m->max_domains) return NULL;
+	sshm=__atomic_load_n(&m->smpshm, __ATOMIC_ACQUIRE);
+	if(!sshm){
+		CB_THREAD_MUTEX_LOCK(&gmcd.mutex);
+		if(!(sshm=m->smpshm)){
+			snprintf(gmcd.smpname, sizeof(gmcd.smpname),
+				 "%s"GPTP_SYNC_SAMPLE_SHM_SUFFIX, gmcd.shmem_name);
+			sshm=(gptp_sync_sample_shm_t *)cb_get_shared_mem(
+				&smpfd, gmcd.smpname, sizeof(gptp_sync_sample_shm_t), O_RDWR);
+			if(!sshm) goto erexit;
+			max_domains=__atomic_load_n(&sshm->max_domains, __ATOMIC_ACQUIRE);
+			num_slots=sshm->num_slots;
+			cb_close_shared_mem(sshm, &smpfd, gmcd.smpname,
+					    sizeof(gptp_sync_sample_shm_t), false);
+			sshm=NULL;
+			if(!max_domains || !num_slots) goto erexit;
+			m->smpsize=gptp_sync_sample_shm_size(max_domains, num_slots);
+			sshm=(gptp_sync_sample_shm_t *)cb_get_shared_mem(
+				&m->smpfd, gmcd.smpname, m->smpsize, O_RDWR);
+			if(!sshm) goto erexit;
+			if(sshm->max_domains!=max_domains || sshm->num_slots!=num_slots){
+				// re-created between the 2 mappings
+				cb_close_shared_mem(sshm, &m->smpfd, gmcd.smpname,
+						    m->smpsize, false);
+				sshm=NULL;
+				goto erexit;
+			}
+			__atomic_store_n(&m->smpshm, sshm, __ATOMIC_RELEASE);
+		}
+	erexit:
+		CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+		if(!sshm) return NULL;
+	}
+	if(domainIndex>=sshm->max_domains) return NULL;
+	*rsshm=sshm;
+	return gptp_sync_sample_ring(sshm, domainIndex);
+}
+
+int gptpmasterclock_init(const char *shmem_name)
+{
+	gmc_map_t *m;
+	int res=0;
+
+	CB_THREAD_MUTEX_LOCK(&gmcd.mutex);
+	gmcd.ref_counter++;
+	UB_LOG(UBL_INFO, "%s: gptp2-"XL4PKGVERSION", ref_counter=%d\n",
+	       __func__, gmcd.ref_counter);
+	if(gmcd.map){
+		UB_LOG(UBL_DEBUG, "%s: already initialized\n", __func__);
+		goto erexit;
+	}
+	if(shmem_name && shmem_name[0]) {
+		snprintf(gmcd.shmem_name, GPTP_MAX_SIZE_SHARED_MEMNAME, "%s", shmem_name);
 	}else{
-		gptpmasterclock_close();
+		strcpy(gmcd.shmem_name, GPTP_MASTER_CLOCK_SHARED_MEM);
 	}
-	gmcd.ref_counter--;
-	return -1;
+	m=gmc_map_open();
+	if(!m){
+		gmcd.ref_counter--;
+		res=-1;
+		goto erexit;
+	}
+	__atomic_store_n(&gmcd.map, m, __ATOMIC_RELEASE);
+	UB_LOG(UBL_DEBUG, "%s:done\n",__func__);
+erexit:
+	CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+	return res;
+}
+
+static int event_fd_close_locked(void)
+{
+	if(gmcd.evfd<0) return -1;
+	__atomic_store_n(&gmcd.evthread_stop, true, __ATOMIC_RELEASE);
+	CB_THREAD_JOIN(gmcd.evthread, NULL);
+	close(gmcd.evfd);
+	gmcd.evfd=-1;
+	return 0;
 }
 
 int gptpmasterclock_close(void)
 {
-	int i;
-	if(!gmcd.max_domains) return -1;
-	if(!gmcd.shm) return -1;
+	gmc_map_t *m, *rm;
+	gmc_thread_data_t *td;
+	CB_THREAD_MUTEX_LOCK(&gmcd.mutex);
+	if(!gmcd.map){
+		CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+		return -1;
+	}
 	gmcd.ref_counter--;
 	UB_LOG(UBL_INFO, "%s: ref_counter=%d\n", __func__, gmcd.ref_counter);
-	if(gmcd.ref_counter>0) return 0;
-	for(i=0;i<gmcd.max_domains;i++){
-		if(!gmcd.shm->gcpp[i].ptpdev[0]) continue;
-		PTPDEV_CLOCK_CLOSE(gmcd.ptpfds[i]);
-	}
-	free(gmcd.ptpfds);
-	cb_close_shared_mem(gmcd.shm, &gmcd.shmfd,
-			    gmcd.shmem_name, gmcd.shmsize, false);
-	memset(&gmcd, 0, sizeof(gmcd));
+	if(gmcd.ref_counter>0){
+		CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+		return 0;
+	}
+	event_fd_close_locked();
+	// the conversion devices of the other threads are closed at their exit
+	td=thread_data_get(false);
+	if(td && td->conv_ptpdev[0]){
+		PTPDEV_CLOCK_CLOSE(td->conv_ptpfd);
+		td->conv_ptpdev[0]=0;
+	}
+	m=gmcd.map;
+	__atomic_store_n(&gmcd.map, NULL, __ATOMIC_RELEASE);
+	while(m){
+		rm=m->retired;
+		gmc_map_close(m);
+		m=rm;
+	}
+	gmcd.suppress_msg=0;
+	CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
 	return 0;
 }
 
 void gptpmasterclock_dump_offset(void)
 {
+	gmc_map_t *m;
 	int i;
-	if(GMCD_INIT_CHECK) return;
-	printf("max_domains=%d, active_domain=%d\n", gmcd.shm->head.max_domains,
-	       gmcd.shm->head.active_domain);
-	for(i=0;i<gmcd.max_domains;i++){
+	if(!(m=gmc_get())) return;
+	printf("max_domains=%d, active_domain=%d, generation=%"PRIu32"\n",
+	       m->shm->head.max_domains, m->shm->head.active_domain,
+	       m->shm->head.generation);
+	for(i=0;i<m->max_domains;i++){
 		printf("index=%d, domainNumber=%d, gmsync=%d, gmchange_ind=%"PRIu32"\n",
-		       i, gmcd.shm->gcpp[i].domainNumber,gmcd.shm->gcpp[i].gmsync,
-		       gmcd.shm->gcpp[i].gmchange_ind);
-		printf("offset %"PRIi64"nsec\n", gmcd.shm->gcpp[i].offset64);
+		       i, m->shm->gcpp[i].domainNumber,m->shm->gcpp[i].gmsync,
+		       m->shm->gcpp[i].gmchange_ind);
+		printf("offset %"PRIi64"nsec\n", m->shm->gcpp[i].offset64);
 	}
 	printf("\n");
 }
 
 int gptpmasterclock_gm_domainIndex(void)
 {
-	if(GMCD_INIT_CHECK) return -1;
-	return gmcd.shm->head.active_domain;
+	gmc_map_t *m;
+	if(!(m=gmc_get())) return -1;
+	return m->shm->head.active_domain;
 }
 
 int gptpmasterclock_gm_domainNumber(void)
 {
-	int i;
-	i= gptpmasterclock_gm_domainIndex();
-	if(i<0) return -1;
-	return gmcd.shm->gcpp[i].domainNumber;
+	gmc_map_t *m;
+	if(!(m=gmc_get())) return -1;
+	return m->shm->gcpp[m->shm->head.active_domain].domainNumber;
 }
 
 int gptpmasterclock_gmchange_ind(void)
 {
-	int i;
-	i= gptpmasterclock_gm_domainIndex();
-	if(i<0) return -1;
-	return gmcd.shm->gcpp[i].gmchange_ind;
+	gmc_map_t *m;
+	if(!(m=gmc_get())) return -1;
+	return m->shm->gcpp[m->shm->head.active_domain].gmchange_ind;
 }
 
 int gptpmasterclock_get_max_domains(void)
 {
-	return gmcd.max_domains;
+	gmc_map_t *m;
+	m=__atomic_load_n(&gmcd.map, __ATOMIC_ACQUIRE);
+	return m?m->max_domains:0;
 }
 
-int gptpmasterclock_get_domain_ts64(int64_t *ts64, int domainIndex)
+uint32_t gptpmasterclock_generation(void)
+{
+	gmc_map_t *m;
+	if(!(m=gmc_get())) return 0;
+	return __atomic_load_n(&m->shm->head.generation, __ATOMIC_ACQUIRE);
+}
+
+int gptpmasterclock_gmstable(int domainIndex)
+{
+	gmc_map_t *m;
+	if(!(m=gmc_get())) return -1;
+	if(domainIndex<0 || domainIndex>=m->max_domains) return -1;
+	return m->shm->gcpp[domainIndex].gmstable;
+}
+
+uint32_t gptpmasterclock_event_seq(void)
+{
+	gmc_map_t *m;
+	if(!(m=gmc_check())) return 0;
+	return __atomic_load_n(&m->shm->head.event_seq, __ATOMIC_ACQUIRE);
+}
+
+int gptpmasterclock_event_wait(uint32_t *event_seq, int64_t toutns, uint32_t *event_flags)
+{
+	gmc_map_t *m;
+	uint32_t seq;
+	int64_t tout=0;
+	// moves to the new shared memory after gptp2d restarted
+	if(!(m=gmc_check())) return -1;
+	if(toutns>=0) tout=ub_mt_gettime64()+toutns;
+	while((seq=__atomic_load_n(&m->shm->head.event_seq, __ATOMIC_ACQUIRE))==
+	      *event_seq){
+		if(toutns>=0){
+			toutns=tout-ub_mt_gettime64();
+			if(toutns<=0) return 0;
+		}
+		// returns immediately when event_seq has been already changed
+		gptpclock_futex_wait(&m->shm->head.event_seq, seq, toutns);
+	}
+	*event_seq=seq;
+	if(event_flags) *event_flags=m->shm->head.event_flags;
+	return 1;
+}
+
+static void *event_thread_proc(void *ptr)
 {
-	int64_t dts;
-	double adjrate;
-	int rval=-1;
-	if(gptpmasterclock_health_check(domainIndex)) return -1;
-	if(domainIndex<0 || domainIndex>=gmcd.max_domains) return -1;
-	gptpclock_mutex_trylock(&gmcd.shm->head.mcmutex);
-	PTPDEV_CLOCK_GETTIME(gmcd.ptpfds[domainIndex], *ts64);
+	uint32_t seq;
+	uint64_t v=1;
+	int res;
+	seq=gptpmasterclock_event_seq();
+	while(!__atomic_load_n(&gmcd.evthread_stop, __ATOMIC_ACQUIRE)){
+		res=gptpmasterclock_event_wait(&seq, EVENT_THREAD_CHECK_INTERVAL, NULL);
+		if(res<0){
+			// gptp2d is down, check again later
+			usleep(EVENT_THREAD_CHECK_INTERVAL/UB_USEC_NS);
+			continue;
+		}
+		if(res==0) continue;
+		if(write(gmcd.evfd, &v, sizeof(v))!=sizeof(v)){
+			UB_LOG(UBL_ERROR, "%s:can't write the eventfd, %s\n",
+			       __func__, strerror(errno));
+		}
+	}
+	return NULL;
+}
+
+int gptpmasterclock_event_fd(void)
+{
+	int res;
+	if(!gmc_get()) return -1;
+	CB_THREAD_MUTEX_LOCK(&gmcd.mutex);
+	if(gmcd.evfd>=0) goto erexit;
+	gmcd.evfd=eventfd(0, EFD_CLOEXEC);
+	if(gmcd.evfd<0){
+		UB_LOG(UBL_ERROR, "%s:eventfd error, %s\n", __func__, strerror(errno));
+		gmcd.evfd=-1;
+		goto erexit;
+	}
+	gmcd.evthread_stop=false;
+	if(CB_THREAD_CREATE(&gmcd.evthread, NULL, event_thread_proc, NULL)){
+		UB_LOG(UBL_ERROR, "%s:can't start the event thread\n", __func__);
+		close(gmcd.evfd);
+		gmcd.evfd=-1;
+	}
+erexit:
+	res=gmcd.evfd;
+	CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+	return res;
+}
 
-	adjrate=gmcd.shm->gcpp[domainIndex].adjrate;
-	if(adjrate != 0.0){
+int gptpmasterclock_event_fd_close(void)
+{
+	int res;
+	CB_THREAD_MUTEX_LOCK(&gmcd.mutex);
+	res=event_fd_close_locked();
+	CB_THREAD_MUTEX_UNLOCK(&gmcd.mutex);
+	return res;
+}
+
+/* gPTP time by the RAW mapping, the ptp device is not accessed.
+   return -1 when the mapping is not valid */
+static int rawmap_ts64(gptp_clock_ppara_t *pp, int64_t *ts64)
+{
+	int64_t raw, dts;
+	if(!pp->map_valid_until) return -1;
+	raw=gptpclock_rawts64();
+	dts=raw-pp->map_rawts64;
+	if(dts<0 || raw>=pp->map_valid_until) return -1;
+	*ts64=pp->map_gptpts64+dts+gptp_rr_delta_ns(dts, pp->map_rate);
+	return 0;
+}
+
+/* the quality at 'raw', from the parameters which the servo set at the last Sync */
+static void clock_quality(const gptp_clock_quality_para_t *qp, bool gmstable, int64_t raw,
+			  gptpipc_clock_quality_t *quality)
+{
+	int64_t age;
+	memset(quality, 0, sizeof(gptpipc_clock_quality_t));
+	quality->servo_state=qp->servo_state;
+	quality->rate_ratio=qp->rate_ratio;
+	if(gmstable) quality->flags|=GPTPIPC_CLOCK_QUALITY_FLAG_GM_STABLE;
+	quality->sync_age=-1;
+	if(qp->servo_state==GPTPIPC_SERVO_STATE_GM) return;
+	if(!qp->sync_rawts64){
+		quality->uncertainty=-1;
+		return;
+	}
+	age=raw-qp->sync_rawts64;
+	if(age<0) age=0;
+	quality->sync_age=age;
+	if(age>qp->sync_timeout) quality->flags|=GPTPIPC_CLOCK_QUALITY_FLAG_HOLDOVER;
+	if(qp->holdover_rawts64 && raw>qp->holdover_rawts64){
+		// the uncertainty at the holdover start grows by the model errors
+		quality->holdover_time=raw-qp->holdover_rawts64;
+		quality->uncertainty=qp->uncertainty+gptpclock_holdover_error(
+			qp->holdover_ferr_ppt, qp->holdover_derr_ppt, quality->holdover_time);
+		return;
+	}
+	quality->uncertainty=qp->uncertainty+(age/UB_USEC_NS)*qp->drift_ppb/UB_MSEC_NS;
+}
+
+static int get_domain_ts64(int64_t *ts64, int domainIndex, bool use_rawmap,
+			   gptpipc_clock_quality_t *quality)
+{
+	int64_t dts, hwts64=0, offset64=0, last_setts64=0, raw=0;
+	ScaledRateRatio adjrate=RATE_RATIO_ONE;
+	gptp_clock_quality_para_t qp;
+	bool gmstable=false;
+	gptp_clock_ppara_t *pp;
+	gmc_map_t *m;
+	uint32_t seq;
+	bool mapped=false;
+	int i;
+	if(!(m=gptpmasterclock_health_check(domainIndex))) return -1;
+	pp=&m->shm->gcpp[domainIndex];
+	// lock-free read, retry when gptp2d updated the parameters in the middle
+	for(i=0;i<GPTP_MASTER_CLOCK_SEQ_RETRY;i++){
+		gptpclock_seq_read_backoff(i);
+		seq=gptpclock_seq_read_begin(pp);
+		mapped=use_rawmap && !rawmap_ts64(pp, ts64);
+		if(!mapped){
+			if(domain_clock_gettime(m, domainIndex, &hwts64)) return -1;
+			adjrate=pp->adjrate;
+			offset64=pp->offset64;
+			last_setts64=pp->last_setts64;
+		}
+		if(quality){
+			// read in the same sequence, consistent with the time
+			raw=gptpclock_rawts64();
+			qp=pp->quality;
+			gmstable=pp->gmstable;
+		}
+		if(!gptpclock_seq_read_retry(pp, seq)) break;
+	}
+	if(i==GPTP_MASTER_CLOCK_SEQ_RETRY){
+		// the parameters are being updated such a long time; the writer must crash
+		UB_LOG(UBL_WARN, "%s:the process is very slow, or gptp2d may crash\n",
+		       __func__);
+		return -1;
+	}
+	if(quality) clock_quality(&qp, gmstable, raw, quality);
+	if(mapped) return 0;
+
+	dts=0;
+	if(adjrate != RATE_RATIO_ONE){
 		// get dts, which is diff between now and last setts time
-		dts=*ts64-gmcd.shm->gcpp[domainIndex].last_setts64;
+		dts=gptp_rr_delta_ns(hwts64-last_setts64, adjrate);
 	}
 
 	// add offset
-	*ts64+=gmcd.shm->gcpp[domainIndex].offset64;
-	if(adjrate != 0.0) *ts64+=dts*adjrate;
-	rval=0;
+	*ts64=hwts64+offset64+dts;
+	return 0;
+}
+
+int gptpmasterclock_get_domain_ts64(int64_t *ts64, int domainIndex)
+{
+	return get_domain_ts64(ts64, domainIndex, true, NULL);
+}
+
+int gptpmasterclock_get_domain_ts64_ptpdev(int64_t *ts64, int domainIndex)
+{
+	return get_domain_ts64(ts64, domainIndex, false, NULL);
+}
+
+int gptpmasterclock_get_domain_ts64_quality(int64_t *ts64, gptpipc_clock_quality_t *quality,
+					    int domainIndex)
+{
+	if(!quality) return -1;
+	return get_domain_ts64(ts64, domainIndex, true, quality);
+}
+
+typedef struct conv_para {
+	int64_t shift; // the ptp device of the domain - the source clock
+	int64_t offset64;
+	int64_t last_setts64;
+	ScaledRateRatio adjrate;
+} conv_para_t;
+
+static int64_t read_source(PTPFD_TYPE sfd, clockid_t clockid)
+{
+	struct timespec ts;
+	int64_t ts64=0;
+	if(PTPFD_VALID(sfd)){
+		PTPDEV_CLOCK_GETTIME(sfd, ts64);
+		return ts64;
+	}
+	clock_gettime(clockid, &ts);
+	return UB_TS2NSEC(ts);
+}
+
+/* the parameters to convert the time of the source clock to gPTP time of the domain.
+   when 'sfd' is not valid, 'clockid' is the source.
+   'shift' is measured in the same sequence as the other parameters */
+static int get_conv_para(gmc_map_t *m, int domainIndex, bool same_clock, PTPFD_TYPE sfd,
+			 clockid_t clockid, conv_para_t *cp)
+{
+	gptp_clock_ppara_t *pp;
+	int64_t s1, s2, p=0, w, wmin;
+	uint32_t seq;
+	int i, j;
+	pp=&m->shm->gcpp[domainIndex];
+	for(i=0;i<GPTP_MASTER_CLOCK_SEQ_RETRY;i++){
+		gptpclock_seq_read_backoff(i);
+		seq=gptpclock_seq_read_begin(pp);
+		cp->shift=0;
+		for(j=0,wmin=-1;!same_clock && j<CONV_SAMPLE_TRIES;j++){
+			s1=read_source(sfd, clockid);
+			if(domain_clock_gettime(m, domainIndex, &p)) return -1;
+			s2=read_source(sfd, clockid);
+			w=s2-s1;
+			if(wmin>=0 && w>=wmin) continue;
+			wmin=w;
+			cp->shift=p-(s1+w/2);
+		}
+		cp->offset64=pp->offset64;
+		cp->last_setts64=pp->last_setts64;
+		cp->adjrate=pp->adjrate;
+		if(!gptpclock_seq_read_retry(pp, seq)) return 0;
+	}
+	UB_LOG(UBL_WARN, "%s:the process is very slow, or gptp2d may crash\n", __func__);
+	return -1;
+}
 
-	CB_THREAD_MUTEX_UNLOCK(&gmcd.shm->head.mcmutex);
-	return rval;
+/* the same computation as get_domain_ts64 for each timestamp */
+static void conv_to_gptp(const conv_para_t *cp, const int64_t *ts, int64_t *gts, int num)
+{
+	int64_t phc;
+	int i;
+	for(i=0;i<num;i++){
+		phc=ts[i]+cp->shift;
+		gts[i]=phc+cp->offset64+gptp_rr_delta_ns(phc-cp->last_setts64, cp->adjrate);
+	}
+}
+
+int gptpmasterclock_ptpdev2gptp(const char *ptpdev, const int64_t *ts, int64_t *gts,
+				int num, int domainIndex)
+{
+	conv_para_t cp;
+	gmc_map_t *m;
+	gmc_thread_data_t *td;
+	bool same_clock;
+	if(!(m=gptpmasterclock_health_check(domainIndex))) return -1;
+	td=thread_data();
+	same_clock=!ptpdev || !strcmp(ptpdev, m->shm->gcpp[domainIndex].ptpdev);
+	if(!same_clock && strcmp(ptpdev, td->conv_ptpdev)){
+		// keep the last one opened in each thread, a new device closes it
+		if(td->conv_ptpdev[0]) PTPDEV_CLOCK_CLOSE(td->conv_ptpfd);
+		snprintf(td->conv_ptpdev, MAX_PTPDEV_NAME, "%s", ptpdev);
+		td->conv_ptpfd=PTPDEV_CLOCK_OPEN(td->conv_ptpdev, O_RDONLY);
+		if(!PTPFD_VALID(td->conv_ptpfd)){
+			UB_LOG(UBL_ERROR,"%s:can't open %s, %s\n", __func__, ptpdev,
+			       strerror(errno));
+			td->conv_ptpdev[0]=0;
+			return -1;
+		}
+	}
+	if(get_conv_para(m, domainIndex, same_clock, td->conv_ptpfd, 0, &cp)) return -1;
+	conv_to_gptp(&cp, ts, gts, num);
+	return 0;
+}
+
+int gptpmasterclock_sysclock2gptp(clockid_t clockid, const int64_t *ts, int64_t *gts,
+				  int num, int domainIndex)
+{
+	gptp_clock_ppara_t *pp;
+	int64_t rts64, gts64, d;
+	ScaledRateRatio rate;
+	conv_para_t cp;
+	gmc_map_t *m;
+	uint32_t seq;
+	int i, j;
+	if(!(m=gptpmasterclock_health_check(domainIndex))) return -1;
+	if(clockid==CLOCK_MONOTONIC_RAW){
+		// the mapping made by gptp2d includes the rate
+		pp=&m->shm->gcpp[domainIndex];
+		for(i=0;i<GPTP_MASTER_CLOCK_SEQ_RETRY;i++){
+			gptpclock_seq_read_backoff(i);
+			seq=gptpclock_seq_read_begin(pp);
+			if(!pp->map_valid_until ||
+			   gptpclock_rawts64()>=pp->map_valid_until) break;
+			rts64=pp->map_rawts64;
+			gts64=pp->map_gptpts64;
+			rate=pp->map_rate;
+			if(gptpclock_seq_read_retry(pp, seq)) continue;
+			for(j=0;j<num;j++){
+				d=ts[j]-rts64;
+				gts[j]=gts64+d+gptp_rr_delta_ns(d, rate);
+			}
+			return 0;
+		}
+	}
+	if(get_conv_para(m, domainIndex, false, -1, clockid, &cp)) return -1;
+	conv_to_gptp(&cp, ts, gts, num);
+	return 0;
 }
 
 int64_t gptpmasterclock_getts64(void)
 {
 	int64_t ts64;
-	if(GMCD_INIT_CHECK) return -1;
-	if(gptpmasterclock_get_domain_ts64(&ts64, gmcd.shm->head.active_domain)) return -1;
+	gmc_map_t *m;
+	if(!(m=gmc_get())) return -1;
+	if(gptpmasterclock_get_domain_ts64(&ts64, m->shm->head.active_domain)) return -1;
+	return ts64;
+}
+
+int64_t gptpmasterclock_getts64_quality(gptpipc_clock_quality_t *quality)
+{
+	int64_t ts64;
+	gmc_map_t *m;
+	if(!(m=gmc_get())) return -1;
+	if(gptpmasterclock_get_domain_ts64_quality(&ts64, quality, m->shm->head.active_domain))
+		return -1;
 	return ts64;
 }
 
@@ -249,12 +872,104 @@ int64_t gptpmasterclock_getts64(void)
  * nanosleep relies on 'Linux kernel hrtimers'; check hrtimers.txt
  * in the kernel Documents.
  */
+/* rate of gPTP time to the system clock, by the RAW mapping of the active domain.
+   CLOCK_MONOTONIC may be slewed by NTP, but it is small enough for
+   the deadline of a sleep, which is followed by a spin */
+static ScaledRateRatio sysclock_rate(void)
+{
+	gptp_clock_ppara_t *pp;
+	ScaledRateRatio rate=RATE_RATIO_ONE;
+	gmc_map_t *m;
+	uint32_t seq;
+	int i;
+	if(!(m=gmc_get())) return rate;
+	pp=&m->shm->gcpp[m->shm->head.active_domain];
+	for(i=0;i<GPTP_MASTER_CLOCK_SEQ_RETRY;i++){
+		gptpclock_seq_read_backoff(i);
+		seq=gptpclock_seq_read_begin(pp);
+		rate=pp->map_valid_until?pp->map_rate:RATE_RATIO_ONE;
+		if(!gptpclock_seq_read_retry(pp, seq)) return rate;
+	}
+	// only for the deadline of a sleep, the rate of the system clock is used
+	return RATE_RATIO_ONE;
+}
+
+/* sleep with an absolute deadline of CLOCK_MONOTONIC, until 'margin' before 'tts'.
+   the deadline is translated from gPTP time at each sleep, and a sleep interrupted
+   by a signal doesn't accumulate an error.
+   'rts' returns the remaining time to 'tts', a negative value is an over run.
+   return -1 when gPTP time can't be read or the sleep fails */
+static int sleep_until_ts64(int64_t tts, int64_t margin, int64_t *rts)
+{
+	gmc_thread_data_t *td=thread_data();
+	struct timespec dts;
+	int64_t cts, mts, sts;
+	ScaledRateRatio rate;
+	int res;
+	while(true){
+		mts=ub_mt_gettime64();
+		cts=gptpmasterclock_getts64();
+		if(cts==-1) return -1;
+		*rts=tts-cts;
+		if(*rts<=margin) return 0;
+		rate=sysclock_rate();
+		sts=gptp_rr_div_ns(*rts-margin, rate);
+		if(sts>PRECISE_WAIT_MAX_SLEEP) sts=PRECISE_WAIT_MAX_SLEEP;
+		mts+=sts;
+		UB_NSEC2TS(mts, dts);
+		res=clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &dts, NULL);
+		if(res && res!=EINTR){
+			UB_LOG(UBL_ERROR,"%s: error in clock_nanosleep: %s:\n",
+			       __func__, strerror(res));
+			return -1;
+		}
+		if(res || sts==PRECISE_WAIT_MAX_SLEEP) continue;
+		// measure the wake up latency, to decide the spin length
+		sts=ub_mt_gettime64()-mts;
+		if(sts>td->wake_late){
+			td->wake_late=sts;
+		}else{
+			td->wake_late-=(td->wake_late-sts)/16;
+		}
+	}
+}
+
+int gptpmasterclock_precise_wait_until_ts64(int64_t tts, int64_t spin, int64_t *werr)
+{
+	gmc_thread_data_t *td;
+	int64_t cts, rts;
+	if(!gmc_get()) return -1;
+	if(spin<0){
+		// calibrated by the wake up latency of this thread
+		td=thread_data();
+		spin=td->wake_late?td->wake_late+PRECISE_WAIT_SPIN_MARGIN:
+			PRECISE_WAIT_INIT_SPIN;
+		if(spin<PRECISE_WAIT_MIN_SPIN) spin=PRECISE_WAIT_MIN_SPIN;
+	}
+	cts=gptpmasterclock_getts64();
+	if(cts==-1) return -1;
+	rts=tts-cts;
+	if(rts<0){
+		if(werr) *werr=-rts;
+		return 1;
+	}
+	if(sleep_until_ts64(tts, spin, &rts)) return -1;
+	// spin for the rest
+	while(rts>0){
+		cts=gptpmasterclock_getts64();
+		if(cts==-1) return -1;
+		rts=tts-cts;
+	}
+	if(werr) *werr=-rts;
+	return 0;
+}
+
 int gptpmasterclock_wait_until_ts64(int64_t tts, int64_t vclose, int64_t toofar)
 {
 	int64_t cts,dts;
-	int64_t rem;
 
 	cts=gptpmasterclock_getts64();
+	if(cts==-1) return -1;
 	dts=tts-cts;
 	if(dts<0) return 1;
 	if (dts <= vclose) return 2;
@@ -264,29 +979,92 @@ int gptpmasterclock_wait_until_ts64(int64_t tts, int64_t vclose, int64_t toofar)
 		return 3;
 	}
 	UB_LOG(UBL_DEBUG,"%s: wait for %"PRIi64"nsec\n", __func__, dts);
-	if(cb_nanosleep64(dts,&rem)){
-		if(errno==EINTR){
-			cb_nanosleep64(rem, NULL);
-		}else{
-			UB_LOG(UBL_ERROR,"%s: error in nanosleep: %s:\n",
-			       __func__, strerror(errno));
-		}
-		return -1;
-	}
+	if(sleep_until_ts64(tts, 0, &dts)) return -1;
 	return 0;
 }
 
 uint64_t gptpmasterclock_expand_timestamp(uint32_t timestamp)
 {
-	uint32_t ctimes;
-	int32_t dtimes;
-	int64_t ts64;
+	return gptp_expand_ts32(timestamp, gptpmasterclock_getts64());
+}
 
+int gptpmasterclock_expand_timestamps(const uint32_t *timestamps, uint64_t *ts64s,
+				      int num)
+{
+	int64_t ts64;
+	if(num<=0) return 0;
 	ts64=gptpmasterclock_getts64();
-	ctimes = (uint32_t)ts64;
-	// dtimes becomes a range of  -2.147 to 2.147 secconds
-	dtimes = (int32_t)(timestamp - ctimes);
-	return ts64+dtimes;
+	if(ts64<0) return -1;
+	gptp_expand_ts32_batch(timestamps, ts64s, num, ts64);
+	return 0;
+}
+
+int gptpmasterclock_sync_sample_head(int domainIndex, uint64_t *pos)
+{
+	gptp_sync_sample_shm_t *sshm;
+	gptp_sync_sample_ring_t *ring;
+	if(!pos || !(ring=sync_sample_ring(domainIndex, &sshm))) return -1;
+	*pos=__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	return 0;
+}
+
+int gptpmasterclock_sync_sample_read(int domainIndex, uint64_t *pos,
+				     gptpipc_sync_sample_t *samples, int max, uint32_t *lost)
+{
+	gptp_sync_sample_shm_t *sshm;
+	gptp_sync_sample_ring_t *ring;
+	gptp_sync_sample_slot_t *slot;
+	uint64_t head, p, wseq;
+	uint32_t num_slots, nlost=0;
+	int n=0;
+	if(!pos || !samples || max<0) return -1;
+	if(!(ring=sync_sample_ring(domainIndex, &sshm))) return -1;
+	num_slots=sshm->num_slots;
+	p=*pos;
+	head=__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if(p>head) p=0; // the ring was re-created by a restarted gptp2d
+	while(n<max){
+		if(head-p>num_slots){
+			// the writer has gone around the ring
+			nlost+=head-num_slots-p;
+			p=head-num_slots;
+		}
+		if(p==head) break;
+		slot=&ring->slots[p & (num_slots-1)];
+		wseq=__atomic_load_n(&slot->wseq, __ATOMIC_ACQUIRE);
+		memcpy(&samples[n], &slot->smp, sizeof(gptpipc_sync_sample_t));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(wseq==p+1 && __atomic_load_n(&slot->wseq, __ATOMIC_RELAXED)==wseq){
+			n++;
+		}else{
+			// overwritten during the copy
+			nlost++;
+			head=__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		}
+		p++;
+	}
+	*pos=p;
+	if(lost) *lost=nlost;
+	return n;
+}
+
+int gptpmasterclock_sync_sample_wait(int domainIndex, uint64_t pos, int64_t toutns)
+{
+	gptp_sync_sample_shm_t *sshm;
+	gptp_sync_sample_ring_t *ring;
+	uint32_t wake;
+	int res=0;
+	if(!(ring=sync_sample_ring(domainIndex, &sshm))) return -1;
+	wake=__atomic_load_n(&ring->wake, __ATOMIC_ACQUIRE);
+	if(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)!=pos) return 1;
+	__atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+	// a push after reading 'wake' changes it, and the futex doesn't wait
+	if(__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST)==pos)
+		gptpclock_futex_wait(&ring->wake, wake, toutns);
+	__atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_RELAXED);
+	if(!__atomic_load_n(&sshm->max_domains, __ATOMIC_ACQUIRE)) return -1;
+	if(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)!=pos) res=1;
+	return res;
 }
 
 int gptpmasterclock_preinit(void *object)
@@ -31,6 +31,9 @@
 #ifndef __GPTPMASTERCLOCK_H_
 #define __GPTPMASTERCLOCK_H_
 
+#include <time.h>
+#include "gptpipc.h"
+
 /**
  * @brief Pre-initialize to get the gptp clock.
  * @param object platform specific object, refer to the platforms supported below.
@@ -65,12 +68,18 @@ int gptpmasterclock_preinit(void *object);
  * @return -1 on error, 0 on Successful initialization.
  * @note   argument 'shmem_name' will not be used in platforms that recommends against
  * using shared memory (e.g GHS INTEGRITY). Pass NULL is such case.
+ * @note   all the functions in this file are thread-safe.
+ * init and close are reference counted, and can be called from multiple threads.
+ * The reading functions don't take a lock, the small state like the conversion
+ * device is kept in each thread.
  */
 int gptpmasterclock_init(const char *shmem_name);
 
 /**
  * @brief close gptpmasterclcock
  * @return -1: on error, 0:on successfull
+ * @note the shared memory is unmapped at the last close, the other threads must not
+ * use the functions after that.
  */
 int gptpmasterclock_close(void);
 
@@ -101,9 +110,24 @@ int64_t gptpmasterclock_getts64(void);
  * @param vclose        nano second unit; treated as very close, and stop waiting
  * even ttv is still in future
  * @param toofar        nano second unit; treated as too far, and stop waiting
+ * @note the sleep has an absolute deadline of CLOCK_MONOTONIC, which is translated
+ * from 'tts' through the current gPTP rate. A signal doesn't cause an early return.
  */
 int gptpmasterclock_wait_until_ts64(int64_t tts, int64_t vclose, int64_t toofar);
 
+/**
+ * @brief Wait until tts comes, sleep and then spin for the last part
+ * @return -1: error, 1:already passed, 0:waited until tts
+ * @param tts	target time in nano second unit
+ * @param spin	nano second unit; the last part of the wait is done by spinning
+ * on gPTP time. -1 uses the length calibrated by the measured wake up latency.
+ * @param werr	if not NULL, the wake error, gPTP time at the return minus tts,
+ * is returned in nano second unit
+ * @note the sleep is the same as gptpmasterclock_wait_until_ts64.
+ * A long wait, e.g. the whole of a pulse interval, can use this as it is.
+ */
+int gptpmasterclock_precise_wait_until_ts64(int64_t tts, int64_t spin, int64_t *werr);
+
 /**
  * @brief expand 32-bit nsec time to 64 bit with aligning to gptp clock.
  * @param timestamp timestamp which we are going to convert into 32bit to 64 bit.
@@ -113,6 +137,20 @@ int gptpmasterclock_wait_until_ts64(int64_t tts, int64_t vclose, int64_t toofar)
  */
 uint64_t gptpmasterclock_expand_timestamp(uint32_t timestamp);
 
+/**
+ * @brief expand an array of 32-bit nsec time to 64 bit with aligning to gptp clock.
+ * @param timestamps	array of 32-bit timestamps
+ * @param ts64s	array to return the expanded time, it can't be the same as
+ * 'timestamps'
+ * @param num	number of the timestamps
+ * @return 0 on success, -1 on error.
+ * @note gptp clock is read only once for all the timestamps, and the result is
+ * the same as gptpmasterclock_expand_timestamp at that time.
+ * SIMD instructions are used when they are available.
+ */
+int gptpmasterclock_expand_timestamps(const uint32_t *timestamps, uint64_t *ts64s,
+				      int num);
+
 /**
  * @brief get GM change indicator, the number is incremented whenever GM is changed
  * @return GM change indicator value, -1: on error
@@ -126,14 +164,168 @@ int gptpmasterclock_gmchange_ind(void);
  */
 int gptpmasterclock_get_max_domains(void);
 
+/**
+ * @brief get the generation of gptp2d
+ * @return the number which is incremented at each start of gptp2d, 0:not initialized
+ * @note when gptp2d is restarted with the handoff, the shared memory stays valid
+ *	during the restart, and only this number is changed.
+ */
+uint32_t gptpmasterclock_generation(void);
+
 /**
  * @brief get a synchronized clock value on specific domain
  * @param ts64	pointer to return clock value
  * @param domainIndex domain index number
  * @return 0 on success, -1 on error.
+ * @note while gptp2d keeps updating the mapping of CLOCK_MONOTONIC_RAW to
+ * gPTP time, the value is extrapolated from CLOCK_MONOTONIC_RAW, and
+ * the ptp device is not read.
  */
 int gptpmasterclock_get_domain_ts64(int64_t *ts64, int domainIndex);
 
+/**
+ * @brief the same as gptpmasterclock_get_domain_ts64, but always reads the ptp device
+ * @param ts64	pointer to return clock value
+ * @param domainIndex domain index number
+ * @return 0 on success, -1 on error.
+ */
+int gptpmasterclock_get_domain_ts64_ptpdev(int64_t *ts64, int domainIndex);
+
+/**
+ * @brief get a synchronized clock value on specific domain, with its quality
+ * @param ts64	pointer to return clock value
+ * @param quality	pointer to return the quality of the clock
+ * @param domainIndex domain index number
+ * @return 0 on success, -1 on error.
+ * @note the quality is read in the same sequence as the clock parameters,
+ * both are consistent even when gptp2d updates them at the same time.
+ * 'sync_age' and the growth of 'uncertainty' are computed at the time of reading.
+ */
+int gptpmasterclock_get_domain_ts64_quality(int64_t *ts64, gptpipc_clock_quality_t *quality,
+					    int domainIndex);
+
+/**
+ * @brief gptpmasterclock_getts64 with the quality of the clock
+ * @param quality	pointer to return the quality of the clock
+ * @return 64-bit nsec unit ts, -1 on error
+ */
+int64_t gptpmasterclock_getts64_quality(gptpipc_clock_quality_t *quality);
+
+/**
+ * @brief get gm_stable status of the domain
+ * @param domainIndex domain index number
+ * @return 1: gm is stable, 0: not stable, -1: on error
+ */
+int gptpmasterclock_gmstable(int domainIndex);
+
+/**
+ * @brief get the current event sequence number
+ * @return the number which is incremented by gptp2d at each event
+ * @note use this as the initial value of 'event_seq' in gptpmasterclock_event_wait
+ */
+uint32_t gptpmasterclock_event_seq(void);
+
+/**
+ * @brief wait for an event of GM change, active domain change, GM sync status
+ * change or gm_stable change
+ * @param event_seq	the last known sequence number, updated when an event comes
+ * @param toutns	timeout in nano second unit, -1 waits forever, 0 doesn't wait
+ * @param event_flags	if not NULL, GPTPIPC_EVENT_CLOCK_FLAG_* of the last event
+ * is returned
+ * @return 1: event came, 0: timeout, -1: on error
+ * @note successive events may be merged into one wake up, and 'event_flags' shows
+ * only the last one. Read the status by the other functions after waking up.
+ * The waiting thread is woken up by a futex on the shared memory, no IPC is used.
+ * Closing gptp2d also wakes it up, and the next call waits on the restarted gptp2d.
+ * -1 is returned while gptp2d is down.
+ */
+int gptpmasterclock_event_wait(uint32_t *event_seq, int64_t toutns, uint32_t *event_flags);
+
+/**
+ * @brief get a file descriptor which becomes readable at the events
+ * @return eventfd file descriptor, -1: on error
+ * @note the same events as gptpmasterclock_event_wait, the fd can be used with
+ * poll/epoll. Reading it returns the number of events and clears it.
+ * A thread is started to wait on the futex and write the eventfd.
+ * Calling again returns the same fd.
+ */
+int gptpmasterclock_event_fd(void);
+
+/**
+ * @brief stop the event thread and close the file descriptor of
+ * gptpmasterclock_event_fd
+ * @return 0 on success, -1 on error
+ * @note this is called in gptpmasterclock_close
+ */
+int gptpmasterclock_event_fd_close(void);
+
+/**
+ * @brief convert timestamps of a ptp device to gPTP time of a domain
+ * @param ptpdev	ptp device name of the timestamps, NULL for the ptp device
+ * of the domain
+ * @param ts	array of the timestamps in nano second unit
+ * @param gts	array to return gPTP time, it can be the same as 'ts'
+ * @param num	number of the timestamps
+ * @param domainIndex domain index number
+ * @return 0 on success, -1 on error.
+ * @note the parameters which gptp2d keeps in the shared memory are read once
+ * for all the timestamps. When 'ptpdev' is not the one of the domain,
+ * the offset between the 2 ptp devices is measured at the call,
+ * and the rate difference is not compensated; the timestamps should be recent.
+ */
+int gptpmasterclock_ptpdev2gptp(const char *ptpdev, const int64_t *ts, int64_t *gts,
+				int num, int domainIndex);
+
+/**
+ * @brief convert timestamps of a system clock to gPTP time of a domain
+ * @param clockid	CLOCK_REALTIME, CLOCK_MONOTONIC, CLOCK_MONOTONIC_RAW, etc.
+ * @param ts	array of the timestamps in nano second unit
+ * @param gts	array to return gPTP time, it can be the same as 'ts'
+ * @param num	number of the timestamps
+ * @param domainIndex domain index number
+ * @return 0 on success, -1 on error.
+ * @note CLOCK_MONOTONIC_RAW is converted by the mapping of gptp2d, which includes
+ * the rate. The other clocks are converted in the same way as a ptp device
+ * which is not the one of the domain.
+ */
+int gptpmasterclock_sysclock2gptp(clockid_t clockid, const int64_t *ts, int64_t *gts,
+				  int num, int domainIndex);
+
+/**
+ * @brief get the position of the next sync sample which gptp2d pushes
+ * @param domainIndex domain index number
+ * @param pos	the position is returned
+ * @return 0 on success, -1 on error.
+ * @note use this as the initial 'pos' of gptpmasterclock_sync_sample_read to
+ * read only new samples. 0 as the initial 'pos' reads from the oldest sample in the ring.
+ */
+int gptpmasterclock_sync_sample_head(int domainIndex, uint64_t *pos);
+
+/**
+ * @brief read the sync samples of a domain from the ring in the shared memory
+ * @param domainIndex domain index number
+ * @param pos	the position of the reader, updated to the next position
+ * @param samples	array to return the samples
+ * @param max	the size of 'samples'
+ * @param lost	if not NULL, the number of the samples which were overwritten
+ * before being read is returned
+ * @return the number of the read samples, -1 on error.
+ * @note gptp2d pushes one sample for each Sync, and it never waits for the readers.
+ * When the reader is behind by more than the ring size, the oldest samples are lost.
+ * The read doesn't lock anything, any number of readers can read the same ring.
+ */
+int gptpmasterclock_sync_sample_read(int domainIndex, uint64_t *pos,
+				     gptpipc_sync_sample_t *samples, int max, uint32_t *lost);
+
+/**
+ * @brief wait until a new sync sample is pushed after 'pos'
+ * @param domainIndex domain index number
+ * @param pos	the position of the reader
+ * @param toutns	timeout in nano second unit, -1 waits forever
+ * @return 1: a sample is available, 0: timeout, -1: on error
+ */
+int gptpmasterclock_sync_sample_wait(int domainIndex, uint64_t pos, int64_t toutns);
+
 /**
  * @brief print phase offset for all domains
  */
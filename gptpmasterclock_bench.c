@@ -0,0 +1,397 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * throughput benchmark of gptpmasterclock_getts64 with concurrent readers.
+ * This process plays the role of gptp2d; it creates the shared memory
+ * and keeps updating the clock parameters, while 1 to 64 reader threads
+ * call gptpmasterclock_getts64.
+ * usage: gptpmasterclock_bench [-m] [-p] [-c ptpdev] [-w number_of_waits]
+ *                              [-t number_of_timers] [-s spin_usec] [-x]
+ *                              [msec_per_step]
+ *   -m: lock 'mcmutex' in the readers, to compare with the mutex protected reads
+ *   -p: read the ptp device, not using the mapping of CLOCK_MONOTONIC_RAW
+ *   -c: ptp device, the default is the software clock.
+ *       the frequency of a real ptp device is adjusted during the test.
+ *   -w: instead of the readers, measure the wake error distribution of
+ *       gptpmasterclock_wait_until_ts64 and gptpmasterclock_precise_wait_until_ts64
+ *   -t: instead of the readers, measure the jitter of 125usec period timers of
+ *       gptpmastertimer, for 'msec_per_step'
+ *   -s: spin length of the timer thread
+ *   -x: instead of the readers, measure the throughput of the timestamp conversions
+ *       to gPTP time, for 'msec_per_step' in each case
+ */
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <xl4unibase/unibase_binding.h>
+#include "gptp_config.h"
+#include "gptpclock.h"
+#include "gptpmasterclock.h"
+#include "gptpmastertimer.h"
+#include "ll_gptpsupport.h"
+
+#define BENCH_SHARED_MEM "/gptp_mc_shm_bench"
+#define BENCH_MAX_THREADS 64
+#define BENCH_WRITE_INTERVAL (UB_MSEC_NS/8) // 8 times of 1msec Sync interval
+#define BENCH_WAIT_INTERVAL (10*UB_MSEC_NS)
+#define BENCH_TIMER_PERIOD (125*UB_USEC_NS) // class A presentation interval
+#define BENCH_CONV_BATCH 1024
+
+typedef struct reader_data {
+	CB_THREAD_T th;
+	uint64_t count;
+	int64_t backstep;
+} reader_data_t;
+
+static volatile int running;
+static bool use_mutex;
+static bool use_ptpdev;
+static gptp_master_clock_shm_t *rshm;
+
+static void *reader_proc(void *ptr)
+{
+	reader_data_t *rd=(reader_data_t *)ptr;
+	int64_t ts, lts=0;
+	while(running){
+		if(use_mutex) gptpclock_mutex_trylock(&rshm->head.mcmutex);
+		if(use_ptpdev){
+			gptpmasterclock_get_domain_ts64_ptpdev(&ts, 0);
+		}else{
+			ts=gptpmasterclock_getts64();
+		}
+		if(use_mutex) CB_THREAD_MUTEX_UNLOCK(&rshm->head.mcmutex);
+		// the time must not go back by a torn read
+		if(ts<lts && lts-ts>rd->backstep) rd->backstep=lts-ts;
+		lts=ts;
+		rd->count++;
+	}
+	return NULL;
+}
+
+static void *writer_proc(void *ptr)
+{
+	uint64_t *count=(uint64_t *)ptr;
+	int adjppb=0;
+	uint64_t nts;
+	while(running){
+		// +-10ppm, the offset is kept continuous by gptpclock_setadj
+		adjppb=(adjppb>=10000)?-10000:adjppb+100;
+		gptpclock_setadj(adjppb, 1, 0);
+		// gptp2d updates the mapping after each event
+		gptpclock_rawmap_update();
+		(*count)++;
+		nts=ub_mt_gettime64()+BENCH_WRITE_INTERVAL;
+		while(running && ub_mt_gettime64()<nts) sched_yield();
+	}
+	return NULL;
+}
+
+static int one_step(int nthreads, int msec)
+{
+	reader_data_t rds[BENCH_MAX_THREADS];
+	CB_THREAD_T wth;
+	uint64_t wcount=0, rcount=0;
+	int64_t backstep=0;
+	uint64_t ts;
+	int i;
+
+	memset(rds, 0, sizeof(rds));
+	running=1;
+	if(CB_THREAD_CREATE(&wth, NULL, writer_proc, &wcount)) return -1;
+	ts=ub_mt_gettime64();
+	for(i=0;i<nthreads;i++){
+		if(CB_THREAD_CREATE(&rds[i].th, NULL, reader_proc, &rds[i])) break;
+	}
+	nthreads=i;
+	usleep(msec*1000);
+	running=0;
+	for(i=0;i<nthreads;i++){
+		CB_THREAD_JOIN(rds[i].th, NULL);
+		rcount+=rds[i].count;
+		if(rds[i].backstep>backstep) backstep=rds[i].backstep;
+	}
+	ts=ub_mt_gettime64()-ts;
+	CB_THREAD_JOIN(wth, NULL);
+	printf("%2d readers: %10"PRIu64" calls/sec, %8"PRIu64" calls/sec/thread, "
+	       "%6"PRIu64" updates/sec, max backstep=%"PRIi64"nsec\n",
+	       nthreads, rcount*(uint64_t)UB_SEC_NS/ts,
+	       rcount*(uint64_t)UB_SEC_NS/ts/nthreads,
+	       wcount*(uint64_t)UB_SEC_NS/ts, backstep);
+	return 0;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t d=*(const int64_t *)a-*(const int64_t *)b;
+	return (d>0)-(d<0);
+}
+
+static void print_distribution(const char *name, int64_t *werr, int n)
+{
+	qsort(werr, n, sizeof(int64_t), cmp_int64);
+	printf("%-8s wake error(nsec): min=%"PRIi64" 50%%=%"PRIi64" 90%%=%"PRIi64
+	       " 99%%=%"PRIi64" 99.9%%=%"PRIi64" max=%"PRIi64"\n", name, werr[0],
+	       werr[n/2], werr[n*9/10], werr[n*99/100], werr[n*999/1000], werr[n-1]);
+}
+
+/* wait for the aligned time of every BENCH_WAIT_INTERVAL, while the writer keeps
+   updating the clock */
+static int wait_bench(int nwaits)
+{
+	CB_THREAD_T wth;
+	uint64_t wcount=0;
+	int64_t *werr;
+	int64_t tts;
+	int i, m;
+
+	werr=malloc(nwaits*sizeof(int64_t));
+	if(!werr) return -1;
+	running=1;
+	if(CB_THREAD_CREATE(&wth, NULL, writer_proc, &wcount)){
+		free(werr);
+		return -1;
+	}
+	for(m=0;m<3;m++){
+		for(i=0;i<nwaits;i++){
+			tts=gptpmasterclock_getts64()+BENCH_WAIT_INTERVAL;
+			tts=(tts/BENCH_WAIT_INTERVAL)*BENCH_WAIT_INTERVAL;
+			switch(m){
+			case 0:
+				gptpmasterclock_wait_until_ts64(tts, 0, 0);
+				werr[i]=gptpmasterclock_getts64()-tts;
+				break;
+			case 1:
+				gptpmasterclock_precise_wait_until_ts64(tts, -1, &werr[i]);
+				break;
+			default:
+				gptpmasterclock_precise_wait_until_ts64(tts, 0, &werr[i]);
+				break;
+			}
+		}
+		print_distribution(m==0?"sleep":(m==1?"precise":"no spin"), werr, nwaits);
+	}
+	running=0;
+	CB_THREAD_JOIN(wth, NULL);
+	free(werr);
+	return 0;
+}
+
+typedef struct timer_data {
+	gptpmastertimer_t *tm;
+	int64_t *jitter;
+	int num;
+	int size;
+	uint32_t overrun;
+} timer_data_t;
+
+static void timer_cb(void *cbdata, gptpmastertimer_event_t event, int64_t ts64,
+		     uint32_t overrun)
+{
+	timer_data_t *td=(timer_data_t *)cbdata;
+	int64_t cts=gptpmasterclock_getts64();
+	if(event!=GPTPMASTERTIMER_EXPIRE) return;
+	td->overrun+=overrun;
+	if(td->num<td->size) td->jitter[td->num++]=cts-ts64;
+}
+
+/* the timers have the same period, and the phases are spread in the period */
+static int timer_bench(int ntimers, int msec)
+{
+	CB_THREAD_T wth;
+	uint64_t wcount=0;
+	timer_data_t *tds;
+	int64_t *all;
+	uint32_t overrun=0;
+	int i, n=0, res=-1;
+	char name[32];
+
+	tds=calloc(ntimers, sizeof(timer_data_t));
+	if(!tds) return -1;
+	running=1;
+	if(CB_THREAD_CREATE(&wth, NULL, writer_proc, &wcount)) goto erexit;
+	for(i=0;i<ntimers;i++){
+		tds[i].size=(int64_t)msec*UB_MSEC_NS/BENCH_TIMER_PERIOD+1;
+		tds[i].jitter=malloc(tds[i].size*sizeof(int64_t));
+		if(!tds[i].jitter) break;
+		tds[i].tm=gptpmastertimer_create(BENCH_TIMER_PERIOD,
+						 i*BENCH_TIMER_PERIOD/ntimers, timer_cb, &tds[i]);
+		if(!tds[i].tm) break;
+	}
+	if(i==ntimers) usleep(msec*1000);
+	for(i=0;i<ntimers;i++){
+		if(tds[i].tm) gptpmastertimer_delete(tds[i].tm);
+	}
+	running=0;
+	CB_THREAD_JOIN(wth, NULL);
+	for(i=0;i<ntimers;i++){
+		n+=tds[i].num;
+		overrun+=tds[i].overrun;
+	}
+	all=malloc((n?n:1)*sizeof(int64_t));
+	if(!all) goto erexit;
+	for(n=0,i=0;i<ntimers;i++){
+		memcpy(&all[n], tds[i].jitter, tds[i].num*sizeof(int64_t));
+		n+=tds[i].num;
+	}
+	printf("%d timers: %d expirations, %"PRIu32" overruns\n", ntimers, n, overrun);
+	if(n){
+		snprintf(name, sizeof(name), "%dtimers", ntimers);
+		print_distribution(name, all, n);
+	}
+	free(all);
+	res=0;
+erexit:
+	for(i=0;i<ntimers;i++) free(tds[i].jitter);
+	free(tds);
+	return res;
+}
+
+/* conversions of BENCH_CONV_BATCH timestamps, and of 1 timestamp for the overhead */
+static int conv_bench(const char *ptpdev, int msec)
+{
+	static int64_t ts[BENCH_CONV_BATCH];
+	static const struct {const char *name; clockid_t clockid;} srcs[]={
+		{"ptpdev of the domain", 0}, {"CLOCK_REALTIME", CLOCK_REALTIME},
+		{"CLOCK_MONOTONIC", CLOCK_MONOTONIC},
+		{"CLOCK_MONOTONIC_RAW", CLOCK_MONOTONIC_RAW}};
+	CB_THREAD_T wth;
+	int64_t ets, dts;
+	uint64_t count, wcount=0;
+	int i, n, num, res=-1;
+
+	for(i=0;i<BENCH_CONV_BATCH;i++) ts[i]=ub_rt_gettime64()+i*UB_USEC_NS;
+	running=1;
+	if(CB_THREAD_CREATE(&wth, NULL, writer_proc, &wcount)) return -1;
+	for(i=0;i<(int)(sizeof(srcs)/sizeof(srcs[0]));i++){
+		for(n=0;n<2;n++){
+			num=n?1:BENCH_CONV_BATCH;
+			count=0;
+			dts=ub_mt_gettime64();
+			ets=dts+msec*UB_MSEC_NS;
+			while(ub_mt_gettime64()<ets){
+				if(i==0){
+					if(gptpmasterclock_ptpdev2gptp(ptpdev, ts, ts, num, 0))
+						goto erexit;
+				}else{
+					if(gptpmasterclock_sysclock2gptp(srcs[i].clockid,
+									 ts, ts, num, 0))
+						goto erexit;
+				}
+				count++;
+			}
+			dts=ub_mt_gettime64()-dts;
+			printf("%-20s %4d timestamps/call: %10"PRIu64" timestamps/sec, "
+			       "%7.1f nsec/call\n", srcs[i].name, num,
+			       count*num*(uint64_t)UB_SEC_NS/dts, (double)dts/count);
+		}
+	}
+	res=0;
+erexit:
+	running=0;
+	CB_THREAD_JOIN(wth, NULL);
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	unibase_init_para_t init_para;
+	ClockIdentity clockId={0,};
+	char *ptpdev=GPTP_SWCLOCK_PTPDEV;
+	int64_t ts;
+	int i, msec=1000, nwaits=0, ntimers=0;
+	bool conv=false;
+	int rshmfd;
+	int res=-1;
+
+	for(i=1;i<argc;i++){
+		if(!strcmp(argv[i], "-m")){
+			use_mutex=true;
+		}else if(!strcmp(argv[i], "-p")){
+			use_ptpdev=true;
+		}else if(!strcmp(argv[i], "-c") && i<argc-1){
+			ptpdev=argv[++i];
+		}else if(!strcmp(argv[i], "-w") && i<argc-1){
+			nwaits=atoi(argv[++i]);
+		}else if(!strcmp(argv[i], "-t") && i<argc-1){
+			ntimers=atoi(argv[++i]);
+		}else if(!strcmp(argv[i], "-x")){
+			conv=true;
+		}else if(!strcmp(argv[i], "-s") && i<argc-1){
+			gptpmastertimer_set_spin(atoi(argv[++i])*UB_USEC_NS);
+		}else{
+			msec=atoi(argv[i]);
+		}
+	}
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("3,ubase:35,cbase:35,gptp:35", "UBL_GPTP");
+	unibase_init(&init_para);
+
+	gptpconf_set_item(CONF_MASTER_CLOCK_SHARED_MEM, BENCH_SHARED_MEM);
+	if(gptpclock_init(1, 2)) goto erexit;
+	/* the same setup as gptp2d, thisClock(clockIndex=1) is adjusted,
+	   and the result is set to the master clock parameters in the shared memory */
+	if(gptpclock_add_clock(0, ptpdev, 0, 0, clockId)) goto erexit;
+	clockId[7]=1;
+	if(gptpclock_add_clock(1, ptpdev, 0, 0, clockId)) goto erexit;
+	if(gptpclock_set_thisClock(1, 0, false)) goto erexit;
+	gptpclock_setts64(ub_rt_gettime64(), 1, 0);
+	if(gptpmasterclock_init(BENCH_SHARED_MEM)) goto erexit;
+	rshm=(gptp_master_clock_shm_t *)cb_get_shared_mem(
+		&rshmfd, BENCH_SHARED_MEM, sizeof(gptp_master_clock_shm_t), O_RDWR);
+	if(!rshm) goto erexit;
+
+	// the mapping is made after the rate of the ptp device is measured
+	ts=ub_mt_gettime64()+(gptpconf_get_intitem(CONF_RAWMAP_RATE_PERIOD)+
+			       gptpconf_get_intitem(CONF_RAWMAP_UPDATE_INTERVAL))*UB_MSEC_NS;
+	while(ub_mt_gettime64()<ts){
+		gptpclock_rawmap_update();
+		usleep(10000);
+	}
+
+	if(nwaits>0){
+		printf("%d waits for each method\n", nwaits);
+		res=wait_bench(nwaits);
+	}else if(conv){
+		res=conv_bench(ptpdev, msec);
+	}else if(ntimers>0){
+		printf("%"PRIi64" usec period timers, %d msec\n",
+		       (int64_t)(BENCH_TIMER_PERIOD/UB_USEC_NS), msec);
+		for(i=1;i<=ntimers;i*=2){
+			res=timer_bench(i, msec);
+			if(res) break;
+		}
+	}else{
+		printf("%s %s reads, %d msec per step\n", use_mutex?"mutex":"lock-free",
+		       use_ptpdev?"ptpdev":"rawmap", msec);
+		for(i=1;i<=BENCH_MAX_THREADS;i*=2){
+			if(one_step(i, msec)) break;
+		}
+		res=0;
+	}
+	cb_close_shared_mem(rshm, &rshmfd, BENCH_SHARED_MEM,
+			    sizeof(gptp_master_clock_shm_t), false);
+erexit:
+	gptpmasterclock_close();
+	gptpclock_close();
+	unibase_close();
+	return res;
+}
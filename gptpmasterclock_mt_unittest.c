@@ -0,0 +1,263 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * multithreaded stress test of libx4gptp2.
+ * A child process plays the role of gptp2d, and keeps updating the shared memory.
+ * The threads of this process call the library functions concurrently,
+ * without any lock in the test. Build with '--enable-unittest-tsan' to run
+ * this under ThreadSanitizer.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <cmocka.h>
+#include <xl4unibase/unibase_binding.h>
+#include "gptp_config.h"
+#include "gptpclock.h"
+#include "gptpmasterclock.h"
+#include "gptpmastertimer.h"
+#include "ll_gptpsupport.h"
+
+#define MT_SHARED_MEM "/gptp_mc_shm_mt"
+#define MT_NUM_THREADS 8
+#define MT_TEST_MSEC 3000
+#define MT_WRITE_INTERVAL_USEC 1000
+// the reads by the ptp device and by the RAW mapping may differ by this
+#define MT_BACKSTEP_LIMIT (10*UB_USEC_NS)
+#define MT_TIMESTAMPS 16
+
+typedef struct mt_thread_data {
+	CB_THREAD_T th;
+	int index;
+	uint64_t count;
+	int errors;
+	int64_t backstep;
+} mt_thread_data_t;
+
+static int running;
+
+static void timer_cb(void *cbdata, gptpmastertimer_event_t event, int64_t ts64,
+		     uint32_t overrun)
+{
+	__atomic_add_fetch((uint64_t *)cbdata, 1, __ATOMIC_RELAXED);
+}
+
+/* getts64 must not go back, and the expansion must match it */
+static void read_time(mt_thread_data_t *td, int64_t *lts)
+{
+	uint32_t ts32[MT_TIMESTAMPS];
+	uint64_t ts64s[MT_TIMESTAMPS];
+	int64_t ts;
+	int i;
+	ts=gptpmasterclock_getts64();
+	if(ts<0) td->errors++;
+	if(ts<*lts && *lts-ts>td->backstep) td->backstep=*lts-ts;
+	*lts=ts;
+	for(i=0;i<MT_TIMESTAMPS;i++) ts32[i]=(uint32_t)ts+i*1000;
+	if(gptpmasterclock_expand_timestamps(ts32, ts64s, MT_TIMESTAMPS)) td->errors++;
+	for(i=0;i<MT_TIMESTAMPS;i++){
+		if(llabs((int64_t)ts64s[i]-ts)>UB_SEC_NS) td->errors++;
+	}
+}
+
+/* the conversion device is cached in each thread */
+static void convert(mt_thread_data_t *td)
+{
+	char ptpdev[MAX_PTPDEV_NAME];
+	int64_t ts[MT_TIMESTAMPS], ref;
+	struct timespec tsp;
+	int i;
+	snprintf(ptpdev, MAX_PTPDEV_NAME, "%s%d", CB_VIRTUAL_PTPDEV_PREFIX, td->index%2);
+	ref=gptpmasterclock_getts64();
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tsp);
+	for(i=0;i<MT_TIMESTAMPS;i++) ts[i]=UB_TS2NSEC(tsp);
+	if(gptpmasterclock_sysclock2gptp(CLOCK_MONOTONIC_RAW, ts, ts, MT_TIMESTAMPS, 0))
+		td->errors++;
+	if(llabs(ts[0]-ref)>UB_MSEC_NS*100) td->errors++;
+	if(gptpmasterclock_sysclock2gptp(CLOCK_MONOTONIC, ts, ts, MT_TIMESTAMPS, 0))
+		td->errors++;
+	if(gptpmasterclock_ptpdev2gptp(ptpdev, ts, ts, MT_TIMESTAMPS, 0)) td->errors++;
+}
+
+/* init and close are nested in the reference of the main thread */
+static void status_reads(mt_thread_data_t *td, uint64_t *pos)
+{
+	gptpipc_sync_sample_t smps[MT_TIMESTAMPS];
+	uint32_t lost;
+	if(gptpmasterclock_init(MT_SHARED_MEM)) td->errors++;
+	if(gptpmasterclock_sync_sample_read(0, pos, smps, MT_TIMESTAMPS, &lost)<0)
+		td->errors++;
+	if(gptpmasterclock_gm_domainIndex()!=0) td->errors++;
+	if(gptpmasterclock_gmstable(0)<0) td->errors++;
+	gptpmasterclock_event_seq();
+	if(gptpmasterclock_event_fd()<0) td->errors++;
+	if(gptpmasterclock_close()) td->errors++;
+}
+
+static void wait_and_timer(mt_thread_data_t *td)
+{
+	gptpmastertimer_t *tm;
+	uint64_t expire=0;
+	int64_t werr;
+	if(gptpmasterclock_precise_wait_until_ts64(gptpmasterclock_getts64()+
+						   200*UB_USEC_NS, -1, &werr)<0)
+		td->errors++;
+	if(td->count%16) return;
+	tm=gptpmastertimer_create(UB_MSEC_NS, 0, timer_cb, &expire);
+	if(!tm){
+		td->errors++;
+		return;
+	}
+	usleep(3000);
+	if(gptpmastertimer_delete(tm)) td->errors++;
+}
+
+static void *mt_thread_proc(void *ptr)
+{
+	mt_thread_data_t *td=(mt_thread_data_t *)ptr;
+	int64_t lts=0;
+	uint64_t pos=0;
+	if(gptpmasterclock_init(MT_SHARED_MEM)) td->errors++;
+	while(__atomic_load_n(&running, __ATOMIC_ACQUIRE)){
+		switch(td->index%4){
+		case 0:
+			read_time(td, &lts);
+			break;
+		case 1:
+			convert(td);
+			break;
+		case 2:
+			status_reads(td, &pos);
+			break;
+		case 3:
+			wait_and_timer(td);
+			break;
+		}
+		td->count++;
+	}
+	if(gptpmasterclock_close()) td->errors++;
+	return NULL;
+}
+
+/* gptp2d side, in the child process */
+static void writer_loop(int msec)
+{
+	gptpipc_sync_sample_t smp;
+	ClockIdentity gmid={0,};
+	int64_t ets;
+	int adjppb=0;
+	uint64_t n=0;
+	memset(&smp, 0, sizeof(smp));
+	ets=ub_mt_gettime64()+(int64_t)msec*UB_MSEC_NS;
+	while(ub_mt_gettime64()<ets){
+		// +-10ppm, the offset is kept continuous by gptpclock_setadj
+		adjppb=(adjppb>=10000)?-10000:adjppb+100;
+		gptpclock_setadj(adjppb, 1, 0);
+		gptpclock_rawmap_update();
+		smp.local_ts64=n;
+		gptpclock_sync_sample_push(0, &smp);
+		if(++n%100==0){
+			gmid[7]++;
+			gptpclock_set_gmchange(0, gmid);
+		}
+		usleep(MT_WRITE_INTERVAL_USEC);
+	}
+}
+
+static void test_mt_stress(void **state)
+{
+	mt_thread_data_t tds[MT_NUM_THREADS];
+	uint64_t counts[4]={0,0,0,0};
+	int64_t backstep=0;
+	pid_t pid;
+	int i, wstatus, errors=0;
+
+	pid=fork();
+	assert_true(pid>=0);
+	if(pid==0){
+		writer_loop(MT_TEST_MSEC+500);
+		// not to unlink the shared memory, which the parent closes
+		_exit(0);
+	}
+
+	assert_false(gptpmasterclock_init(MT_SHARED_MEM));
+	memset(tds, 0, sizeof(tds));
+	__atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+	for(i=0;i<MT_NUM_THREADS;i++){
+		tds[i].index=i;
+		assert_false(CB_THREAD_CREATE(&tds[i].th, NULL, mt_thread_proc, &tds[i]));
+	}
+	usleep(MT_TEST_MSEC*1000);
+	__atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+	for(i=0;i<MT_NUM_THREADS;i++){
+		CB_THREAD_JOIN(tds[i].th, NULL);
+		counts[i%4]+=tds[i].count;
+		errors+=tds[i].errors;
+		if(tds[i].backstep>backstep) backstep=tds[i].backstep;
+	}
+	assert_int_equal(waitpid(pid, &wstatus, 0), pid);
+	printf("%d threads: %"PRIu64" time reads, %"PRIu64" conversions, %"PRIu64
+	       " status reads, %"PRIu64" waits, max backstep=%"PRIi64"nsec, errors=%d\n",
+	       MT_NUM_THREADS, counts[0], counts[1], counts[2], counts[3], backstep, errors);
+	assert_int_equal(errors, 0);
+	assert_true(backstep<MT_BACKSTEP_LIMIT);
+	for(i=0;i<4;i++) assert_true(counts[i]>0);
+	assert_false(gptpmasterclock_close());
+	// the last close, it is not initialized any more
+	assert_int_equal(gptpmasterclock_close(), -1);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ClockIdentity clockId={0,};
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:45", "UBL_GPTP");
+	unibase_init(&init_para);
+
+	gptpconf_set_item(CONF_MASTER_CLOCK_SHARED_MEM, MT_SHARED_MEM);
+	if(gptpclock_init(1, 2)) return -1;
+	/* the same setup as gptp2d, thisClock(clockIndex=1) is adjusted,
+	   and the result is set to the master clock parameters in the shared memory */
+	if(gptpclock_add_clock(0, GPTP_SWCLOCK_PTPDEV, 0, 0, clockId)) return -1;
+	clockId[7]=1;
+	if(gptpclock_add_clock(1, GPTP_SWCLOCK_PTPDEV, 0, 0, clockId)) return -1;
+	if(gptpclock_set_thisClock(1, 0, false)) return -1;
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	gptpclock_close();
+	unibase_close();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_mt_stress),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,408 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "gptpmasterclock.h"
+#include "gptpmastertimer.h"
+
+// the thread wakes up at least in this interval, to check GM change and time jump
+#define TIMER_MAX_SLEEP (10*UB_MSEC_NS)
+#define TIMER_DEFAULT_SPIN (20*UB_USEC_NS)
+// gPTP time which moves differently from the system clock by more than this is a jump
+#define TIMER_TIME_JUMP_THRESH (100*UB_USEC_NS)
+// and the rate difference up to 1/TIMER_TIME_JUMP_RATE_DIV(100ppm) is allowed
+#define TIMER_TIME_JUMP_RATE_DIV 10000
+#define TIMER_HEAP_INIT_SIZE 16
+
+struct gptpmastertimer {
+	int64_t period;
+	int64_t phase;
+	int64_t next; // the next expiration time
+	gptpmastertimer_cb_t cb;
+	void *cbdata;
+	int evfd;
+	uint32_t events; // GPTPMASTERTIMER_FLAG_*
+	int hindex; // index in the heap, -1 when it is not in the heap
+	bool running; // the callback is running
+	bool deleted; // deleted in the callback, freed by the timer thread
+};
+
+typedef struct gptpmastertimer_data {
+	CB_THREAD_MUTEX_T mutex;
+	CB_THREAD_T thread;
+	bool thread_running;
+	uint32_t wake_seq; // futex to wake up the timer thread
+	int64_t spin;
+	gptpmastertimer_t **heap;
+	int num;
+	int size;
+} gptpmastertimer_data_t;
+
+static gptpmastertimer_data_t gtd={
+	.mutex=PTHREAD_MUTEX_INITIALIZER,
+	.spin=TIMER_DEFAULT_SPIN,
+};
+
+static void futex_wake(uint32_t *addr)
+{
+	__atomic_add_fetch(addr, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/* wait while *addr==val, until 'mts' of CLOCK_MONOTONIC */
+static void futex_wait_until(uint32_t *addr, uint32_t val, int64_t mts)
+{
+	struct timespec ts;
+	UB_NSEC2TS(mts, ts);
+	syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, val, &ts, NULL,
+		FUTEX_BITSET_MATCH_ANY);
+}
+
+/* the deadline heap, the earliest 'next' is on the top */
+static void heap_swap(int a, int b)
+{
+	gptpmastertimer_t *tm=gtd.heap[a];
+	gtd.heap[a]=gtd.heap[b];
+	gtd.heap[b]=tm;
+	gtd.heap[a]->hindex=a;
+	gtd.heap[b]->hindex=b;
+}
+
+static void heap_up(int i)
+{
+	while(i>0 && gtd.heap[(i-1)/2]->next > gtd.heap[i]->next){
+		heap_swap(i, (i-1)/2);
+		i=(i-1)/2;
+	}
+}
+
+static void heap_down(int i)
+{
+	int c;
+	while((c=2*i+1)<gtd.num){
+		if(c+1<gtd.num && gtd.heap[c+1]->next < gtd.heap[c]->next) c++;
+		if(gtd.heap[i]->next <= gtd.heap[c]->next) break;
+		heap_swap(i, c);
+		i=c;
+	}
+}
+
+static int heap_add(gptpmastertimer_t *tm)
+{
+	gptpmastertimer_t **nheap;
+	if(gtd.num==gtd.size){
+		nheap=realloc(gtd.heap, (gtd.size?gtd.size*2:TIMER_HEAP_INIT_SIZE)*
+			      sizeof(gptpmastertimer_t *));
+		if(!nheap) return -1;
+		gtd.heap=nheap;
+		gtd.size=gtd.size?gtd.size*2:TIMER_HEAP_INIT_SIZE;
+	}
+	tm->hindex=gtd.num++;
+	gtd.heap[tm->hindex]=tm;
+	heap_up(tm->hindex);
+	return 0;
+}
+
+static void heap_remove(gptpmastertimer_t *tm)
+{
+	int i=tm->hindex;
+	if(i<0) return;
+	tm->hindex=-1;
+	if(i!=--gtd.num){
+		gtd.heap[i]=gtd.heap[gtd.num];
+		gtd.heap[i]->hindex=i;
+		heap_up(i);
+		heap_down(gtd.heap[i]->hindex);
+	}
+	if(!gtd.num){
+		free(gtd.heap);
+		gtd.heap=NULL;
+		gtd.size=0;
+	}
+}
+
+/* the first expiration time after 'cts' */
+static int64_t align_next(gptpmastertimer_t *tm, int64_t cts)
+{
+	int64_t n;
+	n=(cts-tm->phase)/tm->period;
+	if(cts-tm->phase<0) n--; // round toward minus
+	return tm->phase+(n+1)*tm->period;
+}
+
+static void free_timer(gptpmastertimer_t *tm)
+{
+	if(tm->evfd>=0) close(tm->evfd);
+	free(tm);
+}
+
+/* call the callback with the mutex unlocked. return true if 'tm' is freed */
+static bool call_cb(gptpmastertimer_t *tm, gptpmastertimer_event_t event,
+		    int64_t ts64, uint32_t overrun)
+{
+	tm->running=true;
+	CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+	tm->cb(tm->cbdata, event, ts64, overrun);
+	CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+	tm->running=false;
+	if(!tm->deleted) return false;
+	free_timer(tm);
+	return true;
+}
+
+static void signal_evfd(gptpmastertimer_t *tm, uint64_t v)
+{
+	if(write(tm->evfd, &v, sizeof(v))!=sizeof(v)){
+		UB_LOG(UBL_ERROR, "%s:can't write the eventfd, %s\n", __func__,
+		       strerror(errno));
+	}
+}
+
+/* GM change or time jump, all the timers are re-aligned to gPTP time 'cts' */
+static void realign_timers(int64_t cts, gptpmastertimer_event_t event)
+{
+	gptpmastertimer_t *tm;
+	int i;
+	UB_LOG(UBL_INFO, "%s:%s, re-align %d timers\n", __func__,
+	       event==GPTPMASTERTIMER_GM_CHANGE?"GM change":"time jump", gtd.num);
+	for(i=0;i<gtd.num;i++){
+		tm=gtd.heap[i];
+		tm->next=align_next(tm, cts);
+		tm->events|=1<<event;
+		// the users of the eventfd get the events by gptpmastertimer_get_events
+		if(!tm->cb) signal_evfd(tm, 1);
+	}
+	for(i=gtd.num/2-1;i>=0;i--) heap_down(i);
+	// the heap may change in the callbacks, search from the top every time
+	while(true){
+		for(i=0;i<gtd.num;i++){
+			if(gtd.heap[i]->cb && gtd.heap[i]->events) break;
+		}
+		if(i==gtd.num) break;
+		tm=gtd.heap[i];
+		tm->events=0;
+		call_cb(tm, event, tm->next, 0);
+	}
+}
+
+static void expire_timer(gptpmastertimer_t *tm, int64_t cts)
+{
+	uint32_t overrun;
+	int64_t ts64;
+	overrun=(cts-tm->next)/tm->period;
+	ts64=tm->next+(int64_t)overrun*tm->period;
+	tm->next=ts64+tm->period;
+	heap_down(tm->hindex);
+	if(tm->cb){
+		call_cb(tm, GPTPMASTERTIMER_EXPIRE, ts64, overrun);
+		return;
+	}
+	signal_evfd(tm, overrun+1);
+}
+
+/* read gPTP time and CLOCK_MONOTONIC at the same moment.
+   return false if the reads were preempted and the pair is not reliable */
+static bool read_time_pair(int64_t *cts, int64_t *mts)
+{
+	int64_t mts2;
+	*mts=ub_mt_gettime64();
+	*cts=gptpmasterclock_getts64();
+	mts2=ub_mt_gettime64();
+	return mts2-*mts < TIMER_TIME_JUMP_THRESH/2;
+}
+
+static bool time_jumped(int64_t dcts, int64_t dmts)
+{
+	int64_t d=dcts-dmts;
+	if(d<0) d=-d;
+	return d > TIMER_TIME_JUMP_THRESH+dmts/TIMER_TIME_JUMP_RATE_DIV;
+}
+
+static void *timer_thread_proc(void *ptr)
+{
+	gptpmastertimer_t *tm;
+	int64_t cts, mts, rts, next, pcts=0, pmts=0;
+	uint32_t wseq;
+	int gmind, ngmind;
+	bool reliable;
+
+	CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+	gmind=gptpmasterclock_gmchange_ind();
+	// the thread ends when the last timer is deleted
+	while(gtd.num){
+		wseq=__atomic_load_n(&gtd.wake_seq, __ATOMIC_ACQUIRE);
+		reliable=read_time_pair(&cts, &mts);
+		if(cts==-1){
+			// gptp2d is not running, check again after a while
+			CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+			futex_wait_until(&gtd.wake_seq, wseq, mts+TIMER_MAX_SLEEP);
+			CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+			continue;
+		}
+		ngmind=gptpmasterclock_gmchange_ind();
+		if(ngmind!=gmind){
+			gmind=ngmind;
+			realign_timers(cts, GPTPMASTERTIMER_GM_CHANGE);
+		}else if(reliable && pmts && time_jumped(cts-pcts, mts-pmts)){
+			realign_timers(cts, GPTPMASTERTIMER_TIME_JUMP);
+		}
+		if(reliable){
+			pcts=cts;
+			pmts=mts;
+		}
+		if(!gtd.num) break; // deleted in the callbacks
+		tm=gtd.heap[0];
+		rts=tm->next-cts;
+		if(rts>gtd.spin){
+			rts-=gtd.spin;
+			if(rts>TIMER_MAX_SLEEP) rts=TIMER_MAX_SLEEP;
+			CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+			futex_wait_until(&gtd.wake_seq, wseq, mts+rts);
+			CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+			continue;
+		}
+		// spin with the mutex unlocked, the timers may change in the spin
+		next=tm->next;
+		CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+		while(cts!=-1 && cts<next) cts=gptpmasterclock_getts64();
+		CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+		if(cts==-1 || !gtd.num) continue;
+		tm=gtd.heap[0];
+		if(cts<tm->next) continue;
+		expire_timer(tm, cts);
+	}
+	gtd.thread_running=false;
+	CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+	return NULL;
+}
+
+gptpmastertimer_t *gptpmastertimer_create(int64_t period, int64_t phase,
+					  gptpmastertimer_cb_t cb, void *cbdata)
+{
+	gptpmastertimer_t *tm;
+	int64_t cts;
+	if(period<=0){
+		UB_LOG(UBL_ERROR, "%s:invalid period=%"PRIi64"\n", __func__, period);
+		return NULL;
+	}
+	if(gptpmasterclock_init(NULL)) return NULL;
+	tm=malloc(sizeof(gptpmastertimer_t));
+	if(!tm) goto erexit;
+	memset(tm, 0, sizeof(gptpmastertimer_t));
+	tm->period=period;
+	tm->phase=phase%period;
+	tm->cb=cb;
+	tm->cbdata=cbdata;
+	tm->hindex=-1;
+	tm->evfd=-1;
+	if(!cb){
+		tm->evfd=eventfd(0, EFD_CLOEXEC);
+		if(tm->evfd<0){
+			UB_LOG(UBL_ERROR, "%s:eventfd error, %s\n", __func__, strerror(errno));
+			free(tm);
+			goto erexit;
+		}
+	}
+	CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+	cts=gptpmasterclock_getts64();
+	if(cts==-1){
+		UB_LOG(UBL_ERROR, "%s:can't read gPTP time\n", __func__);
+		goto erexit_unlock;
+	}
+	tm->next=align_next(tm, cts);
+	if(heap_add(tm)) goto erexit_unlock;
+	if(!gtd.thread_running){
+		if(CB_THREAD_CREATE(&gtd.thread, NULL, timer_thread_proc, NULL)){
+			UB_LOG(UBL_ERROR, "%s:can't start the timer thread\n", __func__);
+			heap_remove(tm);
+			goto erexit_unlock;
+		}
+		pthread_detach(gtd.thread);
+		gtd.thread_running=true;
+	}
+	CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+	// the new timer may be the earliest one
+	futex_wake(&gtd.wake_seq);
+	return tm;
+erexit_unlock:
+	CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+	free_timer(tm);
+erexit:
+	gptpmasterclock_close();
+	return NULL;
+}
+
+int gptpmastertimer_delete(gptpmastertimer_t *tm)
+{
+	bool in_thread;
+	if(!tm) return -1;
+	CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+	in_thread=gtd.thread_running && pthread_equal(gtd.thread, pthread_self());
+	heap_remove(tm);
+	if(in_thread && tm->running){
+		// called in the callback, freed after the callback returns
+		tm->deleted=true;
+	}else{
+		while(tm->running){
+			CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+			sched_yield();
+			CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+		}
+		free_timer(tm);
+	}
+	CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+	// the thread ends by itself when the last timer is deleted
+	if(!in_thread) futex_wake(&gtd.wake_seq);
+	gptpmasterclock_close();
+	return 0;
+}
+
+int gptpmastertimer_fd(gptpmastertimer_t *tm)
+{
+	if(!tm || tm->evfd<0) return -1;
+	return tm->evfd;
+}
+
+uint32_t gptpmastertimer_get_events(gptpmastertimer_t *tm)
+{
+	uint32_t events;
+	if(!tm) return 0;
+	CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+	events=tm->events;
+	tm->events=0;
+	CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+	return events;
+}
+
+void gptpmastertimer_set_spin(int64_t spin)
+{
+	CB_THREAD_MUTEX_LOCK(&gtd.mutex);
+	gtd.spin=spin<0?0:spin;
+	CB_THREAD_MUTEX_UNLOCK(&gtd.mutex);
+	futex_wake(&gtd.wake_seq);
+}
@@ -0,0 +1,116 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/**
+ * @addtogroup gptp
+ * @{
+ * @file gptpmastertimer.h
+ * @copyright Copyright (C) 2019 Excelfore Corporation
+ * @brief periodic timers aligned to gPTP time.
+ *
+ * All the timers in a process are served by one timer thread,
+ * which keeps the timers in a heap ordered by the next expiration time.
+ * The thread sleeps until shortly before the earliest expiration, and
+ * spins on gPTP time for the rest.
+ * The expiration times are 'phase + N * period' in gPTP time.
+ * When GM changes or gPTP time jumps, the next expiration times are
+ * re-aligned to the new gPTP time, and the event is notified.
+ */
+
+#ifndef __GPTPMASTERTIMER_H_
+#define __GPTPMASTERTIMER_H_
+
+#include <stdint.h>
+
+/**
+ * @brief events notified to the timers
+ */
+typedef enum {
+	GPTPMASTERTIMER_EXPIRE = 0, //!< the timer expired
+	GPTPMASTERTIMER_GM_CHANGE, //!< GM changed, the timer is re-aligned
+	GPTPMASTERTIMER_TIME_JUMP, //!< gPTP time jumped, the timer is re-aligned
+} gptpmastertimer_event_t;
+
+#define GPTPMASTERTIMER_FLAG_GM_CHANGE (1<<GPTPMASTERTIMER_GM_CHANGE)
+#define GPTPMASTERTIMER_FLAG_TIME_JUMP (1<<GPTPMASTERTIMER_TIME_JUMP)
+
+/**
+ * @brief callback function of a timer, called in the timer thread
+ * @param cbdata	'cbdata' given in gptpmastertimer_create
+ * @param event	GPTPMASTERTIMER_EXPIRE, GPTPMASTERTIMER_GM_CHANGE or
+ * GPTPMASTERTIMER_TIME_JUMP
+ * @param ts64	the expiration time in gPTP time for GPTPMASTERTIMER_EXPIRE,
+ * the re-aligned next expiration time for the other events
+ * @param overrun	the number of the missed expirations before this one
+ * @note the callback must return quickly, it delays the other timers.
+ */
+typedef void (*gptpmastertimer_cb_t)(void *cbdata, gptpmastertimer_event_t event,
+				     int64_t ts64, uint32_t overrun);
+
+typedef struct gptpmastertimer gptpmastertimer_t;
+
+/**
+ * @brief create a periodic timer, the timer thread is started by the first timer
+ * @param period	period in nano second unit
+ * @param phase	phase in nano second unit, the timer expires at
+ * 'phase + N * period' in gPTP time
+ * @param cb	callback function, if NULL an eventfd is used, see
+ * gptpmastertimer_fd
+ * @param cbdata	data passed to 'cb'
+ * @return the timer, NULL on error
+ */
+gptpmastertimer_t *gptpmastertimer_create(int64_t period, int64_t phase,
+					  gptpmastertimer_cb_t cb, void *cbdata);
+
+/**
+ * @brief delete a timer, the timer thread is stopped by deleting the last timer
+ * @param tm	the timer
+ * @return 0 on success, -1 on error
+ * @note this can be called in the callback of the timer. When it is called
+ * in another thread, it waits for the running callback to return.
+ */
+int gptpmastertimer_delete(gptpmastertimer_t *tm);
+
+/**
+ * @brief get the eventfd of a timer created without a callback
+ * @param tm	the timer
+ * @return eventfd file descriptor, -1 on error
+ * @note the fd becomes readable at the expiration, and reading it returns
+ * the number of the expirations since the last read.
+ */
+int gptpmastertimer_fd(gptpmastertimer_t *tm);
+
+/**
+ * @brief get and clear the events of a timer created without a callback
+ * @param tm	the timer
+ * @return GPTPMASTERTIMER_FLAG_* of the events which happened since the last call
+ */
+uint32_t gptpmastertimer_get_events(gptpmastertimer_t *tm);
+
+/**
+ * @brief set the spin length of the timer thread
+ * @param spin	nano second unit; the last part of the wait before an expiration
+ * is done by spinning on gPTP time. 0 doesn't spin.
+ * @note it should be longer than the wake up latency of the system.
+ */
+void gptpmastertimer_set_spin(int64_t spin);
+
+#endif
+/** @}*/
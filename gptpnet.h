@@ -116,6 +116,16 @@ int gptpnet_ipc_respond(gptpnet_data_t *gpnet, struct sockaddr *addr,
 			gptpipc_gptpd_data_t *ipcdata, int size);
 int gptpnet_ipc_client_remove(gptpnet_data_t *gpnet, struct sockaddr *addr);
 
+/**
+ * @brief get statistics of the software clock timestamp conversion
+ * @param ndevIndex	index of a network device
+ * @param stat	the statistics is returned, portIndex is not set
+ * @param reset	if true, reset the statistics and 'stat' is not used
+ * @return 0 on success, -1 if the device doesn't run with the software clock
+ */
+int gptpnet_swclock_stat(gptpnet_data_t *gpnet, int ndevIndex,
+			 gptpipc_statistics_swclock_t *stat, bool reset);
+
 /**
  * @brief make the next timeout happen in toutns (nsec)
  * @param toutns	if 0, use the default(GPTPNET_EXTRA_TOUTNS)
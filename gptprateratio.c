@@ -0,0 +1,174 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * x is t1 from the first pair in usec, y is the difference of (t2-t1) from
+ * the first pair in nsec. The sums are taken around the means, then
+ * they don't overflow with the max window of 8sec intervals.
+ * The residual of a new pair is compared with the rms of the residuals in
+ * the window, only integer arithmetic is used on the Pdelay path.
+ */
+#include "gptpclock.h"
+#include "gptprateratio.h"
+#include "gptp_config.h"
+
+#define RATE_RATIO_MAX_WINDOW 32
+// a residual over this times of the rms is an outlier
+#define RATE_RATIO_OUTLIER_SIGMA 4
+// a residual over this is always an outlier, like a step of the peer clock
+#define RATE_RATIO_OUTLIER_MAX UB_MSEC_NS
+
+struct gptprateratio {
+	int window;
+	int64_t outlier; // nsec, residuals under this are never rejected
+	uint64_t lts0, pts0; // the first pair after the reset
+	uint64_t last_lts, last_pts;
+	int head; // the next position
+	int count;
+	int rejects; // consecutive rejects
+	int64_t x[RATE_RATIO_MAX_WINDOW];
+	int64_t y[RATE_RATIO_MAX_WINDOW];
+	// the fit on the current window, y=my+slope*(x-mx)
+	int64_t mx, my;
+	ScaledRateRatio slope; // nsec per usec, in the rate ratio unit
+	int64_t ssr; // sum of the squared residuals
+};
+
+gptprateratio_t *gptprateratio_create(void)
+{
+	gptprateratio_t *rre;
+	int window;
+	window=gptpconf_get_intitem(CONF_NEIGHBOR_RATE_RATIO_WINDOW);
+	if(window<3) return NULL;
+	if(window>RATE_RATIO_MAX_WINDOW){
+		UB_LOG(UBL_WARN, "%s:window=%d is too big, use %d\n",
+		       __func__, window, RATE_RATIO_MAX_WINDOW);
+		window=RATE_RATIO_MAX_WINDOW;
+	}
+	rre=malloc(sizeof(gptprateratio_t));
+	ub_assert(rre, __func__, "malloc");
+	memset(rre, 0, sizeof(gptprateratio_t));
+	rre->window=window;
+	rre->outlier=gptpconf_get_intitem(CONF_NEIGHBOR_RATE_RATIO_OUTLIER);
+	return rre;
+}
+
+void gptprateratio_delete(gptprateratio_t *rre)
+{
+	free(rre);
+}
+
+void gptprateratio_reset(gptprateratio_t *rre)
+{
+	rre->count=0;
+	rre->head=0;
+	rre->rejects=0;
+}
+
+static int fit(gptprateratio_t *rre)
+{
+	int64_t sxx=0, sxy=0, dx, r;
+	int i;
+	rre->mx=0;
+	rre->my=0;
+	for(i=0;i<rre->count;i++){
+		rre->mx+=rre->x[i];
+		rre->my+=rre->y[i];
+	}
+	rre->mx/=rre->count;
+	rre->my/=rre->count;
+	for(i=0;i<rre->count;i++){
+		dx=rre->x[i]-rre->mx;
+		sxx+=dx*dx;
+		sxy+=dx*(rre->y[i]-rre->my);
+	}
+	if(sxx<=0) return -1;
+	// gptp_rr_from_delta loses the lower bits with big values
+	while(sxx>=((int64_t)1<<31)){
+		sxx>>=1;
+		sxy>>=1;
+	}
+	rre->slope=gptp_rr_from_delta(sxy+sxx, sxx);
+	rre->ssr=0;
+	for(i=0;i<rre->count;i++){
+		r=rre->y[i]-rre->my-
+			gptp_fp_mulshr(rre->slope, rre->x[i]-rre->mx, RATE_RATIO_SHIFT);
+		// the first 2 pairs are not checked, limit not to overflow
+		if(r>RATE_RATIO_OUTLIER_MAX) r=RATE_RATIO_OUTLIER_MAX;
+		if(r<-RATE_RATIO_OUTLIER_MAX) r=-RATE_RATIO_OUTLIER_MAX;
+		rre->ssr+=r*r;
+	}
+	return 0;
+}
+
+static bool is_outlier(gptprateratio_t *rre, int64_t x, int64_t y)
+{
+	int64_t r;
+	// the rms isn't known with less than 3 pairs
+	if(rre->count<3) return false;
+	r=y-rre->my-gptp_fp_mulshr(rre->slope, x-rre->mx, RATE_RATIO_SHIFT);
+	if(r<0) r=-r;
+	if(r>RATE_RATIO_OUTLIER_MAX) return true;
+	if(r<=rre->outlier) return false;
+	// r^2 > SIGMA^2 * ssr/(count-2)
+	return r*r*(rre->count-2) >
+		RATE_RATIO_OUTLIER_SIGMA*RATE_RATIO_OUTLIER_SIGMA*rre->ssr;
+}
+
+int gptprateratio_add(gptprateratio_t *rre, uint64_t lts, uint64_t pts,
+		      ScaledRateRatio *rr)
+{
+	int64_t x, y;
+	if(rre->count && (lts<=rre->last_lts || pts<=rre->last_pts)){
+		UB_LOG(UBL_INFO, "%s:the timestamp went backward, reset\n", __func__);
+		gptprateratio_reset(rre);
+	}
+	if(!rre->count){
+		rre->lts0=lts;
+		rre->pts0=pts;
+	}
+	x=(int64_t)(lts-rre->lts0)/UB_USEC_NS;
+	y=(int64_t)(pts-rre->pts0)-(int64_t)(lts-rre->lts0);
+	if(is_outlier(rre, x, y)){
+		if(++rre->rejects < (rre->window+1)/2){
+			UB_LOG(UBL_DEBUG, "%s:rejected an outlier, t1=%"PRIu64", t2=%"PRIu64"\n",
+			       __func__, lts, pts);
+			return 1;
+		}
+		// too many in a row, the peer clock must have changed
+		UB_LOG(UBL_INFO, "%s:%d outliers in a row, reset\n", __func__, rre->rejects);
+		gptprateratio_reset(rre);
+		rre->lts0=lts;
+		rre->pts0=pts;
+		x=0;
+		y=0;
+	}
+	rre->rejects=0;
+	rre->last_lts=lts;
+	rre->last_pts=pts;
+	rre->x[rre->head]=x;
+	rre->y[rre->head]=y;
+	rre->head=(rre->head+1)%rre->window;
+	if(rre->count<rre->window) rre->count++;
+	if(rre->count<2 || fit(rre)) return -1;
+	// nsec per usec to nsec per nsec
+	*rr=rre->slope/1000;
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/**
+ * @addtogroup gptp
+ * @{
+ * @file gptprateratio.h
+ * @copyright Copyright (C) 2019 Excelfore Corporation
+ * @brief neighborRateRatio estimation by a windowed least squares.
+ *
+ * The pairs of pdelayReqEventEgressTimestamp(t1) and pdelayReqEventIngressTimestamp(t2)
+ * of the last CONF_NEIGHBOR_RATE_RATIO_WINDOW Pdelay exchanges are fitted by a line,
+ * and the slope gives neighborRateRatio. A new pair which is far from the line
+ * is rejected as an outlier, and doesn't enter the window.
+ */
+
+#ifndef __GPTPRATERATIO_H_
+#define __GPTPRATERATIO_H_
+
+#include "gptpfixedpoint.h"
+
+typedef struct gptprateratio gptprateratio_t;
+
+/**
+ * @brief create an estimator
+ * @return the estimator, NULL if CONF_NEIGHBOR_RATE_RATIO_WINDOW is less than 3,
+ * then neighborRateRatio is computed from the last 2 exchanges.
+ */
+gptprateratio_t *gptprateratio_create(void);
+
+void gptprateratio_delete(gptprateratio_t *rre);
+
+/**
+ * @brief drop all the pairs in the window
+ */
+void gptprateratio_reset(gptprateratio_t *rre);
+
+/**
+ * @brief add a pair of the timestamps, and estimate the rate ratio
+ * @param lts	timestamp by this clock, pdelayReqEventEgressTimestamp(t1)
+ * @param pts	timestamp by the peer clock, pdelayReqEventIngressTimestamp(t2)
+ * @param rr	return the rate ratio of the peer clock to this clock, it is not
+ *		updated unless 0 is returned
+ * @return 0 on success, 1 if the pair is rejected as an outlier,
+ * -1 if the window doesn't have enough pairs yet
+ */
+int gptprateratio_add(gptprateratio_t *rre, uint64_t lts, uint64_t pts,
+		      ScaledRateRatio *rr);
+
+#endif
+/** @}*/
@@ -0,0 +1,197 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * neighborRateRatio on virtual clocks. The timestamps of Pdelay exchanges have
+ * a gaussian noise and occasional spikes, and the stability of the rate ratio
+ * by the windowed least squares is compared with the computation by 2 exchanges.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <xl4unibase/unibase_binding.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "gptpclock.h"
+#include "gptpclock_virtual.h"
+#include "gptprateratio.h"
+#include "gptp_config.h"
+
+#define RR_PDELAY_INTERVAL UB_SEC_NS
+#define RR_EXCHANGES 600
+#define RR_SETTLE 32 // exchanges not counted in the statistics
+#define RR_PROP_DELAY 500 // nsec
+#define RR_TS_NOISE 20 // nsec
+#define RR_SPIKE_INTERVAL 37 // a spike in this number of exchanges
+#define RR_SPIKE 2000 // nsec
+#define RR_LOCAL_PPB (-5000)
+#define RR_PEER_PPB 20000
+
+typedef struct rateratio_result {
+	double rms; // ppb
+	double max; // ppb
+	int rejects;
+} rateratio_result_t;
+
+/* the same as computePdelayRateRatio without the window */
+static ScaledRateRatio two_point_rr(uint64_t t1, uint64_t t2, uint64_t *prev_t1,
+				    uint64_t *prev_t2, ScaledRateRatio old)
+{
+	ScaledRateRatio rr=RATE_RATIO_ONE;
+	if(*prev_t1) rr=gptp_rr_from_delta(t2-*prev_t2, t1-*prev_t1);
+	*prev_t1=t1;
+	*prev_t2=t2;
+	return (old+rr)/2;
+}
+
+static void run_rateratio(int window, rateratio_result_t *res)
+{
+	PTPFD_TYPE lcfd, pefd;
+	gptp_vclock_model_t model;
+	gptprateratio_t *rre;
+	uint64_t base, rts, t1, t2, prev_t1=0, prev_t2=0;
+	ScaledRateRatio rr=RATE_RATIO_ONE, truerr;
+	double err, sum2=0;
+	int32_t v=window, defv;
+	int i, n=0, r;
+
+	defv=gptpconf_get_intitem(CONF_NEIGHBOR_RATE_RATIO_WINDOW);
+	gptpconf_set_item(CONF_NEIGHBOR_RATE_RATIO_WINDOW, &v);
+	rre=gptprateratio_create();
+	if(window<3) assert_null(rre);
+	else assert_non_null(rre);
+	memset(&model, 0, sizeof(model));
+	lcfd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w1");
+	model.freq_ppb=RR_LOCAL_PPB;
+	model.ts_noise=RR_TS_NOISE;
+	model.seed=1;
+	assert_int_equal(gptp_vclock_set_model(lcfd, &model), 0);
+	pefd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w2");
+	model.freq_ppb=RR_PEER_PPB;
+	model.seed=2;
+	assert_int_equal(gptp_vclock_set_model(pefd, &model), 0);
+	truerr=gptp_rr_from_double((1.0+RR_PEER_PPB*1.0E-9)/(1.0+RR_LOCAL_PPB*1.0E-9));
+
+	memset(res, 0, sizeof(rateratio_result_t));
+	base=ub_rt_gettime64();
+	for(i=0;i<RR_EXCHANGES;i++){
+		rts=base+(uint64_t)i*RR_PDELAY_INTERVAL;
+		t1=gptp_vclock_gettime_at(lcfd, rts);
+		t2=gptp_vclock_gettime_at(pefd, rts+RR_PROP_DELAY);
+		if(i%RR_SPIKE_INTERVAL==RR_SPIKE_INTERVAL-1) t2+=RR_SPIKE;
+		if(rre){
+			r=gptprateratio_add(rre, t1, t2, &rr);
+			if(r==1) res->rejects++;
+			if(i>=2) assert_int_not_equal(r, -1);
+		}else{
+			rr=two_point_rr(t1, t2, &prev_t1, &prev_t2, rr);
+		}
+		if(i<RR_SETTLE) continue;
+		// 2^-41 to ppb
+		err=(double)(rr-truerr)*1.0E9/(double)((int64_t)1<<RATE_RATIO_SHIFT);
+		sum2+=err*err;
+		if(fabs(err)>res->max) res->max=fabs(err);
+		n++;
+	}
+	res->rms=sqrt(sum2/n);
+	printf("window=%2d: neighborRateRatio error rms=%.3fppb max=%.3fppb, "
+	       "%d outliers rejected\n", window, res->rms, res->max, res->rejects);
+	gptprateratio_delete(rre);
+	gptp_vclock_free_fd(lcfd);
+	gptp_vclock_free_fd(pefd);
+	gptpconf_set_item(CONF_NEIGHBOR_RATE_RATIO_WINDOW, &defv);
+}
+
+/* the window reduces the noise, and the spikes are rejected */
+static void test_rateratio_stability(void **state)
+{
+	rateratio_result_t r2, r8, r16;
+	run_rateratio(2, &r2);
+	run_rateratio(8, &r8);
+	run_rateratio(16, &r16);
+	assert_int_equal(r2.rejects, 0);
+	assert_true(r8.rejects >= (RR_EXCHANGES-RR_SETTLE)/RR_SPIKE_INTERVAL);
+	assert_true(r8.rms*4 < r2.rms);
+	assert_true(r8.max*4 < r2.max);
+	assert_true(r16.rms < r8.rms);
+}
+
+/* the fit on synthetic timestamps, the outliers and the reset */
+static void test_rateratio_fit(void **state)
+{
+	gptprateratio_t *rre;
+	ScaledRateRatio rr=RATE_RATIO_ONE, truerr;
+	uint64_t lts, pts;
+	int i;
+	rre=gptprateratio_create();
+	assert_non_null(rre);
+	// the peer is faster by 100ppm
+	truerr=gptp_rr_from_ppb(100000);
+	lts=UB_SEC_NS;
+	pts=10*UB_SEC_NS;
+	assert_int_equal(gptprateratio_add(rre, lts, pts, &rr), -1);
+	assert_int_equal(rr, RATE_RATIO_ONE);
+	for(i=1;i<20;i++)
+		assert_int_equal(gptprateratio_add(rre, lts+(uint64_t)i*UB_SEC_NS,
+						   pts+(uint64_t)i*(UB_SEC_NS+100000), &rr), 0);
+	assert_true(llabs(rr-truerr) < 16);
+	// a spike is rejected, and the ratio is not changed
+	rr=RATE_RATIO_ONE;
+	assert_int_equal(gptprateratio_add(rre, lts+(uint64_t)i*UB_SEC_NS,
+					   pts+(uint64_t)i*(UB_SEC_NS+100000)+1000, &rr), 1);
+	assert_int_equal(rr, RATE_RATIO_ONE);
+	i++;
+	// a step of the peer clock, rejected several times then the window restarts
+	pts+=UB_MSEC_NS;
+	for(;;i++){
+		if(gptprateratio_add(rre, lts+(uint64_t)i*UB_SEC_NS,
+				     pts+(uint64_t)i*(UB_SEC_NS+100000), &rr)!=1) break;
+	}
+	assert_int_equal(gptprateratio_add(rre, lts+(uint64_t)(i+1)*UB_SEC_NS,
+					   pts+(uint64_t)(i+1)*(UB_SEC_NS+100000), &rr), 0);
+	assert_true(llabs(rr-truerr) < 16);
+	// a backward timestamp restarts the window
+	assert_int_equal(gptprateratio_add(rre, lts, pts, &rr), -1);
+	gptprateratio_delete(rre);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:45", "UBL_GPTP");
+	unibase_init(&init_para);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unibase_close();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_rateratio_fit),
+		cmocka_unit_test(test_rateratio_stability),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
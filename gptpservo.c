@@ -0,0 +1,370 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+#include "gptpservo.h"
+#include "gptpipc.h"
+#include "gptp_config.h"
+
+// the sums of the fast lock are kept in int64_t by these limits
+#define FAST_LOCK_MAX_SAMPLES 64
+#define FAST_LOCK_MAX_SPAN (16*UB_SEC_NS)
+//if passing time between GM and thisClock, no way to calculate the freq offset
+#define FAST_LOCK_TOO_BIG_PASSTIME_GAP (UB_SEC_NS/10)
+// the sums of the decimation are kept in int64_t by these limits,
+// x<2*DECIMATE_MAX_INTERVAL in usec, |y|<=FAST_LOCK_TOO_BIG_PASSTIME_GAP in nsec
+#define DECIMATE_MAX_INTERVAL (10*UB_SEC_NS)
+#define DECIMATE_MAX_SAMPLES 1024
+
+typedef struct fast_lock {
+	int nsamples; // 0:disabled
+	int count; // the number of the samples, -1:done
+	bool done_now; // completed by the last sample
+	bool active; // the last sample was taken by the fast lock
+	bool gm_known;
+	int gmchange_ind;
+	int64_t lts0; // x=lts-lts0 in usec
+	int64_t dts0; // y='mts-lts'-dts0 in nsec
+	int64_t last_lts;
+	int64_t last_mts;
+	int64_t sx, sy, sxx, sxy;
+	gptpservo_output_t out;
+} fast_lock_t;
+
+// the samples in 'interval' are fitted to a line, and given to the algorithm as one
+typedef struct decimate {
+	int64_t interval; // nsec, 0:disabled
+	int count; // the number of the samples in the current interval
+	bool held; // the last sample was held in the interval
+	int gmchange_ind;
+	int64_t lts0; // x=lts-lts0 in usec
+	int64_t dts0; // y='mts-lts'-dts0 in nsec
+	int64_t last_lts; // lts of the previous sample
+	int64_t sx, sy, sxx, sxy;
+	int64_t sf, sxf; // f=sub-nsec part of y in 2^-16 nsec
+} decimate_t;
+
+struct gptpservo {
+	const gptpservo_ops_t *ops;
+	gptpservo_type_t type;
+	void *data;
+	gptpservo_para_t para;
+	fast_lock_t fl;
+	decimate_t dec;
+};
+
+static const gptpservo_ops_t *servo_ops[GPTPSERVO_TYPE_NUM]={
+	[GPTPSERVO_IIR]=&gptpservo_iir_ops,
+	[GPTPSERVO_PI]=&gptpservo_pi_ops,
+	[GPTPSERVO_KALMAN]=&gptpservo_kalman_ops,
+};
+
+gptpservo_t *gptpservo_create(gptpservo_type_t type, const gptpservo_para_t *para)
+{
+	gptpservo_t *sv;
+	if((int)type<0 || type>=GPTPSERVO_TYPE_NUM){
+		UB_LOG(UBL_ERROR, "%s:invalid servo type=%d\n", __func__, type);
+		return NULL;
+	}
+	sv=malloc(sizeof(gptpservo_t));
+	ub_assert(sv, __func__, "malloc1");
+	sv->ops=servo_ops[type];
+	sv->type=type;
+	sv->data=malloc(sv->ops->data_size);
+	ub_assert(sv->data, __func__, "malloc2");
+	memset(sv->data, 0, sv->ops->data_size);
+	if(sv->ops->init(sv->data, para)){
+		gptpservo_delete(sv);
+		return NULL;
+	}
+	sv->para=*para;
+	memset(&sv->fl, 0, sizeof(fast_lock_t));
+	sv->fl.nsamples=gptpconf_get_intitem(CONF_SERVO_FAST_LOCK_SAMPLES);
+	if(sv->fl.nsamples<2) sv->fl.nsamples=0;
+	if(sv->fl.nsamples>FAST_LOCK_MAX_SAMPLES) sv->fl.nsamples=FAST_LOCK_MAX_SAMPLES;
+	memset(&sv->dec, 0, sizeof(decimate_t));
+	sv->dec.interval=gptpconf_get_intitem(CONF_SERVO_UPDATE_INTERVAL_MSEC)*UB_MSEC_NS;
+	if(sv->dec.interval<0) sv->dec.interval=0;
+	if(sv->dec.interval>DECIMATE_MAX_INTERVAL) sv->dec.interval=DECIMATE_MAX_INTERVAL;
+	UB_LOG(UBL_INFO, "%s:domainNumber=%d, %s servo, fast lock by %d samples, "
+	       "update interval=%dmsec\n", __func__, para->domainNumber, sv->ops->name,
+	       sv->fl.nsamples, (int)(sv->dec.interval/UB_MSEC_NS));
+	return sv;
+}
+
+void gptpservo_delete(gptpservo_t *sv)
+{
+	if(!sv) return;
+	free(sv->data);
+	free(sv);
+}
+
+/* least squares fit of y=a+b*x, and apply the phase and the frequency at the last sample */
+static int fast_lock_apply(gptpservo_t *sv)
+{
+	fast_lock_t *fl=&sv->fl;
+	gptpservo_handover_t ho;
+	gptpservo_output_t out;
+	int64_t n=fl->count, num, den, slope, xl, yfit;
+	int ppb, maxadj;
+	num=n*fl->sxy-fl->sx*fl->sy;
+	den=n*fl->sxx-fl->sx*fl->sx;
+	if(den<=0){
+		fl->count=0;
+		return -1;
+	}
+	// nsec per usec, in the rate ratio unit
+	slope=gptp_rr_from_delta(num+den, den);
+	// 1nsec per usec is 10^6 ppb
+	ppb=gptp_fp_mulshr(slope, 1000000, RATE_RATIO_SHIFT);
+	xl=(fl->last_lts-fl->lts0)/UB_USEC_NS;
+	yfit=(fl->sy+gptp_fp_mulshr(slope, n*xl-fl->sx, RATE_RATIO_SHIFT))/n;
+
+	sv->ops->output(sv->data, &out);
+	maxadj=gptpconf_get_intitem(CONF_MAX_ADJUST_RATE_ON_CLOCK);
+	ho.adjppb=out.adjppb+ppb;
+	if(ho.adjppb > maxadj) ho.adjppb=maxadj;
+	if(ho.adjppb < -maxadj) ho.adjppb=-maxadj;
+	fl->out.step=fl->dts0+yfit;
+	ho.offset=sv->para.hw_phase_adj?0:fl->out.step;
+	ho.lts=fl->last_lts;
+	ho.mts=fl->last_mts;
+	ho.span=fl->last_lts-fl->lts0;
+	ho.nsamples=n;
+	ho.gmchange_ind=fl->gmchange_ind;
+	sv->ops->handover(sv->data, &ho);
+	UB_LOG(UBL_INFO, "%s:domainNumber=%d, fast lock by %d samples, rate=%dppb, "
+	       "adjppb=%d, offset=%"PRIi64"\n", __func__, sv->para.domainNumber,
+	       (int)n, ppb, ho.adjppb, fl->out.step);
+
+	sv->ops->output(sv->data, &out);
+	fl->out.offset=ho.offset;
+	fl->out.rate=gptp_rr_from_ppb(ppb);
+	fl->out.adjppb=ho.adjppb;
+	fl->out.flags=GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ | GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP |
+		(out.flags & (GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE |
+			      GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE));
+	fl->out.fstate[0]=out.fstate[0];
+	fl->out.fstate[1]=out.fstate[1];
+	fl->count=-1;
+	fl->done_now=true;
+	return 0;
+}
+
+static int fast_lock_sample(gptpservo_t *sv, int64_t lts, int64_t mts)
+{
+	fast_lock_t *fl=&sv->fl;
+	int64_t dlts, dmts, x, y;
+	fl->active=true;
+	// no adjustment while collecting the samples
+	sv->ops->output(sv->data, &fl->out);
+	fl->out.rate=0;
+	fl->out.flags=0;
+	if(fl->count>0){
+		dlts=lts-fl->last_lts;
+		dmts=mts-fl->last_mts;
+		if(dlts<=0 || llabs(dmts-dlts) > FAST_LOCK_TOO_BIG_PASSTIME_GAP ||
+		   lts-fl->lts0 > FAST_LOCK_MAX_SPAN){
+			fl->count=0;
+		}else{
+			fl->out.rate=gptp_rr_from_delta(dmts, dlts);
+		}
+	}
+	if(fl->count==0){
+		fl->lts0=lts;
+		fl->dts0=mts-lts;
+		fl->sx=0;
+		fl->sy=0;
+		fl->sxx=0;
+		fl->sxy=0;
+	}
+	x=(lts-fl->lts0)/UB_USEC_NS;
+	y=mts-lts-fl->dts0;
+	fl->sx+=x;
+	fl->sy+=y;
+	fl->sxx+=x*x;
+	fl->sxy+=x*y;
+	fl->last_lts=lts;
+	fl->last_mts=mts;
+	if(++fl->count<fl->nsamples) return -1;
+	return fast_lock_apply(sv);
+}
+
+static void decimate_add(decimate_t *dec, int64_t lts, int64_t dts, uint16_t subns)
+{
+	int64_t x, y;
+	if(dec->count==0){
+		dec->lts0=lts;
+		dec->dts0=dts;
+		dec->sx=0;
+		dec->sy=0;
+		dec->sxx=0;
+		dec->sxy=0;
+		dec->sf=0;
+		dec->sxf=0;
+	}
+	x=(lts-dec->lts0)/UB_USEC_NS;
+	y=dts-dec->dts0;
+	dec->sx+=x;
+	dec->sy+=y;
+	dec->sxx+=x*x;
+	dec->sxy+=x*y;
+	dec->sf+=subns;
+	dec->sxf+=x*subns;
+	dec->count++;
+}
+
+/* sum((a-ma)*(b-mb)) by the means of a and b, from the plain sums.
+   'n*sab-sa*sb' overflows, but each term here is at most n*max(a)*max(b) */
+static int64_t decimate_csum(int64_t n, int64_t sa, int64_t sb, int64_t sab)
+{
+	int64_t ma=sa/n, mb=sb/n;
+	// the truncated means, and the correction by the remainders
+	return sab-ma*sb-mb*sa+n*ma*mb-(sa-n*ma)*(sb-n*mb)/n;
+}
+
+/* 'mts-lts' at 'lts' on the fitted line in scaled nsec, the mean if the line can't be
+   fitted. the nsec part and the sub-nsec part are fitted separately, and added */
+static int64_t decimate_dts(decimate_t *dec, int64_t lts)
+{
+	int64_t n=dec->count, cxx, cxy, cxf, slope, slopef, dx;
+	cxx=(n<3)?0:decimate_csum(n, dec->sx, dec->sx, dec->sxx);
+	if(cxx<=0)
+		return gptp_sns_from_ns(dec->dts0, 0)+
+			(dec->sy*((int64_t)1<<SCALED_NS_SHIFT)+dec->sf)/n;
+	cxy=decimate_csum(n, dec->sx, dec->sy, dec->sxy);
+	cxf=decimate_csum(n, dec->sx, dec->sf, dec->sxf);
+	// gptp_rr_from_delta loses the lower bits with big values
+	while(cxx>=((int64_t)1<<31)){
+		cxx>>=1;
+		cxy>>=1;
+		cxf>>=1;
+	}
+	// nsec per usec, and 2^-16 nsec per usec, in the rate ratio unit
+	slope=gptp_rr_from_delta(cxy+cxx, cxx);
+	slopef=gptp_rr_from_delta(cxf+cxx, cxx);
+	dx=n*((lts-dec->lts0)/UB_USEC_NS)-dec->sx;
+	return gptp_sns_from_ns(dec->dts0, 0)+
+		((dec->sy+gptp_fp_mulshr(slope, dx, RATE_RATIO_SHIFT))*
+		 ((int64_t)1<<SCALED_NS_SHIFT)+
+		 dec->sf+gptp_fp_mulshr(slopef, dx, RATE_RATIO_SHIFT))/n;
+}
+
+/* hold the samples until 'interval' passes, then give the fitted one to the algorithm.
+   a GM change, a big jump, lts going backward or too old samples flush the samples
+   before it. DECIMATE_MAX_SAMPLES samples give the fitted one before 'interval' */
+static int decimate_sample(gptpservo_t *sv, int64_t lts, int64_t mts, uint16_t mts_subns,
+			   int gmchange_ind)
+{
+	decimate_t *dec=&sv->dec;
+	int64_t dts;
+	dts=mts-lts;
+	if(dec->count && (dec->gmchange_ind!=gmchange_ind || lts<=dec->last_lts ||
+			  lts-dec->lts0 >= 2*DECIMATE_MAX_INTERVAL ||
+			  llabs(dts-dec->dts0) > FAST_LOCK_TOO_BIG_PASSTIME_GAP))
+		dec->count=0;
+	dec->gmchange_ind=gmchange_ind;
+	dec->last_lts=lts;
+	decimate_add(dec, lts, dts, mts_subns);
+	if(lts-dec->lts0 < dec->interval && dec->count<DECIMATE_MAX_SAMPLES){
+		dec->held=true;
+		return -1;
+	}
+	dts=decimate_dts(dec, lts);
+	dec->count=0;
+	return sv->ops->sample(sv->data, lts, lts+gptp_sns_to_ns(dts),
+			       dts&SCALED_NS_MASK, gmchange_ind);
+}
+
+int gptpservo_sample(gptpservo_t *sv, int64_t lts, int64_t mts, uint16_t mts_subns,
+		     int gmchange_ind)
+{
+	fast_lock_t *fl=&sv->fl;
+	fl->done_now=false;
+	fl->active=false;
+	sv->dec.held=false;
+	if(fl->nsamples){
+		if(fl->gm_known && fl->gmchange_ind!=gmchange_ind){
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, GM changed. start the fast lock\n",
+			       __func__, sv->para.domainNumber);
+			fl->count=0;
+		}
+		fl->gmchange_ind=gmchange_ind;
+		fl->gm_known=true;
+		// nsec resolution is enough for the fit, round mts
+		if(fl->count>=0)
+			return fast_lock_sample(sv, lts,
+						mts+(mts_subns>>(SCALED_NS_SHIFT-1)));
+	}
+	if(sv->dec.interval)
+		return decimate_sample(sv, lts, mts, mts_subns, gmchange_ind);
+	return sv->ops->sample(sv->data, lts, mts, mts_subns, gmchange_ind);
+}
+
+void gptpservo_output(gptpservo_t *sv, gptpservo_output_t *out)
+{
+	if(sv->fl.active){
+		*out=sv->fl.out;
+		return;
+	}
+	sv->ops->output(sv->data, out);
+	if(sv->dec.held){
+		// nothing to be applied for a held sample
+		out->rate=0;
+		out->flags&=~(GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ |
+			      GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP);
+	}
+}
+
+void gptpservo_reset(gptpservo_t *sv)
+{
+	sv->ops->reset(sv->data);
+	sv->fl.count=0;
+	sv->fl.active=false;
+	sv->fl.done_now=false;
+	sv->dec.count=0;
+	sv->dec.held=false;
+}
+
+bool gptpservo_fast_locked(gptpservo_t *sv)
+{
+	return sv->fl.done_now;
+}
+
+void gptpservo_skip_fast_lock(gptpservo_t *sv)
+{
+	sv->fl.count=-1;
+	sv->fl.gm_known=false;
+}
+
+gptpservo_type_t gptpservo_type(gptpservo_t *sv)
+{
+	return sv->type;
+}
+
+const char *gptpservo_name(gptpservo_t *sv)
+{
+	return sv->ops->name;
+}
+
+void *gptpservo_state(gptpservo_t *sv, int *size)
+{
+	*size=sv->ops->data_size;
+	return sv->data;
+}
@@ -0,0 +1,165 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/**
+ * @addtogroup gptp
+ * @{
+ * @file gptpservo.h
+ * @copyright Copyright (C) 2019 Excelfore Corporation
+ * @brief the servo which synchronizes thisClock to GM.
+ *
+ * A servo gets pairs of the local time and GM time of the received Sync,
+ * and decides the frequency adjustment and the phase step of thisClock.
+ * The servo doesn't touch the clocks, the caller applies the output.
+ * The algorithm is selected by CONF_SERVO_TYPE.
+ *
+ * With CONF_SERVO_FAST_LOCK_SAMPLES, after the start, a reset and a GM change,
+ * the frequency and the phase are fitted by least squares over the first
+ * samples, and applied in one step. Then the algorithm takes over from there.
+ */
+
+#ifndef __GPTPSERVO_H_
+#define __GPTPSERVO_H_
+
+#include "gptpfixedpoint.h"
+
+/**
+ * @brief servo algorithms, the value is CONF_SERVO_TYPE
+ */
+typedef enum {
+	GPTPSERVO_IIR = 0, //!< IIR filters on the rate and the phase
+	GPTPSERVO_PI, //!< PI controller on the phase offset
+	GPTPSERVO_KALMAN, //!< Kalman filter on the phase and the frequency
+	GPTPSERVO_TYPE_NUM,
+} gptpservo_type_t;
+
+/**
+ * @brief parameters given at the creation
+ */
+typedef struct gptpservo_para {
+	uint8_t domainNumber; //!< used only for the log
+	//! a phase step is done on thisClock, and the offset becomes 0 after the step.
+	//! if false, the step is done on the master clock, and the offset remains.
+	bool hw_phase_adj;
+} gptpservo_para_t;
+
+/**
+ * @brief the servo output of the last sample
+ */
+typedef struct gptpservo_output {
+	int64_t offset; //!< the estimated phase offset of GM to thisClock, 'mts-lts'
+	int64_t step; //!< the offset to be set, with GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP
+	ScaledRateRatio rate; //!< the measured rate of the last sample, 0 if not measured
+	int adjppb; //!< the frequency adjustment of thisClock
+	uint8_t flags; //!< GPTPIPC_SYNC_SAMPLE_FLAG_*
+	//! the internal filter state for the telemetry, the meaning depends on the algorithm
+	//! IIR:[mean rate(ScaledRateRatio), alpha], PI:[error(nsec), drift(1/1000 ppb)],
+	//! KALMAN:[phase(psec), freq(1/1000 ppb)]
+	int64_t fstate[2];
+} gptpservo_output_t;
+
+/**
+ * @brief the state given to the algorithm at the end of the fast lock
+ */
+typedef struct gptpservo_handover {
+	int adjppb; //!< the frequency adjustment of thisClock
+	int64_t offset; //!< the phase offset after the step
+	int64_t lts; //!< the last sample
+	int64_t mts; //!< the last sample
+	int64_t span; //!< nsec, the time span of the fitted samples
+	int nsamples; //!< the number of the fitted samples
+	int gmchange_ind;
+} gptpservo_handover_t;
+
+/**
+ * @brief the hooks of a servo algorithm.
+ * The state is in 'data' of 'data_size' bytes, which must not have pointers,
+ * because it is copied for the handoff to the next gptp2d.
+ */
+typedef struct gptpservo_ops {
+	const char *name;
+	int data_size;
+	//! initialize the state, read the config items
+	int (*init)(void *data, const gptpservo_para_t *para);
+	//! process a sample, return 0 when the output is updated, -1 when not.
+	//! mts_subns is the sub-nsec part of mts, use it or round mts by it.
+	int (*sample)(void *data, int64_t lts, int64_t mts, uint16_t mts_subns,
+		      int gmchange_ind);
+	//! get the output, FREQ_ADJ and PHASE_STEP flags are only for the last sample
+	void (*output)(void *data, gptpservo_output_t *out);
+	//! start over the phase and rate estimation, the frequency adjustment remains
+	void (*reset)(void *data);
+	//! continue from the result of the fast lock
+	void (*handover)(void *data, const gptpservo_handover_t *ho);
+} gptpservo_ops_t;
+
+typedef struct gptpservo gptpservo_t;
+
+extern const gptpservo_ops_t gptpservo_iir_ops;
+extern const gptpservo_ops_t gptpservo_pi_ops;
+extern const gptpservo_ops_t gptpservo_kalman_ops;
+
+/**
+ * @brief create a servo
+ * @param type	GPTPSERVO_*
+ * @return the servo, NULL for an invalid type
+ */
+gptpservo_t *gptpservo_create(gptpservo_type_t type, const gptpservo_para_t *para);
+
+void gptpservo_delete(gptpservo_t *sv);
+
+/**
+ * @brief process a Sync sample
+ * @param lts	receipt time in thisClock
+ * @param mts	GM time at the receipt
+ * @param mts_subns	sub-nsec part of mts in 2^-16 nsec
+ * @param gmchange_ind	incremented at every GM change, gptpclock_get_gmchange_ind
+ * @return 0 when the output is updated, -1 when not
+ */
+int gptpservo_sample(gptpservo_t *sv, int64_t lts, int64_t mts, uint16_t mts_subns,
+		     int gmchange_ind);
+
+void gptpservo_output(gptpservo_t *sv, gptpservo_output_t *out);
+
+void gptpservo_reset(gptpservo_t *sv);
+
+gptpservo_type_t gptpservo_type(gptpservo_t *sv);
+
+const char *gptpservo_name(gptpservo_t *sv);
+
+/**
+ * @brief true if the fast lock has been completed by the last sample
+ */
+bool gptpservo_fast_locked(gptpservo_t *sv);
+
+/**
+ * @brief don't run the fast lock until the next reset or GM change,
+ * used when the state is inherited from the previous gptp2d
+ */
+void gptpservo_skip_fast_lock(gptpservo_t *sv);
+
+/**
+ * @brief the state data of the servo, to be handed off to the next gptp2d
+ * @param size	return the size of the data
+ */
+void *gptpservo_state(gptpservo_t *sv, int *size);
+
+#endif
+/** @}*/
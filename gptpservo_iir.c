@@ -0,0 +1,302 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * IIR servo, the rate and the phase offset are estimated by IIR filters.
+ * A small phase offset is adjusted by the frequency, a big one is stepped.
+ */
+#include "gptpservo.h"
+#include "gptpipc.h"
+#include "gptp_config.h"
+
+typedef enum {
+	OFFSET_NOT_ADJ=-1,
+	OFFSET_START_ADJ,
+	OFFSET_UNSTABLE_ADJ,
+	OFFSET_STABLE_ADJ,
+}offset_state_t;
+
+typedef struct servo_iir_data {
+	gptpservo_para_t para;
+	ScaledRateRatio mrate;
+	uint64_t last_lts;
+	uint64_t last_mts;
+	int gmadjppb;
+	int alpha; // IIR coefficient is 1/alpha
+	int rate_stable;
+	int64_t offsetGM;
+	offset_state_t offsetGM_stable;
+	int gmchange_ind;
+	ScaledRateRatio smp_rate; // measured rate of the current sync sample
+	uint8_t smp_flags; // GPTPIPC_SYNC_SAMPLE_FLAG_* of the current sync sample
+	int64_t step; // the offset to be stepped by the current sync sample
+} servo_iir_data_t;
+
+//if passing time between GM and thisClock, no way to calculate the freq offset
+#define CMSR_TOO_BIG_PASSTIME_GAP (UB_SEC_NS/10)
+
+/* the following FREQ_* and PHASE_* constants may be configurable.
+ * But because the current values have been well tuned,
+ * and changing is not so easy, we use hardcoded numbers at this time.
+ */
+
+// move to stable condition if the FREQ_OFFSET_STABLE_PPB passed this time consecutively
+#define FREQ_OFFSET_STABLE_TRNS 3
+// unstable if delta of adj rate is bigger than this
+#define FREQ_OFFSET_UNSTABLE_PPB 1000
+
+#define PHASE_NEWGM_CRITERION 1000000 // 1msec
+#define PHASE_STABLE_CRITERION 10000 // 10usec
+#define PHASE_UNSTABLE_CRITERION 30000 // 30usec
+// after stable, adjust phase when the detected gap between GM and thisClock exceeds this value
+#define PHASE_OFFSET_ADJUST_TARGET 10000 // nsec
+#define PHASE_OFFSET_ADJUST_BY_FREQ 100000 // 100usec
+#define SET_PHASE_OFFSETGM_NOOP_RETURN -99999999 // not in +/-(PHASE_OFFSET_ADJUST_BY_FREQ*10)
+
+static int set_phase_offsetGM(servo_iir_data_t *sm, int64_t dts, int64_t dlts,
+			      int gmchange_ind)
+{
+	uint64_t dofg;
+	int alpha=1;
+	int64_t od;
+	int64_t offsetGM=0;
+	int poabf;
+
+	dofg=llabs(dts-sm->offsetGM);
+	if(dofg>=PHASE_NEWGM_CRITERION){
+		if(sm->gmchange_ind && sm->gmchange_ind==gmchange_ind){
+			if(sm->offsetGM_stable>=OFFSET_START_ADJ) {
+				UB_LOG(UBL_INFO, "%s:domainNumber=%d, big offset Jump=%u\n",
+				       __func__, sm->para.domainNumber, (unsigned int)dofg);
+				sm->offsetGM_stable=OFFSET_NOT_ADJ;
+				// don't update 'sm->offsetGM' by the first 'big jump'
+				// if the value at the next time is in PHASE_NEWGM_CRITERION,
+				// this is treated as 'OFFSET_START_ADJ'
+				return 0;
+			}
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, big offset Jump=%u"
+			       "second time, update with the big jump\n",
+			       __func__, sm->para.domainNumber, (unsigned int)dofg);
+			// second 'big jump', start over from 'OFFSET_START_ADJ'
+		}
+		sm->offsetGM_stable=OFFSET_START_ADJ;
+	}
+
+	if((dlts < gptpconf_get_intitem(CONF_CLOCK_COMPUTE_INTERVAL_MSEC)*UB_MSEC_NS)
+	   && (sm->offsetGM_stable > OFFSET_START_ADJ)) {
+		// once it reaches adjustment stage, use longer interval
+		return SET_PHASE_OFFSETGM_NOOP_RETURN;
+	}
+	switch(sm->offsetGM_stable){
+	case OFFSET_NOT_ADJ:
+	case OFFSET_START_ADJ:
+		offsetGM = dts;
+		sm->offsetGM_stable=OFFSET_UNSTABLE_ADJ;
+		UB_LOG(UBL_INFO, "%s:domainNumber=%d, New adjustment(New GM?)\n",
+		       __func__, sm->para.domainNumber);
+		break;
+	case OFFSET_UNSTABLE_ADJ:
+		alpha=gptpconf_get_intitem(CONF_PHASE_OFFSET_IIR_ALPHA_START_VALUE);
+		offsetGM = dts/alpha + (alpha-1) * (sm->offsetGM / alpha);
+		if(dofg<PHASE_STABLE_CRITERION){
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, stable\n",
+			       __func__, sm->para.domainNumber);
+			sm->offsetGM_stable=OFFSET_STABLE_ADJ;
+			sm->gmchange_ind=gmchange_ind;
+			UB_LOG(UBL_DEBUG, "%s:gmchange_ind=%d\n",
+			       __func__, sm->gmchange_ind);
+		}
+		break;
+	case OFFSET_STABLE_ADJ:
+		if(sm->gmchange_ind!=gmchange_ind){
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, GM changed. start over.\n",
+			       __func__, sm->para.domainNumber);
+			sm->offsetGM_stable=OFFSET_START_ADJ;
+			return 0;
+		}
+		alpha=gptpconf_get_intitem(CONF_PHASE_OFFSET_IIR_ALPHA_STABLE_VALUE);
+		offsetGM = dts/alpha + (alpha-1) * (sm->offsetGM / alpha);
+		if(dofg>PHASE_UNSTABLE_CRITERION){
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, unstable\n",
+			       __func__, sm->para.domainNumber);
+			sm->offsetGM_stable=OFFSET_UNSTABLE_ADJ;
+		}
+		break;
+	}
+
+	od=offsetGM-sm->offsetGM;
+	if(sm->para.hw_phase_adj){
+		// the range to be adjusted by freq must be wider than normal,
+		// then the phase is stepped less frequently
+		poabf=PHASE_OFFSET_ADJUST_BY_FREQ*10;
+	}else{
+		poabf=PHASE_OFFSET_ADJUST_BY_FREQ;
+	}
+	if(llabs(od)<poabf && gptpconf_get_intitem(CONF_PHASE_ADJUSTMENT_BY_FREQ)){
+		if(llabs(od)<PHASE_OFFSET_ADJUST_TARGET) return od;
+		UB_LOG(UBL_INFO, "%s:domainNumber=%d, offset adjustment by Freq., diff=%d\n",
+		       __func__, sm->para.domainNumber, (int)(od));
+		return od;
+	}
+	UB_LOG(UBL_INFO, "%s:domainNumber=%d, offset adjustment, diff=%d\n",
+	       __func__, sm->para.domainNumber, (int)od);
+	sm->step=offsetGM;
+	sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP;
+	if(sm->para.hw_phase_adj){
+		sm->offsetGM=0;
+	}else{
+		sm->offsetGM=offsetGM;
+	}
+	return 0;
+}
+
+static int computeGmRateRatio(servo_iir_data_t *sm, uint64_t lts, uint64_t mts,
+			      int gmchange_ind)
+{
+	int64_t dlts, dmts;
+	int64_t	dts;
+	ScaledRateRatio nrate;
+	int ppb;
+	int offset_comp;
+	dlts = lts - sm->last_lts;
+	dts=mts-lts;
+	offset_comp=set_phase_offsetGM(sm, dts, dlts, gmchange_ind);
+	if(offset_comp==SET_PHASE_OFFSETGM_NOOP_RETURN) return -1;
+
+	dmts = mts - sm->last_mts;
+	sm->last_lts = lts;
+	sm->last_mts = mts;
+	if(llabs(dmts-dlts) > CMSR_TOO_BIG_PASSTIME_GAP) return -1;
+	// IIR filter, M(n) = a*R(n) + (1-a)*M(n-1) = M(n-1) + (R(n)-M(n-1))*a, a=1/alpha
+	nrate = gptp_rr_from_delta(dmts, dlts);
+	sm->smp_rate = nrate;
+	nrate = sm->mrate + (nrate - sm->mrate) / sm->alpha;
+	ppb = gptp_rr_to_ppb(nrate);
+	if(sm->rate_stable < FREQ_OFFSET_STABLE_TRNS && abs(ppb) <
+	   gptpconf_get_intitem(CONF_FREQ_OFFSET_STABLE_PPB)){
+		sm->rate_stable++;
+		if(sm->rate_stable >= FREQ_OFFSET_STABLE_TRNS){
+			sm->alpha = gptpconf_get_intitem(
+				CONF_FREQ_OFFSET_IIR_ALPHA_STABLE_VALUE);
+			UB_LOG(UBL_INFO, "domainNumber=%d, clock_master_sync_receive:stable rate\n",
+				sm->para.domainNumber);
+		}
+	}
+	if(abs(ppb) > FREQ_OFFSET_UNSTABLE_PPB) {
+		sm->rate_stable=0;
+		sm->alpha = gptpconf_get_intitem(
+			CONF_FREQ_OFFSET_IIR_ALPHA_START_VALUE);
+		UB_LOG(UBL_INFO,
+		       "domainNumber=%d, clock_master_sync_receive:unstable rate\n",
+		       sm->para.domainNumber);
+	}
+
+	UB_LOG(UBL_DEBUGV, "clock_master_sync_receive:%s:domainNumber=%d rate=%dppb\n",
+	       __func__, sm->para.domainNumber, ppb);
+
+	ppb+=offset_comp;
+	if(abs(ppb) > gptpconf_get_intitem(CONF_FREQ_OFFSET_UPDATE_MRATE_PPB)){
+		int maxadj=gptpconf_get_intitem(CONF_MAX_ADJUST_RATE_ON_CLOCK);
+		sm->gmadjppb += ppb;
+		if(sm->gmadjppb > maxadj){
+			sm->gmadjppb = maxadj;
+		}else if(sm->gmadjppb < -maxadj){
+			sm->gmadjppb = -maxadj;
+		}
+		sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ;
+		UB_LOG(UBL_INFO, "domainNumber=%d, clock_master_sync_receive:"
+		       "the master clock rate to %dppb\n",
+		       sm->para.domainNumber, sm->gmadjppb);
+		// the master must be synchronized and the rate becomes 1.0
+		sm->mrate = RATE_RATIO_ONE;
+	}
+
+	return 0;
+}
+
+static void servo_iir_reset(void *data)
+{
+	servo_iir_data_t *sm=(servo_iir_data_t *)data;
+	sm->mrate = RATE_RATIO_ONE;
+	sm->alpha = gptpconf_get_intitem(CONF_FREQ_OFFSET_IIR_ALPHA_START_VALUE);
+	sm->last_lts = 0;
+	sm->last_mts = 0;
+	sm->offsetGM = 0;
+}
+
+static int servo_iir_init(void *data, const gptpservo_para_t *para)
+{
+	servo_iir_data_t *sm=(servo_iir_data_t *)data;
+	sm->para=*para;
+	servo_iir_reset(sm);
+	return 0;
+}
+
+static int servo_iir_sample(void *data, int64_t lts, int64_t mts, uint16_t mts_subns,
+			    int gmchange_ind)
+{
+	servo_iir_data_t *sm=(servo_iir_data_t *)data;
+	sm->smp_rate = 0;
+	sm->smp_flags = 0;
+	// the filters run in nsec, round mts
+	return computeGmRateRatio(sm, lts, mts+(mts_subns>>(SCALED_NS_SHIFT-1)), gmchange_ind);
+}
+
+static void servo_iir_output(void *data, gptpservo_output_t *out)
+{
+	servo_iir_data_t *sm=(servo_iir_data_t *)data;
+	out->offset = sm->offsetGM;
+	out->step = sm->step;
+	out->rate = sm->smp_rate;
+	out->adjppb = sm->gmadjppb;
+	out->flags = sm->smp_flags;
+	out->fstate[0] = sm->mrate;
+	out->fstate[1] = sm->alpha;
+	if(sm->offsetGM_stable==OFFSET_STABLE_ADJ)
+		out->flags |= GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE;
+	if(sm->rate_stable>=FREQ_OFFSET_STABLE_TRNS)
+		out->flags |= GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE;
+}
+
+static void servo_iir_handover(void *data, const gptpservo_handover_t *ho)
+{
+	servo_iir_data_t *sm=(servo_iir_data_t *)data;
+	sm->gmadjppb = ho->adjppb;
+	sm->mrate = RATE_RATIO_ONE;
+	sm->rate_stable = FREQ_OFFSET_STABLE_TRNS;
+	sm->alpha = gptpconf_get_intitem(CONF_FREQ_OFFSET_IIR_ALPHA_STABLE_VALUE);
+	sm->offsetGM = ho->offset;
+	sm->offsetGM_stable = OFFSET_STABLE_ADJ;
+	sm->gmchange_ind = ho->gmchange_ind;
+	sm->last_lts = ho->lts;
+	sm->last_mts = ho->mts;
+	sm->smp_rate = 0;
+	sm->smp_flags = 0;
+}
+
+const gptpservo_ops_t gptpservo_iir_ops={
+	.name="IIR",
+	.data_size=sizeof(servo_iir_data_t),
+	.init=servo_iir_init,
+	.sample=servo_iir_sample,
+	.output=servo_iir_output,
+	.reset=servo_iir_reset,
+	.handover=servo_iir_handover,
+};
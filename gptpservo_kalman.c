@@ -0,0 +1,365 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * Kalman filter servo, the phase offset and the frequency offset to GM are
+ * estimated jointly.
+ *   state x=[phase(psec), freq(1/1000 ppb)], x(n+1)=F*x(n), F=[[1,T],[0,1]]
+ *   measurement z='mts-lts-offset'(psec), z=H*x, H=[1,0]
+ * The frequency has a random walk of CONF_SERVO_KF_FREQ_NOISE, and the
+ * measurement has a white noise of CONF_SERVO_KF_MEAS_NOISE.
+ * A sample whose innovation is bigger than CONF_SERVO_KF_GATE times of its
+ * standard deviation is rejected as an outlier, like a delay spike on a
+ * congested bridge. Consecutive rejections more than CONF_SERVO_KF_MAX_REJECTS
+ * mean a real change, and the filter starts over.
+ * The frequency is adjusted by the estimated frequency plus the phase divided
+ * by CONF_SERVO_KF_PHASE_TIME.
+ * The computation is in integer, the gains are in the ScaledRateRatio unit(2^-41),
+ * and gptp_fp_mulshr gives 128-bit intermediate results.
+ */
+#include "gptpservo.h"
+#include "gptpipc.h"
+#include "gptp_config.h"
+
+typedef struct servo_kf_data {
+	gptpservo_para_t para;
+	int64_t rvar; // measurement noise variance, psec^2
+	int64_t qf; // frequency random walk, (1/1000 ppb)^2 per sec
+	int64_t gate;
+	int max_rejects;
+	int64_t phase_time; // msec
+	int64_t step_threshold;
+	int64_t locked_threshold;
+	int maxadj;
+	int count; // number of the samples after the reset
+	int rejects; // number of the consecutive rejections
+	int locked;
+	int rate_stable;
+	int gmchange_ind;
+	int64_t last_lts;
+	int64_t last_mts;
+	int64_t offset; // the phase offset which has been stepped
+	int64_t x[2];
+	int64_t p[3]; // covariance, P00, P01(=P10), P11
+	int64_t adjppt; // frequency adjustment in 1/1000 ppb
+	int adjppb;
+	ScaledRateRatio smp_rate;
+	uint8_t smp_flags;
+	int64_t step;
+	uint32_t outliers; // total number of the rejected samples
+} servo_kf_data_t;
+
+#define KF_SHIFT RATE_RATIO_SHIFT
+//if passing time between GM and thisClock, no way to calculate the freq offset
+#define KF_TOO_BIG_PASSTIME_GAP (UB_SEC_NS/10)
+// the prediction interval is limited to this, after a long loss of Sync
+#define KF_MAX_INTERVAL (UB_SEC_NS*4)
+// locked after this number of consecutive samples within the threshold
+#define KF_LOCKED_TRNS 3
+
+// num/den in 2^-KF_SHIFT unit, the same way as a rate ratio from time deltas
+static int64_t kf_ratio(int64_t num, int64_t den)
+{
+	return gptp_rr_from_delta(num+den, den);
+}
+
+static int64_t kf_isqrt(int64_t v)
+{
+	uint64_t r=0, b=(uint64_t)1<<62, uv;
+	if(v<=0) return 0;
+	uv=v;
+	while(b>uv) b>>=2;
+	while(b){
+		if(uv>=r+b){
+			uv-=r+b;
+			r=(r>>1)+b;
+		}else{
+			r>>=1;
+		}
+		b>>=2;
+	}
+	return r;
+}
+
+static void kf_clamp_adj(servo_kf_data_t *sm)
+{
+	int64_t maxppt=(int64_t)sm->maxadj*1000;
+	if(sm->adjppt > maxppt) sm->adjppt=maxppt;
+	if(sm->adjppt < -maxppt) sm->adjppt=-maxppt;
+}
+
+/* x=F*x, P=F*P*F'+Q */
+static void kf_predict(servo_kf_data_t *sm, int64_t dlts)
+{
+	int64_t ts, qt;
+	if(dlts > KF_MAX_INTERVAL) dlts=KF_MAX_INTERVAL;
+	// T in sec with 32 bits fraction
+	ts=gptp_fp_mulshr(dlts, ((int64_t)1<<62)/UB_SEC_NS, 30);
+	sm->x[0]+=gptp_fp_mulshr(sm->x[1], ts, 32);
+	sm->p[0]+=2*gptp_fp_mulshr(sm->p[1], ts, 32)+
+		gptp_fp_mulshr(gptp_fp_mulshr(sm->p[2], ts, 32), ts, 32);
+	sm->p[1]+=gptp_fp_mulshr(sm->p[2], ts, 32);
+	// Q=qf*[[T^3/3, T^2/2], [T^2/2, T]]
+	qt=gptp_fp_mulshr(sm->qf, ts, 32);
+	sm->p[2]+=qt;
+	qt=gptp_fp_mulshr(qt, ts, 32);
+	sm->p[1]+=qt/2;
+	sm->p[0]+=gptp_fp_mulshr(qt, ts, 32)/3;
+}
+
+/* return -1 when z is rejected */
+static int kf_update(servo_kf_data_t *sm, int64_t z)
+{
+	int64_t y, s, k0, k1, p01;
+	y=z-sm->x[0];
+	s=sm->p[0]+sm->rvar;
+	if(llabs(y) > sm->gate*kf_isqrt(s)){
+		sm->rejects++;
+		sm->outliers++;
+		UB_LOG(UBL_DEBUG, "%s:domainNumber=%d, rejected innovation=%"PRIi64"nsec, "
+		       "sigma=%"PRIi64"nsec\n", __func__, sm->para.domainNumber,
+		       y/1000, kf_isqrt(s)/1000);
+		return -1;
+	}
+	sm->rejects=0;
+	k0=kf_ratio(sm->p[0], s);
+	k1=kf_ratio(sm->p[1], s);
+	sm->x[0]+=gptp_fp_mulshr(k0, y, KF_SHIFT);
+	sm->x[1]+=gptp_fp_mulshr(k1, y, KF_SHIFT);
+	// P=(I-K*H)*P
+	p01=sm->p[1];
+	sm->p[2]-=gptp_fp_mulshr(k1, p01, KF_SHIFT);
+	sm->p[1]-=gptp_fp_mulshr(k0, p01, KF_SHIFT);
+	sm->p[0]-=gptp_fp_mulshr(k0, sm->p[0], KF_SHIFT);
+	return 0;
+}
+
+static void kf_step(servo_kf_data_t *sm, int64_t dts)
+{
+	UB_LOG(UBL_INFO, "%s:domainNumber=%d, offset adjustment, diff=%"PRIi64"\n",
+	       __func__, sm->para.domainNumber, dts-sm->offset);
+	sm->step=dts;
+	sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP;
+	sm->offset=sm->para.hw_phase_adj?0:dts;
+	sm->x[0]=0;
+	sm->locked=0;
+}
+
+/* the initial state by the first 2 samples */
+static void kf_start(servo_kf_data_t *sm, int64_t dts, int64_t dlts, int rppb)
+{
+	int64_t fsigma;
+	sm->adjppt+=(int64_t)rppb*1000;
+	kf_clamp_adj(sm);
+	sm->adjppb=sm->adjppt/1000;
+	sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ;
+	sm->x[0]=(dts-sm->offset)*1000;
+	sm->x[1]=0;
+	// the frequency is from 2 measurements in 'dlts'
+	fsigma=kf_isqrt(sm->rvar*2)*UB_SEC_NS/dlts;
+	sm->p[0]=sm->rvar;
+	sm->p[1]=0;
+	sm->p[2]=fsigma*fsigma;
+	sm->rejects=0;
+	if(llabs(dts-sm->offset) > sm->step_threshold) kf_step(sm, dts);
+}
+
+/* frequency adjustment by the estimated frequency and phase */
+static void kf_control(servo_kf_data_t *sm)
+{
+	int64_t du;
+	int nadj;
+	du=sm->x[1]+sm->x[0]*1000/sm->phase_time;
+	sm->adjppt+=du;
+	kf_clamp_adj(sm);
+	nadj=sm->adjppt/1000;
+	// the residual frequency after the adjustment
+	sm->x[1]-=(int64_t)(nadj-sm->adjppb)*1000;
+	sm->adjppb=nadj;
+	sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ;
+}
+
+static void servo_kf_reset(void *data)
+{
+	servo_kf_data_t *sm=(servo_kf_data_t *)data;
+	sm->count=0;
+	sm->rejects=0;
+	sm->locked=0;
+	sm->rate_stable=0;
+	sm->last_lts=0;
+	sm->last_mts=0;
+	sm->x[0]=0;
+	sm->x[1]=0;
+	// keep adjppt within the integer adjppb
+	sm->adjppt=(int64_t)sm->adjppb*1000;
+}
+
+static int servo_kf_init(void *data, const gptpservo_para_t *para)
+{
+	servo_kf_data_t *sm=(servo_kf_data_t *)data;
+	int64_t v;
+	sm->para=*para;
+	v=gptpconf_get_intitem(CONF_SERVO_KF_MEAS_NOISE)*1000;
+	sm->rvar=v*v;
+	v=gptpconf_get_intitem(CONF_SERVO_KF_FREQ_NOISE)*1000;
+	sm->qf=v*v;
+	sm->gate=gptpconf_get_intitem(CONF_SERVO_KF_GATE);
+	sm->max_rejects=gptpconf_get_intitem(CONF_SERVO_KF_MAX_REJECTS);
+	sm->phase_time=gptpconf_get_intitem(CONF_SERVO_KF_PHASE_TIME);
+	sm->step_threshold=gptpconf_get_intitem(CONF_SERVO_KF_STEP_THRESHOLD);
+	sm->locked_threshold=gptpconf_get_intitem(CONF_SERVO_KF_LOCKED_THRESHOLD);
+	sm->maxadj=gptpconf_get_intitem(CONF_MAX_ADJUST_RATE_ON_CLOCK);
+	if(sm->rvar<=0 || sm->gate<=0 || sm->phase_time<=0){
+		UB_LOG(UBL_ERROR, "%s:invalid MEAS_NOISE, GATE or PHASE_TIME\n", __func__);
+		return -1;
+	}
+	servo_kf_reset(sm);
+	return 0;
+}
+
+static int servo_kf_sample(void *data, int64_t lts, int64_t mts, uint16_t mts_subns,
+			   int gmchange_ind)
+{
+	servo_kf_data_t *sm=(servo_kf_data_t *)data;
+	int64_t dlts, dmts, dts, sigma;
+	int rppb;
+
+	sm->smp_rate=0;
+	sm->smp_flags=0;
+	if(sm->count && sm->gmchange_ind!=gmchange_ind){
+		UB_LOG(UBL_INFO, "%s:domainNumber=%d, GM changed. start over.\n",
+		       __func__, sm->para.domainNumber);
+		servo_kf_reset(sm);
+	}
+	sm->gmchange_ind=gmchange_ind;
+	dlts=lts-sm->last_lts;
+	dmts=mts-sm->last_mts;
+	dts=mts-lts;
+	if(!sm->count++){
+		sm->last_lts=lts;
+		sm->last_mts=mts;
+		return -1;
+	}
+	if(dlts<=0 || llabs(dmts-dlts) > KF_TOO_BIG_PASSTIME_GAP){
+		sm->last_lts=lts;
+		sm->last_mts=mts;
+		sm->count=1;
+		return -1;
+	}
+	sm->smp_rate=gptp_rr_from_delta(dmts, dlts);
+	rppb=gptp_rr_to_ppb(sm->smp_rate);
+	if(sm->count==2){
+		sm->last_lts=lts;
+		sm->last_mts=mts;
+		kf_start(sm, dts, dlts, rppb);
+		return 0;
+	}
+
+	kf_predict(sm, dlts);
+	sm->last_lts=lts;
+	sm->last_mts=mts;
+	// the phase is in psec, the sub-nsec part of mts is used here
+	if(kf_update(sm, (dts-sm->offset)*1000+((mts_subns*1000)>>SCALED_NS_SHIFT))){
+		if(sm->rejects <= sm->max_rejects) return -1;
+		UB_LOG(UBL_INFO, "%s:domainNumber=%d, %d consecutive outliers, start over\n",
+		       __func__, sm->para.domainNumber, sm->rejects);
+		// this sample becomes the first one
+		servo_kf_reset(sm);
+		sm->count=1;
+		sm->last_lts=lts;
+		sm->last_mts=mts;
+		return -1;
+	}
+	kf_control(sm);
+
+	sigma=kf_isqrt(sm->p[2])/1000;
+	if(sigma < gptpconf_get_intitem(CONF_FREQ_OFFSET_STABLE_PPB)){
+		if(sm->rate_stable<KF_LOCKED_TRNS) sm->rate_stable++;
+	}else{
+		sm->rate_stable=0;
+	}
+	if(llabs(sm->x[0]/1000) < sm->locked_threshold){
+		if(sm->locked<KF_LOCKED_TRNS && ++sm->locked==KF_LOCKED_TRNS)
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, locked\n",
+			       __func__, sm->para.domainNumber);
+	}else{
+		if(sm->locked>=KF_LOCKED_TRNS)
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, unlocked, phase=%"PRIi64"\n",
+			       __func__, sm->para.domainNumber, sm->x[0]/1000);
+		sm->locked=0;
+	}
+	UB_LOG(UBL_DEBUGV, "%s:domainNumber=%d, phase=%"PRIi64"psec, freq=%"PRIi64
+	       "/1000ppb, adjppb=%d\n", __func__, sm->para.domainNumber,
+	       sm->x[0], sm->x[1], sm->adjppb);
+	return 0;
+}
+
+static void servo_kf_output(void *data, gptpservo_output_t *out)
+{
+	servo_kf_data_t *sm=(servo_kf_data_t *)data;
+	out->offset = sm->offset;
+	out->step = sm->step;
+	out->rate = sm->smp_rate;
+	out->adjppb = sm->adjppb;
+	out->flags = sm->smp_flags;
+	out->fstate[0] = sm->x[0];
+	out->fstate[1] = sm->x[1];
+	if(sm->locked>=KF_LOCKED_TRNS)
+		out->flags |= GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE;
+	if(sm->rate_stable>=KF_LOCKED_TRNS)
+		out->flags |= GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE;
+}
+
+static void servo_kf_handover(void *data, const gptpservo_handover_t *ho)
+{
+	servo_kf_data_t *sm=(servo_kf_data_t *)data;
+	int64_t fsigma;
+	sm->adjppt=(int64_t)ho->adjppb*1000;
+	kf_clamp_adj(sm);
+	sm->adjppb=sm->adjppt/1000;
+	sm->offset=ho->offset;
+	sm->x[0]=0;
+	sm->x[1]=0;
+	// the variances of the least squares fit at the end of the span
+	fsigma=ho->span>0?kf_isqrt(sm->rvar*12/ho->nsamples)*UB_SEC_NS/ho->span:0;
+	sm->p[0]=sm->rvar*4/ho->nsamples;
+	sm->p[1]=0;
+	sm->p[2]=fsigma*fsigma;
+	// the next sample runs predict and update
+	sm->count=3;
+	sm->rejects=0;
+	sm->locked=KF_LOCKED_TRNS;
+	sm->rate_stable=KF_LOCKED_TRNS;
+	sm->gmchange_ind=ho->gmchange_ind;
+	sm->last_lts=ho->lts;
+	sm->last_mts=ho->mts;
+	sm->smp_rate=0;
+	sm->smp_flags=0;
+}
+
+const gptpservo_ops_t gptpservo_kalman_ops={
+	.name="KF",
+	.data_size=sizeof(servo_kf_data_t),
+	.init=servo_kf_init,
+	.sample=servo_kf_sample,
+	.output=servo_kf_output,
+	.reset=servo_kf_reset,
+	.handover=servo_kf_handover,
+};
@@ -0,0 +1,223 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * PI servo, the phase offset to GM is fed to a PI controller, and the output
+ * is the frequency adjustment.
+ *   adjppb = KP*offset + I,  I += KI*offset*interval
+ * The first 2 samples give the initial frequency, and the phase is stepped
+ * when the offset is bigger than CONF_SERVO_PI_STEP_THRESHOLD.
+ * All the computation is done in integer, KP and KI are in 1/1000 unit.
+ */
+#include "gptpservo.h"
+#include "gptpipc.h"
+#include "gptp_config.h"
+
+typedef struct servo_pi_data {
+	gptpservo_para_t para;
+	int64_t kp; // 1/1000 per sec
+	int64_t ki; // 1/1000 per sec^2
+	int64_t step_threshold;
+	int64_t locked_threshold;
+	int maxadj;
+	int count; // number of the samples after the reset
+	int locked; // number of the consecutive samples within locked_threshold
+	int rate_stable; // number of the consecutive samples within CONF_FREQ_OFFSET_STABLE_PPB
+	int gmchange_ind;
+	int64_t last_lts;
+	int64_t last_mts;
+	int64_t offset; // the phase offset which has been stepped, not adjusted by the servo
+	int64_t drift; // the integral term, 1/1000 ppb
+	int adjppb;
+	ScaledRateRatio smp_rate;
+	uint8_t smp_flags;
+	int64_t step;
+	int64_t error; // the phase error of the current sample
+} servo_pi_data_t;
+
+//if passing time between GM and thisClock, no way to calculate the freq offset
+#define PI_TOO_BIG_PASSTIME_GAP (UB_SEC_NS/10)
+// the interval for the integral term is limited to this, after a long loss of Sync
+#define PI_MAX_INTERVAL (UB_SEC_NS*4)
+// locked after this number of consecutive samples within the threshold
+#define PI_LOCKED_TRNS 3
+
+static int pi_clamp(servo_pi_data_t *sm, int64_t v)
+{
+	if(v > sm->maxadj) return sm->maxadj;
+	if(v < -sm->maxadj) return -sm->maxadj;
+	return (int)v;
+}
+
+static void pi_step(servo_pi_data_t *sm, int64_t dts)
+{
+	UB_LOG(UBL_INFO, "%s:domainNumber=%d, offset adjustment, diff=%"PRIi64"\n",
+	       __func__, sm->para.domainNumber, dts-sm->offset);
+	sm->step=dts;
+	sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP;
+	sm->offset=sm->para.hw_phase_adj?0:dts;
+	sm->error=0;
+	sm->locked=0;
+}
+
+static void servo_pi_reset(void *data)
+{
+	servo_pi_data_t *sm=(servo_pi_data_t *)data;
+	sm->count=0;
+	sm->locked=0;
+	sm->rate_stable=0;
+	sm->last_lts=0;
+	sm->last_mts=0;
+	sm->error=0;
+}
+
+static int servo_pi_init(void *data, const gptpservo_para_t *para)
+{
+	servo_pi_data_t *sm=(servo_pi_data_t *)data;
+	sm->para=*para;
+	sm->kp=gptpconf_get_intitem(CONF_SERVO_PI_KP);
+	sm->ki=gptpconf_get_intitem(CONF_SERVO_PI_KI);
+	sm->step_threshold=gptpconf_get_intitem(CONF_SERVO_PI_STEP_THRESHOLD);
+	sm->locked_threshold=gptpconf_get_intitem(CONF_SERVO_PI_LOCKED_THRESHOLD);
+	sm->maxadj=gptpconf_get_intitem(CONF_MAX_ADJUST_RATE_ON_CLOCK);
+	if(sm->kp<=0 || sm->ki<0){
+		UB_LOG(UBL_ERROR, "%s:invalid KP=%"PRIi64", KI=%"PRIi64"\n",
+		       __func__, sm->kp, sm->ki);
+		return -1;
+	}
+	servo_pi_reset(sm);
+	return 0;
+}
+
+static int servo_pi_sample(void *data, int64_t lts, int64_t mts, uint16_t mts_subns,
+			   int gmchange_ind)
+{
+	servo_pi_data_t *sm=(servo_pi_data_t *)data;
+	int64_t dlts, dmts, dts, ppb;
+	int rppb;
+
+	sm->smp_rate=0;
+	sm->smp_flags=0;
+	if(sm->count && sm->gmchange_ind!=gmchange_ind){
+		UB_LOG(UBL_INFO, "%s:domainNumber=%d, GM changed. start over.\n",
+		       __func__, sm->para.domainNumber);
+		servo_pi_reset(sm);
+	}
+	sm->gmchange_ind=gmchange_ind;
+	// the controller runs in nsec, round mts
+	mts+=mts_subns>>(SCALED_NS_SHIFT-1);
+	dlts=lts-sm->last_lts;
+	dmts=mts-sm->last_mts;
+	dts=mts-lts;
+	sm->last_lts=lts;
+	sm->last_mts=mts;
+	if(!sm->count++) return -1;
+	if(dlts<=0 || llabs(dmts-dlts) > PI_TOO_BIG_PASSTIME_GAP){
+		sm->count=1;
+		return -1;
+	}
+	sm->smp_rate=gptp_rr_from_delta(dmts, dlts);
+	rppb=gptp_rr_to_ppb(sm->smp_rate);
+	if(abs(rppb) < gptpconf_get_intitem(CONF_FREQ_OFFSET_STABLE_PPB)){
+		if(sm->rate_stable<PI_LOCKED_TRNS) sm->rate_stable++;
+	}else{
+		sm->rate_stable=0;
+	}
+
+	if(sm->count==2){
+		// the initial frequency from the first 2 samples
+		sm->adjppb=pi_clamp(sm, (int64_t)sm->adjppb+rppb);
+		sm->drift=(int64_t)sm->adjppb*1000;
+		sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ;
+		if(llabs(dts-sm->offset) > sm->step_threshold) pi_step(sm, dts);
+		return 0;
+	}
+
+	sm->error=dts-sm->offset;
+	if(llabs(sm->error) > sm->step_threshold){
+		pi_step(sm, dts);
+		return 0;
+	}
+	if(dlts > PI_MAX_INTERVAL) dlts=PI_MAX_INTERVAL;
+	// ki*error*dlts, error and dlts in nsec, the result is in 1/1000 ppb
+	sm->drift+=sm->ki*sm->error*(dlts/UB_USEC_NS)/UB_MSEC_NS;
+	if(sm->drift > (int64_t)sm->maxadj*1000) sm->drift=(int64_t)sm->maxadj*1000;
+	if(sm->drift < -(int64_t)sm->maxadj*1000) sm->drift=-(int64_t)sm->maxadj*1000;
+	ppb=(sm->kp*sm->error+sm->drift)/1000;
+	sm->adjppb=pi_clamp(sm, ppb);
+	sm->smp_flags|=GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ;
+	if(llabs(sm->error) < sm->locked_threshold){
+		if(sm->locked<PI_LOCKED_TRNS && ++sm->locked==PI_LOCKED_TRNS)
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, locked\n",
+			       __func__, sm->para.domainNumber);
+	}else{
+		if(sm->locked>=PI_LOCKED_TRNS)
+			UB_LOG(UBL_INFO, "%s:domainNumber=%d, unlocked, error=%"PRIi64"\n",
+			       __func__, sm->para.domainNumber, sm->error);
+		sm->locked=0;
+	}
+	UB_LOG(UBL_DEBUGV, "%s:domainNumber=%d, error=%"PRIi64", adjppb=%d\n",
+	       __func__, sm->para.domainNumber, sm->error, sm->adjppb);
+	return 0;
+}
+
+static void servo_pi_output(void *data, gptpservo_output_t *out)
+{
+	servo_pi_data_t *sm=(servo_pi_data_t *)data;
+	out->offset = sm->offset;
+	out->step = sm->step;
+	out->rate = sm->smp_rate;
+	out->adjppb = sm->adjppb;
+	out->flags = sm->smp_flags;
+	out->fstate[0] = sm->error;
+	out->fstate[1] = sm->drift;
+	if(sm->locked>=PI_LOCKED_TRNS)
+		out->flags |= GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE;
+	if(sm->rate_stable>=PI_LOCKED_TRNS)
+		out->flags |= GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE;
+}
+
+static void servo_pi_handover(void *data, const gptpservo_handover_t *ho)
+{
+	servo_pi_data_t *sm=(servo_pi_data_t *)data;
+	sm->adjppb=pi_clamp(sm, ho->adjppb);
+	sm->drift=(int64_t)sm->adjppb*1000;
+	sm->offset=ho->offset;
+	sm->error=0;
+	// the next sample runs the PI loop
+	sm->count=3;
+	sm->locked=PI_LOCKED_TRNS;
+	sm->rate_stable=PI_LOCKED_TRNS;
+	sm->gmchange_ind=ho->gmchange_ind;
+	sm->last_lts=ho->lts;
+	sm->last_mts=ho->mts;
+	sm->smp_rate=0;
+	sm->smp_flags=0;
+}
+
+const gptpservo_ops_t gptpservo_pi_ops={
+	.name="PI",
+	.data_size=sizeof(servo_pi_data_t),
+	.init=servo_pi_init,
+	.sample=servo_pi_sample,
+	.output=servo_pi_output,
+	.reset=servo_pi_reset,
+	.handover=servo_pi_handover,
+};
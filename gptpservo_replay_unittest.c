@@ -0,0 +1,397 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * offline replay of Sync captures through clock_slave_sync_sm,
+ * clock_master_sync_receive_sm and gptpclock on a virtual clock.
+ * The virtual clock runs in a simulated time, and the replay is much faster
+ * than the real time.
+ *
+ * A capture is a text file, one received Sync in a line, '#' starts a comment:
+ *   receipt,preciseOriginTimestamp,correction,rateRatio[,neighborPropDelay]
+ *   receipt: nsec, Sync receipt time by the free-running local clock
+ *   preciseOriginTimestamp: nsec
+ *   correction: nsec, followUpCorrectionField
+ *   rateRatio: rateRatio of GM to the local clock, like 1.000012345
+ *   neighborPropDelay: nsec, 0 if omitted
+ * The servo is selected and tuned by the config file.
+ *   gptpservo_replay_unittest [-c config_file] capture_file
+ * prints the statistics of the time error of the master clock to GM.
+ * Without a capture file, a synthetic capture is replayed by all the servos.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <getopt.h>
+#include <xl4unibase/unibase_binding.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "mind.h"
+#include "gptpclock.h"
+#include "gptpclock_virtual.h"
+#include "gptpservo.h"
+#include "clock_slave_sync_sm.h"
+#include "clock_master_sync_receive_sm.h"
+#include "gptp_config.h"
+
+#define RP_SYNC_INTERVAL (125*UB_MSEC_NS)
+#define RP_CAPTURE_SEC 300 // length of the synthetic capture
+#define RP_SETTLE_SEC 60 // the statistics are taken after this time from the first Sync
+#define RP_LOCK_THRESHOLD 1000 // nsec, converged when the error stays within this
+#define RP_PROP_DELAY 500 // nsec
+#define RP_TS_NOISE 20 // nsec, standard deviation of the timestamp noise
+#define RP_SHARED_MEM "/gptp_mc_replay"
+#define RP_PTPDEV CB_VIRTUAL_PTPDEV_PREFIX"w9"
+#define RP_UPDATE_INTERVAL_MSEC 500
+
+typedef struct replay_record {
+	int64_t receipt;
+	int64_t pot;
+	int64_t correction;
+	ScaledRateRatio rate_ratio;
+	int64_t prop_delay;
+} replay_record_t;
+
+typedef struct replay_result {
+	int nsamples;
+	int nsteady; // number of the samples in the statistics
+	int64_t conv_time; // nsec from the first Sync
+	double mean;
+	double rms;
+	int64_t max_err;
+	int64_t p99_err; // 99 percentile of the absolute error
+	int64_t duration; // nsec of the capture
+	int64_t runtime; // nsec of the replay in the real time
+	uint32_t adj_calls; // number of the frequency adjustments, clock_adjtime syscalls
+} replay_result_t;
+
+static const gptpservo_ops_t *servo_ops[GPTPSERVO_TYPE_NUM]={
+	&gptpservo_iir_ops, &gptpservo_pi_ops, &gptpservo_kalman_ops};
+
+static int read_record(FILE *inf, replay_record_t *rec)
+{
+	char line[256];
+	double rr;
+	int n;
+	while(fgets(line, sizeof(line), inf)){
+		if(line[0]=='#' || line[0]=='\n') continue;
+		rec->prop_delay=0;
+		n=sscanf(line, "%"SCNi64",%"SCNi64",%"SCNi64",%lf,%"SCNi64, &rec->receipt,
+			 &rec->pot, &rec->correction, &rr, &rec->prop_delay);
+		if(n<4){
+			UB_LOG(UBL_WARN, "%s:bad line, %s", __func__, line);
+			continue;
+		}
+		rec->rate_ratio=gptp_rr_from_double(rr);
+		return 0;
+	}
+	return -1;
+}
+
+/* GM and the free-running local clock are on the virtual clocks in the real time,
+   GM has -3ppm, and the local clock has +20ppm and a random walk */
+static void make_capture(FILE *outf)
+{
+	PTPFD_TYPE gmfd, lcfd;
+	gptp_vclock_model_t model;
+	uint64_t base, rts;
+	int64_t pot, lts;
+	int i, n;
+
+	memset(&model, 0, sizeof(model));
+	gmfd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"0");
+	model.freq_ppb=-3000;
+	model.init_offset=1000000;
+	model.seed=1;
+	assert_int_equal(gptp_vclock_set_model(gmfd, &model), 0);
+	lcfd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"1");
+	model.freq_ppb=20000;
+	model.init_offset=-5000000;
+	model.random_walk_ppb=10;
+	model.ts_noise=RP_TS_NOISE;
+	model.seed=3;
+	assert_int_equal(gptp_vclock_set_model(lcfd, &model), 0);
+	fprintf(outf, "# receipt,preciseOriginTimestamp,correction,rateRatio,"
+		"neighborPropDelay\n");
+	base=1000*UB_SEC_NS;
+	n=RP_CAPTURE_SEC*UB_SEC_NS/RP_SYNC_INTERVAL;
+	for(i=0;i<n;i++){
+		rts=base+(uint64_t)i*RP_SYNC_INTERVAL;
+		// sent by GM before the propagation delay
+		pot=gptp_vclock_gettime_at(gmfd, rts-RP_PROP_DELAY);
+		lts=gptp_vclock_gettime_at(lcfd, rts);
+		fprintf(outf, "%"PRIi64",%"PRIi64",0,%.12f,%d\n", lts, pot,
+			(1.0-3000e-9)/(1.0+20000e-9), RP_PROP_DELAY);
+	}
+	gptp_vclock_free_fd(gmfd);
+	gptp_vclock_free_fd(lcfd);
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+	int64_t d=*(const int64_t *)a-*(const int64_t *)b;
+	return d<0?-1:(d>0?1:0);
+}
+
+/*
+ * each record is given to ClockSlaveSync as PortSyncSync of a port directly
+ * connected to GM, and the thisClock timestamp of the receipt is read from
+ * the virtual clock at the simulated time of the receipt.
+ * The time error is that of the master clock just before the sample is applied.
+ */
+static int run_replay(FILE *inf, replay_result_t *res)
+{
+	PerTimeAwareSystemGlobal ptasg;
+	PerPortGlobal ppg;
+	PerPortGlobalForAllDomain ppgad;
+	PortSyncSync pss;
+	clock_slave_sync_data_t *cssd=NULL;
+	clock_master_sync_receive_data_t *cmsrd=NULL;
+	replay_record_t rec;
+	ClockIdentity clkid={0,1,2,3,4,5,6,7};
+	int64_t lts, mts, err, first, last, last_bad=0, sum=0, sum2=0;
+	int64_t *errs=NULL;
+	int nerrs=0, type, rval=-1;
+	uint16_t seqid=0;
+
+	memset(res, 0, sizeof(replay_result_t));
+	if(read_record(inf, &rec)) return -1;
+	res->runtime=ub_rt_gettime64();
+	first=rec.receipt;
+	last=first-1;
+	gptp_vclock_set_simtime(rec.receipt);
+	if(gptpclock_init(1, 2)) return -1;
+	if(gptpclock_add_clock(1, RP_PTPDEV, 0, 0, clkid) ||
+	   gptpclock_add_clock(0, RP_PTPDEV, 0, 0, clkid)) goto erexit;
+	gptpclock_set_thisClock(1, 0, false);
+	memset(&ptasg, 0, sizeof(ptasg));
+	ptasg.instanceEnable=true;
+	ptasg.thisClockIndex=1;
+	memset(&ppg, 0, sizeof(ppg));
+	memset(&ppgad, 0, sizeof(ppgad));
+	ppg.forAllDomain=&ppgad;
+	clock_slave_sync_sm_init(&cssd, 0, &ptasg);
+	clock_master_sync_receive_sm_init(&cmsrd, 0, &ptasg);
+	do{
+		if(rec.receipt<=last){
+			UB_LOG(UBL_WARN, "%s:receipt time goes backward, %"PRIi64"\n",
+			       __func__, rec.receipt);
+			continue;
+		}
+		last=rec.receipt;
+		gptp_vclock_set_simtime(rec.receipt);
+		res->duration=rec.receipt-first;
+		// the ingress timestamp by thisClock
+		lts=gptpclock_getts64(1, 0);
+		memset(&pss, 0, sizeof(pss));
+		pss.localPortNumber=1;
+		pss.local_ppg=&ppg;
+		pss.preciseOriginTimestamp.seconds.lsb=rec.pot/UB_SEC_NS;
+		pss.preciseOriginTimestamp.nanoseconds=rec.pot%UB_SEC_NS;
+		pss.followUpCorrectionField.nsec=rec.correction;
+		pss.rateRatio=rec.rate_ratio;
+		ppgad.neighborRateRatio=rec.rate_ratio;
+		ppgad.neighborPropDelay.nsec=rec.prop_delay;
+		pss.upstreamTxTime.nsec=lts-gptp_rr_div_ns(rec.prop_delay, rec.rate_ratio);
+		pss.lastSyncSeqID=seqid++;
+		clock_slave_sync_sm_portSyncSync(cssd, &pss, rec.receipt);
+		mts=ptasg.syncReceiptTime.seconds.lsb*UB_SEC_NS+
+			ptasg.syncReceiptTime.fractionalNanoseconds.msb;
+		gptpclock_tsconv(&lts, 1, 0, 0, 0);
+		err=mts-lts;
+		clock_master_sync_receive_sm_ClockSourceReq(cmsrd, rec.receipt);
+
+		res->nsamples++;
+		if(llabs(err)>RP_LOCK_THRESHOLD) last_bad=res->duration+RP_SYNC_INTERVAL;
+		if(res->duration < (int64_t)RP_SETTLE_SEC*UB_SEC_NS) continue;
+		if(!(nerrs & 0xff)){
+			errs=realloc(errs, (nerrs+0x100)*sizeof(int64_t));
+			ub_assert(errs, __func__, "realloc");
+		}
+		errs[nerrs++]=llabs(err);
+		sum+=err;
+		sum2+=err*err;
+	}while(!read_record(inf, &rec));
+	res->runtime=ub_rt_gettime64()-res->runtime;
+	res->adj_calls=clock_master_sync_receive_sm_adj_calls(cmsrd);
+	res->conv_time=last_bad;
+	res->nsteady=nerrs;
+	if(nerrs){
+		qsort(errs, nerrs, sizeof(int64_t), cmp_int64);
+		res->mean=(double)sum/nerrs;
+		res->rms=sqrt((double)sum2/nerrs);
+		res->max_err=errs[nerrs-1];
+		res->p99_err=errs[nerrs*99/100];
+	}
+	type=gptpconf_get_intitem(CONF_SERVO_TYPE);
+	printf("%-4s servo: %d samples in %.1fsec, replayed in %.3fsec, convergence %.2fsec, "
+	       "after %dsec mean=%.1fnsec rms=%.1fnsec p99=%"PRIi64"nsec max=%"PRIi64"nsec, "
+	       "%u freq adjustments\n",
+	       servo_ops[(type>=0 && type<GPTPSERVO_TYPE_NUM)?type:GPTPSERVO_IIR]->name,
+	       res->nsamples, (double)res->duration/UB_SEC_NS,
+	       (double)res->runtime/UB_SEC_NS, (double)res->conv_time/UB_SEC_NS,
+	       RP_SETTLE_SEC, res->mean, res->rms, res->p99_err, res->max_err,
+	       res->adj_calls);
+	free(errs);
+	clock_master_sync_receive_sm_close(&cmsrd);
+	clock_slave_sync_sm_close(&cssd);
+	rval=0;
+erexit:
+	gptpclock_close();
+	gptp_vclock_set_simtime(0);
+	return rval;
+}
+
+/* the synthetic capture is replayed by each servo, much faster than the real time */
+static void test_replay_servos(void **state)
+{
+	replay_result_t res;
+	FILE *capf;
+	int32_t v;
+	int i;
+	capf=tmpfile();
+	assert_non_null(capf);
+	make_capture(capf);
+	for(i=0;i<GPTPSERVO_TYPE_NUM;i++){
+		v=i;
+		gptpconf_set_item(CONF_SERVO_TYPE, &v);
+		rewind(capf);
+		assert_int_equal(run_replay(capf, &res), 0);
+		assert_int_equal(res.nsamples, RP_CAPTURE_SEC*UB_SEC_NS/RP_SYNC_INTERVAL);
+		assert_true(res.conv_time < 30*UB_SEC_NS);
+		assert_true(res.max_err < (i==GPTPSERVO_IIR?RP_LOCK_THRESHOLD:200));
+		assert_true(fabs(res.mean) < 50.0);
+		assert_true(res.runtime*10 < res.duration);
+	}
+	v=GPTPSERVO_IIR;
+	gptpconf_set_item(CONF_SERVO_TYPE, &v);
+	fclose(capf);
+}
+
+/* with CONF_SERVO_UPDATE_INTERVAL_MSEC, every sample is still used, and the number of
+   the frequency adjustments is limited */
+static void test_replay_update_interval(void **state)
+{
+	replay_result_t res;
+	FILE *capf;
+	int32_t v;
+	int i;
+	capf=tmpfile();
+	assert_non_null(capf);
+	make_capture(capf);
+	for(i=0;i<GPTPSERVO_TYPE_NUM;i++){
+		v=i;
+		gptpconf_set_item(CONF_SERVO_TYPE, &v);
+		v=RP_UPDATE_INTERVAL_MSEC;
+		gptpconf_set_item(CONF_SERVO_UPDATE_INTERVAL_MSEC, &v);
+		rewind(capf);
+		assert_int_equal(run_replay(capf, &res), 0);
+		assert_true(res.adj_calls <= res.duration/(RP_UPDATE_INTERVAL_MSEC*UB_MSEC_NS)+1);
+		assert_true(res.conv_time < 60*UB_SEC_NS);
+		assert_true(res.max_err < RP_LOCK_THRESHOLD);
+		v=0;
+		gptpconf_set_item(CONF_SERVO_UPDATE_INTERVAL_MSEC, &v);
+	}
+	v=GPTPSERVO_IIR;
+	gptpconf_set_item(CONF_SERVO_TYPE, &v);
+	fclose(capf);
+}
+
+/* comments and bad lines are skipped, the receipt time must go forward */
+static void test_replay_format(void **state)
+{
+	replay_result_t res;
+	FILE *capf;
+	int i;
+	capf=tmpfile();
+	assert_non_null(capf);
+	fprintf(capf, "# comment\nbad line\n");
+	for(i=0;i<10;i++)
+		fprintf(capf, "%d,%d,0,1.0\n", (i+1)*125000000, (i+1)*125000000+1000);
+	fprintf(capf, "125000000,125001000,0,1.0\n");
+	rewind(capf);
+	assert_int_equal(run_replay(capf, &res), 0);
+	assert_int_equal(res.nsamples, 10);
+	fclose(capf);
+	capf=tmpfile();
+	assert_int_equal(run_replay(capf, &res), -1);
+	fclose(capf);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:34", "UBL_GPTP");
+	unibase_init(&init_para);
+	gptpconf_set_item(CONF_MASTER_CLOCK_SHARED_MEM, RP_SHARED_MEM);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unibase_close();
+	return 0;
+}
+
+/* replay a capture file, the statistics are printed */
+static int replay_file(int argc, char *argv[])
+{
+	replay_result_t res;
+	FILE *capf;
+	int oc, rval;
+	while((oc=getopt(argc, argv, "c:h"))!=-1){
+		switch(oc){
+		case 'c':
+			ub_read_config_file(optarg, gptpconf_set_stritem);
+			break;
+		case 'h':
+		default:
+			printf("%s [-c config_file] capture_file\n", argv[0]);
+			return -1;
+		}
+	}
+	if(optind>=argc) return -1;
+	capf=fopen(argv[optind], "r");
+	if(!capf){
+		printf("can't open %s\n", argv[optind]);
+		return -1;
+	}
+	rval=run_replay(capf, &res);
+	fclose(capf);
+	return rval;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_replay_format),
+		cmocka_unit_test(test_replay_servos),
+		cmocka_unit_test(test_replay_update_interval),
+	};
+	int rval;
+
+	if(argc>1){
+		setup(NULL);
+		rval=replay_file(argc, argv);
+		teardown(NULL);
+		return rval;
+	}
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -0,0 +1,433 @@
+/*
+ * Excelfore gptp - Implementation of gPTP(IEEE 802.1AS)
+ * Copyright (C) 2019 Excelfore Corporation (https://excelfore.com)
+ *
+ * This file is part of Excelfore-gptp.
+ *
+ * Excelfore-gptp is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Excelfore-gptp is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Excelfore-gptp.  If not, see
+ * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
+ */
+/*
+ * convergence and steady-state comparison of the servos on virtual clocks.
+ * A slave clock with a frequency error is synchronized to a virtual GM,
+ * the time runs in simulation, not in the real time.
+ * In the middle, GM changes to another clock with a different phase and frequency.
+ * The timestamps have a gaussian noise, and optionally delay spikes which
+ * happen on a congested bridge.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <xl4unibase/unibase_binding.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "gptpclock.h"
+#include "gptpclock_virtual.h"
+#include "gptpipc.h"
+#include "gptpservo.h"
+#include "gptp_config.h"
+
+#define SV_SYNC_INTERVAL (125*UB_MSEC_NS)
+#define SV_PHASE_SEC 120 // each of before and after the GM change
+#define SV_STEADY_SEC 30 // the last this time of each phase is the steady state
+#define SV_LOCK_THRESHOLD 1000 // nsec, converged when the error stays within this
+#define SV_TS_NOISE 20 // nsec, standard deviation of the timestamp noise
+#define SV_SPIKE_PERMIL 50 // probability of a delay spike
+#define SV_SPIKE_MAX 50000 // nsec, the delay is uniform in 0 to this
+#define SV_FAST_LOCK_SAMPLES 16 // 2sec of Sync
+#define SV_FAST_LOCK_CONV (3*UB_SEC_NS)
+
+typedef struct servo_result {
+	int64_t conv_time[2]; // nsec from the start and from the GM change
+	int64_t max_err[2];
+	double rms_err[2];
+	int steps;
+} servo_result_t;
+
+typedef struct servo_sim {
+	PTPFD_TYPE gmfd[2];
+	PTPFD_TYPE lcfd;
+	uint64_t rnd;
+	int64_t applied; // the phase offset set on the master clock by the steps
+} servo_sim_t;
+
+// xorshift64*, the same sequence in every run
+static uint64_t sim_rand(servo_sim_t *sim)
+{
+	sim->rnd ^= sim->rnd >> 12;
+	sim->rnd ^= sim->rnd << 25;
+	sim->rnd ^= sim->rnd >> 27;
+	return sim->rnd * 2685821657736338717ULL;
+}
+
+// normal distribution with sigma=1.0, by Box-Muller
+static double sim_gauss(servo_sim_t *sim)
+{
+	double u1, u2;
+	u1=((sim_rand(sim)>>11)+1.0)/9007199254740993.0;
+	u2=(sim_rand(sim)>>11)/9007199254740992.0;
+	return sqrt(-2.0*log(u1))*cos(2.0*M_PI*u2);
+}
+
+// the receipt time is delayed by the noise and the spikes
+static int64_t sim_delay(servo_sim_t *sim, bool spike)
+{
+	int64_t d;
+	d=(int64_t)(SV_TS_NOISE*sim_gauss(sim));
+	if(spike && sim_rand(sim)%1000 < SV_SPIKE_PERMIL)
+		d+=sim_rand(sim)%SV_SPIKE_MAX;
+	return d;
+}
+
+static void sim_open(servo_sim_t *sim)
+{
+	gptp_vclock_model_t model;
+	memset(sim, 0, sizeof(servo_sim_t));
+	sim->rnd=0x5eed;
+	memset(&model, 0, sizeof(model));
+	sim->gmfd[0]=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"0");
+	model.freq_ppb=-3000;
+	model.seed=1;
+	assert_int_equal(gptp_vclock_set_model(sim->gmfd[0], &model), 0);
+	// the new GM is 300usec ahead, and 8ppm faster than the first GM
+	sim->gmfd[1]=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"1");
+	model.freq_ppb=5000;
+	model.init_offset=300000;
+	model.seed=2;
+	assert_int_equal(gptp_vclock_set_model(sim->gmfd[1], &model), 0);
+	// the slave has +20ppm and a random walk
+	sim->lcfd=gptp_vclock_alloc_fd(CB_VIRTUAL_PTPDEV_PREFIX"w2");
+	model.freq_ppb=20000;
+	model.init_offset=-5000000;
+	model.random_walk_ppb=10;
+	model.seed=3;
+	assert_int_equal(gptp_vclock_set_model(sim->lcfd, &model), 0);
+}
+
+static void sim_close(servo_sim_t *sim)
+{
+	gptp_vclock_free_fd(sim->gmfd[0]);
+	gptp_vclock_free_fd(sim->gmfd[1]);
+	gptp_vclock_free_fd(sim->lcfd);
+}
+
+static void run_servo(gptpservo_type_t type, bool spike, servo_result_t *res)
+{
+	servo_sim_t sim;
+	gptpservo_t *sv;
+	gptpservo_para_t para={.domainNumber=0, .hw_phase_adj=false};
+	gptpservo_output_t out;
+	uint64_t base, rts, lts, mts;
+	int64_t err, last_bad[2]={0,0}, sum2[2]={0,0};
+	int i, n, gmi, nsteady[2]={0,0};
+
+	sim_open(&sim);
+	memset(res, 0, sizeof(servo_result_t));
+	sv=gptpservo_create(type, &para);
+	assert_non_null(sv);
+	// adjtime applies the old rate up to the real time, the simulation must be ahead
+	base=ub_rt_gettime64()+UB_SEC_NS;
+	n=SV_PHASE_SEC*UB_SEC_NS/SV_SYNC_INTERVAL;
+	for(i=0;i<n*2;i++){
+		gmi=i/n;
+		rts=base+(uint64_t)i*SV_SYNC_INTERVAL;
+		mts=gptp_vclock_gettime_at(sim.gmfd[gmi], rts);
+		lts=gptp_vclock_gettime_at(sim.lcfd, rts);
+		// the error of the master clock, before this sample is applied
+		err=(int64_t)(mts-lts)-sim.applied;
+		if(llabs(err)>SV_LOCK_THRESHOLD)
+			last_bad[gmi]=(int64_t)(i%n+1)*SV_SYNC_INTERVAL;
+		if(i%n >= n-SV_STEADY_SEC*UB_SEC_NS/SV_SYNC_INTERVAL){
+			if(llabs(err)>res->max_err[gmi]) res->max_err[gmi]=llabs(err);
+			sum2[gmi]+=err*err;
+			nsteady[gmi]++;
+		}
+		gptpservo_sample(sv, lts+sim_delay(&sim, spike), mts, 0, gmi+1);
+		gptpservo_output(sv, &out);
+		if(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP){
+			sim.applied=out.step;
+			res->steps++;
+		}
+		if(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ)
+			assert_int_equal(gptp_vclock_adjtime(sim.lcfd, out.adjppb), 0);
+	}
+	for(i=0;i<2;i++){
+		res->conv_time[i]=last_bad[i];
+		res->rms_err[i]=sqrt((double)sum2[i]/nsteady[i]);
+	}
+	printf("%-4s servo%s: convergence %6.2fsec/%6.2fsec after GM change, "
+	       "steady-state rms=%7.1fnsec/%7.1fnsec, max=%6"PRIi64"nsec/%6"PRIi64"nsec, "
+	       "steps=%d\n", gptpservo_name(sv), spike?"(spikes)":"",
+	       (double)res->conv_time[0]/UB_SEC_NS, (double)res->conv_time[1]/UB_SEC_NS,
+	       res->rms_err[0], res->rms_err[1], res->max_err[0], res->max_err[1], res->steps);
+	gptpservo_delete(sv);
+	sim_close(&sim);
+}
+
+static void check_result(servo_result_t *res, int64_t conv_limit, int64_t max_limit)
+{
+	int i;
+	for(i=0;i<2;i++){
+		assert_true(res->conv_time[i] < conv_limit);
+		assert_true(res->max_err[i] < max_limit);
+	}
+}
+
+static void test_servo_iir(void **state)
+{
+	servo_result_t res;
+	run_servo(GPTPSERVO_IIR, false, &res);
+	check_result(&res, 30*UB_SEC_NS, SV_LOCK_THRESHOLD);
+}
+
+static void test_servo_pi(void **state)
+{
+	servo_result_t res;
+	run_servo(GPTPSERVO_PI, false, &res);
+	check_result(&res, 20*UB_SEC_NS, 200);
+}
+
+static void test_servo_kalman(void **state)
+{
+	servo_result_t res;
+	run_servo(GPTPSERVO_KALMAN, false, &res);
+	check_result(&res, 20*UB_SEC_NS, 200);
+}
+
+/* the spikes are absorbed by IIR and PI, and rejected by the Kalman filter */
+static void test_servo_spikes(void **state)
+{
+	servo_result_t res[GPTPSERVO_TYPE_NUM];
+	int i;
+	for(i=0;i<GPTPSERVO_TYPE_NUM;i++) run_servo(i, true, &res[i]);
+	check_result(&res[GPTPSERVO_KALMAN], 20*UB_SEC_NS, 300);
+	for(i=0;i<2;i++){
+		assert_true(res[GPTPSERVO_KALMAN].rms_err[i] < res[GPTPSERVO_IIR].rms_err[i]);
+		assert_true(res[GPTPSERVO_KALMAN].rms_err[i] < res[GPTPSERVO_PI].rms_err[i]);
+	}
+}
+
+/* the least squares fast lock makes the convergence after the GM change
+ * shorter than each servo alone */
+static void test_servo_fast_lock(void **state)
+{
+	servo_result_t res, fres;
+	int32_t v;
+	int i;
+	for(i=0;i<GPTPSERVO_TYPE_NUM;i++){
+		v=0;
+		gptpconf_set_item(CONF_SERVO_FAST_LOCK_SAMPLES, &v);
+		run_servo(i, false, &res);
+		v=SV_FAST_LOCK_SAMPLES;
+		gptpconf_set_item(CONF_SERVO_FAST_LOCK_SAMPLES, &v);
+		run_servo(i, false, &fres);
+		check_result(&fres, SV_FAST_LOCK_CONV,
+			     i==GPTPSERVO_IIR?SV_LOCK_THRESHOLD:200);
+		assert_true(fres.conv_time[1] < res.conv_time[1]);
+	}
+	v=0;
+	gptpconf_set_item(CONF_SERVO_FAST_LOCK_SAMPLES, &v);
+}
+
+static void test_servo_ops(void **state)
+{
+	gptpservo_para_t para={.domainNumber=0, .hw_phase_adj=true};
+	gptpservo_output_t out;
+	gptpservo_t *sv;
+	int i;
+	assert_null(gptpservo_create(GPTPSERVO_TYPE_NUM, &para));
+	sv=gptpservo_create(GPTPSERVO_PI, &para);
+	assert_non_null(sv);
+	assert_int_equal(gptpservo_type(sv), GPTPSERVO_PI);
+	// the first sample gives no output
+	assert_int_equal(gptpservo_sample(sv, UB_SEC_NS, UB_SEC_NS+2000000, 0, 1), -1);
+	// the second sample gives the rate +10ppm, and a step of the big offset
+	assert_int_equal(gptpservo_sample(sv, 2*UB_SEC_NS, 2*UB_SEC_NS+2010000, 0, 1), 0);
+	gptpservo_output(sv, &out);
+	assert_int_equal(out.adjppb, 10000);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP);
+	assert_int_equal(out.step, 2010000);
+	// with hw_phase_adj, the offset becomes 0 after the step
+	assert_int_equal(out.offset, 0);
+	// locked by small errors
+	for(i=3;i<10;i++)
+		assert_int_equal(gptpservo_sample(sv, i*UB_SEC_NS, i*UB_SEC_NS+10, 0, 1), 0);
+	gptpservo_output(sv, &out);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_RATE_STABLE);
+	// the filter state for the telemetry, the PI error is the last offset
+	assert_int_equal(out.fstate[0], 10);
+	// reset keeps the frequency adjustment
+	i=out.adjppb;
+	gptpservo_reset(sv);
+	gptpservo_output(sv, &out);
+	assert_int_equal(out.adjppb, i);
+	assert_false(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE);
+	// GM change starts over
+	assert_int_equal(gptpservo_sample(sv, 10*UB_SEC_NS, 10*UB_SEC_NS, 0, 1), -1);
+	assert_int_equal(gptpservo_sample(sv, 11*UB_SEC_NS, 11*UB_SEC_NS, 0, 2), -1);
+	gptpservo_delete(sv);
+}
+
+static void test_kalman_gate(void **state)
+{
+	gptpservo_para_t para={.domainNumber=0, .hw_phase_adj=false};
+	gptpservo_output_t out;
+	gptpservo_t *sv;
+	int64_t ts;
+	int i;
+	sv=gptpservo_create(GPTPSERVO_KALMAN, &para);
+	assert_non_null(sv);
+	for(i=0;i<40;i++){
+		ts=(int64_t)i*SV_SYNC_INTERVAL;
+		gptpservo_sample(sv, ts, ts+1000, 0, 1);
+	}
+	gptpservo_output(sv, &out);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE);
+	// a delay spike is rejected, no adjustment
+	ts+=SV_SYNC_INTERVAL;
+	assert_int_equal(gptpservo_sample(sv, ts+20000, ts+1000, 0, 1), -1);
+	gptpservo_output(sv, &out);
+	assert_false(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_FREQ_ADJ);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STABLE);
+	ts+=SV_SYNC_INTERVAL;
+	assert_int_equal(gptpservo_sample(sv, ts, ts+1000, 0, 1), 0);
+	// a real phase jump is accepted after CONF_SERVO_KF_MAX_REJECTS
+	for(i=0;i<=gptpconf_get_intitem(CONF_SERVO_KF_MAX_REJECTS);i++){
+		ts+=SV_SYNC_INTERVAL;
+		assert_int_equal(gptpservo_sample(sv, ts, ts+2000000, 0, 1), -1);
+	}
+	ts+=SV_SYNC_INTERVAL;
+	assert_int_equal(gptpservo_sample(sv, ts, ts+2000000, 0, 1), 0);
+	gptpservo_output(sv, &out);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP);
+	assert_int_equal(out.step, 2000000);
+	gptpservo_delete(sv);
+}
+
+/* the decimated interval starts over when lts goes backward */
+static void test_servo_decimate(void **state)
+{
+	gptpservo_para_t para={.domainNumber=0, .hw_phase_adj=true};
+	gptpservo_t *sv;
+	int64_t ts;
+	int32_t v;
+	int i;
+	v=500;
+	gptpconf_set_item(CONF_SERVO_UPDATE_INTERVAL_MSEC, &v);
+	sv=gptpservo_create(GPTPSERVO_PI, &para);
+	assert_non_null(sv);
+	// the first interval gives the first sample to PI, the second one gives the output
+	for(i=0;i<=11;i++){
+		ts=(int64_t)i*SV_SYNC_INTERVAL;
+		assert_int_equal(gptpservo_sample(sv, ts, ts+1000, 0, 1), i==9?0:-1);
+	}
+	// 50msec backward, the interval starts at this sample
+	ts-=50*UB_MSEC_NS;
+	assert_int_equal(gptpservo_sample(sv, ts, ts+1000, 0, 1), -1);
+	ts+=450*UB_MSEC_NS;
+	assert_int_equal(gptpservo_sample(sv, ts, ts+1000, 0, 1), -1);
+	ts+=50*UB_MSEC_NS;
+	assert_int_equal(gptpservo_sample(sv, ts, ts+1000, 0, 1), 0);
+	gptpservo_delete(sv);
+	v=0;
+	gptpconf_set_item(CONF_SERVO_UPDATE_INTERVAL_MSEC, &v);
+}
+
+#define SV_DEC_WORST_INTERVAL 10000 // msec, DECIMATE_MAX_INTERVAL
+#define SV_DEC_WORST_SYNC (UB_SEC_NS/64) // logSyncInterval=-6
+#define SV_DEC_OFFSET 2000000 // nsec, a step by the first output
+#define SV_DEC_RATE 50 // ppb
+/* the longest interval with the fastest Sync, the fitted value is not broken.
+   the sub-nsec part reaches the algorithm */
+static void test_servo_decimate_worst(void **state)
+{
+	gptpservo_para_t para={.domainNumber=0, .hw_phase_adj=true};
+	gptpservo_output_t out, fout;
+	gptpservo_t *sv, *fsv;
+	int64_t lts, sns, rlts=0;
+	int32_t v;
+	int i, res;
+	v=SV_DEC_WORST_INTERVAL;
+	gptpconf_set_item(CONF_SERVO_UPDATE_INTERVAL_MSEC, &v);
+	sv=gptpservo_create(GPTPSERVO_PI, &para);
+	assert_non_null(sv);
+	// 2 intervals of 640 samples, the second output has the offset and the rate
+	for(i=0;!rlts && i<=3*SV_DEC_WORST_INTERVAL*64/1000;i++){
+		lts=UB_SEC_NS+(int64_t)i*SV_DEC_WORST_SYNC;
+		// mts-lts grows by SV_DEC_RATE, with the sub-nsec part
+		sns=gptp_sns_from_ns(SV_DEC_OFFSET, 0)+
+			(int64_t)i*SV_DEC_WORST_SYNC*SV_DEC_RATE*65536/UB_SEC_NS;
+		res=gptpservo_sample(sv, lts, lts+gptp_sns_to_ns(sns), sns&SCALED_NS_MASK, 1);
+		if(res==0) rlts=lts;
+	}
+	assert_true(rlts>0);
+	gptpservo_output(sv, &out);
+	assert_true(out.flags & GPTPIPC_SYNC_SAMPLE_FLAG_PHASE_STEP);
+	assert_true(llabs(out.step-SV_DEC_OFFSET-(rlts-UB_SEC_NS)*SV_DEC_RATE/UB_SEC_NS)<=1);
+	assert_true(abs(out.adjppb-SV_DEC_RATE)<=1);
+	gptpservo_delete(sv);
+
+	// the same samples to KF, with and without 0.25nsec
+	v=1000;
+	gptpconf_set_item(CONF_SERVO_UPDATE_INTERVAL_MSEC, &v);
+	sv=gptpservo_create(GPTPSERVO_KALMAN, &para);
+	fsv=gptpservo_create(GPTPSERVO_KALMAN, &para);
+	assert_non_null(sv);
+	assert_non_null(fsv);
+	for(i=0;i<10*UB_SEC_NS/SV_SYNC_INTERVAL;i++){
+		lts=UB_SEC_NS+(int64_t)i*SV_SYNC_INTERVAL;
+		gptpservo_sample(sv, lts, lts+100, 0, 1);
+		gptpservo_sample(fsv, lts, lts+100, 1<<(SCALED_NS_SHIFT-2), 1);
+	}
+	gptpservo_output(sv, &out);
+	gptpservo_output(fsv, &fout);
+	assert_true(fout.fstate[0]>out.fstate[0]);
+	gptpservo_delete(sv);
+	gptpservo_delete(fsv);
+	v=0;
+	gptpconf_set_item(CONF_SERVO_UPDATE_INTERVAL_MSEC, &v);
+}
+
+static int setup(void **state)
+{
+	unibase_init_para_t init_para;
+	ubb_default_initpara(&init_para);
+	init_para.ub_log_initstr=UBL_OVERRIDE_ISTR("4,ubase:45,cbase:45,gptp:45", "UBL_GPTP");
+	unibase_init(&init_para);
+	return 0;
+}
+
+static int teardown(void **state)
+{
+	unibase_close();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_servo_ops),
+		cmocka_unit_test(test_kalman_gate),
+		cmocka_unit_test(test_servo_decimate),
+		cmocka_unit_test(test_servo_decimate_worst),
+		cmocka_unit_test(test_servo_iir),
+		cmocka_unit_test(test_servo_pi),
+		cmocka_unit_test(test_servo_kalman),
+		cmocka_unit_test(test_servo_spikes),
+		cmocka_unit_test(test_servo_fast_lock),
+	};
+
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
@@ -28,6 +28,27 @@
 #define PRiFD "%d"
 #endif
 
+/* the thread specific data, a platform without pthread defines these in combase */
+#ifndef CB_THREAD_KEY_T
+#define CB_THREAD_KEY_T pthread_key_t
+#define CB_THREAD_KEY_CREATE pthread_key_create
+#define CB_THREAD_GETSPECIFIC pthread_getspecific
+#define CB_THREAD_SETSPECIFIC pthread_setspecific
+#define CB_THREAD_ONCE_T pthread_once_t
+#define CB_THREAD_ONCE_INIT PTHREAD_ONCE_INIT
+#define CB_THREAD_ONCE pthread_once
+#endif
+
+/*
+ * Software clock based on CLOCK_MONOTONIC_RAW, for network devices without PHC.
+ * It is used as a ptp device with #GPTP_SWCLOCK_PTPDEV name.
+ * It can't be adjusted, and the frequency and phase adjustment is done
+ * in gptpclock as PTPCLOCK_SLAVE_SUB.
+ */
+#define GPTP_SWCLOCK_PTPDEV "swclock"
+#define GPTP_SWCLOCK_FD 3118 // next to the range of the virtual clock fd
+#define SWCLOCK_NAME(name) (!strcmp(name, GPTP_SWCLOCK_PTPDEV))
+
 /*******************************************************
  * functions supported in the platform dependent layer
  *******************************************************/
@@ -120,6 +141,13 @@ int gptp_vclock_settime(PTPFD_TYPE ptpfd, uint64_t ts64);
  */
 int ll_set_hw_timestamping(CB_SOCKET_T cfd, const char *dev);
 
+/**
+ * @brief enables only software timestamping for socket,
+ *	  the timestamps are taken by CLOCK_REALTIME
+ * @return 0 on success, -1 on error
+ */
+int ll_set_sw_timestamping(CB_SOCKET_T cfd);
+
 /**
  * @brief disables hardware timestamping for socket
  * @param dev	ethernet device name like 'eth0'
@@ -23,6 +23,7 @@
 #include "gptpnet.h"
 #include "gptpclock.h"
 #include "md_pdelay_req_sm.h"
+#include "gptprateratio.h"
 #include "md_abnormal_hooks.h"
 
 typedef enum {
@@ -58,8 +59,15 @@ struct md_pdelay_req_data{
 	uint64_t mock_txts64;
 	uint64_t prev_t1ts64;
 	uint64_t prev_t2ts64;
+	gptprateratio_t *rre;
 };
 
+// the neighbor delay which is handed off to the next gptp2d
+typedef struct pdelay_handoff {
+	UScaledNs neighborPropDelay;
+	ScaledRateRatio neighborRateRatio;
+} pdelay_handoff_t;
+
 #define RCVD_PDELAY_RESP sm->thisSM->rcvdPdelayResp
 #define RCVD_PDELAY_RESP_PTR sm->thisSM->rcvdPdelayRespPtr
 #define RCVD_PDELAY_RESP_FOLLOWUP sm->thisSM->rcvdPdelayRespFollowUp
@@ -88,12 +96,21 @@ static int txPdelayReq(gptpnet_data_t *gpnetd, int portIndex)
 	return gptpnet_send_whook(gpnetd, portIndex-1, ssize);
 }
 
-static double computePdelayRateRatio(md_pdelay_req_data_t *sm, double oldRateRatio)
+static ScaledRateRatio computePdelayRateRatio(md_pdelay_req_data_t *sm,
+					      ScaledRateRatio oldRateRatio)
 {
 	uint64_t dt1, dt2;
 	uint64_t maxd, mind;
-	double pDelayRateRatio = 1.0;
+	ScaledRateRatio pDelayRateRatio = RATE_RATIO_ONE;
 
+	if(sm->rre){
+		// the window tolerates lost responses, the interval is not checked
+		if(!gptprateratio_add(sm->rre, sm->t1ts64, sm->t2ts64, &pDelayRateRatio)){
+			sm->thisSM->neighborRateRatioValid=true;
+			return pDelayRateRatio;
+		}
+		return oldRateRatio;
+	}
 	dt1=sm->t1ts64-sm->prev_t1ts64;
 	dt2=sm->t2ts64-sm->prev_t2ts64;
 	// check in +/- 50% of the interval time
@@ -114,23 +131,24 @@ static double computePdelayRateRatio(md_pdelay_req_data_t *sm, double oldRateRat
 		 *   D = [r x (t4 - t1)] - (t3 - t2) / 2
 		 * In other words, converting the difference in the frequency of the peer(responder).
 		 */
-		pDelayRateRatio = (double)(sm->t2ts64-sm->prev_t2ts64)/(sm->t1ts64-sm->prev_t1ts64);
+		pDelayRateRatio = gptp_rr_from_delta(dt2, dt1);
 		// neighborRateValid should be set to TRUE only after 2 valid responses
 		if(!sm->thisSM->neighborRateRatioValid){
 			sm->thisSM->neighborRateRatioValid=true;
 		}
 	}
-	UB_LOG(UBL_DEBUG, "%s: old pDelayRateRatio %.17g -> %.17g : ave=%.17g  min=%"PRIu64" max=%"PRIu64" dt1=%"PRIu64" dt2=%"PRIu64"\n",
-			__func__, oldRateRatio, pDelayRateRatio,
-			(double)(oldRateRatio+pDelayRateRatio)/2, mind, maxd, dt1, dt2);
+	UB_LOG(UBL_DEBUG, "%s: old pDelayRateRatio %"PRIi64" -> %"PRIi64" : ave=%"PRIi64
+	       "  min=%"PRIu64" max=%"PRIu64" dt1=%"PRIu64" dt2=%"PRIu64"\n",
+	       __func__, oldRateRatio, pDelayRateRatio,
+	       (oldRateRatio+pDelayRateRatio)/2, mind, maxd, dt1, dt2);
 	sm->prev_t1ts64 = sm->t1ts64;
 	sm->prev_t2ts64 = sm->t2ts64;
 	// do rolling average
-	return (double)(oldRateRatio+pDelayRateRatio)/2;
+	return (oldRateRatio+pDelayRateRatio)/2;
 }
 
 #define COMPUTED_PROP_TIME_TOO_BIG (UB_SEC_NS/100)
-static uint64_t computePropTime(md_pdelay_req_data_t *sm)
+static void computePropTime(md_pdelay_req_data_t *sm, UScaledNs *propTime)
 {
 	int64_t rts;
 	/* 802.1AS-2020 Section 11.2.19.3.4 computePropTime
@@ -142,17 +160,22 @@ static uint64_t computePropTime(md_pdelay_req_data_t *sm)
 	 * Do note that the neighborRateRatio (r) above needs to correspond to the
 	 * rate of "delta of TS at peer" over "delta of TS at this TAS", see
 	 * computePdelayRateRatio().
+	 * It is computed in scaled nsec, not to lose the half nsec by '/2'.
 	 */
-	rts = ( sm->ppg->forAllDomain->neighborRateRatio*(int64_t)(sm->t4ts64 - sm->t1ts64) -
-		(int64_t)(sm->t3ts64 - sm->t2ts64) )/2;
-	if(rts<0 || rts>COMPUTED_PROP_TIME_TOO_BIG){
+	rts = ( gptp_rr_mul_ns(gptp_sns_from_ns(sm->t4ts64 - sm->t1ts64, 0),
+			       sm->ppg->forAllDomain->neighborRateRatio) -
+		gptp_sns_from_ns(sm->t3ts64 - sm->t2ts64, 0) )/2;
+	if(!gptpconf_get_intitem(CONF_SYNC_SUBNS_PRECISION)) rts &= ~(int64_t)SCALED_NS_MASK;
+	if(rts<0 || gptp_sns_to_ns(rts)>COMPUTED_PROP_TIME_TOO_BIG){
 		UB_LOG(UBL_WARN, "%s: computed PropTime is out of range = %"PRIi64", set 0\n",
-		       __func__, rts);
+		       __func__, gptp_sns_to_ns(rts));
 		rts=0;
 	}else{
-		UB_LOG(UBL_DEBUGV, "%s: computed PropTime = %"PRIu64"\n", __func__, rts);
+		UB_LOG(UBL_DEBUGV, "%s: computed PropTime = %"PRIi64"\n", __func__,
+		       gptp_sns_to_ns(rts));
 	}
-	return rts;
+	propTime->nsec = gptp_sns_to_ns(rts);
+	propTime->subns = rts & SCALED_NS_MASK;
 }
 
 static md_pdelay_req_state_t allstate_condition(md_pdelay_req_data_t *sm)
@@ -166,7 +189,7 @@ static void *not_enabled_proc(md_pdelay_req_data_t *sm)
 {
 	UB_LOG(UBL_DEBUGV, "md_pdelay_req:%s:portIndex=%d\n", __func__, sm->portIndex);
 	if(gptpconf_get_intitem(CONF_NEIGHBOR_PROP_DELAY)){
-		sm->ppg->forAllDomain->neighborRateRatio = 1.0;
+		sm->ppg->forAllDomain->neighborRateRatio = RATE_RATIO_ONE;
 		sm->mdeg->forAllDomain->asCapableAcrossDomains = true;
 		sm->ppg->forAllDomain->neighborPropDelay.nsec =
 			gptpconf_get_intitem(CONF_NEIGHBOR_PROP_DELAY);
@@ -188,13 +211,15 @@ static md_pdelay_req_state_t not_enabled_condition(md_pdelay_req_data_t *sm)
 static int initial_send_pdelay_req_proc(md_pdelay_req_data_t *sm, uint64_t cts64)
 {
 	int res;
+	pdelay_handoff_t ho;
 	UB_LOG(UBL_DEBUGV, "md_pdelay_req:%s:portIndex=%d\n", __func__, sm->portIndex);
 	sm->thisSM->initPdelayRespReceived = false;
 	RCVD_PDELAY_RESP = false;
 	RCVD_PDELAY_RESP_FOLLOWUP = false;
-	sm->ppg->forAllDomain->neighborRateRatio = 1.0;
+	sm->ppg->forAllDomain->neighborRateRatio = RATE_RATIO_ONE;
 	sm->prev_t1ts64 = 0;
 	sm->prev_t2ts64 = 0;
+	if(sm->rre) gptprateratio_reset(sm->rre);
 	sm->thisSM->rcvdMDTimestampReceive = false;
 	sm->thisSM->pdelayReqSequenceId = (uint16_t)(rand() & 0xffff);
 	sm->thisSM->txPdelayReqPtr = setPdelayReq(sm);
@@ -210,6 +235,16 @@ static int initial_send_pdelay_req_proc(md_pdelay_req_data_t *sm, uint64_t cts64
 	sm->thisSM->detectedFaults = 0;
 	sm->mdeg->forAllDomain->isMeasuringDelay = false;
 	sm->mdeg->forAllDomain->asCapableAcrossDomains = false;
+	if(!gptpclock_handoff_get(GPTPCLOCK_HANDOFF_PDELAY, sm->portIndex, &ho, sizeof(ho))){
+		// measured by the previous gptp2d, asCapable without waiting the measurement
+		sm->ppg->forAllDomain->neighborPropDelay = ho.neighborPropDelay;
+		sm->ppg->forAllDomain->neighborRateRatio = ho.neighborRateRatio;
+		sm->thisSM->neighborRateRatioValid = true;
+		sm->mdeg->forAllDomain->isMeasuringDelay = true;
+		sm->mdeg->forAllDomain->asCapableAcrossDomains = true;
+		UB_LOG(UBL_INFO, "%s:portIndex=%d, inherited neighborPropDelay=%"PRIu64"\n",
+		       __func__, sm->portIndex, ho.neighborPropDelay.nsec);
+	}
 	return 0;
 }
 
@@ -261,7 +296,8 @@ static void *reset_proc(md_pdelay_req_data_t *sm)
 		if(!sm->mdeg->forAllDomain->asCapableAcrossDomains) return NULL;
 		sm->mdeg->forAllDomain->asCapableAcrossDomains = false;
 		sm->thisSM->neighborRateRatioValid=false;
-		sm->ppg->forAllDomain->neighborRateRatio = 1;
+		sm->ppg->forAllDomain->neighborRateRatio = RATE_RATIO_ONE;
+		if(sm->rre) gptprateratio_reset(sm->rre);
 		UB_LOG(UBL_INFO, "%s:reset asCapableAcrossDomains, portIndex=%d\n",
 		       __func__, sm->portIndex);
 	}
@@ -278,7 +314,7 @@ static void *reset_proc(md_pdelay_req_data_t *sm)
 			sm->mdeg->forAllDomain->isMeasuringDelay = false;
 			sm->mdeg->forAllDomain->asCapableAcrossDomains = false;
 			sm->thisSM->neighborRateRatioValid=false;
-			sm->ppg->forAllDomain->neighborRateRatio = 1;
+			sm->ppg->forAllDomain->neighborRateRatio = RATE_RATIO_ONE;
 		}
 	}
 
@@ -551,7 +587,7 @@ static void *waiting_for_pdelay_interval_timer_proc(md_pdelay_req_data_t *sm)
 		sm->thisSM->neighborRateRatioValid=true;
 	}
 	if(sm->ppg->forAllDomain->computeNeighborPropDelay)
-		sm->ppg->forAllDomain->neighborPropDelay.nsec = computePropTime(sm);
+		computePropTime(sm, &sm->ppg->forAllDomain->neighborPropDelay);
 
 	sm->mdeg->forAllDomain->isMeasuringDelay = true;
 
@@ -710,6 +746,7 @@ void md_pdelay_req_sm_init(md_pdelay_req_data_t **sm,
 	(*sm)->mdeg = mdeg;
 	(*sm)->portIndex = portIndex;
 	(*sm)->cmlds_mode = gptpconf_get_intitem(CONF_CMLDS_MODE);
+	(*sm)->rre = gptprateratio_create();
 
 	// 11.2.17.2.13
 	if((*sm)->cmlds_mode){
@@ -723,10 +760,24 @@ void md_pdelay_req_sm_init(md_pdelay_req_data_t **sm,
 int md_pdelay_req_sm_close(md_pdelay_req_data_t **sm)
 {
 	UB_LOG(UBL_DEBUGV, "%s:portIndex=%d\n", __func__, (*sm)->portIndex);
+	gptprateratio_delete((*sm)->rre);
 	CLOSE_SM_DATA(sm);
 	return 0;
 }
 
+int md_pdelay_req_sm_handoff(md_pdelay_req_data_t *sm)
+{
+	pdelay_handoff_t ho;
+	if(!sm) return -1;
+	// only a valid measurement is handed off
+	if(!sm->mdeg->forAllDomain->asCapableAcrossDomains ||
+	   !sm->thisSM->neighborRateRatioValid) return 0;
+	memset(&ho, 0, sizeof(ho));
+	ho.neighborPropDelay = sm->ppg->forAllDomain->neighborPropDelay;
+	ho.neighborRateRatio = sm->ppg->forAllDomain->neighborRateRatio;
+	return gptpclock_handoff_put(GPTPCLOCK_HANDOFF_PDELAY, sm->portIndex, &ho, sizeof(ho));
+}
+
 void md_pdelay_req_sm_txts(md_pdelay_req_data_t *sm, event_data_txts_t *edtxts,
 			   uint64_t cts64)
 {
@@ -39,6 +39,8 @@ void md_pdelay_req_sm_init(md_pdelay_req_data_t **sm,
 			   PerPortGlobal *ppg,
 			   MDEntityGlobal *mdeg);
 int md_pdelay_req_sm_close(md_pdelay_req_data_t **mdpdrd);
+/* put the neighbor delay for the next gptp2d, after gptpclock_handoff_begin */
+int md_pdelay_req_sm_handoff(md_pdelay_req_data_t *sm);
 void md_pdelay_req_sm_txts(md_pdelay_req_data_t *sm, event_data_txts_t *edtxts,
 			   uint64_t cts64);
 void md_pdelay_req_sm_recv_resp(md_pdelay_req_data_t *sm, event_data_recv_t *edrecv,
@@ -65,14 +65,17 @@ struct md_sync_receive_data{
 
 static MDSyncReceive *setMDSyncReceive(md_sync_receive_data_t *sm)
 {
+	int64_t cf, dts;
+	bool subns_precision=gptpconf_get_intitem(CONF_SYNC_SUBNS_PRECISION);
+	// correctionField is in scaled nsec, without the precision truncate it to nsec
+	int64_t cfmask=subns_precision?-1:~(int64_t)SCALED_NS_MASK;
 	sm->mdSyncReceive.domainNumber = RCVD_SYNC_PTR->head.domainNumber;
 	sm->mdSyncReceive.seqid = ntohs(RCVD_SYNC_PTR->head.sequenceId_ns);
-	sm->mdSyncReceive.followUpCorrectionField.nsec =
-		(UB_NTOHLL((uint64_t)RCVD_SYNC_PTR->head.correctionField_nll)>>16);
+	cf=(int64_t)UB_NTOHLL((uint64_t)RCVD_SYNC_PTR->head.correctionField_nll) & cfmask;
 
 	if(TWO_STEP_FLAG){
-		sm->mdSyncReceive.followUpCorrectionField.nsec +=
-			(UB_NTOHLL((uint64_t)RCVD_FOLLOWUP_PTR->head.correctionField_nll)>>16);
+		cf+=(int64_t)UB_NTOHLL((uint64_t)RCVD_FOLLOWUP_PTR->head.correctionField_nll) &
+			cfmask;
 		sm->mdSyncReceive.preciseOriginTimestamp.seconds.lsb =
 			(uint64_t)ntohl(RCVD_FOLLOWUP_PTR->preciseOriginTimestamp.seconds_lsb_nl);
 		sm->mdSyncReceive.preciseOriginTimestamp.seconds.msb =
@@ -80,10 +83,10 @@ static MDSyncReceive *setMDSyncReceive(md_sync_receive_data_t *sm)
 		sm->mdSyncReceive.preciseOriginTimestamp.nanoseconds =
 			(uint64_t)ntohl(RCVD_FOLLOWUP_PTR->preciseOriginTimestamp.nanoseconds_nl);
 
+		// ScaledRateRatio has the same scale as cumulativeScaledRateOffset
 		sm->mdSyncReceive.rateRatio =
-			1.0 + ldexp((int32_t)ntohl(RCVD_FOLLOWUP_PTR->
-						  FUpInfoTLV.cumulativeScaledRateOffset_nl),
-				    -41);
+			(int32_t)ntohl(RCVD_FOLLOWUP_PTR->
+				       FUpInfoTLV.cumulativeScaledRateOffset_nl);
 		sm->mdSyncReceive.gmTimeBaseIndicator =
 			ntohs(RCVD_FOLLOWUP_PTR->FUpInfoTLV.gmTimeBaseIndicator_ns);
 
@@ -114,9 +117,8 @@ static MDSyncReceive *setMDSyncReceive(md_sync_receive_data_t *sm)
 			(uint64_t)ntohl(RCVD_SYNC_ONESETP_PTR->originTimestamp.nanoseconds_nl);
 
 		sm->mdSyncReceive.rateRatio =
-			1.0 + ldexp((int32_t)ntohl(RCVD_SYNC_ONESETP_PTR->
-						  FUpInfoTLV.cumulativeScaledRateOffset_nl),
-				    -41);
+			(int32_t)ntohl(RCVD_SYNC_ONESETP_PTR->
+				       FUpInfoTLV.cumulativeScaledRateOffset_nl);
 		sm->mdSyncReceive.gmTimeBaseIndicator =
 			ntohs(RCVD_SYNC_ONESETP_PTR->FUpInfoTLV.gmTimeBaseIndicator_ns);
 		sm->mdSyncReceive.lastGmPhaseChange.nsec_msb =
@@ -139,11 +141,22 @@ static MDSyncReceive *setMDSyncReceive(md_sync_receive_data_t *sm)
 		ntohs(RCVD_SYNC_PTR->head.sourcePortIdentity.portNumber_ns);
 	sm->mdSyncReceive.logMessageInterval = RCVD_SYNC_PTR->head.logMessageInterval;
 
-	sm->mdSyncReceive.upstreamTxTime.nsec = (sm->rts -
-		((double)sm->ppg->forAllDomain->neighborPropDelay.nsec /
-		 sm->ppg->forAllDomain->neighborRateRatio) -
-		((double)sm->ppg->forAllDomain->delayAsymmetry.nsec /
-		 sm->mdSyncReceive.rateRatio));
+	sm->mdSyncReceive.followUpCorrectionField.subns = cf & SCALED_NS_MASK;
+	sm->mdSyncReceive.followUpCorrectionField.nsec = gptp_sns_to_ns(cf);
+
+	// rts-(neighborPropDelay/neighborRateRatio)-(delayAsymmetry/rateRatio)
+	dts = gptp_rr_div_ns(
+		gptp_sns_from_ns(sm->ppg->forAllDomain->neighborPropDelay.nsec,
+				 sm->ppg->forAllDomain->neighborPropDelay.subns),
+		sm->ppg->forAllDomain->neighborRateRatio) +
+		gptp_rr_div_ns(
+			gptp_sns_from_ns(sm->ppg->forAllDomain->delayAsymmetry.nsec,
+					 sm->ppg->forAllDomain->delayAsymmetry.subns),
+			sm->mdSyncReceive.rateRatio);
+	if(!subns_precision) dts = gptp_sns_round_ns(dts)*((int64_t)1<<SCALED_NS_SHIFT);
+	sm->mdSyncReceive.upstreamTxTime.subns = 0;
+	sm->mdSyncReceive.upstreamTxTime.nsec =
+		gptp_sns_add(sm->rts, &sm->mdSyncReceive.upstreamTxTime.subns, -dts);
 	return &sm->mdSyncReceive;
 }
 
@@ -364,8 +377,27 @@ void md_sync_receive_sm_recv_sync(md_sync_receive_data_t *sm, event_data_recv_t
 				  uint64_t cts64)
 {
 	int size;
+	int pi;
 	UB_LOG(UBL_DEBUGV, "%s:domainIndex=%d, portIndex=%d\n",
 	       __func__, sm->domainIndex, sm->portIndex);
+	/* in a TAS, all the TSs work based on 'thisClock', so when a TS is not
+	 * based on 'thisClock', it must be converted.
+	 * When this TAS is synced to GM, 'thisClock' has the same freq. rate as GM,
+	 * but the phase is different. The phase sync happens in the TAS master clock,
+	 * which is gptpclock entity of (ClockIndex=0, tasglb->domainNumber)
+	 */
+	pi=gptpconf_get_intitem(CONF_SINGLE_CLOCK_MODE)?1:sm->portIndex;
+	switch(gptpclock_tsconv(&edrecv->ts64, pi, 0,
+				sm->ptasg->thisClockIndex, sm->ptasg->domainNumber)){
+	case 0:
+		sm->statd.sync_rec_tsconv++;
+		break;
+	case 1:
+		sm->statd.sync_rec_tsconv_skip++;
+		break;
+	default:
+		break;
+	}
 	RCVD_SYNC=true;
 	size=GET_TWO_STEP_FLAG(*(MDPTPMsgHeader *)edrecv->recbptr)?
 		sizeof(MDPTPMsgSync):sizeof(MDPTPMsgSyncOneStep);
@@ -28,6 +28,8 @@ typedef struct md_sync_receive_stat_data{
 	uint32_t sync_rec_valid;
 	uint32_t sync_fup_rec;
 	uint32_t sync_fup_rec_valid;
+	uint32_t sync_rec_tsconv; // RxTS conversion needed reading two clocks
+	uint32_t sync_rec_tsconv_skip; // RxTS conversion without reading clocks
 }md_sync_receive_stat_data_t;
 
 void *md_sync_receive_sm(md_sync_receive_data_t *sm, uint64_t cts64);
@@ -129,10 +129,14 @@ static int setFollowUp_txFollowUp(md_sync_send_data_t *sm, uint64_t cts64)
 		cf = sm->sync_ts - RCVD_MDSYNC_PTR->upstreamTxTime.nsec;
 		// we assume cf<1sec
 	}else{
-		head.correctionField = (RCVD_MDSYNC_PTR->followUpCorrectionField.nsec<<16);
-		head.correctionField += (RCVD_MDSYNC_PTR->rateRatio *
-					 ((sm->sync_ts -
-					   RCVD_MDSYNC_PTR->upstreamTxTime.nsec)<<16));
+		// in scaled nsec, the sub-nsec parts are kept
+		head.correctionField = gptp_sns_from_ns(
+			RCVD_MDSYNC_PTR->followUpCorrectionField.nsec,
+			RCVD_MDSYNC_PTR->followUpCorrectionField.subns);
+		head.correctionField += gptp_rr_mul_ns(
+			gptp_sns_from_ns(sm->sync_ts - RCVD_MDSYNC_PTR->upstreamTxTime.nsec, 0) -
+			RCVD_MDSYNC_PTR->upstreamTxTime.subns,
+			RCVD_MDSYNC_PTR->rateRatio);
 		cf=0;
 	}
 
@@ -401,8 +405,17 @@ void md_sync_send_sm_txts(md_sync_send_data_t *sm, event_data_txts_t *edtxts,
 	if(md_abnormal_timestamp(SYNC, sm->portIndex-1, sm->ptasg->domainNumber)) return;
 	RCVD_MDTIMESTAMP_RECEIVE = true;
 	pi=gptpconf_get_intitem(CONF_SINGLE_CLOCK_MODE)?1:sm->portIndex;
-	gptpclock_tsconv(&edtxts->ts64, pi, 0,
-			 sm->ptasg->thisClockIndex, sm->ptasg->domainNumber);
+	switch(gptpclock_tsconv(&edtxts->ts64, pi, 0,
+				sm->ptasg->thisClockIndex, sm->ptasg->domainNumber)){
+	case 0:
+		sm->statd.sync_send_tsconv++;
+		break;
+	case 1:
+		sm->statd.sync_send_tsconv_skip++;
+		break;
+	default:
+		break;
+	}
 	sm->sync_ts=edtxts->ts64;
 	md_sync_send_sm(sm, cts64);
 }
@@ -26,6 +26,8 @@ typedef struct md_sync_send_data md_sync_send_data_t;
 typedef struct md_sync_send_stat_data{
 	uint32_t sync_send;
 	uint32_t sync_fup_send;
+	uint32_t sync_send_tsconv; // TxTS conversion needed reading two clocks
+	uint32_t sync_send_tsconv_skip; // TxTS conversion without reading clocks
 }md_sync_send_stat_data_t;
 
 int md_sync_send_sm(md_sync_send_data_t *sm, uint64_t cts64);
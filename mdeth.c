@@ -125,7 +125,7 @@ void *md_header_compose(gptpnet_data_t *gpnetd, int portIndex, PTPMsgType msgtyp
 }
 
 void md_followup_information_tlv_compose(MDFollowUpInformationTLV *tlv,
-					 double rateRatio, uint16_t gmTimeBaseIndicator,
+					 ScaledRateRatio rateRatio, uint16_t gmTimeBaseIndicator,
 					 ScaledNs lastGmPhaseChange, double lastGmFreqChange)
 {
 	// 11.4.4.3 Follow_Up information TLV
@@ -137,7 +137,10 @@ void md_followup_information_tlv_compose(MDFollowUpInformationTLV *tlv,
 	tlv->organizationSubType_nb[0] = 0;
 	tlv->organizationSubType_nb[1] = 0;
 	tlv->organizationSubType_nb[2] = 1;
-	tlv->cumulativeScaledRateOffset_nl = htonl((int32_t)ldexp((rateRatio - 1.0), 41));
+	// the field is Integer32, saturate the value out of the range
+	if(rateRatio > INT32_MAX) rateRatio = INT32_MAX;
+	else if(rateRatio < INT32_MIN) rateRatio = INT32_MIN;
+	tlv->cumulativeScaledRateOffset_nl = htonl((int32_t)rateRatio);
 	tlv->gmTimeBaseIndicator_ns = htons(gmTimeBaseIndicator);
 	tlv->lastGmPhaseChange.nsec_msb = htons(lastGmPhaseChange.nsec_msb);
 	tlv->lastGmPhaseChange.nsec_nll = UB_HTONLL((uint64_t)lastGmPhaseChange.nsec);
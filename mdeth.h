@@ -328,7 +328,7 @@ void md_entity_glb_init(MDEntityGlobal **mdeglb, MDEntityGlobalForAllDomain *for
 void md_entity_glb_close(MDEntityGlobal **mdeglb, int domainIndex);
 
 void md_followup_information_tlv_compose(MDFollowUpInformationTLV *tlv,
-					 double rateRatio, uint16_t gmTimeBaseIndicator,
+					 ScaledRateRatio rateRatio, uint16_t gmTimeBaseIndicator,
 					 ScaledNs lastGmPhaseChange, double lastGmFreqChange);
 
 #endif
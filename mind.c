@@ -36,7 +36,7 @@ void ptas_glb_init(PerTimeAwareSystemGlobal **tasglb, uint8_t domainNumber)
 		gptpconf_get_intitem(CONF_LOG_SYNC_INTERVAL));
 	(*tasglb)->instanceEnable=true;
 	(*tasglb)->domainNumber=domainNumber;
-	(*tasglb)->gmRateRatio = 1.0;
+	(*tasglb)->gmRateRatio = RATE_RATIO_ONE;
 	(*tasglb)->conformToAvnu = gptpconf_get_intitem(CONF_FOLLOW_AVNU);
 }
 
@@ -22,6 +22,7 @@
 #define __MIND_H_
 
 #include "gptpbasetypes.h"
+#include "gptpfixedpoint.h"
 
 #define NUMBER_OF_PORTS 2
 
@@ -39,7 +40,7 @@ typedef struct MDSyncSend {
 	int8_t logMessageInterval;
 	Timestamp preciseOriginTimestamp;
 	UScaledNs upstreamTxTime;
-	double rateRatio;
+	ScaledRateRatio rateRatio;
 	uint16_t gmTimeBaseIndicator;
 	ScaledNs lastGmPhaseChange;
 	double lastGmFreqChange;
@@ -53,7 +54,7 @@ typedef struct MDSyncReceive {
 	int8_t logMessageInterval;
 	Timestamp preciseOriginTimestamp;
 	UScaledNs upstreamTxTime;
-	double rateRatio;
+	ScaledRateRatio rateRatio;
 	uint16_t gmTimeBaseIndicator;
 	ScaledNs lastGmPhaseChange;
 	double lastGmFreqChange;
@@ -70,7 +71,7 @@ typedef struct PortSyncSync {
 	int8_t logMessageInterval;
 	Timestamp preciseOriginTimestamp;
 	UScaledNs upstreamTxTime;
-	double rateRatio;
+	ScaledRateRatio rateRatio;
 	uint16_t gmTimeBaseIndicator;
 	ScaledNs lastGmPhaseChange;
 	double lastGmFreqChange;
@@ -97,7 +98,7 @@ typedef struct PerTimeAwareSystemGlobal {
 	double clockSourceLastGmFreqChange;
 	//UScaledNs currentTime; //we use gptpclock of (clockIndex,domainNumber)
 	bool gmPresent;
-	double gmRateRatio;
+	ScaledRateRatio gmRateRatio;
 	uint16_t gmTimeBaseIndicator;
 	ScaledNs lastGmPhaseChange;
 	double lastGmFreqChange;
@@ -112,6 +113,7 @@ typedef struct PerTimeAwareSystemGlobal {
 	int thisClockIndex; // index of the gptpclock entity of 'thisClock'
 	int8_t clockMasterLogSyncInterval;
 	bool gm_stable_initdone;
+	bool servo_fast_locked; // the servo has done the fast lock after the last GM_UNSTABLE
 	bool asCapableOrAll;
 	uint16_t lastSyncSeqID;
 	ClockIdentity gmIdentity;
@@ -122,7 +124,7 @@ typedef struct PerTimeAwareSystemGlobal {
 // 10.2.4 Per-port global variables
 typedef struct PerPortGlobalForAllDomain {
 	bool asymmetryMeasurementMode;
-	double neighborRateRatio;
+	ScaledRateRatio neighborRateRatio;
 	UScaledNs neighborPropDelay;
 	UScaledNs delayAsymmetry;
 	bool computeNeighborRateRatio;
@@ -186,7 +188,7 @@ typedef struct PortSyncSyncReceiveSM {
 	bool rcvdMDSync;
 	MDSyncReceive *rcvdMDSyncPtr;
 	PortSyncSync *txPSSyncPtr;
-	double rateRatio;
+	ScaledRateRatio rateRatio;
 } PortSyncSyncReceiveSM;
 
 // 10.2.8 ClockMasterSyncSend state machine
@@ -214,7 +216,7 @@ typedef struct PortSyncSyncSendSM {
 	PortSyncSync *rcvdPSSyncPtr;
 	Timestamp lastPreciseOriginTimestamp;
 	ScaledNs lastFollowUpCorrectionField;
-	double lastRateRatio;
+	ScaledRateRatio lastRateRatio;
 	UScaledNs lastUpstreamTxTime;
 	UScaledNs lastSyncSentTime;
 	uint16_t lastRcvdPortNum;
@@ -49,7 +49,8 @@ struct port_sync_sync_receive_data{
 	PortSyncSync portSyncSync;
 };
 
-static void setPSSyncPSSR(port_sync_sync_receive_data_t *sm, double rateRatio, uint64_t cts64)
+static void setPSSyncPSSR(port_sync_sync_receive_data_t *sm, ScaledRateRatio rateRatio,
+			  uint64_t cts64)
 {
 	uint64_t interval;
 	sm->portSyncSync.localPortNumber = sm->ppg->thisPort;
@@ -86,11 +87,12 @@ static void setPSSyncPSSR(port_sync_sync_receive_data_t *sm, double rateRatio, u
 
 static void *received_sync(port_sync_sync_receive_data_t *sm, uint64_t cts64)
 {
-	double rateRatio;
+	ScaledRateRatio rateRatio;
 	int a;
 	RCVD_MDSYNC = false;
 	rateRatio = RCVD_MDSYNC_PTR->rateRatio;
-	rateRatio += (sm->ppg->forAllDomain->neighborRateRatio - 1.0);
+	// (neighborRateRatio - 1.0) is added, it is simply the value in ScaledRateRatio
+	rateRatio += sm->ppg->forAllDomain->neighborRateRatio;
 	a = RCVD_MDSYNC_PTR->logMessageInterval;
 	sm->ppg->syncReceiptTimeoutTimeInterval.nsec =
 		sm->ppg->syncReceiptTimeout * LOG_TO_NSEC(a);
@@ -29,9 +29,24 @@
 #include "gptpclock_virtual.h"
 
 #define PTPCLOCK_OPEN_TOUT 100 // msec
+/* ptp devices are opened one by one at the startup, and waiting for each of them
+   delays the startup by PTPCLOCK_OPEN_TOUT per device.
+   The devices come up all together, so the waiting time is shared in
+   PTPCLOCK_OPEN_TOUT from the first retry. */
+static uint64_t open_retry_end;
+
+static int open_retry_time(void)
+{
+	uint64_t cts64=ub_mt_gettime64();
+	if(!open_retry_end || cts64>open_retry_end+PTPCLOCK_OPEN_TOUT*UB_MSEC_NS)
+		open_retry_end=cts64+PTPCLOCK_OPEN_TOUT*UB_MSEC_NS;
+	if(cts64>=open_retry_end) return 0;
+	return (open_retry_end-cts64)/UB_MSEC_NS;
+}
+
 ptpclock_state_t gptp_get_ptpfd(char *ptpdev, PTPFD_TYPE *ptpfd)
 {
-	int toutmsec = PTPCLOCK_OPEN_TOUT;
+	int toutmsec = -1;
 	ptpclock_state_t state=PTPCLOCK_NOWORK;
 
 #ifdef PTP_VIRTUAL_CLOCK_SUPPORT
@@ -41,17 +56,23 @@ ptpclock_state_t gptp_get_ptpfd(char *ptpdev, PTPFD_TYPE *ptpfd)
 			UB_LOG(UBL_ERROR,"%s:no access on %s\n", __func__, ptpdev);
 			return PTPCLOCK_NOACCESS;
 		}
-		/* virtual ptp clock has to use PTPCLOCK_SLAVE_SUB to support
-		 * the clock value for the other processes through gptpmasterclock.c
-		 * So, regularly this returns PTPCLOCK_RDONLY
+		/* virtual ptp clock regularly uses PTPCLOCK_SLAVE_SUB, and this returns
+		 * PTPCLOCK_RDONLY.
 		 * For testing purpose, add 'w' as the first character of the suffix
 		 * then this returns PTPCLOCK_RDWR, and the adjustment parameters are
-		 * maintained in this layer. */
+		 * maintained in this layer. The other processes read either one
+		 * through gptpmasterclock.c, from the shared oscillator state. */
 		if(ptpdev[strlen(CB_VIRTUAL_PTPDEV_PREFIX)]=='w') return PTPCLOCK_RDWR;
 		return PTPCLOCK_RDONLY;
 	}
 #endif //PTP_VIRTUAL_CLOCK_SUPPORT
 
+	if(SWCLOCK_NAME(ptpdev)){
+		// adjusted by software in gptpclock
+		*ptpfd = GPTP_SWCLOCK_FD;
+		return PTPCLOCK_RDONLY;
+	}
+
 	while(true){
 		*ptpfd = ptpdev_clock_open(ptpdev, O_RDWR);
 		if (PTPFD_VALID(*ptpfd)){
@@ -70,6 +91,7 @@ ptpclock_state_t gptp_get_ptpfd(char *ptpdev, PTPFD_TYPE *ptpfd)
 				break;
 			}
 		}
+		if(toutmsec<0) toutmsec=open_retry_time();
 		if(toutmsec>0){
 			// sleep 10msec and try again
 			CB_USLEEP(10000);
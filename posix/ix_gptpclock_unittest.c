@@ -24,11 +24,16 @@
 #include <signal.h>
 #include <stdio.h>
 #include <setjmp.h>
+#include <poll.h>
 #include <cmocka.h>
 #include <xl4unibase/unibase_binding.h>
 #include "gptpnet.h"
 #include "gptpclock.h"
+#include "gptpmasterclock.h"
+#include "gptpmastertimer.h"
 #include "mdeth.h"
+#include "ll_gptpsupport.h"
+#include "gptpclock_virtual.h"
 #define MAX_PORTS_NUM 5
 #define TEST_VALUE_RANGE 50000
 
@@ -58,6 +63,10 @@ static void test_add_and_del(void **state)
 		assert_int_equal(gptpclock_add_clock(i, ptpdevs[i], 0, 0, clockId), 0);
 	}
 
+	// the calibration is deferred, one clock is calibrated at a time
+	for(i=0;i<num_ports;i++) assert_int_equal(gptpclock_calibrate_next(), 1);
+	assert_int_equal(gptpclock_calibrate_next(), 0);
+
 	for(i=0;i<num_ports;i++){
 		assert_int_equal(gptpclock_del_clock(i, 0), 0);
 	}
@@ -235,6 +244,785 @@ static void test_adj_freq(void **state)
 	assert_false(gptpclock_del_clock(0, 2));
 }
 
+static void test_swclock(void **state) __attribute__((unused));
+static void test_swclock(void **state)
+{
+	int64_t ts0,ts1,tsv;
+	struct timespec tspec;
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, GPTP_SWCLOCK_PTPDEV, 0, 0, clockId));
+	cidex[1]=1;
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(1, GPTP_SWCLOCK_PTPDEV, 0, 0, clockId));
+
+	// the software clock is CLOCK_MONOTONIC_RAW
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tspec);
+	ts0=UB_TS2NSEC(tspec);
+	ts1=gptpclock_gethwts64(1, 0);
+	printf("swclock - MONOTONIC_RAW = %"PRIi64" nsec, should be near 0\n", ts1-ts0);
+	assert_true(ts1-ts0 > -TEST_VALUE_RANGE);
+	assert_true(ts1-ts0 < TEST_VALUE_RANGE);
+
+	// it can't be adjusted by HW, frequency and phase are adjusted by SW
+	assert_false(gptpclock_set_thisClock(1, 0, false));
+	gptpclock_setadj(100000, 1, 0); // +100ppm
+	tsv=ub_rt_gettime64();
+	gptpclock_setts64(tsv, 1, 0);
+	sleep(1);
+	ts0=ub_rt_gettime64();
+	ts1=gptpclock_getts64(1, 0);
+	tsv=ts1-ts0;
+	printf("ts1-ts0 = %"PRIi64" nsec, should be near 100000 nsec\n", tsv);
+	assert_true(tsv > 100000L-TEST_VALUE_RANGE);
+	assert_true(tsv < 100000L+TEST_VALUE_RANGE);
+	// the software clock itself is not changed
+	clock_gettime(CLOCK_MONOTONIC_RAW, &tspec);
+	ts0=UB_TS2NSEC(tspec);
+	ts1=gptpclock_gethwts64(1, 0);
+	assert_true(ts1-ts0 > -TEST_VALUE_RANGE);
+	assert_true(ts1-ts0 < TEST_VALUE_RANGE);
+
+	assert_false(gptpclock_del_clock(0, 0));
+	assert_false(gptpclock_del_clock(1, 0));
+}
+
+/* compare the RAW mapping reads with the ptp device reads for 'msec',
+   gptpclock_rawmap_update is called in every 10 msec as gptp2d does.
+   return the max difference */
+static int64_t compare_rawmap(int msec)
+{
+	int64_t ts0, ts1, ts2, d, dmax=0;
+	int i;
+	for(i=0;i<msec/10;i++){
+		gptpclock_rawmap_update();
+		assert_false(gptpmasterclock_get_domain_ts64_ptpdev(&ts0, 0));
+		assert_false(gptpmasterclock_get_domain_ts64(&ts1, 0));
+		assert_false(gptpmasterclock_get_domain_ts64_ptpdev(&ts2, 0));
+		// ts1 must be between ts0 and ts2
+		d=(ts1<ts0)?ts0-ts1:(ts1>ts2)?ts1-ts2:0;
+		if(d>dmax) dmax=d;
+		usleep(10000);
+	}
+	return dmax;
+}
+
+#define RAWMAP_ACCURACY 1000
+static void test_rawmap(void **state) __attribute__((unused));
+static void test_rawmap(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	char *ptpdev=CB_VIRTUAL_PTPDEV_PREFIX"0";
+	int64_t tsv, dmax;
+
+	// SW adjusted thisClock on a read-only virtual clock
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdev, 0, 0, clockId));
+	cidex[1]=1;
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(1, ptpdev, 0, 0, clockId));
+	assert_false(gptpclock_set_thisClock(1, 0, false));
+	gptpclock_setadj(100000, 1, 0); // +100ppm
+	tsv=ub_rt_gettime64();
+	gptpclock_setts64(tsv+UB_SEC_NS, 1, 0);
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+
+	// no mapping until the rate is measured, the ptp device is read
+	assert_int_equal(gptpclock_rawmap_update(), 0);
+	dmax=compare_rawmap(gptpconf_get_intitem(CONF_RAWMAP_RATE_PERIOD)+200);
+	printf("rawmap - ptpdev: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < RAWMAP_ACCURACY);
+
+	// a frequency change invalidates the mapping, and it is made again
+	gptpclock_setadj(-50000, 1, 0);
+	assert_int_equal(gptpclock_rawmap_update(), 1);
+	dmax=compare_rawmap(500);
+	printf("rawmap - ptpdev after freq. change: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < RAWMAP_ACCURACY);
+
+	// a phase step
+	tsv=ub_rt_gettime64();
+	gptpclock_setts64(tsv-UB_SEC_NS, 1, 0);
+	assert_int_equal(gptpclock_rawmap_update(), 1);
+	dmax=compare_rawmap(500);
+	printf("rawmap - ptpdev after phase step: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < RAWMAP_ACCURACY);
+
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+	assert_false(gptpclock_del_clock(1, 0));
+}
+
+/* timestamps of 'clockid' are taken between 2 reads of the domain clock,
+   the converted values must be between them */
+#define CONV_NUM 64
+static int64_t compare_conv(char *ptpdev, clockid_t clockid)
+{
+	int64_t ts[CONV_NUM], ref0[CONV_NUM], ref1[CONV_NUM], d, dmax=0;
+	struct timespec tsp;
+	int i;
+	for(i=0;i<CONV_NUM;i++){
+		assert_false(gptpmasterclock_get_domain_ts64_ptpdev(&ref0[i], 0));
+		// the virtual ptp device is CLOCK_REALTIME in the library
+		clock_gettime(ptpdev?CLOCK_REALTIME:clockid, &tsp);
+		ts[i]=UB_TS2NSEC(tsp);
+		assert_false(gptpmasterclock_get_domain_ts64_ptpdev(&ref1[i], 0));
+		usleep(1000);
+	}
+	// converted in place
+	if(ptpdev){
+		assert_false(gptpmasterclock_ptpdev2gptp(ptpdev, ts, ts, CONV_NUM, 0));
+	}else{
+		assert_false(gptpmasterclock_sysclock2gptp(clockid, ts, ts, CONV_NUM, 0));
+	}
+	for(i=0;i<CONV_NUM;i++){
+		d=(ts[i]<ref0[i])?ref0[i]-ts[i]:(ts[i]>ref1[i])?ts[i]-ref1[i]:0;
+		if(d>dmax) dmax=d;
+	}
+	return dmax;
+}
+
+#define CONV_ACCURACY 1000
+static void test_conv(void **state) __attribute__((unused));
+static void test_conv(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	char *ptpdev=CB_VIRTUAL_PTPDEV_PREFIX"0";
+	int64_t ts, dmax;
+
+	// the same setup as test_rawmap
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdev, 0, 0, clockId));
+	cidex[1]=1;
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(1, ptpdev, 0, 0, clockId));
+	assert_false(gptpclock_set_thisClock(1, 0, false));
+	gptpclock_setadj(100000, 1, 0); // +100ppm
+	gptpclock_setts64(ub_rt_gettime64()+UB_SEC_NS, 1, 0);
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+
+	dmax=compare_conv(NULL, 0); // the ptp device of the domain
+	printf("conv domain ptpdev: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < CONV_ACCURACY);
+	dmax=compare_conv(ptpdevs[1], 0); // another ptp device
+	printf("conv %s: max %"PRIi64" nsec\n", ptpdevs[1], dmax);
+	assert_true(dmax < CONV_ACCURACY);
+	dmax=compare_conv(NULL, CLOCK_REALTIME);
+	printf("conv CLOCK_REALTIME: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < CONV_ACCURACY);
+	dmax=compare_conv(NULL, CLOCK_MONOTONIC);
+	printf("conv CLOCK_MONOTONIC: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < CONV_ACCURACY);
+
+	// CLOCK_MONOTONIC_RAW, before and after the mapping is made
+	dmax=compare_conv(NULL, CLOCK_MONOTONIC_RAW);
+	printf("conv CLOCK_MONOTONIC_RAW: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < CONV_ACCURACY);
+	ts=ub_mt_gettime64()+(gptpconf_get_intitem(CONF_RAWMAP_RATE_PERIOD)+
+			      gptpconf_get_intitem(CONF_RAWMAP_UPDATE_INTERVAL))*UB_MSEC_NS;
+	while(ub_mt_gettime64()<ts){
+		gptpclock_rawmap_update();
+		usleep(10000);
+	}
+	dmax=compare_conv(NULL, CLOCK_MONOTONIC_RAW);
+	printf("conv CLOCK_MONOTONIC_RAW by the mapping: max %"PRIi64" nsec\n", dmax);
+	assert_true(dmax < CONV_ACCURACY);
+
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+	assert_false(gptpclock_del_clock(1, 0));
+}
+
+typedef struct event_waiter {
+	CB_THREAD_T th;
+	uint32_t seq;
+	int64_t wts;
+} event_waiter_t;
+
+static void *event_wait_proc(void *ptr)
+{
+	event_waiter_t *ew=(event_waiter_t *)ptr;
+	uint32_t flags;
+	if(gptpmasterclock_event_wait(&ew->seq, UB_SEC_NS, &flags)!=1) return NULL;
+	if(flags & GPTPIPC_EVENT_CLOCK_FLAG_GM_CHANGE) ew->wts=ub_mt_gettime64();
+	return NULL;
+}
+
+static void print_latency(const char *name, int64_t *lat, int n)
+{
+	int64_t min=lat[0], max=lat[0], sum=0;
+	int i;
+	for(i=0;i<n;i++){
+		if(lat[i]<min) min=lat[i];
+		if(lat[i]>max) max=lat[i];
+		sum+=lat[i];
+	}
+	printf("%s: GM change to wake up latency min=%"PRIi64", avg=%"PRIi64
+	       ", max=%"PRIi64" nsec\n", name, min, sum/n, max);
+}
+
+#define EVENT_TEST_COUNT 20
+#define EVENT_LATENCY_LIMIT (100*UB_MSEC_NS)
+static void test_event(void **state) __attribute__((unused));
+static void test_event(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	event_waiter_t ew;
+	int64_t lat[EVENT_TEST_COUNT];
+	int64_t ts;
+	uint64_t v;
+	struct pollfd pfd;
+	int i, efd, gmind;
+
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdevs[0], 0, 0, clockId));
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+	gmind=gptpmasterclock_gmchange_ind();
+
+	// a thread blocked in gptpmasterclock_event_wait
+	for(i=0;i<EVENT_TEST_COUNT;i++){
+		ew.seq=gptpmasterclock_event_seq();
+		ew.wts=0;
+		assert_false(CB_THREAD_CREATE(&ew.th, NULL, event_wait_proc, &ew));
+		usleep(10000); // let the thread go into the wait
+		ts=ub_mt_gettime64();
+		clockId[7]++;
+		gptpclock_set_gmchange(0, clockId);
+		CB_THREAD_JOIN(ew.th, NULL);
+		assert_true(ew.wts>0);
+		lat[i]=ew.wts-ts;
+		assert_true(lat[i]<EVENT_LATENCY_LIMIT);
+	}
+	print_latency("futex", lat, EVENT_TEST_COUNT);
+	assert_int_equal(gptpmasterclock_gmchange_ind(), gmind+EVENT_TEST_COUNT);
+
+	// poll on the event fd
+	efd=gptpmasterclock_event_fd();
+	assert_true(efd>=0);
+	assert_int_equal(gptpmasterclock_event_fd(), efd);
+	pfd.fd=efd;
+	pfd.events=POLLIN;
+	usleep(10000); // let the event thread go into the wait
+	for(i=0;i<EVENT_TEST_COUNT;i++){
+		ts=ub_mt_gettime64();
+		clockId[7]++;
+		gptpclock_set_gmchange(0, clockId);
+		assert_int_equal(poll(&pfd, 1, 1000), 1);
+		lat[i]=ub_mt_gettime64()-ts;
+		assert_int_equal(read(efd, &v, sizeof(v)), sizeof(v));
+		assert_true(lat[i]<EVENT_LATENCY_LIMIT);
+		usleep(10000);
+	}
+	print_latency("eventfd", lat, EVENT_TEST_COUNT);
+
+	// gm_stable is shown in the shared memory
+	gptpclock_set_gmstable(0, true);
+	assert_int_equal(poll(&pfd, 1, 1000), 1);
+	assert_int_equal(read(efd, &v, sizeof(v)), sizeof(v));
+	assert_int_equal(gptpmasterclock_gmstable(0), 1);
+	gptpclock_set_gmstable(0, false);
+	assert_int_equal(gptpmasterclock_gmstable(0), 0);
+
+	// no event, timeout
+	ew.seq=gptpmasterclock_event_seq();
+	assert_int_equal(gptpmasterclock_event_wait(&ew.seq, 10*UB_MSEC_NS, NULL), 0);
+
+	assert_false(gptpmasterclock_event_fd_close());
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+}
+
+static void *event_forever_proc(void *ptr)
+{
+	event_waiter_t *ew=(event_waiter_t *)ptr;
+	if(gptpmasterclock_event_wait(&ew->seq, -1, NULL)==1) ew->wts=ub_mt_gettime64();
+	return NULL;
+}
+
+/* closing gptp2d wakes up the waiters, and the events of the restarted gptp2d come */
+static void test_event_restart(void **state) __attribute__((unused));
+static void test_event_restart(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	event_waiter_t ew;
+	uint64_t v;
+	struct pollfd pfd;
+	int efd;
+
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdevs[0], 0, 0, clockId));
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+	efd=gptpmasterclock_event_fd();
+	assert_true(efd>=0);
+	pfd.fd=efd;
+	pfd.events=POLLIN;
+	ew.seq=gptpmasterclock_event_seq();
+	ew.wts=0;
+	assert_false(CB_THREAD_CREATE(&ew.th, NULL, event_forever_proc, &ew));
+	usleep(10000); // let the threads go into the wait
+
+	// a normal close, not the handoff
+	gptpclock_close();
+	CB_THREAD_JOIN(ew.th, NULL);
+	assert_true(ew.wts>0);
+	assert_int_equal(poll(&pfd, 1, 1000), 1);
+	assert_int_equal(read(efd, &v, sizeof(v)), sizeof(v));
+	// no gptp2d
+	assert_int_equal(gptpmasterclock_event_wait(&ew.seq, 0, NULL), -1);
+
+	// the restarted gptp2d
+	assert_false(gptpclock_init(3, MAX_PORTS_NUM));
+	assert_false(gptpclock_add_clock(0, ptpdevs[0], 0, 0, clockId));
+	usleep(300000); // let the event thread move to the new shared memory
+	if(poll(&pfd, 1, 0)==1)
+		assert_int_equal(read(efd, &v, sizeof(v)), sizeof(v));
+	ew.seq=gptpmasterclock_event_seq();
+	ew.wts=0;
+	assert_false(CB_THREAD_CREATE(&ew.th, NULL, event_forever_proc, &ew));
+	usleep(10000);
+	clockId[7]++;
+	gptpclock_set_gmchange(0, clockId);
+	CB_THREAD_JOIN(ew.th, NULL);
+	assert_true(ew.wts>0);
+	assert_int_equal(poll(&pfd, 1, 1000), 1);
+	assert_int_equal(read(efd, &v, sizeof(v)), sizeof(v));
+
+	assert_false(gptpmasterclock_event_fd_close());
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+}
+
+#define TIMER_TEST_PHASE (100*UB_USEC_NS)
+typedef struct timer_result {
+	int count;
+	int misaligned;
+	int gmchange;
+	int timejump;
+	int64_t late_max;
+} timer_result_t;
+
+static void timer_cb(void *cbdata, gptpmastertimer_event_t event, int64_t ts64,
+		     uint32_t overrun)
+{
+	timer_result_t *tr=(timer_result_t *)cbdata;
+	int64_t late;
+	switch(event){
+	case GPTPMASTERTIMER_EXPIRE:
+		late=gptpmasterclock_getts64()-ts64;
+		if(late>tr->late_max) tr->late_max=late;
+		if(ts64%UB_MSEC_NS!=TIMER_TEST_PHASE) tr->misaligned++;
+		tr->count+=overrun+1;
+		break;
+	case GPTPMASTERTIMER_GM_CHANGE:
+		tr->gmchange++;
+		break;
+	case GPTPMASTERTIMER_TIME_JUMP:
+		tr->timejump++;
+		break;
+	}
+}
+
+static void test_timer(void **state) __attribute__((unused));
+static void test_timer(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	gptpmastertimer_t *tm, *ftm, *ltm;
+	timer_result_t tr;
+	struct pollfd pfd;
+	uint64_t v, fcount=0;
+	char *ptpdev=CB_VIRTUAL_PTPDEV_PREFIX"0";
+
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	// SW adjusted thisClock on a read-only virtual clock, the same as test_rawmap
+	assert_false(gptpclock_add_clock(0, ptpdev, 0, 0, clockId));
+	cidex[1]=1;
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(1, ptpdev, 0, 0, clockId));
+	assert_false(gptpclock_set_thisClock(1, 0, false));
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+
+	// 1msec timer with a callback, and 10msec timer with the eventfd
+	memset(&tr, 0, sizeof(tr));
+	assert_null(gptpmastertimer_create(0, 0, timer_cb, &tr));
+	tm=gptpmastertimer_create(UB_MSEC_NS, TIMER_TEST_PHASE, timer_cb, &tr);
+	assert_non_null(tm);
+	ftm=gptpmastertimer_create(10*UB_MSEC_NS, 0, NULL, NULL);
+	assert_non_null(ftm);
+	assert_int_equal(gptpmastertimer_fd(tm), -1);
+	pfd.fd=gptpmastertimer_fd(ftm);
+	pfd.events=POLLIN;
+	while(fcount<10){
+		assert_int_equal(poll(&pfd, 1, 100), 1);
+		assert_int_equal(read(pfd.fd, &v, sizeof(v)), sizeof(v));
+		fcount+=v;
+	}
+	printf("timer: %d expirations, max late=%"PRIi64" nsec, fd %"PRIu64" expirations\n",
+	       tr.count, tr.late_max, fcount);
+	// 10 times of the 10msec timer, 90 to 100 times of the 1msec timer
+	assert_int_equal(fcount, 10);
+	assert_in_range(tr.count, 89, 101);
+	assert_int_equal(tr.misaligned, 0);
+	assert_int_equal(tr.timejump, 0);
+
+	// GM change, the eventfd of a timer far from the expiration is signaled
+	ltm=gptpmastertimer_create(100*UB_SEC_NS, 0, NULL, NULL);
+	assert_non_null(ltm);
+	clockId[7]++;
+	gptpclock_set_gmchange(0, clockId);
+	usleep(50000);
+	assert_int_equal(tr.gmchange, 1);
+	assert_int_equal(gptpmastertimer_get_events(ftm), GPTPMASTERTIMER_FLAG_GM_CHANGE);
+	assert_int_equal(gptpmastertimer_get_events(ftm), 0);
+	pfd.fd=gptpmastertimer_fd(ltm);
+	assert_int_equal(poll(&pfd, 1, 0), 1);
+	assert_int_equal(read(pfd.fd, &v, sizeof(v)), sizeof(v));
+	assert_int_equal(gptpmastertimer_get_events(ltm), GPTPMASTERTIMER_FLAG_GM_CHANGE);
+	assert_false(gptpmastertimer_delete(ltm));
+
+	// a jump of gPTP time, the timer is still aligned after that
+	gptpclock_setts64(gptpmasterclock_getts64()+UB_SEC_NS/3, 1, 0);
+	usleep(50000);
+	assert_int_equal(tr.timejump, 1);
+	assert_int_equal(gptpmastertimer_get_events(ftm), GPTPMASTERTIMER_FLAG_TIME_JUMP);
+	assert_int_equal(tr.misaligned, 0);
+
+	assert_false(gptpmastertimer_delete(ftm));
+	assert_false(gptpmastertimer_delete(tm));
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+	assert_false(gptpclock_del_clock(1, 0));
+}
+
+#define SAMPLE_THROUGHPUT_NUM 1000000
+#define SAMPLE_READ_MAX 64
+/* the fields are made from 'n', to find a broken sample */
+static void make_sample(gptpipc_sync_sample_t *smp, uint64_t n)
+{
+	smp->local_ts64=n;
+	smp->gm_ts64=n*3;
+	smp->offset64=-(int64_t)n;
+	smp->rate_ratio=n^0x5a5a5a5aLL;
+	smp->adjppb=(int32_t)n;
+	smp->seqid=(uint16_t)n;
+	smp->domainNumber=0;
+	smp->flags=(uint8_t)n;
+}
+
+static bool sample_broken(gptpipc_sync_sample_t *smp)
+{
+	uint64_t n=smp->local_ts64;
+	return smp->gm_ts64!=(int64_t)(n*3) || smp->offset64!=-(int64_t)n ||
+		smp->rate_ratio!=(int64_t)(n^0x5a5a5a5aLL) || smp->adjppb!=(int32_t)n ||
+		smp->seqid!=(uint16_t)n || smp->flags!=(uint8_t)n;
+}
+
+typedef struct sample_pusher {
+	CB_THREAD_T th;
+	uint64_t base;
+	int64_t dts;
+} sample_pusher_t;
+
+static void *sample_push_proc(void *ptr)
+{
+	sample_pusher_t *sp=(sample_pusher_t *)ptr;
+	gptpipc_sync_sample_t smp;
+	int64_t ts;
+	int i;
+	ts=ub_mt_gettime64();
+	for(i=0;i<SAMPLE_THROUGHPUT_NUM;i++){
+		make_sample(&smp, sp->base+i);
+		gptpclock_sync_sample_push(0, &smp);
+	}
+	sp->dts=ub_mt_gettime64()-ts;
+	return NULL;
+}
+
+static void test_sync_sample(void **state) __attribute__((unused));
+static void test_sync_sample(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	gptpipc_sync_sample_t smp, smps[SAMPLE_READ_MAX];
+	sample_pusher_t sp;
+	uint64_t pos, pos0, last;
+	uint32_t lost;
+	int i, n, nread=0, nlost=0, broken=0, num_slots;
+
+	num_slots=gptpconf_get_intitem(CONF_SYNC_SAMPLE_RING_SIZE);
+	assert_true(num_slots>SAMPLE_READ_MAX);
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdevs[0], 0, 0, clockId));
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+	assert_int_equal(gptpmasterclock_sync_sample_read(3, &pos, smps, 1, NULL), -1);
+
+	// nothing new, and the wait times out
+	assert_false(gptpmasterclock_sync_sample_head(0, &pos0));
+	pos=pos0;
+	assert_int_equal(gptpmasterclock_sync_sample_read(0, &pos, smps, 1, &lost), 0);
+	assert_int_equal(gptpmasterclock_sync_sample_wait(0, pos, 10*UB_MSEC_NS), 0);
+
+	// overrun by 10 samples, the oldest 10 are lost
+	for(i=0;i<num_slots+10;i++){
+		make_sample(&smp, pos0+i);
+		assert_false(gptpclock_sync_sample_push(0, &smp));
+	}
+	assert_int_equal(gptpmasterclock_sync_sample_wait(0, pos, 10*UB_MSEC_NS), 1);
+	last=pos0+9;
+	while((n=gptpmasterclock_sync_sample_read(0, &pos, smps, SAMPLE_READ_MAX, &lost))>0){
+		nlost+=lost;
+		for(i=0;i<n;i++){
+			assert_false(sample_broken(&smps[i]));
+			assert_true(smps[i].local_ts64==(int64_t)last+1);
+			assert_true(smps[i].raw_ts64>0);
+			last=smps[i].local_ts64;
+		}
+		nread+=n;
+	}
+	assert_int_equal(nlost, 10);
+	assert_int_equal(nread, num_slots);
+	assert_true(pos==pos0+num_slots+10);
+
+	// throughput, a reader follows the writer
+	sp.base=pos;
+	nread=0;
+	nlost=0;
+	last=0;
+	assert_false(CB_THREAD_CREATE(&sp.th, NULL, sample_push_proc, &sp));
+	while(pos<sp.base+SAMPLE_THROUGHPUT_NUM){
+		n=gptpmasterclock_sync_sample_read(0, &pos, smps, SAMPLE_READ_MAX, &lost);
+		assert_true(n>=0);
+		nlost+=lost;
+		for(i=0;i<n;i++){
+			if(sample_broken(&smps[i]) || smps[i].local_ts64<=(int64_t)last) broken++;
+			last=smps[i].local_ts64;
+		}
+		nread+=n;
+		if(!n) gptpmasterclock_sync_sample_wait(0, pos, 100*UB_MSEC_NS);
+	}
+	CB_THREAD_JOIN(sp.th, NULL);
+	printf("sync sample: %d pushes in %"PRIi64" usec, %.1f nsec/push, "
+	       "read=%d, lost=%d\n", SAMPLE_THROUGHPUT_NUM, (int64_t)(sp.dts/UB_USEC_NS),
+	       (double)sp.dts/SAMPLE_THROUGHPUT_NUM, nread, nlost);
+	assert_int_equal(broken, 0);
+	assert_int_equal(nread+nlost, SAMPLE_THROUGHPUT_NUM);
+
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+}
+
+#define QUALITY_SYNC_INTERVAL (10*UB_MSEC_NS)
+#define QUALITY_UNCERTAINTY 100
+#define QUALITY_DRIFT_PPB 1000
+/* the servo sets the quality at each Sync */
+static void quality_sync(int64_t ptime)
+{
+	gptp_clock_quality_para_t qp;
+	int64_t ets=gptpclock_rawts64()+ptime;
+	memset(&qp, 0, sizeof(qp));
+	qp.sync_timeout=3*QUALITY_SYNC_INTERVAL;
+	qp.uncertainty=QUALITY_UNCERTAINTY;
+	qp.drift_ppb=QUALITY_DRIFT_PPB;
+	qp.rate_ratio=RATE_RATIO_ONE;
+	qp.servo_state=GPTPIPC_SERVO_STATE_LOCKED;
+	do{
+		qp.sync_rawts64=gptpclock_rawts64();
+		assert_false(gptpclock_set_quality(0, &qp));
+		usleep(QUALITY_SYNC_INTERVAL/UB_USEC_NS);
+	}while(gptpclock_rawts64()<ets);
+}
+
+static void test_clock_quality(void **state) __attribute__((unused));
+static void test_clock_quality(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	gptpipc_clock_quality_t qy;
+	gptp_clock_quality_para_t qp;
+	int64_t ts0, ts1, ts2;
+
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdevs[0], 0, 0, clockId));
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+	assert_int_equal(gptpmasterclock_get_domain_ts64_quality(&ts0, NULL, 0), -1);
+
+	// no Sync yet
+	assert_false(gptpmasterclock_get_domain_ts64_quality(&ts0, &qy, 0));
+	assert_int_equal(qy.servo_state, GPTPIPC_SERVO_STATE_FREERUN);
+	assert_int_equal(qy.uncertainty, -1);
+	assert_int_equal(qy.sync_age, -1);
+	assert_int_equal(qy.flags, 0);
+
+	// locked, the time comes with the quality
+	quality_sync(100*UB_MSEC_NS);
+	assert_false(gptpmasterclock_get_domain_ts64_ptpdev(&ts0, 0));
+	assert_false(gptpmasterclock_get_domain_ts64_quality(&ts1, &qy, 0));
+	assert_false(gptpmasterclock_get_domain_ts64_ptpdev(&ts2, 0));
+	assert_true(ts0<=ts1 && ts1<=ts2);
+	assert_int_equal(qy.servo_state, GPTPIPC_SERVO_STATE_LOCKED);
+	assert_int_equal(qy.flags, 0);
+	assert_true(qy.rate_ratio==RATE_RATIO_ONE);
+	assert_true(qy.sync_age>=0 && qy.sync_age<3*QUALITY_SYNC_INTERVAL);
+	assert_int_equal(qy.uncertainty, QUALITY_UNCERTAINTY+
+			 (qy.sync_age/UB_USEC_NS)*QUALITY_DRIFT_PPB/UB_MSEC_NS);
+
+	// inject Sync loss, holdover after the timeout and the uncertainty grows
+	usleep(100*UB_MSEC_NS/UB_USEC_NS);
+	assert_true(gptpmasterclock_getts64_quality(&qy)>0);
+	assert_int_equal(qy.servo_state, GPTPIPC_SERVO_STATE_LOCKED);
+	assert_int_equal(qy.flags, GPTPIPC_CLOCK_QUALITY_FLAG_HOLDOVER);
+	assert_true(qy.sync_age>=100*UB_MSEC_NS);
+	// 100msec by 1000ppb
+	assert_true(qy.uncertainty>=QUALITY_UNCERTAINTY+100);
+	assert_int_equal(qy.holdover_time, 0);
+
+	// the holdover by the frequency model, the uncertainty grows by the model errors
+	memset(&qp, 0, sizeof(qp));
+	qp.sync_rawts64=gptpclock_rawts64()-UB_SEC_NS;
+	qp.sync_timeout=3*QUALITY_SYNC_INTERVAL;
+	qp.uncertainty=QUALITY_UNCERTAINTY;
+	qp.servo_state=GPTPIPC_SERVO_STATE_HOLDOVER;
+	qp.holdover_rawts64=qp.sync_rawts64;
+	qp.holdover_ferr_ppt=10000;
+	assert_false(gptpclock_set_quality(0, &qp));
+	assert_false(gptpmasterclock_get_domain_ts64_quality(&ts0, &qy, 0));
+	assert_int_equal(qy.servo_state, GPTPIPC_SERVO_STATE_HOLDOVER);
+	assert_int_equal(qy.flags, GPTPIPC_CLOCK_QUALITY_FLAG_HOLDOVER);
+	assert_true(qy.holdover_time>=UB_SEC_NS);
+	// more than 1sec by 10ppb
+	assert_true(qy.uncertainty>=QUALITY_UNCERTAINTY+10);
+	assert_int_equal(qy.uncertainty, QUALITY_UNCERTAINTY+gptpclock_holdover_error(
+				 qp.holdover_ferr_ppt, 0, qy.holdover_time));
+
+	// Sync comes back
+	quality_sync(0);
+	assert_false(gptpmasterclock_get_domain_ts64_quality(&ts0, &qy, 0));
+	assert_int_equal(qy.flags, 0);
+	assert_true(qy.uncertainty<QUALITY_UNCERTAINTY+100);
+
+	// this device becomes GM
+	gptpclock_set_gmstable(0, true);
+	assert_false(gptpclock_set_gmsync(0, 0, clockId, true));
+	assert_false(gptpmasterclock_get_domain_ts64_quality(&ts0, &qy, 0));
+	assert_int_equal(qy.servo_state, GPTPIPC_SERVO_STATE_GM);
+	assert_int_equal(qy.uncertainty, 0);
+	assert_int_equal(qy.sync_age, -1);
+	assert_int_equal(qy.flags, GPTPIPC_CLOCK_QUALITY_FLAG_GM_STABLE);
+	gptpclock_set_gmstable(0, false);
+
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+}
+
+/* gPTP time - CLOCK_REALTIME, by the library */
+static int64_t handoff_diff(void)
+{
+	int64_t ts0, ts1, rts;
+	assert_false(gptpmasterclock_get_domain_ts64(&ts0, 0));
+	rts=ub_rt_gettime64();
+	assert_false(gptpmasterclock_get_domain_ts64(&ts1, 0));
+	return (ts0+ts1)/2-rts;
+}
+
+#define HANDOFF_ACCURACY 10000
+static void test_handoff(void **state) __attribute__((unused));
+static void test_handoff(void **state)
+{
+	ClockIdentity clockId0, clockId1;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	char *ptpdev=CB_VIRTUAL_PTPDEV_PREFIX"0";
+	int64_t d0, d1, rts0, rts1, v=0;
+	uint32_t gen;
+
+	// SW adjusted thisClock on a read-only virtual clock, the same as gptp2d does
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId0, cidex);
+	cidex[1]=1;
+	eui48to64(macid, clockId1, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdev, 0, 0, clockId0));
+	assert_false(gptpclock_add_clock(1, ptpdev, 0, 0, clockId1));
+	assert_false(gptpclock_set_thisClock(1, 0, false));
+	gptpclock_setadj(100000, 1, 0); // +100ppm
+	gptpclock_setts64(ub_rt_gettime64()+UB_SEC_NS, 1, 0);
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+	gen=gptpmasterclock_generation();
+
+	// nothing is put before the handoff begins
+	assert_int_equal(gptpclock_handoff_put(GPTPCLOCK_HANDOFF_SERVO, 0, &v, sizeof(v)), -1);
+	assert_false(gptpclock_handoff_begin());
+	v=12345;
+	assert_false(gptpclock_handoff_put(GPTPCLOCK_HANDOFF_SERVO, 0, &v, sizeof(v)));
+	assert_int_equal(gptpclock_handoff_put(GPTPCLOCK_HANDOFF_PDELAY, 1, &v,
+					       GPTPCLOCK_HANDOFF_DATA_SIZE+1), -1);
+	d0=handoff_diff();
+	rts0=ub_rt_gettime64();
+	gptpclock_close();
+
+	// the clients keep reading the clock between the 2 gptp2d
+	assert_int_equal(gptpmasterclock_get_max_domains(), 3);
+	assert_true(llabs(handoff_diff()-d0)<HANDOFF_ACCURACY);
+
+	// the next gptp2d
+	assert_false(gptpclock_init(3, MAX_PORTS_NUM));
+	assert_int_equal(gptpmasterclock_generation(), gen+1);
+	assert_false(gptpclock_add_clock(0, ptpdev, 0, 0, clockId0));
+	assert_false(gptpclock_add_clock(1, ptpdev, 0, 0, clockId1));
+	assert_false(gptpclock_set_thisClock(1, 0, false));
+	assert_int_equal(gptpclock_get_adjppb(1, 0), 100000);
+	gptpclock_setadj(gptpclock_get_adjppb(1, 0), 1, 0);
+	d1=handoff_diff();
+	rts1=ub_rt_gettime64();
+	// +100ppm continues
+	printf("time error across the handoff: %"PRIi64"nsec\n",
+	       d1-d0-(rts1-rts0)/10000);
+	assert_true(llabs(d1-d0-(rts1-rts0)/10000)<HANDOFF_ACCURACY);
+
+	// each record is given only once, with the same size
+	v=0;
+	assert_int_equal(gptpclock_handoff_get(GPTPCLOCK_HANDOFF_SERVO, 0, &v, 4), -1);
+	assert_false(gptpclock_handoff_get(GPTPCLOCK_HANDOFF_SERVO, 0, &v, sizeof(v)));
+	assert_int_equal(v, 12345);
+	assert_int_equal(gptpclock_handoff_get(GPTPCLOCK_HANDOFF_SERVO, 0, &v, sizeof(v)), -1);
+	assert_int_equal(gptpclock_handoff_get(GPTPCLOCK_HANDOFF_PDELAY, 1, &v, sizeof(v)), -1);
+
+	// becoming GM keeps the parameters in the hold, and syncing to GM ends it
+	assert_true(gptpclock_handoff_holding(0));
+	assert_false(gptpclock_set_gmsync(0, 0, clockId0, true));
+	assert_int_equal(gptpclock_get_adjppb(1, 0), 100000);
+	assert_true(gptpclock_we_are_gm(0));
+	assert_false(gptpclock_set_gmsync(0, 0, clockId0, false));
+	assert_false(gptpclock_handoff_holding(0));
+	assert_false(gptpclock_we_are_gm(0));
+	assert_false(gptpclock_reset_gmsync(0, 0));
+
+	gptpmasterclock_close();
+	assert_false(gptpclock_del_clock(0, 0));
+	assert_false(gptpclock_del_clock(1, 0));
+}
+
 #define C0_C2_OFFSET (5*UB_SEC_NS)
 #define C1_C2_OFFSET (10*UB_SEC_NS)
 static void test_domain_clock(char rdwr) __attribute__((unused));
@@ -439,12 +1227,90 @@ static void test_tsconv(void **state)
 	assert_true(ts2 > -330000000-TEST_VALUE_RANGE);
 	assert_true(ts2 < -330000000+TEST_VALUE_RANGE);
 
+	// the clocks on the same ptpdev are converted without reading the clocks
+	ts1=tsv;
+	assert_int_equal(gptpclock_tsconv(&ts1,1,1,1,0), 1);
+	cidex[1]=4;
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(2, ptpdevs[1], 0, 0, clockId));
+	gptpclock_setts64(tsv, 2, 0);
+	ts1=tsv;
+	assert_int_equal(gptpclock_tsconv(&ts1,1,0,2,0), 0);
+	assert_false(gptpclock_del_clock(2, 0));
+
 	assert_false(gptpclock_del_clock(0, 0));
 	assert_false(gptpclock_del_clock(0, 1));
 	assert_false(gptpclock_del_clock(1, 0));
 	assert_false(gptpclock_del_clock(1, 1));
 }
 
+/* a library built with a different layout of the shared memory doesn't attach to it */
+static void test_shm_version(void **state)
+{
+	gptp_master_clock_shm_head_t *head;
+	int shmfd, hsize=sizeof(gptp_master_clock_shm_head_t);
+	uint32_t version;
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdevs[0], 0, 0, clockId));
+	head=(gptp_master_clock_shm_head_t *)cb_get_shared_mem(
+		&shmfd, "/gptp_mc_shm0", hsize, O_RDWR);
+	assert_non_null(head);
+	assert_int_equal(head->version, GPTP_MASTER_CLOCK_SHM_VERSION);
+	assert_int_equal(head->ppara_size, sizeof(gptp_clock_ppara_t));
+	version=head->version;
+	head->version=version+1;
+	assert_int_equal(gptpmasterclock_init("/gptp_mc_shm0"), -1);
+	head->version=version;
+	head->ppara_size--;
+	assert_int_equal(gptpmasterclock_init("/gptp_mc_shm0"), -1);
+	head->ppara_size++;
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+	gptpmasterclock_close();
+	cb_close_shared_mem(head, &shmfd, "/gptp_mc_shm0", hsize, false);
+	assert_false(gptpclock_del_clock(0, 0));
+}
+
+/* the applications read the same virtual clock as gptp2d, not the system clock */
+static void test_vclock_shared(void **state)
+{
+	ClockIdentity clockId;
+	uint8_t cidex[2]={0,0};
+	ub_macaddr_t macid;
+	gptp_vclock_model_t model;
+	PTPFD_TYPE fd;
+	int64_t ts, ts0, ts1;
+	int i;
+
+	cb_get_mac_bydev(0, netdevs[0], macid);
+	eui48to64(macid, clockId, cidex);
+	assert_false(gptpclock_add_clock(0, ptpdevs[0], 0, 0, clockId));
+	fd=gptp_vclock_alloc_fd(ptpdevs[0]);
+	memset(&model, 0, sizeof(model));
+	model.init_offset=10*UB_SEC_NS;
+	model.freq_ppb=50000;
+	model.random_walk_ppb=100;
+	model.seed=5;
+	assert_false(gptp_vclock_set_model(fd, &model));
+	assert_false(gptpmasterclock_init("/gptp_mc_shm0"));
+	for(i=0;i<20;i++){
+		ts0=gptp_vclock_gettime(fd);
+		assert_false(gptpmasterclock_get_domain_ts64_ptpdev(&ts, 0));
+		ts1=gptp_vclock_gettime(fd);
+		assert_true(ts>=ts0 && ts<=ts1);
+		// gptp2d adjusts it, and the applications follow
+		assert_false(gptp_vclock_adjtime(fd, (i&1)?-20000:20000));
+		usleep(50000);
+	}
+	gptpmasterclock_close();
+	gptp_vclock_free_fd(fd);
+	assert_false(gptpclock_del_clock(0, 0));
+}
+
 static int setup(void **state)
 {
 	unibase_init_para_t init_para;
@@ -472,6 +1338,17 @@ int main(int argc, char *argv[])
 		cmocka_unit_test(test_adj_freq),
 		cmocka_unit_test(test_tsconv),
 		cmocka_unit_test(test_thisClock),
+		cmocka_unit_test(test_swclock),
+		cmocka_unit_test(test_rawmap),
+		cmocka_unit_test(test_conv),
+		cmocka_unit_test(test_event),
+		cmocka_unit_test(test_event_restart),
+		cmocka_unit_test(test_timer),
+		cmocka_unit_test(test_sync_sample),
+		cmocka_unit_test(test_clock_quality),
+		cmocka_unit_test(test_handoff),
+		cmocka_unit_test(test_shm_version),
+		cmocka_unit_test(test_vclock_shared),
 	};
 
 	return cmocka_run_group_tests(tests, setup, teardown);
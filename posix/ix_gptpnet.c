@@ -36,6 +36,20 @@ typedef struct sendbuf {
 	uint8_t pdata[GPTP_MAX_PACKET_SIZE];
 } __attribute__((packed)) sendbuf_t;
 
+// a bigger change of the REALTIME offset than this is counted as a step
+#define SWCLOCK_STEP_THRESHOLD 1000000 //1msec
+// the offset is measured this times, and the narrowest one is used
+#define SWCLOCK_MEASURE_TIMES 3
+
+typedef struct swclock_data {
+	int64_t rt_offset;
+	uint32_t ts_count;
+	uint64_t width_sum;
+	uint32_t width_max;
+	uint32_t drift_max;
+	uint32_t step_count;
+} swclock_data_t;
+
 typedef struct netdevice {
 	int fd;
 	int mtusize;
@@ -48,6 +62,9 @@ typedef struct netdevice {
 	uint64_t waiting_txts_tout;
 	int waiting_txts_msgtype;
 	uint16_t ovip_port;
+	bool swclock;
+	swclock_data_t swcd;
+	int phc_index; // -1 for no PHC
 } netdevice_t;
 
 struct gptpnet_data {
@@ -62,6 +79,68 @@ struct gptpnet_data {
 	int64_t next_tout64;
 };
 
+// check if 'netdev' is in the comma separated list of CONF_SWCLOCK_NETDEVS
+static bool swclock_netdev(const char *netdev)
+{
+	char *devs=gptpconf_get_item(CONF_SWCLOCK_NETDEVS);
+	int len=strlen(netdev);
+	char *p;
+
+	if(!devs || !len) return false;
+	for(p=devs;(p=strstr(p, netdev));p+=len){
+		if((p==devs || p[-1]==',') && (p[len]==0 || p[len]==','))
+			return true;
+	}
+	return false;
+}
+
+/* software timestamps are CLOCK_REALTIME, convert it to the software clock
+   (CLOCK_MONOTONIC_RAW). REALTIME is read before and after MONOTONIC_RAW,
+   and the middle point is used. */
+static void swclock_ts_conv(swclock_data_t *swcd, int64_t *ts64)
+{
+	struct timespec ts1, tsr, ts2;
+	int64_t width, best=-1, offset=0, drift;
+	int i;
+
+	for(i=0;i<SWCLOCK_MEASURE_TIMES;i++){
+		clock_gettime(CLOCK_REALTIME, &ts1);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &tsr);
+		clock_gettime(CLOCK_REALTIME, &ts2);
+		width=UB_TS2NSEC(ts2)-UB_TS2NSEC(ts1);
+		if(width<0) continue; // REALTIME was stepped back
+		if(best>=0 && width>=best) continue;
+		best=width;
+		offset=UB_TS2NSEC(ts1)+width/2-UB_TS2NSEC(tsr);
+	}
+	if(best<0) best=0;
+	if(swcd->ts_count){
+		drift=offset-swcd->rt_offset;
+		if(drift<0) drift=-drift;
+		if(drift>SWCLOCK_STEP_THRESHOLD)
+			swcd->step_count++;
+		else
+			swcd->drift_max=UB_MAX(swcd->drift_max, (uint32_t)drift);
+	}
+	swcd->rt_offset=offset;
+	swcd->ts_count++;
+	swcd->width_sum+=best;
+	swcd->width_max=UB_MAX(swcd->width_max, (uint32_t)best);
+	*ts64-=offset;
+}
+
+/* convert an event message timestamp to the ptp clock of the device */
+static void event_ts_conv(netdevice_t *ndev, int dvi, int msgtype, int64_t *ts64)
+{
+	if(ndev->swclock){
+		swclock_ts_conv(&ndev->swcd, ts64);
+		return;
+	}
+	// in OVIP mode, only Sync is converted to the virtual clock
+	if(ndev->ovip_port && msgtype==0)
+		*ts64+=gptpclock_d0ClockfromRT(dvi+1);
+}
+
 static int onenet_init(netdevice_t *ndev, char *netdev)
 {
 	cb_rawsock_paras_t llrawp;
@@ -70,8 +149,13 @@ static int onenet_init(netdevice_t *ndev, char *netdev)
 	int res=0;
 
 	snprintf(ndev->nlstatus.devname, IFNAMSIZ, "%s", netdev);
-	if(!cb_get_ptpdev_from_netdev(ndev->nlstatus.devname,
-				      ndev->nlstatus.ptpdev)) {
+	ndev->swclock=swclock_netdev(netdev);
+	if(ndev->swclock){
+		UB_LOG(UBL_INFO, "%s:%s runs with the software clock\n", __func__, netdev);
+		strcpy(ndev->nlstatus.ptpdev, GPTP_SWCLOCK_PTPDEV);
+		res=1;
+	}else if(!cb_get_ptpdev_from_netdev(ndev->nlstatus.devname,
+					    ndev->nlstatus.ptpdev)) {
 		res=1;
 	}else{
 		ndev->nlstatus.ptpdev[0]=0;
@@ -101,8 +185,15 @@ static int onenet_init(netdevice_t *ndev, char *netdev)
 		UB_LOG(UBL_ERROR,"failed to add multicast address");
 		goto erexit;
 	}
-	if(ll_set_hw_timestamping(ndev->fd, ndev->nlstatus.devname)) goto erexit;
+	if(ndev->swclock){
+		if(ll_set_sw_timestamping(ndev->fd)) goto erexit;
+	}else{
+		if(ll_set_hw_timestamping(ndev->fd, ndev->nlstatus.devname)) goto erexit;
+	}
 	eui48to64(ndev->sbuf.ehd.H_SOURCE, ndev->nlstatus.portid,NULL);
+	ndev->phc_index=-1;
+	if(!ndev->swclock && !ndev->ovip_port)
+		ndev->phc_index=ix_netlinkif_phc_index(ndev->fd, ndev->nlstatus.devname);
 	return res;
 erexit:
 	close(ndev->fd);
@@ -153,8 +244,7 @@ static int read_recdata(gptpnet_data_t *gpnet, int dvi, struct msghdr *msg, int
 			       __func__, dvi, PTPMsgType_debug[edtrecv.msgtype], edtrecv.domain);
 			return -1;
 		}
-		if(gpnet->netdevices[dvi].ovip_port && edtrecv.msgtype==0)
-			edtrecv.ts64+=gptpclock_d0ClockfromRT(dvi+1);
+		event_ts_conv(&gpnet->netdevices[dvi], dvi, edtrecv.msgtype, &edtrecv.ts64);
 	}
 	if(!gpnet->cb_func) return -1;
 	return gpnet->cb_func(gpnet->cb_data, dvi+1, GPTPNET_EVENT_RECV,
@@ -191,6 +281,7 @@ static int read_netdev_event(gptpnet_data_t *gpnet, int dvi)
 		if(!gpnet->cb_func) return -1;
 		ndev=&gpnet->netdevices[dvi];
 		ndev->waiting_txts=false;
+		event_ts_conv(ndev, dvi, edtxts.msgtype, &edtxts.ts64);
 		gpnet->cb_func(gpnet->cb_data, dvi+1, GPTPNET_EVENT_TXTS,
 			       &gpnet->event_ts64, &edtxts);
 		return res;
@@ -326,6 +417,26 @@ int gptpnet_ipc_client_remove(gptpnet_data_t *gpnet, struct sockaddr *addr)
 	return cb_ipcsocket_remove_client(gpnet->ipcsd, addr);
 }
 
+/* the devices which report the same PHC index use the same ptpdev name,
+   then the timestamp conversion between them needs no clock reading in gptpclock */
+static void group_shared_phc(gptpnet_data_t *gpnet)
+{
+	int i, j;
+	netdevice_t *ndev, *ndev1;
+	for(i=1;i<gpnet->num_netdevs;i++){
+		ndev=&gpnet->netdevices[i];
+		if(ndev->phc_index<0) continue;
+		for(j=0;j<i;j++){
+			ndev1=&gpnet->netdevices[j];
+			if(ndev1->phc_index!=ndev->phc_index) continue;
+			UB_LOG(UBL_INFO, "%s:%s shares PHC %d with %s\n", __func__,
+			       ndev->nlstatus.devname, ndev->phc_index, ndev1->nlstatus.devname);
+			strcpy(ndev->nlstatus.ptpdev, ndev1->nlstatus.ptpdev);
+			break;
+		}
+	}
+}
+
 gptpnet_data_t *gptpnet_init(gptpnet_cb_t cb_func, cb_ipcsocket_server_rdcb ipc_cb,
 			     void *cb_data, char *netdev[], int *num_ports, char *master_ptpdev)
 {
@@ -361,7 +472,10 @@ gptpnet_data_t *gptpnet_init(gptpnet_cb_t cb_func, cb_ipcsocket_server_rdcb ipc_
 			UB_LOG(UBL_ERROR, "networkd device:%s can't be opened\n",netdev[i]);
 			continue;
 		}
-		if(first_devwptp<0) first_devwptp=i;
+		// a device with PHC is preferred to the software clock
+		if(first_devwptp<0 || (gpnet->netdevices[first_devwptp].swclock &&
+				       !gpnet->netdevices[i].swclock))
+			first_devwptp=i;
 		// if master_ptpdev option is set, use it as the first device
 		if(master_ptpdev && !strcmp(master_ptpdev,
 					    gpnet->netdevices[i].nlstatus.ptpdev))
@@ -381,6 +495,7 @@ gptpnet_data_t *gptpnet_init(gptpnet_cb_t cb_func, cb_ipcsocket_server_rdcb ipc_
 		       sizeof(netdevice_t));
 		memcpy(&gpnet->netdevices[first_devwptp], &swapdev, sizeof(netdevice_t));
 	}
+	group_shared_phc(gpnet);
 	for(i=1;i<gpnet->num_netdevs;i++){
 		if(gpnet->netdevices[i].nlstatus.ptpdev[0]) continue;
 		UB_LOG(UBL_INFO, "%s:network device %s doesn't have a ptp device, "
@@ -388,6 +503,8 @@ gptpnet_data_t *gptpnet_init(gptpnet_cb_t cb_func, cb_ipcsocket_server_rdcb ipc_
 		       gpnet->netdevices[i].nlstatus.devname);
 		strcpy(gpnet->netdevices[i].nlstatus.ptpdev,
 		       gpnet->netdevices[0].nlstatus.ptpdev);
+		// the timestamps are taken by software, and need the conversion
+		gpnet->netdevices[i].swclock=gpnet->netdevices[0].swclock;
 	}
 	gpnet->cb_func=cb_func;
 	gpnet->ipc_cb=ipc_cb;
@@ -524,6 +641,26 @@ void gptpnet_create_clockid(gptpnet_data_t *gpnet, uint8_t *id,
 	id[4]=domainNumber;
 }
 
+int gptpnet_swclock_stat(gptpnet_data_t *gpnet, int ndevIndex,
+			 gptpipc_statistics_swclock_t *stat, bool reset)
+{
+	swclock_data_t *swcd;
+	if(ndevIndex < 0 || ndevIndex >= gpnet->num_netdevs) return -1;
+	if(!gpnet->netdevices[ndevIndex].swclock) return -1;
+	swcd=&gpnet->netdevices[ndevIndex].swcd;
+	if(reset){
+		memset(swcd, 0, sizeof(swclock_data_t));
+		return 0;
+	}
+	stat->ts_count=swcd->ts_count;
+	stat->rt_offset=swcd->rt_offset;
+	stat->width_avg=swcd->ts_count?swcd->width_sum/swcd->ts_count:0;
+	stat->width_max=swcd->width_max;
+	stat->drift_max=swcd->drift_max;
+	stat->step_count=swcd->step_count;
+	return 0;
+}
+
 int gptpnet_get_nlstatus(gptpnet_data_t *gpnet, int ndevIndex, event_data_netlink_t *nlstatus)
 {
 	if(ndevIndex < 0 || ndevIndex >= gpnet->num_netdevs){
@@ -79,6 +79,19 @@ int ll_set_hw_timestamping(CB_SOCKET_T cfd, const char *dev)
 	return 0;
 }
 
+int ll_set_sw_timestamping(CB_SOCKET_T cfd)
+{
+	int so_timestamping_flags = SOF_TIMESTAMPING_TX_SOFTWARE |
+		SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+
+	if (setsockopt(cfd, SOL_SOCKET, SO_TIMESTAMPING,
+		       &so_timestamping_flags, sizeof(so_timestamping_flags)) < 0) {
+		UB_LOG(UBL_ERROR,"%s:setsockopt SO_TIMESTAMPING, %s\n",__func__, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
 int ll_close_hw_timestamping(CB_SOCKET_T cfd, const char *dev)
 {
 	struct ifreq hwtstamp;
@@ -19,6 +19,9 @@
  * <https://www.gnu.org/licenses/old-licenses/gpl-2.0.html>.
  */
 #include <linux/rtnetlink.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
 #include <errno.h>
 #include "xl4combase/cb_ethernet.h"
 #include "ix_netlinkif.h"
@@ -132,6 +135,24 @@ int ix_netlinkif_getfd(ix_netlinkif_t *nlkd)
 	return nlkd->netlinkfd;
 }
 
+int ix_netlinkif_phc_index(int fd, const char *ifname)
+{
+	struct ifreq ifr;
+	struct ethtool_ts_info info;
+
+	memset(&ifr, 0, sizeof(ifr));
+	memset(&info, 0, sizeof(info));
+	info.cmd=ETHTOOL_GET_TS_INFO;
+	snprintf(ifr.ifr_name, IFNAMSIZ, "%s", ifname);
+	ifr.ifr_data=(char *)&info;
+	if(ioctl(fd, SIOCETHTOOL, &ifr)<0){
+		UB_LOG(UBL_DEBUG, "%s:%s, ETHTOOL_GET_TS_INFO failed, %s\n",
+		       __func__, ifname, strerror(errno));
+		return -1;
+	}
+	return info.phc_index;
+}
+
 int ix_netlinkif_read_event(ix_netlinkif_t *nlkd, gptpnet_data_t *gpnet,
 			    int64_t *event_ts64)
 {
@@ -42,6 +42,14 @@ void ix_netlinkif_close(ix_netlinkif_t *nlkd);
  */
 int ix_netlinkif_getfd(ix_netlinkif_t *nlkd);
 
+/**
+ * @brief get the PHC index of a network device by ethtool
+ * @param fd	an opened socket fd
+ * @param ifname	network device name
+ * @result PHC index, -1 if the device doesn't have PHC
+ */
+int ix_netlinkif_phc_index(int fd, const char *ifname);
+
 /**
  * @brief when events on the netlink fd, read and process the nelink data
  */
@@ -27,11 +27,13 @@
 
 PTPFD_TYPE ptpdev_clock_open(char *ptpdev, int permission)
 {
+	if(SWCLOCK_NAME(ptpdev)) return GPTP_SWCLOCK_FD;
 	return open(ptpdev, permission);
 }
 
 int ptpdev_clock_close(PTPFD_TYPE fd)
 {
+	if(fd==GPTP_SWCLOCK_FD) return 0;
 	return close(fd);
 }
 
@@ -39,7 +41,10 @@ int ptpdev_clock_gettime(PTPFD_TYPE fd, int64_t *ts)
 {
 	struct timespec tspec;
 
-	clock_gettime(FD_TO_CLOCKID(fd), &tspec);
+	if(fd==GPTP_SWCLOCK_FD)
+		clock_gettime(CLOCK_MONOTONIC_RAW, &tspec);
+	else
+		clock_gettime(FD_TO_CLOCKID(fd), &tspec);
 	*ts = UB_TS2NSEC(tspec);
 
 	return 0;
@@ -49,6 +54,7 @@ int ptpdev_clock_settime(PTPFD_TYPE fd, int64_t *ts)
 {
 	struct timespec tspec;
 
+	if(fd==GPTP_SWCLOCK_FD) return -1;
 	UB_NSEC2TS(*ts,tspec);
 	clock_settime(FD_TO_CLOCKID(fd), &tspec);
 
@@ -59,6 +65,7 @@ int ptpdev_clock_adjtime(PTPFD_TYPE ptpfd, int adjppb)
 {
 	struct timex tmx;
 
+	if(ptpfd==GPTP_SWCLOCK_FD) return -1;
 	memset(&tmx, 0, sizeof(tmx));
 	tmx.modes=ADJ_FREQUENCY;
 	tmx.freq=(long)(adjppb * 65.536);
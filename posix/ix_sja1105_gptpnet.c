@@ -1084,6 +1084,13 @@ void gptpnet_create_clockid(gptpnet_data_t *gpnet, uint8_t *id,
 	id[3]+=domainNumber*0x10;
 }
 
+int gptpnet_swclock_stat(gptpnet_data_t *gpnet, int ndevIndex,
+			 gptpipc_statistics_swclock_t *stat, bool reset)
+{
+	// the switch ports always have the hardware clock
+	return -1;
+}
+
 int gptpnet_get_nlstatus(gptpnet_data_t *gpnet, int ndevIndex, event_data_netlink_t *nlstatus)
 {
 	if(ndevIndex < 0 || ndevIndex >= gpnet->num_ports){
@@ -21,7 +21,6 @@
 #include <errno.h>
 #include "xl4combase/cb_ethernet.h"
 #include "gptpnet.h"
-#include "gptpclock.h"
 #include "ll_gptpsupport.h"
 #include "ix_timestamp.h"
 
@@ -52,9 +51,8 @@ static int read_txts(int dvi, struct msghdr *msg, int len, uint16_t ovip_port,
 		return -1;
 	}
 
+	// the timestamp is converted to the ptp clock by the caller
 	if(ll_txmsg_timestamp(msg, &edtxts->ts64)) return -1;
-	if(ovip_port && edtxts->msgtype==0)
-		edtxts->ts64+=gptpclock_d0ClockfromRT(dvi+1);
 	return 0;
 }
 